@@ -91,15 +91,12 @@ double CAddrInfo::GetChance(int64_t nNow) const
 
 CAddrInfo* CAddrMan::Find(const CNetAddr& addr, int* pnId)
 {
-    std::map<CNetAddr, int>::iterator it = mapAddr.find(addr);
-    if (it == mapAddr.end())
+    int nId = mapAddr.Find(addr, vInfo);
+    if (nId == -1)
         return NULL;
     if (pnId)
-        *pnId = (*it).second;
-    std::map<int, CAddrInfo>::iterator it2 = mapInfo.find((*it).second);
-    if (it2 != mapInfo.end())
-        return &(*it2).second;
-    return NULL;
+        *pnId = nId;
+    return &vInfo[nId];
 }
 
 #ifdef I2PADDRMAN_EXTENSIONS
@@ -122,12 +119,9 @@ CAddrInfo* CAddrMan::LookupB32addr(const std::string& sB32addr)
         vchHash = DecodeBase32( sHash.c_str(), &fValid );
         uint256 uintHash( vchHash );        // Hate wasting time copying object, but vectors, strings and uint256 values dont always pass compiler checks otherwise
         if( fValid ) {                      // Lookup the hash for a match, if found we have the CAddrInfo id
-            std::map<uint256, int>::iterator it = mapI2pHashes.find( uintHash );
-            if( it != mapI2pHashes.end() ) {
-                std::map<int, CAddrInfo>::iterator it2 = mapInfo.find((*it).second);
-                if (it2 != mapInfo.end())
-                    return &(*it2).second;
-            }
+            int nId = mapI2pHashes.Find( uintHash, vInfo );
+            if( nId != -1 )
+                return &vInfo[nId];
         }
     }
     return NULL;
@@ -142,21 +136,30 @@ CAddrInfo* CAddrMan::LookupB32addr(const std::string& sB32addr)
  */
 std::string CAddrMan::GetI2pBase64Destination(const std::string& sB32addr)
 {
-    CAddrInfo* paddr = LookupB32addr(sB32addr);
-    return  paddr && paddr->IsI2P() ? paddr->GetI2pDestination() : std::string();
+    {
+        LOCK(cs);
+        CAddrInfo* paddr = LookupB32addr(sB32addr);
+        if( paddr && paddr->IsI2P() )
+            return paddr->GetI2pDestination();
+    }
+    // Not a peer we know, but the router may have resolved it for us before
+    std::string sDest;
+    i2pnames.Get(sB32addr, sDest);
+    return sDest;
 }
 
 // Returns the number of entries processed
 int CAddrMan::CopyDestinationStats( std::vector<CDestinationStats>& vStats )
 {
+    LOCK(cs);
     int nSize = 0;
     vStats.clear();
     vStats.reserve( mapI2pHashes.size() );
-    for( std::map<uint256, int>::iterator it = mapI2pHashes.begin(); it != mapI2pHashes.end(); it++) {
+    for( unsigned int nId = 0; nId < vInfo.size(); nId++ ) {
         CDestinationStats stats;
-        std::map<int, CAddrInfo>::iterator it2 = mapInfo.find((*it).second);
-        if (it2 != mapInfo.end()) {
-            CAddrInfo* paddr = &(*it2).second;
+        CAddrInfo* paddr = &vInfo[nId];
+        // Every destination in the hash table, an entry that isn't could only be a duplicate
+        if( paddr->nRandomPos != -1 && paddr->IsI2P() && mapI2pHashes.Find( paddr->GetI2pDestinationHash(), vInfo ) == (int)nId ) {
             stats.sAddress = paddr->ToString();
             stats.fInTried = paddr->fInTried;
             stats.uPort = paddr->GetPort();
@@ -178,24 +181,31 @@ int CAddrMan::CopyDestinationStats( std::vector<CDestinationStats>& vStats )
 
 CAddrInfo* CAddrMan::Create(const CAddress& addr, const CNetAddr& addrSource, int* pnId)
 {
-    int nId = nIdCount++;
-    mapInfo[nId] = CAddrInfo(addr, addrSource);
-    mapAddr[addr] = nId;
-    mapInfo[nId].nRandomPos = vRandom.size();
+    int nId;
+    if (vFreeIds.empty()) {
+        nId = vInfo.size();
+        vInfo.push_back(CAddrInfo(addr, addrSource));
+    } else {
+        nId = vFreeIds.back();
+        vFreeIds.pop_back();
+        vInfo[nId] = CAddrInfo(addr, addrSource);
+    }
+    mapAddr.Insert(addr, nId);
+    vInfo[nId].nRandomPos = vRandom.size();
     vRandom.push_back(nId);
     if (pnId)
         *pnId = nId;
 #ifdef I2PADDRMAN_EXTENSIONS
     if( addr.IsI2P() ) {
         assert( addr.IsNativeI2P() );
-        uint256 b32hash = GetI2pDestinationHash( addr.GetI2pDestination() );
-        if( mapI2pHashes.count( b32hash ) == 0 )
-            mapI2pHashes[b32hash] = nId;
+        uint256 b32hash = addr.GetI2pDestinationHash();
+        if( mapI2pHashes.Find( b32hash, vInfo ) == -1 )
+            mapI2pHashes.Insert( b32hash, nId );
         else
             LogPrintf( "ERROR - Can't create base32 Hash in AddrMan for one that already exists\n");
     }
 #endif
-    return &mapInfo[nId];
+    return &vInfo[nId];
 }
 
 void CAddrMan::SwapRandom(unsigned int nRndPos1, unsigned int nRndPos2)
@@ -208,11 +218,11 @@ void CAddrMan::SwapRandom(unsigned int nRndPos1, unsigned int nRndPos2)
     int nId1 = vRandom[nRndPos1];
     int nId2 = vRandom[nRndPos2];
 
-    assert(mapInfo.count(nId1) == 1);
-    assert(mapInfo.count(nId2) == 1);
+    assert(vInfo[nId1].nRandomPos == (int)nRndPos1);
+    assert(vInfo[nId2].nRandomPos == (int)nRndPos2);
 
-    mapInfo[nId1].nRandomPos = nRndPos2;
-    mapInfo[nId2].nRandomPos = nRndPos1;
+    vInfo[nId1].nRandomPos = nRndPos2;
+    vInfo[nId2].nRandomPos = nRndPos1;
 
     vRandom[nRndPos1] = nId2;
     vRandom[nRndPos2] = nId1;
@@ -220,30 +230,92 @@ void CAddrMan::SwapRandom(unsigned int nRndPos1, unsigned int nRndPos2)
 
 void CAddrMan::Delete(int nId)
 {
-    assert(mapInfo.count(nId) != 0);
-    CAddrInfo& info = mapInfo[nId];
+    assert(nId >= 0 && nId < (int)vInfo.size());
+    CAddrInfo& info = vInfo[nId];
+    assert(info.nRandomPos != -1);
     assert(!info.fInTried);
     assert(info.nRefCount == 0);
 
+#ifdef I2PADDRMAN_EXTENSIONS
+    CheckAndDeleteB32Hash(nId, info);
+#endif
     SwapRandom(info.nRandomPos, vRandom.size() - 1);
     vRandom.pop_back();
-    mapAddr.erase(info);
-    mapInfo.erase(nId);
+    mapAddr.Erase(info, nId);
+    info = CAddrInfo();
+    vFreeIds.push_back(nId);
     nNew--;
 }
 
+void CAddrMan::SetNew(int nUBucket, int nUBucketPos, int nId)
+{
+    assert(vvNew[nUBucket][nUBucketPos] == -1);
+    CAddrInfo& info = vInfo[nId];
+    assert(info.nRefCount < ADDRMAN_NEW_BUCKETS_PER_ADDRESS);
+    int nSlot = nUBucket * ADDRMAN_BUCKET_SIZE + nUBucketPos;
+    info.anNewSlots[info.nRefCount++] = nSlot;
+    vvNew[nUBucket][nUBucketPos] = nId;
+    vvNewUsedPos[nUBucket][nUBucketPos] = vNewUsed.size();
+    vNewUsed.push_back(nSlot);
+}
+
+int CAddrMan::UnsetNew(int nUBucket, int nUBucketPos)
+{
+    int nId = vvNew[nUBucket][nUBucketPos];
+    assert(nId != -1);
+    CAddrInfo& info = vInfo[nId];
+    int nSlot = nUBucket * ADDRMAN_BUCKET_SIZE + nUBucketPos;
+    for (int i = 0; i < info.nRefCount; i++) {
+        if (info.anNewSlots[i] == nSlot) {
+            info.anNewSlots[i] = info.anNewSlots[--info.nRefCount];
+            break;
+        }
+    }
+    // Fill the hole in vNewUsed with its last position
+    int nPos = vvNewUsedPos[nUBucket][nUBucketPos];
+    int nLast = vNewUsed.back();
+    vNewUsed[nPos] = nLast;
+    vvNewUsedPos[nLast / ADDRMAN_BUCKET_SIZE][nLast % ADDRMAN_BUCKET_SIZE] = nPos;
+    vNewUsed.pop_back();
+    vvNewUsedPos[nUBucket][nUBucketPos] = -1;
+    vvNew[nUBucket][nUBucketPos] = -1;
+    return nId;
+}
+
+void CAddrMan::SetTried(int nKBucket, int nKBucketPos, int nId)
+{
+    assert(vvTried[nKBucket][nKBucketPos] == -1);
+    vvTried[nKBucket][nKBucketPos] = nId;
+    vvTriedUsedPos[nKBucket][nKBucketPos] = vTriedUsed.size();
+    vTriedUsed.push_back(nKBucket * ADDRMAN_BUCKET_SIZE + nKBucketPos);
+}
+
+int CAddrMan::UnsetTried(int nKBucket, int nKBucketPos)
+{
+    int nId = vvTried[nKBucket][nKBucketPos];
+    assert(nId != -1);
+    int nPos = vvTriedUsedPos[nKBucket][nKBucketPos];
+    int nLast = vTriedUsed.back();
+    vTriedUsed[nPos] = nLast;
+    vvTriedUsedPos[nLast / ADDRMAN_BUCKET_SIZE][nLast % ADDRMAN_BUCKET_SIZE] = nPos;
+    vTriedUsed.pop_back();
+    vvTriedUsedPos[nKBucket][nKBucketPos] = -1;
+    vvTried[nKBucket][nKBucketPos] = -1;
+    return nId;
+}
+
 #ifdef I2PADDRMAN_EXTENSIONS
 void CAddrMan::CheckAndDeleteB32Hash( const int nID, const CAddrInfo& aTerrible )
 {
     if( aTerrible.IsI2P() ) {
-        uint256 b32hash = GetI2pDestinationHash( aTerrible.GetI2pDestination() );
-        if( mapI2pHashes.count( b32hash ) == 1 ) {
-            int nID2 = mapI2pHashes[ b32hash ];
+        uint256 b32hash = aTerrible.GetI2pDestinationHash();
+        int nID2 = mapI2pHashes.Find( b32hash, vInfo );
+        if( nID2 != -1 ) {
             if( nID == nID2 )            // Yap this is the one they want to delete, and it exists
-                mapI2pHashes.erase( b32hash );
+                mapI2pHashes.Erase( b32hash, nID );
             else {
                 LogPrint( "addrman", "While attempting to erase base32 hash %s, it was unexpected that the ids differ id1=%d != id2=%d\n", b32hash.GetHex(), nID, nID2 );
-                // CAddrInfo& info2 = mapInfo[nID2];
+                // CAddrInfo& info2 = vInfo[nID2];
                 // aTerrible.print();
                 // info2.print();
             }
@@ -260,15 +332,9 @@ void CAddrMan::ClearNew(int nUBucket, int nUBucketPos)
 {
     // if there is an entry in the specified bucket, delete it.
     if (vvNew[nUBucket][nUBucketPos] != -1) {
-    int nIdDelete = vvNew[nUBucket][nUBucketPos];
-    CAddrInfo& infoDelete = mapInfo[nIdDelete];
-    assert(infoDelete.nRefCount > 0);
-    infoDelete.nRefCount--;
-    vvNew[nUBucket][nUBucketPos] = -1;
+    int nIdDelete = UnsetNew(nUBucket, nUBucketPos);
+    CAddrInfo& infoDelete = vInfo[nIdDelete];
     if (infoDelete.nRefCount == 0) {
-#ifdef I2PADDRMAN_EXTENSIONS
-    CheckAndDeleteB32Hash( nIdDelete, infoDelete);
-#endif
     Delete(nIdDelete);
         }
     }
@@ -277,13 +343,10 @@ void CAddrMan::ClearNew(int nUBucket, int nUBucketPos)
 
 void CAddrMan::MakeTried(CAddrInfo& info, int nId)
 {
-    // remove the entry from all new buckets
-    for (int bucket = 0; bucket < ADDRMAN_NEW_BUCKET_COUNT; bucket++) {
-    int pos = info.GetBucketPosition(nKey, true, bucket);
-    if (vvNew[bucket][pos] == nId) {
-    vvNew[bucket][pos] = -1;
-            info.nRefCount--;
-        }
+    // remove the entry from all new buckets, it knows which ones it is in
+    while (info.nRefCount > 0) {
+        int nSlot = info.anNewSlots[info.nRefCount - 1];
+        UnsetNew(nSlot / ADDRMAN_BUCKET_SIZE, nSlot % ADDRMAN_BUCKET_SIZE);
     }
     nNew--;
 
@@ -295,14 +358,10 @@ void CAddrMan::MakeTried(CAddrInfo& info, int nId)
 
     // first make space to add it (the existing tried entry there is moved to new, deleting whatever is there).
     if (vvTried[nKBucket][nKBucketPos] != -1) {
-    // find an item to evict
-    int nIdEvict = vvTried[nKBucket][nKBucketPos];
-    assert(mapInfo.count(nIdEvict) == 1);
-    CAddrInfo& infoOld = mapInfo[nIdEvict];
- 
-    // Remove the to-be-evicted item from the tried set.
+    // find an item to evict, and remove it from the tried set
+    int nIdEvict = UnsetTried(nKBucket, nKBucketPos);
+    CAddrInfo& infoOld = vInfo[nIdEvict];
     infoOld.fInTried = false;
-    vvTried[nKBucket][nKBucketPos] = -1;
     nTried--;
  
     // find which new bucket it belongs to
@@ -312,13 +371,12 @@ void CAddrMan::MakeTried(CAddrInfo& info, int nId)
     assert(vvNew[nUBucket][nUBucketPos] == -1);
  
     // Enter it into the new set again.
-    infoOld.nRefCount = 1;
-    vvNew[nUBucket][nUBucketPos] = nIdEvict;
+    assert(infoOld.nRefCount == 0);
+    SetNew(nUBucket, nUBucketPos, nIdEvict);
     nNew++;
     }
-    assert(vvTried[nKBucket][nKBucketPos] == -1);
 
-    vvTried[nKBucket][nKBucketPos] = nId;
+    SetTried(nKBucket, nKBucketPos, nId);
     nTried++;
     info.fInTried = true;
 }
@@ -376,21 +434,9 @@ void CAddrMan::Good_(const CAddress& addr, int64_t nTime)
     }
 
 
-    // find a bucket it is in now
-    int nRnd = GetRandInt(ADDRMAN_NEW_BUCKET_COUNT);
-    int nUBucket = -1;
-    for (unsigned int n = 0; n < ADDRMAN_NEW_BUCKET_COUNT; n++) {
-    int nB = (n + nRnd) % ADDRMAN_NEW_BUCKET_COUNT;
-    int nBpos = info.GetBucketPosition(nKey, true, nB);
-    if (vvNew[nB][nBpos] == nId) {
-            nUBucket = nB;
-            break;
-        }
-    }
-
-    // if no bucket is found, something bad happened;
+    // if it isn't in any new bucket, something bad happened;
     // TODO: maybe re-add the node, but for now, just bail out
-    if( nUBucket == -1 ) {
+    if( info.nRefCount == 0 ) {
         LogPrint( "addrman", "Fatal error while trying to add %s to tried, bucket not found\n", info.ToString() );
         return;
     }
@@ -497,7 +543,7 @@ bool CAddrMan::Add_(const CAddress& addrIn, const CNetAddr& source, int64_t nTim
     if (vvNew[nUBucket][nUBucketPos] != nId) {
         bool fInsert = vvNew[nUBucket][nUBucketPos] == -1;
         if (!fInsert) {
-            CAddrInfo& infoExisting = mapInfo[vvNew[nUBucket][nUBucketPos]];
+            CAddrInfo& infoExisting = vInfo[vvNew[nUBucket][nUBucketPos]];
             if (infoExisting.IsTerrible() || (infoExisting.nRefCount > 1 && pinfo->nRefCount == 0)) {
             // Overwrite the existing new table entry.
             fInsert = true;
@@ -505,8 +551,7 @@ bool CAddrMan::Add_(const CAddress& addrIn, const CNetAddr& source, int64_t nTim
         }
     if (fInsert) {
         ClearNew(nUBucket, nUBucketPos);
-        pinfo->nRefCount++;
-        vvNew[nUBucket][nUBucketPos] = nId;
+        SetNew(nUBucket, nUBucketPos, nId);
         } else {
             if (pinfo->nRefCount == 0) {
                 Delete(nId);
@@ -545,40 +590,21 @@ CAddrInfo CAddrMan::Select_()
         return CAddrInfo();
 
     // Use a 50% chance for choosing between tried and new table entries.
-    if (nTried > 0 && (nNew == 0 || GetRandInt(2) == 0)) {
-        // use a tried node
-        double fChanceFactor = 1.0;
-        while (1) {
-            int nKBucket = GetRandInt(ADDRMAN_TRIED_BUCKET_COUNT);
-            int nKBucketPos = GetRandInt(ADDRMAN_BUCKET_SIZE);
-            while (vvTried[nKBucket][nKBucketPos] == -1) {
-                nKBucket = (nKBucket + insecure_rand()) % ADDRMAN_TRIED_BUCKET_COUNT;
-                nKBucketPos = (nKBucketPos + insecure_rand()) % ADDRMAN_BUCKET_SIZE;
-            }
-            int nId = vvTried[nKBucket][nKBucketPos];
-            assert(mapInfo.count(nId) == 1);
-            CAddrInfo& info = mapInfo[nId];
-            if (GetRandInt(1 << 30) < fChanceFactor * info.GetChance() * (1 << 30))
-                return info;
-            fChanceFactor *= 1.2;
-        }
-    } else {
-        // use a new node
-        double fChanceFactor = 1.0;
-        while (1) {
-            int nUBucket = GetRandInt(ADDRMAN_NEW_BUCKET_COUNT);
-            int nUBucketPos = GetRandInt(ADDRMAN_BUCKET_SIZE);
-            while (vvNew[nUBucket][nUBucketPos] == -1) {
-                nUBucket = (nUBucket + insecure_rand()) % ADDRMAN_NEW_BUCKET_COUNT;
-                nUBucketPos = (nUBucketPos + insecure_rand()) % ADDRMAN_BUCKET_SIZE;
-            }
-            int nId = vvNew[nUBucket][nUBucketPos];
-            assert(mapInfo.count(nId) == 1);
-            CAddrInfo& info = mapInfo[nId];
-            if (GetRandInt(1 << 30) < fChanceFactor * info.GetChance() * (1 << 30))
-                return info;
-            fChanceFactor *= 1.2;
-        }
+    // Positions are drawn from the used ones only, so a sparse table costs no extra tries.
+    bool fTried = !vTriedUsed.empty() && (vNewUsed.empty() || GetRandInt(2) == 0);
+    const std::vector<int>& vUsed = fTried ? vTriedUsed : vNewUsed;
+    if (vUsed.empty())
+        return CAddrInfo();
+    double fChanceFactor = 1.0;
+    while (1) {
+        int nSlot = vUsed[GetRandInt(vUsed.size())];
+        int nBucket = nSlot / ADDRMAN_BUCKET_SIZE;
+        int nBucketPos = nSlot % ADDRMAN_BUCKET_SIZE;
+        int nId = fTried ? vvTried[nBucket][nBucketPos] : vvNew[nBucket][nBucketPos];
+        CAddrInfo& info = vInfo[nId];
+        if (GetRandInt(1 << 30) < fChanceFactor * info.GetChance() * (1 << 30))
+            return info;
+        fChanceFactor *= 1.2;
     }
 }
 
@@ -591,9 +617,13 @@ int CAddrMan::Check_()
     if (vRandom.size() != nTried + nNew)
         return -7;
 
-    for (std::map<int, CAddrInfo>::iterator it = mapInfo.begin(); it != mapInfo.end(); it++) {
-        int n = (*it).first;
-        CAddrInfo& info = (*it).second;
+    if (vRandom.size() + vFreeIds.size() != vInfo.size())
+        return -20;
+
+    for (int n = 0; n < (int)vInfo.size(); n++) {
+        CAddrInfo& info = vInfo[n];
+        if (info.nRandomPos == -1)
+            continue;
         if (info.fInTried) {
             if (!info.nLastSuccess)
                 return -1;
@@ -607,8 +637,13 @@ int CAddrMan::Check_()
                 return -4;
             mapNew[n] = info.nRefCount;
         }
-        if (mapAddr[info] != n)
+        if (mapAddr.Find(info, vInfo) != n)
             return -5;
+        for (int i = 0; i < info.nRefCount; i++) {
+            int nSlot = info.anNewSlots[i];
+            if (vvNew[nSlot / ADDRMAN_BUCKET_SIZE][nSlot % ADDRMAN_BUCKET_SIZE] != n)
+                return -21;
+        }
         if (info.nRandomPos < 0 || info.nRandomPos >= vRandom.size() || vRandom[info.nRandomPos] != n)
             return -14;
         if (info.nLastTry < 0)
@@ -627,10 +662,12 @@ int CAddrMan::Check_()
             if (vvTried[n][i] != -1) {
                 if (!setTried.count(vvTried[n][i]))
                 return -11;
-                if (mapInfo[vvTried[n][i]].GetTriedBucket(nKey) != n)
+                if (vInfo[vvTried[n][i]].GetTriedBucket(nKey) != n)
                 return -17;
-                if (mapInfo[vvTried[n][i]].GetBucketPosition(nKey, false, n) != i)
+                if (vInfo[vvTried[n][i]].GetBucketPosition(nKey, false, n) != i)
                 return -18;
+                if (vTriedUsed[vvTriedUsedPos[n][i]] != n * ADDRMAN_BUCKET_SIZE + i)
+                return -22;
                 setTried.erase(vvTried[n][i]);
             }
         }
@@ -641,14 +678,18 @@ int CAddrMan::Check_()
             if (vvNew[n][i] != -1) {
                 if (!mapNew.count(vvNew[n][i]))
                     return -12;
-                if (mapInfo[vvNew[n][i]].GetBucketPosition(nKey, true, n) != i)
+                if (vInfo[vvNew[n][i]].GetBucketPosition(nKey, true, n) != i)
                     return -19;
+                if (vNewUsed[vvNewUsedPos[n][i]] != n * ADDRMAN_BUCKET_SIZE + i)
+                    return -23;
                 if (--mapNew[vvNew[n][i]] == 0)
                     mapNew.erase(vvNew[n][i]);
             }
         }
     }
 
+    if (vTriedUsed.size() != nTried)
+        return -24;
     if (setTried.size())
         return -13;
     if (mapNew.size())
@@ -677,9 +718,7 @@ void CAddrMan::GetAddr_(std::vector<CAddress>& vAddr)
 
         int nRndPos = GetRandInt(vRandom.size() - n) + n;
         SwapRandom(n, nRndPos);
-        assert(mapInfo.count(vRandom[n]) == 1);
-
-        const CAddrInfo& ai = mapInfo[vRandom[n]];
+        const CAddrInfo& ai = vInfo[vRandom[n]];
         //! Don't send terrible addresses in response to GetAddr requests
 //#ifdef I2PADDRMAN_EXTENSIONS
         //! Additional checks, don't send addresses to nodes that cant process them or don't care about them.
@@ -47,6 +47,9 @@ public:
     std::string sSource;        // CAddrInfo member, from CNetAddr of source
 };
 
+//! in how many buckets for entries with new addresses a single address may occur
+#define ADDRMAN_NEW_BUCKETS_PER_ADDRESS 8
+
 /**
  * Extended statistics about a CAddress
  */
@@ -69,10 +72,13 @@ private:
     //! reference count in new sets (memory only)
     int nRefCount;
 
+    //! the positions (bucket * ADDRMAN_BUCKET_SIZE + position) in new sets referring to it, nRefCount of them (memory only)
+    int anNewSlots[ADDRMAN_NEW_BUCKETS_PER_ADDRESS];
+
     //! in tried set? (memory only)
     bool fInTried;
 
-    //! position in vRandom
+    //! position in vRandom, -1 for a free slot in the CAddrMan slab (memory only)
     int nRandomPos;
 
     friend class CAddrMan;
@@ -175,9 +181,6 @@ public:
 //! over how many buckets entries with new addresses originating from a single group are spread
 #define ADDRMAN_NEW_BUCKETS_PER_SOURCE_GROUP 64
 
-//! in how many buckets for entries with new addresses a single address may occur
-#define ADDRMAN_NEW_BUCKETS_PER_ADDRESS 8
-
 //! how old addresses can maximally be
 // CSlave_changed to 10 since enabled the sharing by default of dynamic I2P addresses
 // #define ADDRMAN_HORIZON_DAYS 30
@@ -226,6 +229,115 @@ public:
 // the addrs, has been reduced.
 #define ADDRMAN_GETADDR_MAX 625
 
+//! Hashes and matches the keys CAddrIndex looks entries up by
+inline uint64_t AddrIndexHash(const CNetAddr& addr, const uint256& salt) { return addr.GetSaltedHash(salt); }
+inline uint64_t AddrIndexHash(const uint256& hash, const uint256& salt) { return hash.GetHash(salt); }
+inline bool AddrIndexMatch(const CAddrInfo& info, const CNetAddr& addr) { return (const CNetAddr&)info == addr; }
+inline bool AddrIndexMatch(const CAddrInfo& info, const uint256& hash) { return info.GetI2pDestinationHash() == hash; }
+
+/**
+ * Looks up the id of a CAddrInfo in the CAddrMan slab by a key derived from it, the network address or
+ * the i2p destination hash.  A flat open addressing table with linear probing, that only keeps the ids
+ * and the hashes of their keys, the keys themselves are compared against the entries in the slab.
+ * Slots are picked by a hash salted per table, so peers can't grind addresses into one long probe sequence.
+ */
+template <typename Key>
+class CAddrIndex
+{
+public:
+    CAddrIndex() : nEntries(0), salt(GetRandHash()) {}
+
+    //! The id of the entry with this key, -1 if there is none
+    int Find(const Key& key, const std::vector<CAddrInfo>& vInfo) const
+    {
+        if (vSlots.empty())
+            return -1;
+        uint64_t nHash = AddrIndexHash(key, salt);
+        const size_t nMask = vSlots.size() - 1;
+        for (size_t i = nHash & nMask; vSlots[i].nId >= 0; i = (i + 1) & nMask) {
+            if (vSlots[i].nHash == nHash && AddrIndexMatch(vInfo[vSlots[i].nId], key))
+                return vSlots[i].nId;
+        }
+        return -1;
+    }
+
+    //! Indexes nId under key, which must not be indexed yet
+    void Insert(const Key& key, int nId)
+    {
+        if ((nEntries + 1) > vSlots.size() * 3 / 4)
+            Rehash(vSlots.empty() ? 64 : vSlots.size() * 2);
+        uint64_t nHash = AddrIndexHash(key, salt);
+        const size_t nMask = vSlots.size() - 1;
+        size_t i = nHash & nMask;
+        while (vSlots[i].nId >= 0)
+            i = (i + 1) & nMask;
+        vSlots[i].nHash = nHash;
+        vSlots[i].nId = nId;
+        nEntries++;
+    }
+
+    //! Drops nId, indexed under key, from the index, true if it was there
+    bool Erase(const Key& key, int nId)
+    {
+        if (vSlots.empty())
+            return false;
+        uint64_t nHash = AddrIndexHash(key, salt);
+        const size_t nMask = vSlots.size() - 1;
+        size_t i = nHash & nMask;
+        while (vSlots[i].nId >= 0 && !(vSlots[i].nHash == nHash && vSlots[i].nId == nId))
+            i = (i + 1) & nMask;
+        if (vSlots[i].nId < 0)
+            return false;
+        // Shift the entries behind it back, so no probe sequence runs into the hole
+        for (size_t j = (i + 1) & nMask; vSlots[j].nId >= 0; j = (j + 1) & nMask) {
+            const size_t k = vSlots[j].nHash & nMask;
+            if ((j > i && (k <= i || k > j)) || (j < i && k <= i && k > j)) {
+                vSlots[i] = vSlots[j];
+                i = j;
+            }
+        }
+        vSlots[i].nId = -1;
+        nEntries--;
+        return true;
+    }
+
+    size_t size() const { return nEntries; }
+
+    void clear()
+    {
+        std::vector<CSlot>().swap(vSlots);
+        nEntries = 0;
+    }
+
+private:
+    struct CSlot
+    {
+        uint64_t nHash;
+        int nId;                //! Negative for an empty slot
+
+        CSlot() : nHash(0), nId(-1) {}
+    };
+
+    std::vector<CSlot> vSlots;
+    size_t nEntries;
+    uint256 salt;
+
+    void Rehash(size_t nSlots)
+    {
+        std::vector<CSlot> vOld(nSlots);
+        vOld.swap(vSlots);
+        const size_t nMask = nSlots - 1;
+        for (typename std::vector<CSlot>::const_iterator it = vOld.begin(); it != vOld.end(); ++it) {
+            if (it->nId < 0)
+                continue;
+            size_t i = it->nHash & nMask;
+            while (vSlots[i].nId >= 0)
+                i = (i + 1) & nMask;
+            vSlots[i] = *it;
+        }
+    }
+};
+
 /**
  * Stochastical (IP) address manager
  */
@@ -238,14 +350,14 @@ private:
     //! secret key to randomize bucket select with
     uint256 nKey;
 
-    //! last used nId
-    int nIdCount;
+    //! slab with information about all nIds, an nId is the position of its entry
+    std::vector<CAddrInfo> vInfo;
 
-    //! table with information about all nIds
-    std::map<int, CAddrInfo> mapInfo;
+    //! nIds of the free slots in vInfo, used again before the slab grows
+    std::vector<int> vFreeIds;
 
     //! find an nId based on its network address
-    std::map<CNetAddr, int> mapAddr;
+    CAddrIndex<CNetAddr> mapAddr;
 
     //! randomly-ordered vector of all nIds
     std::vector<int> vRandom;
@@ -262,11 +374,17 @@ private:
     //! list of "new" buckets
     int vvNew[ADDRMAN_NEW_BUCKET_COUNT][ADDRMAN_BUCKET_SIZE];
 
+    //! the used positions (bucket * ADDRMAN_BUCKET_SIZE + position) of the "tried" and "new" buckets, so Select_ draws from them directly
+    std::vector<int> vTriedUsed;
+    std::vector<int> vNewUsed;
+
+    //! where each used position is found in vTriedUsed or vNewUsed
+    int vvTriedUsedPos[ADDRMAN_TRIED_BUCKET_COUNT][ADDRMAN_BUCKET_SIZE];
+    int vvNewUsedPos[ADDRMAN_NEW_BUCKET_COUNT][ADDRMAN_BUCKET_SIZE];
+
 #ifdef I2PADDRMAN_EXTENSIONS
-    //! table of i2p destination address hashes, and the id assigned to them
-    // ToDO: Convert to unordered_map, so we can have immediate lookup, based on hash
-    // typedef boost::unordered_map<uint256, int, I2pHasher> I2pMap;
-    std::map<uint256, int> mapI2pHashes;
+    //! find an nId based on its i2p destination hash
+    CAddrIndex<uint256> mapI2pHashes;
 #endif
 
 protected:
@@ -281,10 +399,18 @@ protected:
     //! Swap two elements in vRandom.
     void SwapRandom(unsigned int nRandomPos1, unsigned int nRandomPos2);
 
+    //! Put an entry in an empty position of a "new" or "tried" bucket.
+    void SetNew(int nUBucket, int nUBucketPos, int nId);
+    void SetTried(int nKBucket, int nKBucketPos, int nId);
+
+    //! Empty a used position of a "new" or "tried" bucket, returns the nId that was there. The entry itself stays.
+    int UnsetNew(int nUBucket, int nUBucketPos);
+    int UnsetTried(int nKBucket, int nKBucketPos);
+
      //! Move an entry from the "new" table(s) to the "tried" table
     void MakeTried(CAddrInfo& info, int nId);
 
-    //! Delete an entry. It must not be in tried, and have refcount 0.
+    //! Delete an entry. It must not be in tried, and have refcount 0. Its slot in vInfo is free for the next one.
     void Delete(int nId);
 
     //! Clear a position in a "new" table. This is the only place where entries are actually deleted.
@@ -319,14 +445,14 @@ protected:
     void Connected_(const CService &addr, int64_t nTime);
 
 #ifdef I2PADDRMAN_EXTENSIONS
-    void CheckAndDeleteB32Hash( const int nID, const CAddrInfo& aTerrible );         // Used in Shrink twice
+    void CheckAndDeleteB32Hash( const int nID, const CAddrInfo& aTerrible );         // Used by Delete
     CAddrInfo* LookupB32addr(const std::string& sB32addr);
 #endif
 
 public:
     /**
      * serialized format:
-     * * version byte (currently 1)
+     * * version byte (currently 2, version 1 kept i2p destinations in base64)
      * * 0x20 + nKey (serialized as if it were a vector, for backward compatibility)
      * * nNew
      * * nTried
@@ -347,6 +473,9 @@ public:
      * vvNew is serialized, but only used if ADDRMAN_UNKOWN_BUCKET_COUNT didn't change,
      * otherwise it is reconstructed as well.
      *
+     * Version 1 files are read with SER_I2PBASE64, their new table is rebuilt as i2p entries are grouped by
+     * destination hash now.
+     *
      * This format is more complex, but significantly smaller (at most 1.5 MiB), and supports
      * changes to the ADDRMAN_ parameters without breaking the on-disk structure.
      *
@@ -359,7 +488,7 @@ public:
     {
         LOCK(cs);
 
-        unsigned char nVersion = 1;
+        unsigned char nVersion = 2;
         s << nVersion;
         s << ((unsigned char)32);
         s << nKey;
@@ -368,21 +497,21 @@ public:
 
         int nUBuckets = ADDRMAN_NEW_BUCKET_COUNT ^ (1 << 30);
         s << nUBuckets;
-        std::map<int, int> mapUnkIds;
+        std::vector<int> vUnkIds(vInfo.size(), -1);
         int nIds = 0;
-        for (std::map<int, CAddrInfo>::const_iterator it = mapInfo.begin(); it != mapInfo.end(); it++) {
-            mapUnkIds[(*it).first] = nIds;
-            const CAddrInfo &info = (*it).second;
-            if (info.nRefCount) {
+        for (unsigned int n = 0; n < vInfo.size(); n++) {
+            const CAddrInfo &info = vInfo[n];
+            if (info.nRandomPos != -1 && info.nRefCount) {
                 assert(nIds != nNew); // this means nNew was wrong, oh ow
+                vUnkIds[n] = nIds;
                 s << info;
                 nIds++;
             }
         }
         nIds = 0;
-        for (std::map<int, CAddrInfo>::const_iterator it = mapInfo.begin(); it != mapInfo.end(); it++) {
-            const CAddrInfo &info = (*it).second;
-            if (info.fInTried) {
+        for (unsigned int n = 0; n < vInfo.size(); n++) {
+            const CAddrInfo &info = vInfo[n];
+            if (info.nRandomPos != -1 && info.fInTried) {
                 assert(nIds != nTried); // this means nTried was wrong, oh ow
                 s << info;
                 nIds++;
@@ -397,7 +526,7 @@ public:
             s << nSize;
             for (int i = 0; i < ADDRMAN_BUCKET_SIZE; i++) {
                 if (vvNew[bucket][i] != -1) {
-                    int nIndex = mapUnkIds[vvNew[bucket][i]];
+                    int nIndex = vUnkIds[vvNew[bucket][i]];
                     s << nIndex;
                 }
             }
@@ -413,6 +542,9 @@ public:
 
         unsigned char nVersion;
         s >> nVersion;
+        int nTypeBefore = s.GetType();
+        if (nVersion < 2)
+            s.SetType(nTypeBefore | SER_I2PBASE64);
         unsigned char nKeySize;
         s >> nKeySize;
         if (nKeySize != 32) throw std::ios_base::failure("Incorrect keysize in addrman deserialization");
@@ -421,16 +553,17 @@ public:
         s >> nTried;
         int nUBuckets = 0;
         s >> nUBuckets;
-#ifdef I2PADDRMAN_EXTENSIONS
-        mapI2pHashes.clear();
-#endif
         if (nVersion != 0) {
             nUBuckets ^= (1 << 30);
         }
+        if (nNew < 0 || nTried < 0)
+            throw std::ios_base::failure("Negative entry count in addrman deserialization");
 
         // Deserialize entries from the new table.
+        vInfo.reserve(nNew + nTried);
+        vInfo.resize(nNew);
         for (int n = 0; n < nNew; n++) {
-            CAddrInfo &info = mapInfo[n];
+            CAddrInfo &info = vInfo[n];
             s >> info;
 
 #ifdef I2PADDRMAN_EXTENSIONS
@@ -438,20 +571,20 @@ public:
                 LogPrint( "addrman", "While reading new %s, from %s found upper service bits set = %x, cleared.\n", info.ToString(), info.source.ToString(), info.nServices );
                 info.nServices &= 0xFF;
             }
+            if( info.CheckAndSetGarlicCat() )
+                LogPrint( "addrman", "While reading new peers, did not expect to need the garliccat fixed for destination %s\n", info.ToString() );
 #endif
-            
-            mapAddr[info] = n;
+
+            mapAddr.Insert(info, n);
             info.nRandomPos = vRandom.size();
             vRandom.push_back(n);
 
 #ifdef I2PADDRMAN_EXTENSIONS
-            if( info.CheckAndSetGarlicCat() )
-                LogPrint( "addrman", "While reading new peers, did not expect to need the garliccat fixed for destination %s\n", info.ToString() );
             if( info.IsI2P() ) {
                 info.SetPort( 0 );              // Make sure the CService port is set to ZERO
-                uint256 b32hash = GetI2pDestinationHash( info.GetI2pDestination() );
-                if( mapI2pHashes.count( b32hash ) == 0 )
-                    mapI2pHashes[b32hash] = n;
+                uint256 b32hash = info.GetI2pDestinationHash();
+                if( mapI2pHashes.Find( b32hash, vInfo ) == -1 )
+                    mapI2pHashes.Insert( b32hash, n );
                 else
                     LogPrint( "addrman", "While reading new peer %s, could not create a base32 hash for one that already exists.\n", info.ToString() );
             } else if( info.GetPort() == 0 ) {                    // not yet sure why clearnet nodes have ports zeroed..ToDo: investigating
@@ -459,18 +592,15 @@ public:
                 info.SetPort( Params().GetDefaultPort() );
             }
 #endif
-            if (nVersion != 1 || nUBuckets != ADDRMAN_NEW_BUCKET_COUNT) {
+            if (nVersion != 2 || nUBuckets != ADDRMAN_NEW_BUCKET_COUNT) {
                 // In case the new table data cannot be used (nVersion unknown, or bucket count wrong),
                 // immediately try to give them a reference based on their primary source address.
                 int nUBucket = info.GetNewBucket(nKey);
                 int nUBucketPos = info.GetBucketPosition(nKey, true, nUBucket);
-                if (vvNew[nUBucket][nUBucketPos] == -1) {
-                    vvNew[nUBucket][nUBucketPos] = n;
-                    info.nRefCount++;
-                }
+                if (vvNew[nUBucket][nUBucketPos] == -1)
+                    SetNew(nUBucket, nUBucketPos, n);
             }
         }
-        nIdCount = nNew;
 
         // Deserialize entries from the tried table.
         int nLost = 0;
@@ -482,38 +612,43 @@ public:
                 LogPrint( "addrman", "While reading tried %s, from %s found upper service bits set = %x, cleared.\n", info.ToString(), info.source.ToString(), info.nServices );
                 info.nServices &= 0xFF;
             }
+            if( info.CheckAndSetGarlicCat() )
+                LogPrint( "addrman", "While reading tried peers, did not expect to need the garliccat fixed for destination %s\n", info.ToString() );
 #endif
             int nKBucket = info.GetTriedBucket(nKey);
             int nKBucketPos = info.GetBucketPosition(nKey, false, nKBucket);
             if (vvTried[nKBucket][nKBucketPos] == -1) {
+                int nId = vInfo.size();
                 info.nRandomPos = vRandom.size();
                 info.fInTried = true;
-                vRandom.push_back(nIdCount);
-                mapInfo[nIdCount] = info;
-                mapAddr[info] = nIdCount;
-                vvTried[nKBucket][nKBucketPos] = nIdCount;
 #ifdef I2PADDRMAN_EXTENSIONS
-                if( info.CheckAndSetGarlicCat() )
-                    LogPrint( "addrman", "While reading tried peers, did not expect to need the garliccat fixed for destination %s\n", info.ToString() );
-                if( info.IsI2P() ) {
+                if( info.IsI2P() )
                     info.SetPort( 0 );              // Make sure the CService port is set to ZERO
-                    uint256 b32hash = GetI2pDestinationHash( info.GetI2pDestination() );
-                    if( mapI2pHashes.count( b32hash ) == 0 )
-                        mapI2pHashes[b32hash] = nIdCount;
-                    else
-                        LogPrint( "addrman", "While reading tried peer %s, could not create a base32 hash for one that already exists.\n", info.ToString() );
-                } else if( info.GetPort() == 0 ) {                    // not yet sure why clearnet nodes have ports zeroed..ToDo: investigating
+                else if( info.GetPort() == 0 ) {                    // not yet sure why clearnet nodes have ports zeroed..ToDo: investigating
                     LogPrint( "addrman", "While reading tried peer %s, unexpected to find port set to zero, changed to default.\n", info.ToString() );
                     info.SetPort( Params().GetDefaultPort() );
                 }
 #endif
-                nIdCount++;
+                vRandom.push_back(nId);
+                vInfo.push_back(info);
+                mapAddr.Insert(info, nId);
+                SetTried(nKBucket, nKBucketPos, nId);
+#ifdef I2PADDRMAN_EXTENSIONS
+                if( info.IsI2P() ) {
+                    uint256 b32hash = info.GetI2pDestinationHash();
+                    if( mapI2pHashes.Find( b32hash, vInfo ) == -1 )
+                        mapI2pHashes.Insert( b32hash, nId );
+                    else
+                        LogPrint( "addrman", "While reading tried peer %s, could not create a base32 hash for one that already exists.\n", info.ToString() );
+                }
+#endif
             } else {
                 nLost++;
             }
         }
         nTried -= nLost;
-        
+        s.SetType(nTypeBefore);
+
         // Deserialize positions in the new table (if possible).
         for (int bucket = 0; bucket < nUBuckets; bucket++) {
             int nSize = 0;
@@ -522,31 +657,26 @@ public:
                 int nIndex = 0;
                 s >> nIndex;
                 if (nIndex >= 0 && nIndex < nNew) {
-                    CAddrInfo &info = mapInfo[nIndex];
+                    CAddrInfo &info = vInfo[nIndex];
                     int nUBucketPos = info.GetBucketPosition(nKey, true, bucket);
-                    if (nVersion == 1 && nUBuckets == ADDRMAN_NEW_BUCKET_COUNT && vvNew[bucket][nUBucketPos] == -1 && info.nRefCount < ADDRMAN_NEW_BUCKETS_PER_ADDRESS) {
-                        info.nRefCount++;
-                        vvNew[bucket][nUBucketPos] = nIndex;
-                    }
+                    if (nVersion == 2 && nUBuckets == ADDRMAN_NEW_BUCKET_COUNT && vvNew[bucket][nUBucketPos] == -1 && info.nRefCount < ADDRMAN_NEW_BUCKETS_PER_ADDRESS)
+                        SetNew(bucket, nUBucketPos, nIndex);
                 }
             }
         }
- 
+
         // Prune new entries with refcount 0 (as a result of collisions).
         int nLostUnk = 0;
-        for (std::map<int, CAddrInfo>::const_iterator it = mapInfo.begin(); it != mapInfo.end(); ) {
-            if (it->second.fInTried == false && it->second.nRefCount == 0) {
-                std::map<int, CAddrInfo>::const_iterator itCopy = it++;
-                Delete(itCopy->first);
+        for (int n = 0; n < nNew + nLostUnk; n++) {
+            if (vInfo[n].nRefCount == 0) {
+                Delete(n);
                 nLostUnk++;
-            } else {
-                it++;
             }
         }
         if (nLost + nLostUnk > 0) {
             LogPrint("addrman", "addrman lost %i new and %i tried addresses due to collisions\n", nLostUnk, nLost);
         }
- 
+
         Check();
     }
 
@@ -557,20 +687,29 @@ public:
 
     void Clear()
     {
+        std::vector<CAddrInfo>().swap(vInfo);
+        std::vector<int>().swap(vFreeIds);
         std::vector<int>().swap(vRandom);
+        std::vector<int>().swap(vTriedUsed);
+        std::vector<int>().swap(vNewUsed);
+        mapAddr.clear();
+#ifdef I2PADDRMAN_EXTENSIONS
+        mapI2pHashes.clear();
+#endif
         nKey = GetRandHash();
         for (size_t bucket = 0; bucket < ADDRMAN_NEW_BUCKET_COUNT; bucket++) {
             for (size_t entry = 0; entry < ADDRMAN_BUCKET_SIZE; entry++) {
                 vvNew[bucket][entry] = -1;
+                vvNewUsedPos[bucket][entry] = -1;
             }
         }
         for (size_t bucket = 0; bucket < ADDRMAN_TRIED_BUCKET_COUNT; bucket++) {
             for (size_t entry = 0; entry < ADDRMAN_BUCKET_SIZE; entry++) {
                 vvTried[bucket][entry] = -1;
+                vvTriedUsedPos[bucket][entry] = -1;
             }
         }
 
-        nIdCount = 0;
         nTried = 0;
         nNew = 0;
     }
@@ -0,0 +1,70 @@
+// Copyright (c) 2013-2017 The Anoncoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench/bench.h"
+
+#include "addrman.h"
+#include "clientversion.h"
+#include "streams.h"
+#include "timedata.h"
+#include "test/netutil.h"
+
+#include <vector>
+
+#include <boost/scoped_ptr.hpp>
+#include <boost/test/unit_test.hpp>
+
+BOOST_AUTO_TEST_SUITE(addrman_bench)
+
+BOOST_AUTO_TEST_CASE(addrman_operations)
+{
+    const int nCount = 100000;
+    boost::scoped_ptr<CAddrMan> paddrman(new CAddrMan());
+    CAddrMan& addrman = *paddrman;
+
+    std::vector<CAddress> vAddr;
+    vAddr.reserve(nCount);
+    for (int i = 0; i < nCount; i++)
+        vAddr.push_back(TestAddress(i));
+
+    // Addresses arrive in addr messages of up to 1000 entries, each from a peer in its own group
+    CBenchTimer timer;
+    for (int i = 0; i < nCount; i += 1000) {
+        std::vector<CAddress> vBatch(vAddr.begin() + i, vAddr.begin() + i + 1000);
+        addrman.Add(vBatch, TestAddress(8191 - i / 1000));
+    }
+    int64_t nAdd = timer.Lap();
+    int nSize = addrman.size();
+    BOOST_CHECK(nSize > 0 && nSize <= nCount);
+
+    for (int i = 0; i < nCount; i += 10)
+        addrman.Good(vAddr[i], GetAdjustedTime() - 3600);
+    int64_t nGood = timer.Lap();
+    BOOST_CHECK_EQUAL(addrman.size(), nSize);
+
+    for (int i = 0; i < nCount; i++) {
+        CAddress addr = addrman.Select();
+        if (!addr.IsValid()) {
+            BOOST_ERROR("Select() found nothing in a full address manager");
+            break;
+        }
+    }
+    int64_t nSelect = timer.Lap();
+
+    for (int i = 0; i < 100; i++)
+        BOOST_CHECK(!addrman.GetAddr(true, false).empty());
+    int64_t nGetAddr = timer.Lap();
+
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << addrman;
+    boost::scoped_ptr<CAddrMan> paddrman2(new CAddrMan());
+    ss >> *paddrman2;
+    int64_t nRoundTrip = timer.Lap();
+    BOOST_CHECK_EQUAL(paddrman2->size(), nSize);
+
+    BENCH_RESULT("addrman with %d entries: %d Add %dus, %d Good %dus, %d Select %dus, 100 GetAddr %dus, peers.dat round trip %dus",
+                 nSize, nCount, nAdd, nCount / 10, nGood, nCount, nSelect, nGetAddr, nRoundTrip);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
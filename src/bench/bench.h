@@ -0,0 +1,39 @@
+// Copyright (c) 2013-2017 The Anoncoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef ANONCOIN_BENCH_BENCH_H
+#define ANONCOIN_BENCH_BENCH_H
+
+#include "util.h"
+
+#include <stdint.h>
+#include <string>
+
+/**
+ * Wall clock for the benchmarks.  Lap() returns the microseconds since construction or the
+ * previous Lap(), so a run of consecutive phases is timed without juggling start values.
+ */
+class CBenchTimer
+{
+public:
+    CBenchTimer() : nStart(GetTimeMicros()) {}
+
+    int64_t Lap()
+    {
+        int64_t nNow = GetTimeMicros();
+        int64_t nElapsed = nNow - nStart;
+        nStart = nNow;
+        return nElapsed;
+    }
+
+private:
+    int64_t nStart;
+};
+
+//! Prints one line of results, whatever log level the runner was started with
+void BenchResult(const std::string& strResult);
+
+#define BENCH_RESULT(...) BenchResult(strprintf(__VA_ARGS__))
+
+#endif // ANONCOIN_BENCH_BENCH_H
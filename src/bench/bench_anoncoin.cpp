@@ -0,0 +1,82 @@
+// Copyright (c) 2013-2017 The Anoncoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+// Many builder specific things set in the config file, ENABLE_WALLET is a good example.  Don't forget to include it this way in your source files.
+#if defined(HAVE_CONFIG_H)
+#include "config/anoncoin-config.h"
+#endif
+
+#define BOOST_TEST_MODULE Anoncoin Benchmarks
+
+#include "bench/bench.h"
+
+#include "chainparams.h"
+#include "random.h"
+#include "ui_interface.h"
+#include "util.h"
+#ifdef ENABLE_WALLET
+#include "db.h"
+#include "wallet.h"
+#endif
+
+#include <stdio.h>
+
+#include <boost/filesystem.hpp>
+#include <boost/test/unit_test.hpp>
+
+CClientUIInterface uiInterface; // Declared but not defined in ui_interface.h
+CWallet* pwalletMain;
+
+extern void noui_connect();
+
+//! Only what the benchmarks need: main net parameters, a scratch data directory and the mock wallet database
+struct BenchSetup {
+    boost::filesystem::path pathTemp;
+
+    BenchSetup() {
+        SetupEnvironment();
+        RandAddSeedPerfmon();
+        fPrintToDebugLog = false;
+        SelectParams(CBaseChainParams::MAIN);
+        noui_connect();
+#ifdef ENABLE_WALLET
+        bitdb.MakeMock();
+#endif
+        ClearDatadirCache();
+        pathTemp = GetTempPath() / strprintf("bench_anoncoin_%lu_%i", (unsigned long)GetTime(), (int)(GetRand(100000)));
+        boost::filesystem::create_directories(pathTemp);
+        mapArgs["-datadir"] = pathTemp.string();
+    }
+    ~BenchSetup()
+    {
+#ifdef ENABLE_WALLET
+        bitdb.Flush(true);
+        bitdb.Reset();
+#endif
+        boost::filesystem::remove_all(pathTemp);
+    }
+};
+
+BOOST_GLOBAL_FIXTURE(BenchSetup);
+
+void BenchResult(const std::string& strResult)
+{
+    fprintf(stdout, "%s\n", strResult.c_str());
+    fflush(stdout);
+}
+
+void Shutdown(void* parg)
+{
+  exit(0);
+}
+
+void StartShutdown()
+{
+  exit(0);
+}
+
+bool ShutdownRequested()
+{
+  return false;
+}
@@ -0,0 +1,47 @@
+// Copyright (c) 2013-2017 The Anoncoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench/bench.h"
+
+#include "main.h"
+#include "random.h"
+
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_AUTO_TEST_SUITE(blockindex_bench)
+
+BOOST_AUTO_TEST_CASE(blockindexmap_insert_find)
+{
+    const unsigned int nEntries = 1000000;
+    std::vector<uint256> vHash(nEntries);
+    for (unsigned int i = 0; i < nEntries; i++)
+        vHash[i] = GetRandHash();
+
+    //! A chain the size of a long lived node's, built without reserving the way LoadBlockIndex does
+    CBlockIndexMap map;
+    CBenchTimer timer;
+    CBlockIndex* pprev = NULL;
+    for (unsigned int i = 0; i < nEntries; i++) {
+        CBlockIndex* pindex = map.insert(vHash[i]);
+        pindex->nHeight = i;
+        pindex->pprev = pprev;
+        pindex->BuildSkip();
+        pprev = pindex;
+    }
+    int64_t nInsert = timer.Lap();
+
+    unsigned int nFound = 0;
+    for (unsigned int i = 0; i < nEntries; i++)
+        if (map.find(vHash[i]) != map.end())
+            nFound++;
+    int64_t nFind = timer.Lap();
+    BOOST_CHECK_EQUAL(nFound, nEntries);
+
+    BENCH_RESULT("blockindexmap: %u entries, insert %.2fms, find %.2fms, %u bytes per entry",
+                 nEntries, 0.001 * nInsert, 0.001 * nFind, map.DynamicMemoryUsage() / nEntries);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
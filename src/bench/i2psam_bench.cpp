@@ -0,0 +1,122 @@
+// Copyright (c) 2013-2017 The Anoncoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench/bench.h"
+
+#include "i2psam.h"
+#include "i2pwrapper.h"
+#include "netbase.h"
+#include "test/sammock.h"
+
+#include <string>
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+#ifndef WIN32
+BOOST_AUTO_TEST_SUITE(i2psam_bench)
+
+BOOST_AUTO_TEST_CASE(session_setup)
+{
+    CMockSamBridge bridge;
+    const int nSessions = 50;
+    CBenchTimer timer;
+    for (int i = 0; i < nSessions; i++) {
+        SAM::StreamSessionAdapter session("bench", "127.0.0.1", bridge.GetPort());
+        BOOST_CHECK(!session.isSick());
+    }
+    BENCH_RESULT("SAM session setup and teardown: %d sessions, %dus each", nSessions, timer.Lap() / nSessions);
+}
+
+BOOST_AUTO_TEST_CASE(connect_accept)
+{
+    CMockSamBridge bridge;
+    bridge.SetReplyDelay(20);
+    SAM::StreamSessionAdapter sessionFrom("from", "127.0.0.1", bridge.GetPort());
+    SAM::StreamSessionAdapter sessionTo("to", "127.0.0.1", bridge.GetPort());
+    sessionFrom.setConnectOptions(8, 5000);
+    sessionFrom.refillConnectPool(2000);
+
+    const int nRounds = 10;
+    const int nStreams = 16;
+    int nAccepted = 0;
+    CBenchTimer timer;
+    for (int i = 0; i < nRounds; i++) {
+        std::vector<SAM::StreamConnector::Result> vAccepts = sessionTo.accept(nStreams, false);
+        std::vector<SAM::SOCKET> vSockets = sessionFrom.connect(std::vector<std::string>(nStreams, sessionTo.getMyDestination().pub), false);
+        for (unsigned int j = 0; j < vAccepts.size(); j++) {
+            SOCKET hSocket = vAccepts[j].socket;
+            if (hSocket != INVALID_SOCKET && ReadAcceptLine(hSocket) == sessionFrom.getMyDestination().pub)
+                nAccepted++;
+            CloseSocket(hSocket);
+        }
+        for (unsigned int j = 0; j < vSockets.size(); j++) {
+            SOCKET hSocket = vSockets[j];
+            CloseSocket(hSocket);
+        }
+    }
+    int64_t nElapsed = timer.Lap();
+    BOOST_CHECK_EQUAL(nAccepted, nRounds * nStreams);
+    //! One tunnel build after the other would take nStreams * 20ms per round
+    BENCH_RESULT("STREAM CONNECT/ACCEPT with 20ms tunnel builds: %d streams in %dms (%dms serialized), %d streams/s",
+                 nAccepted, nElapsed / 1000, nRounds * nStreams * 20, nElapsed ? nAccepted * 1000000LL / nElapsed : 0);
+}
+
+BOOST_AUTO_TEST_CASE(round_trip)
+{
+    CMockSamBridge bridge;
+    SAM::StreamSessionAdapter sessionFrom("from", "127.0.0.1", bridge.GetPort());
+    SAM::StreamSessionAdapter sessionTo("to", "127.0.0.1", bridge.GetPort());
+
+    for (int nLinkDelay = 0; nLinkDelay <= 5; nLinkDelay += 5) {
+        bridge.SetLinkDelay(nLinkDelay);
+        std::vector<SAM::StreamConnector::Result> vAccepts = sessionTo.accept(1, false);
+        BOOST_REQUIRE_EQUAL(vAccepts[0].status, SAM::Message::OK);
+        SOCKET hFrom = sessionFrom.connect(sessionTo.getMyDestination().pub, false);
+        SOCKET hTo = vAccepts[0].socket;
+        BOOST_REQUIRE(hFrom != INVALID_SOCKET);
+        BOOST_CHECK_EQUAL(ReadAcceptLine(hTo), sessionFrom.getMyDestination().pub);
+
+        //! A ping sized message there and back again
+        const int nRoundTrips = nLinkDelay ? 20 : 1000;
+        char pchPing[32], pchBuf[32];
+        memset(pchPing, 0x5a, sizeof(pchPing));
+        bool fOk = true;
+        CBenchTimer timer;
+        for (int i = 0; i < nRoundTrips && fOk; i++) {
+            fOk = send(hFrom, pchPing, sizeof(pchPing), MSG_NOSIGNAL) == sizeof(pchPing) && RecvAll(hTo, pchBuf, sizeof(pchBuf)) &&
+                  send(hTo, pchBuf, sizeof(pchBuf), MSG_NOSIGNAL) == sizeof(pchBuf) && RecvAll(hFrom, pchBuf, sizeof(pchBuf));
+        }
+        int64_t nAverage = timer.Lap() / nRoundTrips;
+        BOOST_CHECK(fOk);
+        BENCH_RESULT("Round trip through the bridge with %dms link delay: %dus", nLinkDelay, nAverage);
+        CloseSocket(hFrom);
+        CloseSocket(hTo);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(name_cache_hit)
+{
+    CMockSamBridge bridge;
+    SAM::StreamSessionAdapter session("bench", "127.0.0.1", bridge.GetPort());
+    CTestNameCache cache(&session);
+    std::string strDest = bridge.CreateSession("PEER");
+    std::string strB32 = B32AddressFromDestination(strDest);
+    bridge.AddName(strB32, strDest);
+    bridge.SetLookupDelay(200);
+
+    CBenchTimer timer;
+    BOOST_CHECK_EQUAL(cache.Resolve(strB32), strDest);
+    int64_t nLookup = timer.Lap();
+    const int nResolves = 100000;
+    int nHits = 0;
+    for (int i = 0; i < nResolves; i++)
+        nHits += cache.Resolve(strB32) == strDest;
+    int64_t nCached = timer.Lap();
+    BOOST_CHECK_EQUAL(nHits, nResolves);
+    BENCH_RESULT("b32.i2p resolve: NAMING LOOKUP with 200ms replies %dms, cached %dns", nLookup / 1000, nCached * 1000 / nResolves);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+#endif
@@ -0,0 +1,197 @@
+// Copyright (c) 2013-2017 The Anoncoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench/bench.h"
+
+#include "random.h"
+#include "wallet.h"
+#include "walletdb.h"
+
+#include <cmath>
+#include <map>
+#include <set>
+#include <utility>
+#include <vector>
+
+#include <boost/foreach.hpp>
+#include <boost/test/unit_test.hpp>
+
+using namespace std;
+
+typedef set<pair<const CWalletTx*,unsigned int> > CoinSet;
+
+BOOST_AUTO_TEST_SUITE(wallet_bench)
+
+//! Random amount between 0.001 and 100 coins, spread evenly over the orders of magnitude
+static CAmount RandomLogAmount()
+{
+    double dExp = log((double)COIN / 1000) + (log((double)COIN * 100) - log((double)COIN / 1000)) * GetRand(1000000) / 1000000.0;
+    return (CAmount)exp(dExp);
+}
+
+BOOST_AUTO_TEST_CASE(coin_selection)
+{
+    CWallet wallet;
+    const int nCounts[] = { 10000, 100000, 1000000 };
+    const int nRuns[] = { 100, 20, 5 };
+    for (unsigned int n = 0; n < sizeof(nCounts) / sizeof(nCounts[0]); n++) {
+        CMutableTransaction mtx;
+        mtx.vout.resize(nCounts[n]);
+        for (int i = 0; i < nCounts[n]; i++)
+            mtx.vout[i].nValue = RandomLogAmount();
+        CWalletTx wtx(&wallet, CTransaction(mtx));
+        vector<COutput> vOutputs;
+        vOutputs.reserve(nCounts[n]);
+        for (int i = 0; i < nCounts[n]; i++)
+            vOutputs.push_back(COutput(&wtx, i, 6*24, true));
+
+        int64_t nTime = 0;
+        int nChangeless = 0;
+        uint64_t nInputs = 0;
+        CAmount nChange = 0;
+        for (int nRun = 0; nRun < nRuns[n]; nRun++) {
+            CAmount nTarget = RandomLogAmount() * 10;
+            CoinSet setCoinsRet;
+            CAmount nValueRet;
+            CBenchTimer timer;
+            BOOST_CHECK(wallet.SelectCoinsMinConf(nTarget, 1, 6, vOutputs, setCoinsRet, nValueRet));
+            nTime += timer.Lap();
+            BOOST_CHECK(nValueRet >= nTarget);
+            if (nValueRet == nTarget)
+                nChangeless++;
+            nInputs += setCoinsRet.size();
+            nChange += nValueRet - nTarget;
+        }
+        BENCH_RESULT("coin selection over %d outputs: %dus per selection, %d of %d without change, %.1f inputs and %s change on average",
+                     nCounts[n], nTime / nRuns[n], nChangeless, nRuns[n], (double)nInputs / nRuns[n], FormatMoney(nChange / nRuns[n]));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(keypool_fill)
+{
+    const unsigned int nSerial = 200;
+    const unsigned int nKeys = 2000;
+    CWallet wallet("bench_keypool.dat");
+    bool fFirstRun;
+    BOOST_REQUIRE_EQUAL(wallet.LoadWallet(fFirstRun), DB_LOAD_OK);
+
+    // One key and one database write at a time, the way the keypool used to be filled
+    CBenchTimer timer;
+    {
+        LOCK(wallet.cs_wallet);
+        for (unsigned int i = 0; i < nSerial; i++)
+            BOOST_CHECK(wallet.GenerateNewKey().IsValid());
+    }
+    int64_t nSerialTime = timer.Lap();
+
+    unsigned int nStartSize;
+    {
+        LOCK(wallet.cs_wallet);
+        nStartSize = wallet.GetKeyPoolSize();
+    }
+    timer.Lap();
+    BOOST_CHECK(wallet.TopUpKeyPool(nStartSize + nKeys));
+    int64_t nBatchTime = timer.Lap();
+
+    BENCH_RESULT("keypool: %d keys one at a time %dus (%d keys/s), %d keys batched %dus (%d keys/s)",
+                 nSerial, nSerialTime, nSerial * 1000000LL / max(nSerialTime, (int64_t)1),
+                 nKeys, nBatchTime, nKeys * 1000000LL / max(nBatchTime, (int64_t)1));
+}
+
+//! Opens up the protected key store calls a wallet makes when it is encrypted and unlocked
+class CCryptBenchKeyStore : public CCryptoKeyStore
+{
+public:
+    bool EncryptKeys(CKeyingMaterial& vMasterKeyIn) { return CCryptoKeyStore::EncryptKeys(vMasterKeyIn); }
+    bool Unlock(const CKeyingMaterial& vMasterKeyIn) { return CCryptoKeyStore::Unlock(vMasterKeyIn); }
+};
+
+BOOST_AUTO_TEST_CASE(wallet_crypt)
+{
+    const unsigned int vCounts[] = {1000, 20000};
+    BOOST_FOREACH(unsigned int nKeys, vCounts)
+    {
+        CCryptBenchKeyStore keystore;
+        vector<CKeyID> vKeyID;
+        map<CKeyID, CKey> mapOriginal;
+        for (unsigned int i = 0; i < nKeys; i++) {
+            CKey key;
+            key.MakeNewKey(i % 2 == 0);
+            CPubKey pubkey = key.GetPubKey();
+            BOOST_CHECK(keystore.AddKeyPubKey(key, pubkey));
+            vKeyID.push_back(pubkey.GetID());
+            mapOriginal[pubkey.GetID()] = key;
+        }
+        CKeyingMaterial vMasterKey(WALLET_CRYPTO_KEY_SIZE);
+        GetRandBytes(&vMasterKey[0], WALLET_CRYPTO_KEY_SIZE);
+
+        CBenchTimer timer;
+        BOOST_REQUIRE(keystore.EncryptKeys(vMasterKey));
+        int64_t nEncrypt = timer.Lap();
+
+        BOOST_CHECK(keystore.Lock());
+        timer.Lap();
+        BOOST_CHECK(keystore.Unlock(vMasterKey));
+        int64_t nUnlock = timer.Lap();
+
+        // One key at a time, the way a dump used to read them
+        unsigned int nMatched = 0;
+        BOOST_FOREACH(const CKeyID& keyid, vKeyID) {
+            CKey key;
+            if (keystore.GetKey(keyid, key) && key == mapOriginal[keyid])
+                nMatched++;
+        }
+        int64_t nSerial = timer.Lap();
+        BOOST_CHECK_EQUAL(nMatched, nKeys);
+
+        map<CKeyID, CKey> mapKeys;
+        BOOST_CHECK(keystore.GetKeys(vKeyID, mapKeys));
+        int64_t nBulk = timer.Lap();
+        BOOST_CHECK(mapKeys == mapOriginal);
+
+        BENCH_RESULT("crypter: %d keys encrypted %dus, unlock %dus, decrypted one at a time %dus, in bulk %dus",
+                     nKeys, nEncrypt, nUnlock, nSerial, nBulk);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(wallet_filter)
+{
+    CWallet keywallet;
+    LOCK2(cs_main, keywallet.cs_wallet);
+    CKey key, keyOther;
+    key.MakeNewKey(true);
+    keyOther.MakeNewKey(true);
+    BOOST_CHECK(keywallet.AddKeyPubKey(key, key.GetPubKey()));
+
+    // The prefilter is what keeps foreign transactions cheap, time it against IsMine/IsFromMe
+    const int nCount = 20000;
+    vector<CTransaction> vtx;
+    vtx.reserve(nCount);
+    for (int i = 0; i < nCount; i++) {
+        CKey keyRandom;
+        keyRandom.MakeNewKey(true);
+        CMutableTransaction mtxRandom;
+        mtxRandom.vin.push_back(CTxIn(COutPoint(GetRandHash(), 0)));
+        mtxRandom.vout.resize(2);
+        mtxRandom.vout[0].scriptPubKey = GetScriptForDestination(keyRandom.GetPubKey().GetID());
+        mtxRandom.vout[1].scriptPubKey = GetScriptForDestination(keyOther.GetPubKey().GetID());
+        vtx.push_back(CTransaction(mtxRandom));
+    }
+    int nMine = 0, nRelevant = 0;
+    CBenchTimer timer;
+    BOOST_FOREACH(const CTransaction& tx, vtx)
+        if (keywallet.IsMine(tx) || keywallet.IsFromMe(tx))
+            nMine++;
+    int64_t nIsMine = timer.Lap();
+    BOOST_FOREACH(const CTransaction& tx, vtx)
+        if (keywallet.IsRelevantToWallet(tx))
+            nRelevant++;
+    int64_t nFilter = timer.Lap();
+    BOOST_CHECK_EQUAL(nMine, 0);
+    BOOST_CHECK_EQUAL(nRelevant, 0);
+
+    BENCH_RESULT("%d foreign transactions: IsMine/IsFromMe %dus, IsRelevantToWallet %dus", nCount, nIsMine, nFilter);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -65,3 +65,101 @@ const CBlockIndex *CChain::FindFork(const CBlockIndex *pindex) const {
         pindex = pindex->pprev;
     return pindex;
 }
+
+/**
+ * CBlockIndexPool implementation
+ */
+CBlockIndex* CBlockIndexPool::Allocate(const uint256& hash)
+{
+    if (nAllocated == vSlabs.size() * SLAB_ENTRIES)
+        vSlabs.push_back(new CEntry[SLAB_ENTRIES]);
+
+    CEntry& entry = vSlabs.back()[nAllocated++ % SLAB_ENTRIES];
+    entry.hash = hash;
+    entry.index.SetNull();
+    entry.index.phashBlock = &entry.hash;
+    return &entry.index;
+}
+
+void CBlockIndexPool::Clear()
+{
+    BOOST_FOREACH(CEntry* pslab, vSlabs)
+        delete[] pslab;
+    vSlabs.clear();
+    nAllocated = 0;
+}
+
+/**
+ * CBlockIndexMap implementation
+ */
+//! Real block hashes are uniformly distributed in their low bits, there is no need for a stronger hash function.
+//! The table is kept at most 3/4 full, with a power of two size, so lookups are a mask and a short linear probe.
+static inline size_t BlockIndexSlot(const uint256& hash, size_t nMask)
+{
+    return (size_t)hash.GetLow64() & nMask;
+}
+
+CBlockIndexMap::iterator CBlockIndexMap::find(const uint256& hash) const
+{
+    if (vTable.empty())
+        return end();
+    const size_t nMask = vTable.size() - 1;
+    for (size_t i = BlockIndexSlot(hash, nMask); vTable[i] != NULL; i = (i + 1) & nMask) {
+        if (*vTable[i]->phashBlock == hash)
+            return iterator(&vTable[i], &vTable[0] + vTable.size());
+    }
+    return end();
+}
+
+CBlockIndex* CBlockIndexMap::operator[](const uint256& hash) const
+{
+    iterator it = find(hash);
+    return it != end() ? it->second : NULL;
+}
+
+void CBlockIndexMap::reserve(size_t n)
+{
+    size_t nSlots = 16;
+    while (nSlots * 3 / 4 < n)
+        nSlots <<= 1;
+    if (nSlots > vTable.size())
+        Rehash(nSlots);
+}
+
+void CBlockIndexMap::Rehash(size_t nSlots)
+{
+    std::vector<CBlockIndex*> vOld(nSlots, (CBlockIndex*)NULL);
+    vOld.swap(vTable);
+    const size_t nMask = nSlots - 1;
+    BOOST_FOREACH(CBlockIndex* pindex, vOld) {
+        if (pindex == NULL)
+            continue;
+        size_t i = BlockIndexSlot(*pindex->phashBlock, nMask);
+        while (vTable[i] != NULL)
+            i = (i + 1) & nMask;
+        vTable[i] = pindex;
+    }
+}
+
+CBlockIndex* CBlockIndexMap::insert(const uint256& hash)
+{
+    assert(find(hash) == end());
+    if ((nEntries + 1) > vTable.size() * 3 / 4)
+        Rehash(vTable.empty() ? 16 : vTable.size() * 2);
+
+    CBlockIndex* pindex = pool.Allocate(hash);
+    const size_t nMask = vTable.size() - 1;
+    size_t i = BlockIndexSlot(hash, nMask);
+    while (vTable[i] != NULL)
+        i = (i + 1) & nMask;
+    vTable[i] = pindex;
+    nEntries++;
+    return pindex;
+}
+
+void CBlockIndexMap::clear()
+{
+    std::vector<CBlockIndex*>().swap(vTable);
+    nEntries = 0;
+    pool.Clear();
+}
@@ -12,6 +12,8 @@
 #include "tinyformat.h"
 #include "uint256.h"
 
+#include <iterator>
+#include <utility>
 #include <vector>
 
 #include <boost/foreach.hpp>
@@ -88,6 +90,47 @@ enum BlockStatus {
     BLOCK_FAILED_MASK        =   BLOCK_FAILED_VALID | BLOCK_FAILED_CHILD,
 };
 
+/**
+ * Total chain work, kept in 128 bits instead of a full uint256. Even at many
+ * orders of magnitude above today's network hash rate, the cumulative work
+ * stays far below 2^128, and every block index entry in memory carries one of
+ * these.
+ */
+class CChainWork
+{
+private:
+    uint64_t nLow;
+    uint64_t nHigh;
+
+public:
+    CChainWork() : nLow(0), nHigh(0) {}
+
+    CChainWork(const base_uint<256>& work)
+    {
+        assert((work >> 128) == 0);
+        nLow = work.GetLow64();
+        nHigh = (work >> 64).GetLow64();
+    }
+
+    //! Expand back to a uint256 for arithmetic with block proofs
+    uint256 GetWork() const
+    {
+        return (uint256(nHigh) << 64) | uint256(nLow);
+    }
+
+    bool IsNull() const { return nLow == 0 && nHigh == 0; }
+
+    std::string GetHex() const { return GetWork().GetHex(); }
+    std::string ToString() const { return GetWork().ToString(); }
+
+    friend bool operator==(const CChainWork& a, const CChainWork& b) { return a.nHigh == b.nHigh && a.nLow == b.nLow; }
+    friend bool operator!=(const CChainWork& a, const CChainWork& b) { return !(a == b); }
+    friend bool operator<(const CChainWork& a, const CChainWork& b) { return a.nHigh < b.nHigh || (a.nHigh == b.nHigh && a.nLow < b.nLow); }
+    friend bool operator>(const CChainWork& a, const CChainWork& b) { return b < a; }
+    friend bool operator<=(const CChainWork& a, const CChainWork& b) { return !(b < a); }
+    friend bool operator>=(const CChainWork& a, const CChainWork& b) { return !(a < b); }
+};
+
 /** The block chain is a tree shaped structure starting with the
  * genesis block at the root, with each block potentially having multiple
  * candidates to be the next block. A blockindex may have multiple pprev pointing
@@ -99,7 +142,8 @@ public:
     //! This is part of how we map sha256d hash values into real pow hashes that the rest of the software can use
     uintFakeHash fakeBIhash;
 
-    //! pointer to the hash of the block, This is in the mapBlockIndex and based on the real POW. memory is owned by this CBlockIndex
+    //! pointer to the hash of the block, based on the real POW. For entries in mapBlockIndex the hash is stored next to
+    //! this CBlockIndex in the slab it was allocated from, see CBlockIndexPool
     const uint256* phashBlock;
 
     //! pointer to the index of the predecessor of this block
@@ -121,7 +165,7 @@ public:
     unsigned int nUndoPos;
 
     //! (memory only) Total amount of work (expected number of hashes) in the chain up to and including this block
-    uint256 nChainWork;
+    CChainWork nChainWork;
 
     //! Number of transactions in this block.
     //! Note: in a potential headers-first mode, this number cannot be relied upon
@@ -154,7 +198,7 @@ public:
         nFile = 0;
         nDataPos = 0;
         nUndoPos = 0;
-        nChainWork = 0;
+        nChainWork = CChainWork();
         nTx = 0;
         nChainTx = 0;
         nStatus = 0;
@@ -176,7 +220,11 @@ public:
     CBlockIndex(const CBlockHeader& block)
     {
         SetNull();
+        SetBlockHeader(block);
+    }
 
+    void SetBlockHeader(const CBlockHeader& block)
+    {
         nVersion       = block.nVersion;
         hashMerkleRoot = block.hashMerkleRoot;
         nTime          = block.nTime;
@@ -346,6 +394,125 @@ public:
     }
 };
 
+/**
+ * Slab allocator for the block index. Entries are handed out from large
+ * contiguous slabs instead of one heap allocation each, and are only ever
+ * released all together, which matches the life cycle of the block index.
+ * Every entry is stored together with its real (scrypt) hash, which is what
+ * phashBlock points at, so the hash stays put however the lookup table grows.
+ * When loading from disk entries are allocated in height order, so walking
+ * pprev or the active chain touches neighbouring memory.
+ */
+class CBlockIndexPool
+{
+private:
+    struct CEntry
+    {
+        uint256 hash;
+        CBlockIndex index;
+    };
+
+    std::vector<CEntry*> vSlabs;
+    size_t nAllocated;
+
+public:
+    enum { SLAB_ENTRIES = 8192 };
+
+    CBlockIndexPool() : nAllocated(0) {}
+    ~CBlockIndexPool() { Clear(); }
+
+    //! Returns a fresh (SetNull) entry, with phashBlock pointing at a copy of hash
+    CBlockIndex* Allocate(const uint256& hash);
+
+    //! Releases every entry handed out so far
+    void Clear();
+
+    size_t size() const { return nAllocated; }
+    size_t DynamicMemoryUsage() const { return vSlabs.size() * SLAB_ENTRIES * sizeof(CEntry) + vSlabs.capacity() * sizeof(CEntry*); }
+};
+
+/**
+ * The block index lookup by real block hash. A flat open addressing table of
+ * CBlockIndex pointers, keyed by the hash each entry points to, replaces the
+ * node based unordered_map that was used before. Entries are never removed
+ * individually. The interface follows the parts of the std maps used in the
+ * code base, iterators dereference to a (hash, CBlockIndex*) pair and
+ * operator[] is a pure lookup, returning NULL for unknown hashes.
+ */
+class CBlockIndexMap
+{
+public:
+    typedef std::pair<uint256, CBlockIndex*> value_type;
+
+    class iterator
+    {
+    public:
+        typedef std::forward_iterator_tag iterator_category;
+        typedef std::pair<uint256, CBlockIndex*> value_type;
+        typedef ptrdiff_t difference_type;
+        typedef value_type* pointer;
+        typedef value_type& reference;
+
+    private:
+        CBlockIndex* const* pslot;
+        CBlockIndex* const* pend;
+        mutable value_type current;
+
+        void SkipEmpty() { while (pslot != pend && *pslot == NULL) ++pslot; }
+
+    public:
+
+        iterator() : pslot(NULL), pend(NULL) {}
+        iterator(CBlockIndex* const* pslotIn, CBlockIndex* const* pendIn) : pslot(pslotIn), pend(pendIn) { SkipEmpty(); }
+
+        value_type& operator*() const
+        {
+            current.first = *(*pslot)->phashBlock;
+            current.second = *pslot;
+            return current;
+        }
+        value_type* operator->() const { return &**this; }
+
+        iterator& operator++() { ++pslot; SkipEmpty(); return *this; }
+        iterator operator++(int) { iterator ret = *this; ++*this; return ret; }
+
+        friend bool operator==(const iterator& a, const iterator& b) { return a.pslot == b.pslot; }
+        friend bool operator!=(const iterator& a, const iterator& b) { return a.pslot != b.pslot; }
+    };
+    typedef iterator const_iterator;
+
+    CBlockIndexMap() : nEntries(0) {}
+
+    iterator begin() const { return vTable.empty() ? iterator() : iterator(&vTable[0], &vTable[0] + vTable.size()); }
+    iterator end() const { return vTable.empty() ? iterator() : iterator(&vTable[0] + vTable.size(), &vTable[0] + vTable.size()); }
+
+    iterator find(const uint256& hash) const;
+    size_t count(const uint256& hash) const { return find(hash) != end() ? 1 : 0; }
+    CBlockIndex* operator[](const uint256& hash) const;
+
+    size_t size() const { return nEntries; }
+    bool empty() const { return nEntries == 0; }
+
+    //! Makes room for n entries in total, so inserting them does not rehash the table
+    void reserve(size_t n);
+
+    //! Allocates a new entry for hash and indexes it. The hash must not be in the map yet
+    CBlockIndex* insert(const uint256& hash);
+
+    //! Drops the lookup table and releases every entry
+    void clear();
+
+    //! Heap usage of the lookup table and the entries
+    size_t DynamicMemoryUsage() const { return vTable.capacity() * sizeof(CBlockIndex*) + pool.DynamicMemoryUsage(); }
+
+private:
+    std::vector<CBlockIndex*> vTable;
+    size_t nEntries;
+    CBlockIndexPool pool;
+
+    void Rehash(size_t nSlots);
+};
+
 /** An in-memory indexed chain of blocks. */
 class CChain {
 private:
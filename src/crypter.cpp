@@ -7,9 +7,11 @@
 
 #include "script.h"
 
+#include <algorithm>
 #include <string>
 #include <vector>
 #include <boost/foreach.hpp>
+#include <boost/thread.hpp>
 #include <openssl/aes.h>
 #include <openssl/evp.h>
 
@@ -75,7 +77,7 @@ bool CCrypter::Encrypt(const CKeyingMaterial& vchPlaintext, std::vector<unsigned
 
 bool CCrypter::Decrypt(const std::vector<unsigned char>& vchCiphertext, CKeyingMaterial& vchPlaintext)
 {
-    if (!fKeySet)
+    if (!fKeySet || vchCiphertext.empty())
         return false;
 
     // plaintext will always be equal to or lesser than length of ciphertext
@@ -121,6 +123,145 @@ bool DecryptSecret(const CKeyingMaterial& vMasterKey, const std::vector<unsigned
     return cKeyCrypter.Decrypt(vchCiphertext, *((CKeyingMaterial*)&vchPlaintext));
 }
 
+bool EncryptSecrets(const CKeyingMaterial& vMasterKey, const std::vector<CKeyingMaterial>& vPlaintext, const std::vector<uint256>& vIV, std::vector<std::vector<unsigned char> >& vCiphertext, std::vector<char>& vfOk)
+{
+    vfOk.assign(vPlaintext.size(), false);
+    if (vMasterKey.size() != WALLET_CRYPTO_KEY_SIZE || vPlaintext.size() != vIV.size())
+        return false;
+    vCiphertext.resize(vPlaintext.size());
+
+    EVP_CIPHER_CTX ctx;
+
+    bool fAllOk = true;
+
+    EVP_CIPHER_CTX_init(&ctx);
+    // Expand the key once, every secret after that only brings its own IV
+    if (!EVP_EncryptInit_ex(&ctx, EVP_aes_256_cbc(), NULL, &vMasterKey[0], NULL))
+    {
+        EVP_CIPHER_CTX_cleanup(&ctx);
+        return false;
+    }
+    for (unsigned int i = 0; i < vPlaintext.size(); i++)
+    {
+        // An empty secret fails on its own, the ones after it are still encrypted
+        if (vPlaintext[i].empty())
+        {
+            fAllOk = false;
+            continue;
+        }
+        int nLen = vPlaintext[i].size();
+        int nCLen = nLen + AES_BLOCK_SIZE, nFLen = 0;
+        std::vector<unsigned char>& vchCiphertext = vCiphertext[i];
+        vchCiphertext.resize(nCLen);
+        bool fOk = EVP_EncryptInit_ex(&ctx, NULL, NULL, NULL, (const unsigned char*)&vIV[i]);
+        if (fOk) fOk = EVP_EncryptUpdate(&ctx, &vchCiphertext[0], &nCLen, &vPlaintext[i][0], nLen);
+        if (fOk) fOk = EVP_EncryptFinal_ex(&ctx, (&vchCiphertext[0])+nCLen, &nFLen);
+        if (fOk) vchCiphertext.resize(nCLen + nFLen);
+        vfOk[i] = fOk;
+        fAllOk &= fOk;
+    }
+    EVP_CIPHER_CTX_cleanup(&ctx);
+
+    return fAllOk;
+}
+
+bool DecryptSecrets(const CKeyingMaterial& vMasterKey, const std::vector<std::vector<unsigned char> >& vCiphertext, const std::vector<uint256>& vIV, std::vector<CKeyingMaterial>& vPlaintext, std::vector<char>& vfOk)
+{
+    vfOk.assign(vCiphertext.size(), false);
+    if (vMasterKey.size() != WALLET_CRYPTO_KEY_SIZE || vCiphertext.size() != vIV.size())
+        return false;
+    vPlaintext.resize(vCiphertext.size());
+
+    EVP_CIPHER_CTX ctx;
+
+    bool fAllOk = true;
+
+    EVP_CIPHER_CTX_init(&ctx);
+    if (!EVP_DecryptInit_ex(&ctx, EVP_aes_256_cbc(), NULL, &vMasterKey[0], NULL))
+    {
+        EVP_CIPHER_CTX_cleanup(&ctx);
+        return false;
+    }
+    for (unsigned int i = 0; i < vCiphertext.size(); i++)
+    {
+        // A corrupt record must not take the keys after it down, nor reach OpenSSL without any data
+        if (vCiphertext[i].empty())
+        {
+            fAllOk = false;
+            continue;
+        }
+        int nLen = vCiphertext[i].size();
+        int nPLen = nLen, nFLen = 0;
+        CKeyingMaterial& vchPlaintext = vPlaintext[i];
+        vchPlaintext.resize(nPLen);
+        bool fOk = EVP_DecryptInit_ex(&ctx, NULL, NULL, NULL, (const unsigned char*)&vIV[i]);
+        if (fOk) fOk = EVP_DecryptUpdate(&ctx, &vchPlaintext[0], &nPLen, &vCiphertext[i][0], nLen);
+        if (fOk) fOk = EVP_DecryptFinal_ex(&ctx, (&vchPlaintext[0])+nPLen, &nFLen);
+        if (fOk) vchPlaintext.resize(nPLen + nFLen);
+        else vchPlaintext.clear();
+        vfOk[i] = fOk;
+        fAllOk &= fOk;
+    }
+    EVP_CIPHER_CTX_cleanup(&ctx);
+
+    return fAllOk;
+}
+
+//! Threads worth starting for nKeys keys
+static unsigned int CrypterThreads(size_t nKeys)
+{
+    unsigned int nThreads = std::max(1, std::min((int)boost::thread::hardware_concurrency(), MAX_CRYPTER_THREADS));
+    return std::max(1U, std::min(nThreads, (unsigned int)(nKeys / CRYPTER_KEYS_PER_THREAD)));
+}
+
+//! Works out the public key and encrypted secret of every nThreads-th key, starting at nThread
+static void EncryptKeysThread(const CKeyingMaterial* pvMasterKey, const std::vector<const CKey*>* pvKeys, std::vector<CPubKey>* pvPubKeys,
+                              std::vector<std::vector<unsigned char> >* pvCrypted, std::vector<char>* pvfOk, unsigned int nThread, unsigned int nThreads)
+{
+    std::vector<CKeyingMaterial> vPlaintext;
+    std::vector<uint256> vIV;
+    for (unsigned int i = nThread; i < pvKeys->size(); i += nThreads)
+    {
+        const CKey& key = *(*pvKeys)[i];
+        (*pvPubKeys)[i] = key.GetPubKey();
+        vPlaintext.push_back(CKeyingMaterial(key.begin(), key.end()));
+        vIV.push_back((*pvPubKeys)[i].GetHash());
+    }
+    std::vector<std::vector<unsigned char> > vCiphertext;
+    std::vector<char> vfOk;
+    EncryptSecrets(*pvMasterKey, vPlaintext, vIV, vCiphertext, vfOk);
+    for (unsigned int i = nThread, j = 0; i < pvKeys->size(); i += nThreads, j++)
+    {
+        if (!vfOk[j])
+            continue;
+        (*pvCrypted)[i].swap(vCiphertext[j]);
+        (*pvfOk)[i] = true;
+    }
+}
+
+//! Decrypts every nThreads-th entry of pvCrypted, starting at nThread
+static void DecryptKeysThread(const CKeyingMaterial* pvMasterKey, const std::vector<const std::pair<CPubKey, std::vector<unsigned char> >*>* pvCrypted,
+                              std::vector<CKey>* pvKeys, std::vector<char>* pvfOk, unsigned int nThread, unsigned int nThreads)
+{
+    std::vector<std::vector<unsigned char> > vCiphertext;
+    std::vector<uint256> vIV;
+    for (unsigned int i = nThread; i < pvCrypted->size(); i += nThreads)
+    {
+        vCiphertext.push_back((*pvCrypted)[i]->second);
+        vIV.push_back((*pvCrypted)[i]->first.GetHash());
+    }
+    std::vector<CKeyingMaterial> vPlaintext;
+    std::vector<char> vfOk;
+    DecryptSecrets(*pvMasterKey, vCiphertext, vIV, vPlaintext, vfOk);
+    for (unsigned int i = nThread, j = 0; i < pvCrypted->size(); i += nThreads, j++)
+    {
+        if (!vfOk[j] || vPlaintext[j].size() != 32)
+            continue;
+        (*pvKeys)[i].Set(vPlaintext[j].begin(), vPlaintext[j].end(), (*pvCrypted)[i]->first.IsCompressed());
+        (*pvfOk)[i] = true;
+    }
+}
+
 bool CCryptoKeyStore::SetCrypted()
 {
     LOCK(cs_KeyStore);
@@ -209,6 +350,15 @@ bool CCryptoKeyStore::AddCryptedKey(const CPubKey &vchPubKey, const std::vector<
     return true;
 }
 
+void CCryptoKeyStore::EraseKey(const CKeyID &address)
+{
+    LOCK(cs_KeyStore);
+    if (IsCrypted())
+        mapCryptedKeys.erase(address);
+    else
+        mapKeys.erase(address);
+}
+
 bool CCryptoKeyStore::GetKey(const CKeyID &address, CKey& keyOut) const
 {
     {
@@ -233,6 +383,62 @@ bool CCryptoKeyStore::GetKey(const CKeyID &address, CKey& keyOut) const
     return false;
 }
 
+bool CCryptoKeyStore::GetKeys(const std::vector<CKeyID> &vAddress, std::map<CKeyID, CKey> &mapKeysOut) const
+{
+    LOCK(cs_KeyStore);
+    bool fAllOk = true;
+    if (!IsCrypted() || IsLocked())
+    {
+        BOOST_FOREACH(const CKeyID& address, vAddress)
+        {
+            CKey key;
+            if (GetKey(address, key))
+                mapKeysOut[address] = key;
+            else
+                fAllOk = false;
+        }
+        return fAllOk;
+    }
+
+    std::vector<CKeyID> vFound;
+    std::vector<const std::pair<CPubKey, std::vector<unsigned char> >*> vCrypted;
+    BOOST_FOREACH(const CKeyID& address, vAddress)
+    {
+        CryptedKeyMap::const_iterator mi = mapCryptedKeys.find(address);
+        if (mi == mapCryptedKeys.end())
+        {
+            fAllOk = false;
+            continue;
+        }
+        vFound.push_back(address);
+        vCrypted.push_back(&(*mi).second);
+    }
+
+    std::vector<CKey> vKeys(vCrypted.size());
+    std::vector<char> vfOk(vCrypted.size(), false);
+    unsigned int nThreads = CrypterThreads(vCrypted.size());
+    if (nThreads == 1)
+        DecryptKeysThread(&vMasterKey, &vCrypted, &vKeys, &vfOk, 0, 1);
+    else {
+        boost::thread_group threadGroup;
+        for (unsigned int i = 0; i < nThreads; i++)
+            threadGroup.create_thread(boost::bind(&DecryptKeysThread, &vMasterKey, &vCrypted, &vKeys, &vfOk, i, nThreads));
+        threadGroup.join_all();
+    }
+
+    for (unsigned int i = 0; i < vFound.size(); i++)
+    {
+        if (vfOk[i])
+            mapKeysOut[vFound[i]] = vKeys[i];
+        else
+        {
+            LogPrintf("CCryptoKeyStore::GetKeys : could not decrypt the key of %s\n", vFound[i].ToString());
+            fAllOk = false;
+        }
+    }
+    return fAllOk;
+}
+
 bool CCryptoKeyStore::GetPubKey(const CKeyID &address, CPubKey& vchPubKeyOut) const
 {
     {
@@ -258,15 +464,30 @@ bool CCryptoKeyStore::EncryptKeys(CKeyingMaterial& vMasterKeyIn)
             return false;
 
         fUseCrypto = true;
+
+        // Public keys and ciphertexts are worked out on several threads, then added in map order
+        std::vector<const CKey*> vKeys;
+        vKeys.reserve(mapKeys.size());
         BOOST_FOREACH(KeyMap::value_type& mKey, mapKeys)
+            vKeys.push_back(&mKey.second);
+        std::vector<CPubKey> vPubKeys(vKeys.size());
+        std::vector<std::vector<unsigned char> > vCrypted(vKeys.size());
+        std::vector<char> vfOk(vKeys.size(), false);
+        unsigned int nThreads = CrypterThreads(vKeys.size());
+        if (nThreads == 1)
+            EncryptKeysThread(&vMasterKeyIn, &vKeys, &vPubKeys, &vCrypted, &vfOk, 0, 1);
+        else {
+            boost::thread_group threadGroup;
+            for (unsigned int i = 0; i < nThreads; i++)
+                threadGroup.create_thread(boost::bind(&EncryptKeysThread, &vMasterKeyIn, &vKeys, &vPubKeys, &vCrypted, &vfOk, i, nThreads));
+            threadGroup.join_all();
+        }
+
+        for (unsigned int i = 0; i < vKeys.size(); i++)
         {
-            const CKey &key = mKey.second;
-            CPubKey vchPubKey = key.GetPubKey();
-            CKeyingMaterial vchSecret(key.begin(), key.end());
-            std::vector<unsigned char> vchCryptedSecret;
-            if (!EncryptSecret(vMasterKeyIn, vchSecret, vchPubKey.GetHash(), vchCryptedSecret))
+            if (!vfOk[i])
                 return false;
-            if (!AddCryptedKey(vchPubKey, vchCryptedSecret))
+            if (!AddCryptedKey(vPubKeys[i], vCrypted[i]))
                 return false;
         }
         mapKeys.clear();
@@ -14,6 +14,10 @@ class uint256;
 
 const unsigned int WALLET_CRYPTO_KEY_SIZE = 32;
 const unsigned int WALLET_CRYPTO_SALT_SIZE = 8;
+//! Maximum number of threads encrypting or decrypting wallet keys in bulk
+const int MAX_CRYPTER_THREADS = 8;
+//! Fewest keys worth handing to another crypter thread
+const int CRYPTER_KEYS_PER_THREAD = 500;
 
 /*
 Private key encryption is done based on a CMasterKey,
@@ -110,6 +114,10 @@ public:
 
 bool EncryptSecret(const CKeyingMaterial& vMasterKey, const CKeyingMaterial &vchPlaintext, const uint256& nIV, std::vector<unsigned char> &vchCiphertext);
 bool DecryptSecret(const CKeyingMaterial& vMasterKey, const std::vector<unsigned char>& vchCiphertext, const uint256& nIV, CKeyingMaterial& vchPlaintext);
+//! EncryptSecret and DecryptSecret over many secrets under one master key, the AES key schedule is only set up once.
+//! vfOk tells which secrets made it, one that fails does not stop the others. True only if all of them did.
+bool EncryptSecrets(const CKeyingMaterial& vMasterKey, const std::vector<CKeyingMaterial>& vPlaintext, const std::vector<uint256>& vIV, std::vector<std::vector<unsigned char> >& vCiphertext, std::vector<char>& vfOk);
+bool DecryptSecrets(const CKeyingMaterial& vMasterKey, const std::vector<std::vector<unsigned char> >& vCiphertext, const std::vector<uint256>& vIV, std::vector<CKeyingMaterial>& vPlaintext, std::vector<char>& vfOk);
 
 /** Keystore which keeps the private keys encrypted.
  * It derives from the basic key store, which is used if no encryption is active.
@@ -133,6 +141,9 @@ protected:
 
     bool Unlock(const CKeyingMaterial& vMasterKeyIn);
 
+    //! Forgets a key again, for a caller whose write of it to disk failed
+    void EraseKey(const CKeyID &address);
+
 public:
     CCryptoKeyStore() : fUseCrypto(false)
     {
@@ -170,6 +181,8 @@ public:
         return false;
     }
     bool GetKey(const CKeyID &address, CKey& keyOut) const;
+    //! GetKey for many keys at once, decrypted on several threads. False if any of them can not be had, those are left out.
+    bool GetKeys(const std::vector<CKeyID> &vAddress, std::map<CKeyID, CKey> &mapKeysOut) const;
     bool GetPubKey(const CKeyID &address, CPubKey& vchPubKeyOut) const;
     void GetKeys(std::set<CKeyID> &setAddress) const
     {
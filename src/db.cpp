@@ -25,6 +25,8 @@ using namespace std;
 
 
 unsigned int nWalletDBUpdated;
+//! -walletdurability default, commits are written to the log but the log is not synced
+const int DEFAULT_WALLET_DURABILITY = 1;
 
 
 //
@@ -96,7 +98,12 @@ bool CDBEnv::Open(const boost::filesystem::path& pathIn)
     dbenv->set_lk_max_objects(40000);
     dbenv->set_errfile(fopen(pathErrorFile.string().c_str(), "a")); /// debug
     dbenv->set_flags(DB_AUTO_COMMIT, 1);
-    dbenv->set_flags(DB_TXN_WRITE_NOSYNC, 1);
+    // 0 leaves commits in memory until the next flush, 1 writes them to the log, 2 also syncs the log
+    int nDurability = GetArg("-walletdurability", DEFAULT_WALLET_DURABILITY);
+    if (nDurability <= 0)
+        dbenv->set_flags(DB_TXN_NOSYNC, 1);
+    else if (nDurability == 1)
+        dbenv->set_flags(DB_TXN_WRITE_NOSYNC, 1);
     dbenv->log_set_config(DB_LOG_AUTO_REMOVE, 1);
     int ret = dbenv->open(strPath.c_str(),
                          DB_CREATE |
@@ -314,6 +321,155 @@ void CDB::Close()
     }
 }
 
+bool CDB::QueueWrite(const CDataStream& ssKey, const CDataStream* pssValue)
+{
+    LOCK(bitdb.cs_writequeue);
+    CDBWriteQueue* pqueue = bitdb.GetWriteQueue(strFile);
+    if (!pqueue || pqueue->nBatches == 0 || pqueue->nWriteThrough > 0)
+        return false;
+    pair<bool, CSerializeData>& entry = pqueue->mapWrites[CSerializeData(ssKey.begin(), ssKey.end())];
+    entry.first = (pssValue == NULL);
+    if (pssValue)
+        entry.second.assign(pssValue->begin(), pssValue->end());
+    else
+        entry.second.clear();
+    return true;
+}
+
+bool CDB::ReadQueued(const CDataStream& ssKey, bool& fErased, CSerializeData& vchValue)
+{
+    LOCK(bitdb.cs_writequeue);
+    CDBWriteQueue* pqueue = bitdb.GetWriteQueue(strFile);
+    if (!pqueue)
+        return false;
+    map<CSerializeData, pair<bool, CSerializeData> >::const_iterator it = pqueue->mapWrites.find(CSerializeData(ssKey.begin(), ssKey.end()));
+    if (it == pqueue->mapWrites.end())
+        return false;
+    fErased = it->second.first;
+    vchValue = it->second.second;
+    return true;
+}
+
+bool CDB::CommitWriteQueue()
+{
+    if (!pdb)
+        return false;
+    // Only a writable handle outside of a transaction of its own can apply the queue
+    if (fReadOnly || activeTxn)
+        return true;
+
+    LOCK(bitdb.cs_writequeue);
+    CDBWriteQueue* pqueue = bitdb.GetWriteQueue(strFile);
+    if (!pqueue || pqueue->mapWrites.empty())
+        return true;
+
+    DbTxn* ptxn = bitdb.TxnBegin();
+    if (!ptxn)
+        return error("CDB::CommitWriteQueue : could not begin a transaction on %s", strFile);
+    int ret = 0;
+    for (map<CSerializeData, pair<bool, CSerializeData> >::iterator it = pqueue->mapWrites.begin(); ret == 0 && it != pqueue->mapWrites.end(); ++it)
+    {
+        Dbt datKey((void*)&it->first[0], it->first.size());
+        if (it->second.first) {
+            ret = pdb->del(ptxn, &datKey, 0);
+            if (ret == DB_NOTFOUND)
+                ret = 0;
+        } else {
+            Dbt datValue(&it->second.second[0], it->second.second.size());
+            ret = pdb->put(ptxn, &datKey, &datValue, 0);
+        }
+    }
+    if (ret != 0) {
+        ptxn->abort();
+        return error("CDB::CommitWriteQueue : writing %u records to %s failed: %s", pqueue->mapWrites.size(), strFile, DbEnv::strerror(ret));
+    }
+    ret = ptxn->commit(0);
+    if (ret != 0)
+        return error("CDB::CommitWriteQueue : committing %u records to %s failed: %s", pqueue->mapWrites.size(), strFile, DbEnv::strerror(ret));
+    LogPrint("db", "CDB::CommitWriteQueue : %u records written to %s\n", pqueue->mapWrites.size(), strFile);
+    pqueue->mapWrites.clear();
+    nWalletDBUpdated++;
+    return true;
+}
+
+CDBWriteQueue* CDBEnv::GetWriteQueue(const string& strFile)
+{
+    AssertLockHeld(cs_writequeue);
+    map<string, CDBWriteQueue>::iterator mi = mapWriteQueue.find(strFile);
+    if (mi == mapWriteQueue.end())
+        return NULL;
+    return &mi->second;
+}
+
+//! Short lived handle that applies a write queue
+class CDBQueueWriter : public CDB
+{
+public:
+    explicit CDBQueueWriter(const string& strFile) : CDB(strFile) {}
+};
+
+bool CDBEnv::CommitWriteQueue(const string& strFile)
+{
+    // Keep the queue locked until it is on disk, so that no direct write overtakes it
+    LOCK(cs_writequeue);
+    CDBWriteQueue* pqueue = GetWriteQueue(strFile);
+    if (!pqueue || pqueue->mapWrites.empty())
+        return true;
+    try {
+        CDBQueueWriter db(strFile);
+        return db.CommitWriteQueue();
+    } catch (const std::exception& e) {
+        return error("CDBEnv::CommitWriteQueue : applying the writes queued for %s failed: %s", strFile, e.what());
+    }
+}
+
+CDBBatch::CDBBatch(const string& strFileIn) : strFile(strFileIn)
+{
+    LOCK(bitdb.cs_writequeue);
+    bitdb.mapWriteQueue[strFile].nBatches++;
+}
+
+CDBBatch::~CDBBatch()
+{
+    LOCK(bitdb.cs_writequeue);
+    map<string, CDBWriteQueue>::iterator mi = bitdb.mapWriteQueue.find(strFile);
+    assert(mi != bitdb.mapWriteQueue.end());
+    if (--mi->second.nBatches > 0)
+        return;
+    if (!bitdb.CommitWriteQueue(strFile))
+        LogPrintf("CDBBatch : %u writes queued for %s are lost\n", mi->second.mapWrites.size(), strFile);
+    if (mi->second.nWriteThrough == 0)
+        bitdb.mapWriteQueue.erase(mi);
+    else
+        mi->second.mapWrites.clear();
+}
+
+bool CDBBatch::Commit()
+{
+    return bitdb.CommitWriteQueue(strFile);
+}
+
+CDBWriteThrough::CDBWriteThrough(const string& strFileIn) : strFile(strFileIn), fActive(false)
+{
+    LOCK(bitdb.cs_writequeue);
+    // Writes may only bypass the queue once it is empty, or they would be overwritten by older ones
+    if (!bitdb.CommitWriteQueue(strFile))
+        return;
+    bitdb.mapWriteQueue[strFile].nWriteThrough++;
+    fActive = true;
+}
+
+CDBWriteThrough::~CDBWriteThrough()
+{
+    if (!fActive)
+        return;
+    LOCK(bitdb.cs_writequeue);
+    map<string, CDBWriteQueue>::iterator mi = bitdb.mapWriteQueue.find(strFile);
+    assert(mi != bitdb.mapWriteQueue.end());
+    if (--mi->second.nWriteThrough == 0 && mi->second.nBatches == 0)
+        bitdb.mapWriteQueue.erase(mi);
+}
+
 void CDBEnv::CloseDb(const string& strFile)
 {
     {
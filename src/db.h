@@ -23,6 +23,23 @@
 
 extern unsigned int nWalletDBUpdated;
 
+//! -walletdurability default, commits are written to the log but the log is not synced
+extern const int DEFAULT_WALLET_DURABILITY;
+
+/** Database writes held back while a CDBBatch is open on their file */
+class CDBWriteQueue
+{
+public:
+    //! Open batches, the queue is applied when the last one closes
+    int nBatches;
+    //! Open CDBWriteThrough scopes, nothing is queued while there is one
+    int nWriteThrough;
+    //! Latest value of every record written by serialized key, erased records are flagged with true
+    std::map<CSerializeData, std::pair<bool, CSerializeData> > mapWrites;
+
+    CDBWriteQueue() : nBatches(0), nWriteThrough(0) {}
+};
+
 class CDBEnv
 {
 private:
@@ -39,6 +56,9 @@ public:
     DbEnv *dbenv;
     std::map<std::string, int> mapFileUseCount;
     std::map<std::string, Db*> mapDb;
+    //! Held while a write queue is changed or applied, so no direct write slips in between
+    mutable CCriticalSection cs_writequeue;
+    std::map<std::string, CDBWriteQueue> mapWriteQueue;
 
     CDBEnv();
     ~CDBEnv();
@@ -75,7 +95,13 @@ public:
     void CloseDb(const std::string& strFile);
     bool RemoveDb(const std::string& strFile);
 
-    DbTxn* TxnBegin(int flags = DB_TXN_WRITE_NOSYNC)
+    //! Write queue of strFile, NULL when no batch is open on it. Requires cs_writequeue.
+    CDBWriteQueue* GetWriteQueue(const std::string& strFile);
+    //! Applies the writes queued for strFile right away, open batches stay open. True if nothing was left queued.
+    bool CommitWriteQueue(const std::string& strFile);
+
+    //! Flags 0 commits with the durability configured by -walletdurability
+    DbTxn* TxnBegin(int flags = 0)
     {
         DbTxn* ptxn = NULL;
         int ret = dbenv->txn_begin(NULL, &ptxn, flags);
@@ -104,11 +130,18 @@ protected:
 public:
     void Flush();
     void Close();
+    //! Applies the writes queued for this file in a single transaction, left to later on a read-only handle or inside TxnBegin()
+    bool CommitWriteQueue();
 
 private:
     CDB(const CDB&);
     void operator=(const CDB&);
 
+    //! Queues the write, or the erase when pssValue is NULL, if a batch is open on this file
+    bool QueueWrite(const CDataStream& ssKey, const CDataStream* pssValue);
+    //! Looks a record up in the write queue, true if a batch has written or erased it
+    bool ReadQueued(const CDataStream& ssKey, bool& fErased, CSerializeData& vchValue);
+
 protected:
     template <typename K, typename T>
     bool Read(const K& key, T& value)
@@ -120,6 +153,23 @@ protected:
         CDataStream ssKey(SER_DISK, CLIENT_VERSION);
         ssKey.reserve(1000);
         ssKey << key;
+
+        // Writes held back by a batch come first
+        if (!activeTxn) {
+            bool fErased;
+            CSerializeData vchQueued;
+            if (ReadQueued(ssKey, fErased, vchQueued)) {
+                if (fErased)
+                    return false;
+                try {
+                    CDataStream ssValue(vchQueued.begin(), vchQueued.end(), SER_DISK, CLIENT_VERSION);
+                    ssValue >> value;
+                } catch (const std::exception&) {
+                    return false;
+                }
+                return true;
+            }
+        }
         Dbt datKey(&ssKey[0], ssKey.size());
 
         // Read
@@ -164,8 +214,16 @@ protected:
         ssValue << value;
         Dbt datValue(&ssValue[0], ssValue.size());
 
-        // Write
-        int ret = pdb->put(activeTxn, &datKey, &datValue, (fOverwrite ? 0 : DB_NOOVERWRITE));
+        // Write, or leave it to the batch open on this file
+        int ret;
+        if (!activeTxn && fOverwrite && QueueWrite(ssKey, &ssValue))
+            ret = 0;
+        else {
+            // A record that must not exist yet is checked against the disk, bring that up to date first
+            if (!activeTxn && !fOverwrite)
+                CommitWriteQueue();
+            ret = pdb->put(activeTxn, &datKey, &datValue, (fOverwrite ? 0 : DB_NOOVERWRITE));
+        }
 
         // Clear memory in case it was a private key
         memset(datKey.get_data(), 0, datKey.get_size());
@@ -187,8 +245,12 @@ protected:
         ssKey << key;
         Dbt datKey(&ssKey[0], ssKey.size());
 
-        // Erase
-        int ret = pdb->del(activeTxn, &datKey, 0);
+        // Erase, or leave it to the batch open on this file
+        int ret;
+        if (!activeTxn && QueueWrite(ssKey, NULL))
+            ret = 0;
+        else
+            ret = pdb->del(activeTxn, &datKey, 0);
 
         // Clear memory
         memset(datKey.get_data(), 0, datKey.get_size());
@@ -205,6 +267,13 @@ protected:
         CDataStream ssKey(SER_DISK, CLIENT_VERSION);
         ssKey.reserve(1000);
         ssKey << key;
+
+        if (!activeTxn) {
+            bool fErased;
+            CSerializeData vchQueued;
+            if (ReadQueued(ssKey, fErased, vchQueued))
+                return !fErased;
+        }
         Dbt datKey(&ssKey[0], ssKey.size());
 
         // Exists
@@ -219,6 +288,9 @@ protected:
     {
         if (!pdb)
             return NULL;
+        // A cursor only sees what is on disk
+        if (!CommitWriteQueue())
+            return NULL;
         Dbc* pcursor = NULL;
         int ret = pdb->cursor(NULL, &pcursor, 0);
         if (ret != 0)
@@ -268,6 +340,9 @@ public:
     {
         if (!pdb || activeTxn)
             return false;
+        // Keep the queued writes ahead of this transaction's
+        if (!CommitWriteQueue())
+            return false;
         DbTxn* ptxn = bitdb.TxnBegin();
         if (!ptxn)
             return false;
@@ -307,4 +382,45 @@ public:
     bool static Rewrite(const std::string& strFile, const char* pszSkip = NULL);
 };
 
+/**
+ * RAII group commit. While one is open on a file, writes to that file from any thread
+ * are queued in memory, and applied in a single transaction when the last one closes.
+ * No database handle is held meanwhile, so backups and rewrites are not held up.
+ * Callers that report success should Commit() first, the destructor can only log a failure.
+ */
+class CDBBatch
+{
+private:
+    std::string strFile;
+
+    CDBBatch(const CDBBatch&);
+    void operator=(const CDBBatch&);
+
+public:
+    explicit CDBBatch(const std::string& strFileIn);
+    ~CDBBatch();
+
+    //! Applies everything queued on the file so far, false if that failed
+    bool Commit();
+};
+
+/**
+ * Applies the writes queued on a file and sends later ones straight to disk while in scope,
+ * whatever batches are open. For long running work like a rescan, whose writes must not wait
+ * in memory for a batch to close.
+ */
+class CDBWriteThrough
+{
+private:
+    std::string strFile;
+    bool fActive;
+
+    CDBWriteThrough(const CDBWriteThrough&);
+    void operator=(const CDBWriteThrough&);
+
+public:
+    explicit CDBWriteThrough(const std::string& strFileIn);
+    ~CDBWriteThrough();
+};
+
 #endif // ANONCOIN_DB_H
@@ -14,6 +14,11 @@
 #include <stdlib.h>
 #include <time.h>
 #include <stdarg.h>
+#ifndef WIN32
+#include <poll.h>
+#endif
+
+#include <boost/date_time/posix_time/posix_time.hpp>
 
 // Was 65536, seemed unnecessarily large
 #define SAM_BUFSIZE         4096
@@ -245,6 +250,539 @@ const sockaddr_in& I2pSocket::getAddress() const
 }
 
 
+//--------------------------------------------------------------------------------------------------
+
+namespace
+{
+
+struct PollEntry
+{
+    SOCKET socket;
+    bool wantRead;
+    bool wantWrite;
+    bool readable;
+    bool writable;
+
+    PollEntry(SOCKET socket, bool wantRead, bool wantWrite)
+        : socket(socket), wantRead(wantRead), wantWrite(wantWrite), readable(false), writable(false) {}
+};
+
+int64_t getTimeMillis()
+{
+    return (boost::posix_time::microsec_clock::universal_time() -
+            boost::posix_time::ptime(boost::gregorian::date(1970,1,1))).total_milliseconds();
+}
+
+bool setNonBlocking(SOCKET socket)
+{
+#ifdef WIN32
+    u_long nOne = 1;
+    return ioctlsocket(socket, FIONBIO, &nOne) != SOCKET_ERROR;
+#else
+    int flags = fcntl(socket, F_GETFL, 0);
+    return flags != SOCKET_ERROR && fcntl(socket, F_SETFL, flags | O_NONBLOCK) != SOCKET_ERROR;
+#endif
+}
+
+void closeSocket(SOCKET& socket)
+{
+    if (socket != INVALID_SOCKET)
+    {
+#ifdef WIN32
+        ::closesocket(socket);
+#else
+        ::close(socket);
+#endif
+        socket = INVALID_SOCKET;
+    }
+}
+
+// Waits until one of the sockets can make progress or the timeout expired.  poll() has no
+// FD_SETSIZE limit, select() on Windows doesn't care about the socket values either.
+bool waitSockets(std::vector<PollEntry>& entries, int timeoutMs)
+{
+    if (entries.empty())
+        return true;
+#ifdef WIN32
+    fd_set fdsetRecv;
+    fd_set fdsetSend;
+    fd_set fdsetError;
+    FD_ZERO(&fdsetRecv);
+    FD_ZERO(&fdsetSend);
+    FD_ZERO(&fdsetError);
+    for (size_t i = 0; i < entries.size(); ++i)
+    {
+        if (entries[i].wantRead)
+            FD_SET(entries[i].socket, &fdsetRecv);
+        if (entries[i].wantWrite)
+            FD_SET(entries[i].socket, &fdsetSend);
+        FD_SET(entries[i].socket, &fdsetError);
+    }
+    struct timeval timeout;
+    timeout.tv_sec = timeoutMs / 1000;
+    timeout.tv_usec = (timeoutMs % 1000) * 1000;
+    if (select(0, &fdsetRecv, &fdsetSend, &fdsetError, &timeout) == SOCKET_ERROR)
+        return false;
+    for (size_t i = 0; i < entries.size(); ++i)
+    {
+        const bool error = FD_ISSET(entries[i].socket, &fdsetError);
+        entries[i].readable = error || FD_ISSET(entries[i].socket, &fdsetRecv);
+        entries[i].writable = error || FD_ISSET(entries[i].socket, &fdsetSend);
+    }
+#else
+    std::vector<pollfd> fds(entries.size());
+    for (size_t i = 0; i < entries.size(); ++i)
+    {
+        fds[i].fd = entries[i].socket;
+        fds[i].events = (entries[i].wantRead ? POLLIN : 0) | (entries[i].wantWrite ? POLLOUT : 0);
+        fds[i].revents = 0;
+    }
+    if (poll(&fds[0], fds.size(), timeoutMs) == SOCKET_ERROR)
+        return WSAGetLastError() == WSAEINTR;
+    for (size_t i = 0; i < entries.size(); ++i)
+    {
+        entries[i].readable = fds[i].revents & (POLLIN | POLLERR | POLLHUP);
+        entries[i].writable = fds[i].revents & (POLLOUT | POLLERR | POLLHUP);
+    }
+#endif
+    return true;
+}
+
+} // namespace
+
+StreamConnector::StreamConnector(const sockaddr_in& addr, const std::string& minVer, const std::string& maxVer,
+                                 size_t poolSize /*= SAM_DEFAULT_CONNECT_POOL*/, int timeoutMs /*= SAM_DEFAULT_CONNECT_TIMEOUT*/)
+    : servAddr_(addr), minVer_(minVer), maxVer_(maxVer), poolSize_(poolSize), timeoutMs_(timeoutMs)
+{}
+
+StreamConnector::~StreamConnector()
+{
+    clear();
+}
+
+std::vector<StreamConnector::Result> StreamConnector::connect(const std::string& sessionID, const std::vector<std::string>& destinations, bool silent)
+{
+    std::vector<std::string> requests;
+    for (size_t i = 0; i < destinations.size(); ++i)
+        requests.push_back(Message::streamConnect(sessionID, destinations[i], silent));
+    return execute(requests, true);
+}
+
+std::vector<StreamConnector::Result> StreamConnector::accept(const std::string& sessionID, size_t count, bool silent)
+{
+    return execute(std::vector<std::string>(count, Message::streamAccept(sessionID, silent)), true);
+}
+
+std::vector<StreamConnector::Result> StreamConnector::lookup(const std::vector<std::string>& names)
+{
+    std::vector<std::string> requests;
+    for (size_t i = 0; i < names.size(); ++i)
+        requests.push_back(Message::namingLookup(names[i]));
+    return execute(requests, false);
+}
+
+std::vector<StreamConnector::Result> StreamConnector::execute(const std::vector<std::string>& requests, bool streams)
+{
+    std::vector<Result> results(requests.size());
+    AttemptList attempts;
+    int timeoutMs;
+    size_t poolSize;
+    {
+        boost::mutex::scoped_lock lock(mtx_);
+        timeoutMs = timeoutMs_;
+        poolSize = poolSize_;
+    }
+
+    // Handshaken control sockets go first, the rest of the requests start from scratch
+    const size_t remaining = takeFromPool(attempts, requests.size());
+    AttemptList::iterator it = attempts.begin();
+    for (size_t i = 0; i < requests.size(); ++i, ++it)
+    {
+        if (it == attempts.end())
+        {
+            it = attempts.insert(it, Attempt());
+            start(*it);
+        }
+        it->request = requests[i];
+        it->index = i;
+    }
+    // Replace what was taken from the pool while the requests are under way
+    for (size_t i = remaining; i < poolSize; ++i)
+    {
+        attempts.push_back(Attempt());
+        start(attempts.back());
+    }
+
+    run(attempts, timeoutMs, true);
+
+    for (it = attempts.begin(); it != attempts.end(); )
+    {
+        if (it->request.empty())
+        {
+            ++it;
+            continue;
+        }
+        Result& result = results[it->index];
+        result.status = it->status;
+        result.value = it->value;
+        if (it->state == Attempt::DONE && !streams)
+        {
+            // An answered lookup leaves a control socket that is as good as before
+            it->request.clear();
+            it->value.clear();
+            it->state = Attempt::READY;
+            it->lastActive = getTimeMillis();
+            ++it;
+            continue;
+        }
+        if (it->state == Attempt::DONE)
+        {
+            result.socket = it->socket;
+            it->socket = INVALID_SOCKET;
+        }
+        closeSocket(it->socket);
+        it = attempts.erase(it);
+    }
+    returnToPool(attempts);
+    return results;
+}
+
+void StreamConnector::refill(int timeoutMs)
+{
+    AttemptList attempts;
+    size_t poolSize;
+    {
+        boost::mutex::scoped_lock lock(mtx_);
+        poolSize = poolSize_;
+    }
+    takeFromPool(attempts, poolSize);
+    while (attempts.size() < poolSize)
+    {
+        attempts.push_back(Attempt());
+        start(attempts.back());
+    }
+    run(attempts, timeoutMs, false);
+    returnToPool(attempts);
+}
+
+void StreamConnector::clear()
+{
+    boost::mutex::scoped_lock lock(mtx_);
+    for (AttemptList::iterator it = pool_.begin(); it != pool_.end(); ++it)
+        closeSocket(it->socket);
+    pool_.clear();
+}
+
+void StreamConnector::setPoolSize(size_t poolSize)
+{
+    boost::mutex::scoped_lock lock(mtx_);
+    poolSize_ = poolSize;
+    while (pool_.size() > poolSize_)
+    {
+        closeSocket(pool_.back().socket);
+        pool_.pop_back();
+    }
+}
+
+void StreamConnector::setTimeout(int timeoutMs)
+{
+    boost::mutex::scoped_lock lock(mtx_);
+    timeoutMs_ = timeoutMs;
+}
+
+size_t StreamConnector::getPoolSize() const
+{
+    boost::mutex::scoped_lock lock(mtx_);
+    return poolSize_;
+}
+
+int StreamConnector::getTimeout() const
+{
+    boost::mutex::scoped_lock lock(mtx_);
+    return timeoutMs_;
+}
+
+size_t StreamConnector::getReadyCount() const
+{
+    boost::mutex::scoped_lock lock(mtx_);
+    size_t ready = 0;
+    for (AttemptList::const_iterator it = pool_.begin(); it != pool_.end(); ++it)
+        if (it->state == Attempt::READY)
+            ++ready;
+    return ready;
+}
+
+void StreamConnector::start(Attempt& attempt) const
+{
+    attempt.state = Attempt::CONNECTING;
+    attempt.lastActive = getTimeMillis();
+    attempt.socket = socket(AF_INET, SOCK_STREAM, 0);
+    if (attempt.socket == INVALID_SOCKET || !setNonBlocking(attempt.socket))
+    {
+        print_error("Failed to create socket");
+        fail(attempt, Message::CLOSED_SOCKET);
+        return;
+    }
+#ifdef SO_NOSIGPIPE
+    int set = 1;
+    setsockopt(attempt.socket, SOL_SOCKET, SO_NOSIGPIPE, (void*)&set, sizeof(int));
+#endif
+    attempt.sendBuffer = Message::hello(minVer_, maxVer_);
+    if (::connect(attempt.socket, (const sockaddr*)&servAddr_, sizeof(servAddr_)) == SOCKET_ERROR)
+    {
+        const int err = WSAGetLastError();
+        if (err != WSAEINPROGRESS && err != WSAEWOULDBLOCK && err != WSAEINVAL)
+        {
+            print_error("Failed to connect to SAM");
+            fail(attempt, Message::CLOSED_SOCKET);
+        }
+        return;
+    }
+    attempt.state = Attempt::HELLO_SENT;
+    flush(attempt);
+}
+
+void StreamConnector::advance(Attempt& attempt, bool readable, bool writable) const
+{
+    if (attempt.state == Attempt::CONNECTING)
+    {
+        if (!writable)
+            return;
+        int err = 0;
+        socklen_t len = sizeof(err);
+        if (getsockopt(attempt.socket, SOL_SOCKET, SO_ERROR, (char*)&err, &len) == SOCKET_ERROR || err != 0)
+        {
+            print_error("Failed to connect to SAM");
+            fail(attempt, Message::CLOSED_SOCKET);
+            return;
+        }
+        attempt.state = Attempt::HELLO_SENT;
+    }
+    if (writable && !flush(attempt))
+        return;
+
+    std::string line;
+    if (!readable || !readLine(attempt, line))
+        return;
+    const Message::eStatus status = Message::checkAnswer(line);
+    switch (attempt.state)
+    {
+    case Attempt::HELLO_SENT:
+        if (status != Message::OK)
+        {
+            print_error("Handshake failed");
+            fail(attempt, status);
+            return;
+        }
+        attempt.state = Attempt::READY;
+        attempt.lastActive = getTimeMillis();
+        break;
+    case Attempt::STREAM_SENT:
+        // Whatever a NAMING REPLY says, it is the answer to the lookup
+        if (status != Message::OK && line.compare(0, 12, "NAMING REPLY") != 0)
+        {
+            fail(attempt, status);
+            return;
+        }
+        attempt.state = Attempt::DONE;
+        attempt.status = status;
+        attempt.value = Message::getValue(line, "VALUE");
+        break;
+    default:
+        // Nothing is expected from the bridge on an idle control socket
+        fail(attempt, Message::CANNOT_PARSE_ERROR);
+        break;
+    }
+}
+
+void StreamConnector::run(AttemptList& attempts, int timeoutMs, bool untilRequestsDone) const
+{
+    const int64_t deadline = getTimeMillis() + timeoutMs;
+    std::vector<PollEntry> entries;
+    std::vector<Attempt*> polled;
+    while (true)
+    {
+        entries.clear();
+        polled.clear();
+        bool waiting = false;
+        for (AttemptList::iterator it = attempts.begin(); it != attempts.end(); ++it)
+        {
+            Attempt& attempt = *it;
+            if (attempt.state == Attempt::READY && !attempt.request.empty())
+            {
+                attempt.sendBuffer = attempt.request;
+                attempt.state = Attempt::STREAM_SENT;
+                if (!flush(attempt))
+                    continue;
+            }
+            if (attempt.state == Attempt::READY || attempt.state == Attempt::DONE || attempt.state == Attempt::FAILED)
+                continue;
+            if (!untilRequestsDone || !attempt.request.empty())
+                waiting = true;
+            const bool connecting = attempt.state == Attempt::CONNECTING;
+            entries.push_back(PollEntry(attempt.socket, !connecting, connecting || !attempt.sendBuffer.empty()));
+            polled.push_back(&attempt);
+        }
+        const int64_t now = getTimeMillis();
+        if (!waiting || now >= deadline)
+            break;
+        if (!waitSockets(entries, (int)std::min<int64_t>(deadline - now, 1000)))
+        {
+            print_error("Failed to wait for SAM sockets");
+            break;
+        }
+        for (size_t i = 0; i < entries.size(); ++i)
+            if (entries[i].readable || entries[i].writable)
+                advance(*polled[i], entries[i].readable, entries[i].writable);
+    }
+
+    // Whatever is still on its way towards a stream has run out of time
+    for (AttemptList::iterator it = attempts.begin(); it != attempts.end(); ++it)
+        if (!it->request.empty() && it->state != Attempt::DONE && it->state != Attempt::FAILED)
+            fail(*it, Message::TIMEOUT);
+}
+
+// Moves up to count pooled attempts over, returns how many stay in the pool
+size_t StreamConnector::takeFromPool(AttemptList& attempts, size_t count)
+{
+    boost::mutex::scoped_lock lock(mtx_);
+
+    // The bridge may have dropped an idle control socket, it then reads as closed
+    const int64_t now = getTimeMillis();
+    std::vector<PollEntry> entries;
+    for (AttemptList::iterator it = pool_.begin(); it != pool_.end(); )
+    {
+        if (now - it->lastActive > SAM_CONNECT_POOL_MAX_IDLE)
+        {
+            closeSocket(it->socket);
+            it = pool_.erase(it);
+            continue;
+        }
+        if (it->state == Attempt::READY)
+            entries.push_back(PollEntry(it->socket, true, false));
+        ++it;
+    }
+    waitSockets(entries, 0);
+    for (size_t i = 0; i < entries.size(); ++i)
+    {
+        if (!entries[i].readable)
+            continue;
+        for (AttemptList::iterator it = pool_.begin(); it != pool_.end(); ++it)
+        {
+            if (it->socket == entries[i].socket)
+            {
+                closeSocket(it->socket);
+                pool_.erase(it);
+                break;
+            }
+        }
+    }
+
+    // Ready ones first, then those still in their handshake
+    for (int pass = 0; pass < 2; ++pass)
+    {
+        for (AttemptList::iterator it = pool_.begin(); it != pool_.end() && attempts.size() < count; )
+        {
+            AttemptList::iterator next = it;
+            ++next;
+            if ((it->state == Attempt::READY) == (pass == 0))
+                attempts.splice(attempts.end(), pool_, it);
+            it = next;
+        }
+    }
+    return pool_.size();
+}
+
+void StreamConnector::returnToPool(AttemptList& attempts)
+{
+    boost::mutex::scoped_lock lock(mtx_);
+    for (AttemptList::iterator it = attempts.begin(); it != attempts.end(); ++it)
+    {
+        if (it->state == Attempt::FAILED || it->state == Attempt::DONE || !it->request.empty())
+            continue;
+        if (pool_.size() < poolSize_)
+        {
+            pool_.push_back(*it);
+            it->socket = INVALID_SOCKET;
+        }
+        else
+            closeSocket(it->socket);
+    }
+    attempts.clear();
+}
+
+/*static*/
+void StreamConnector::fail(Attempt& attempt, Message::eStatus status)
+{
+    closeSocket(attempt.socket);
+    attempt.state = Attempt::FAILED;
+    attempt.status = status;
+}
+
+/*static*/
+bool StreamConnector::flush(Attempt& attempt)
+{
+    while (!attempt.sendBuffer.empty())
+    {
+        ssize_t sentBytes = send(attempt.socket, attempt.sendBuffer.data(), attempt.sendBuffer.size(), MSG_NOSIGNAL);
+        if (sentBytes == SOCKET_ERROR)
+        {
+            const int err = WSAGetLastError();
+            if (err == WSAEWOULDBLOCK || err == WSAEINTR)
+                return true;
+            print_error("Failed to send data");
+            fail(attempt, Message::CLOSED_SOCKET);
+            return false;
+        }
+        attempt.sendBuffer.erase(0, sentBytes);
+    }
+    return true;
+}
+
+/*static*/
+bool StreamConnector::readLine(Attempt& attempt, std::string& line)
+{
+    // Only peek first, anything behind the reply line already belongs to the stream
+    char buffer[SAM_BUFSIZE];
+    ssize_t recievedBytes = recv(attempt.socket, buffer, sizeof(buffer), MSG_PEEK);
+    if (recievedBytes == SOCKET_ERROR)
+    {
+        const int err = WSAGetLastError();
+        if (err != WSAEWOULDBLOCK && err != WSAEINTR)
+        {
+            print_error("Failed to receive data");
+            fail(attempt, Message::CLOSED_SOCKET);
+        }
+        return false;
+    }
+    if (recievedBytes == 0)
+    {
+        print_error("I2pSocket was closed");
+        fail(attempt, Message::CLOSED_SOCKET);
+        return false;
+    }
+    const char* newLine = (const char*)memchr(buffer, '\n', recievedBytes);
+    const ssize_t lineBytes = newLine ? newLine - buffer + 1 : recievedBytes;
+    if (recv(attempt.socket, buffer, lineBytes, 0) != lineBytes)
+    {
+        fail(attempt, Message::CLOSED_SOCKET);
+        return false;
+    }
+    attempt.recvBuffer.append(buffer, lineBytes);
+    if (!newLine)
+    {
+        if (attempt.recvBuffer.size() > SAM_BUFSIZE)
+            fail(attempt, Message::CANNOT_PARSE_ERROR);
+        return false;
+    }
+#ifdef DEBUG_ON_STDOUT
+    std::cout << "Reply: " << attempt.recvBuffer << std::endl;
+#endif
+    line.swap(attempt.recvBuffer);
+    attempt.recvBuffer.clear();
+    return true;
+}
+
 //--------------------------------------------------------------------------------------------------
 
 StreamSession::StreamSession(
@@ -256,6 +794,7 @@ StreamSession::StreamSession(
         const std::string& minVer      /*= SAM_DEFAULT_MIN_VER*/,
         const std::string& maxVer      /*= SAM_DEFAULT_MAX_VER*/)
     : socket_(SAMHost, SAMPort, minVer, maxVer)
+    , connector_(socket_.getAddress(), minVer, maxVer)
     , nickname_(nickname)
     , sessionID_(generateSessionID())
     , i2pOptions_(i2pOptions)
@@ -269,6 +808,7 @@ StreamSession::StreamSession(
 
 StreamSession::StreamSession(StreamSession& rhs)
     : socket_(rhs.socket_)
+    , connector_(rhs.socket_.getAddress(), rhs.socket_.getMinVer(), rhs.socket_.getMaxVer(), rhs.connector_.getPoolSize(), rhs.connector_.getTimeout())
     , nickname_(rhs.nickname_)
     , sessionID_(generateSessionID())
     , myDestination_(rhs.myDestination_)
@@ -304,7 +844,13 @@ std::string StreamSession::generateSessionID()
     int length = minSessionIDLength - 1;
     std::string result;
 
-    srand(time(NULL));
+    // Seeding again on every call gave all sessions created within the same second the same ID
+    static bool seeded = false;
+    if (!seeded)
+    {
+        srand(time(NULL));
+        seeded = true;
+    }
 
     while(length < minSessionIDLength)
         length = rand() % maxSessionIDLength;
@@ -318,48 +864,43 @@ std::string StreamSession::generateSessionID()
     return result;
 }
 
-RequestResult<std::auto_ptr<I2pSocket> > StreamSession::accept(bool silent)
+std::vector<StreamConnector::Result> StreamSession::accept(size_t count, bool silent)
 {
-    typedef RequestResult<std::auto_ptr<I2pSocket> > ResultType;
+    std::vector<StreamConnector::Result> results = connector_.accept(sessionID_, count, silent);
+    checkResults(results);
+    return results;
+}
 
-    std::auto_ptr<I2pSocket> streamSocket(new I2pSocket(socket_));
-    const Message::eStatus status = accept(*streamSocket, sessionID_, silent);
-    switch(status)
-    {
-    case Message::OK:
-        return RequestResult<std::auto_ptr<I2pSocket> >(streamSocket);
-    case Message::EMPTY_ANSWER:
-    case Message::CLOSED_SOCKET:
-    case Message::INVALID_ID:
-    case Message::I2P_ERROR:
-        fallSick();
-        break;
-    default:
-        break;
-    }
-    return ResultType();
+std::vector<StreamConnector::Result> StreamSession::connect(const std::vector<std::string>& destinations, bool silent)
+{
+    std::vector<StreamConnector::Result> results = connector_.connect(sessionID_, destinations, silent);
+    checkResults(results);
+    return results;
 }
 
-RequestResult<std::auto_ptr<I2pSocket> > StreamSession::connect(const std::string& destination, bool silent)
+std::vector<StreamConnector::Result> StreamSession::namingLookup(const std::vector<std::string>& names)
 {
-    typedef RequestResult<std::auto_ptr<I2pSocket> > ResultType;
+    std::vector<StreamConnector::Result> results = connector_.lookup(names);
+    checkResults(results);
+    return results;
+}
 
-    std::auto_ptr<I2pSocket> streamSocket(new I2pSocket(socket_));
-    const Message::eStatus status = connect(*streamSocket, sessionID_, destination, silent);
-    switch(status)
+void StreamSession::checkResults(const std::vector<StreamConnector::Result>& results) const
+{
+    for (size_t i = 0; i < results.size(); ++i)
     {
-    case Message::OK:
-        return ResultType(streamSocket);
-    case Message::EMPTY_ANSWER:
-    case Message::CLOSED_SOCKET:
-    case Message::INVALID_ID:
-    case Message::I2P_ERROR:
-        fallSick();
-        break;
-    default:
-        break;
+        switch(results[i].status)
+        {
+        case Message::EMPTY_ANSWER:
+        case Message::CLOSED_SOCKET:
+        case Message::INVALID_ID:
+        case Message::I2P_ERROR:
+            fallSick();
+            break;
+        default:
+            break;
+        }
     }
-    return ResultType();
 }
 
 RequestResult<void> StreamSession::forward(const std::string& host, uint16_t port, bool silent)
@@ -465,9 +1006,21 @@ void StreamSession::stopForwardingAll()
     for (ForwardedStreamsContainer::iterator it = forwardedStreams_.begin(); it != forwardedStreams_.end(); ++it)
         delete (it->socket);
     forwardedStreams_.clear();
+    connector_.clear();
     socket_.close();
 }
 
+void StreamSession::setConnectOptions(size_t poolSize, int timeoutMs)
+{
+    connector_.setPoolSize(poolSize);
+    connector_.setTimeout(timeoutMs);
+}
+
+void StreamSession::refillConnectPool(int timeoutMs)
+{
+    connector_.refill(timeoutMs);
+}
+
 /*static*/
 Message::Answer<const std::string> StreamSession::rawRequest(I2pSocket& socket, const std::string& requestStr)
 {
@@ -525,18 +1078,6 @@ Message::Answer<const FullDestination> StreamSession::destGenerate(I2pSocket& so
     return (!pub.empty() && !priv.empty()) ? ResultType(Message::OK, FullDestination(pub, priv, /*isGenerated*/ true)) : ResultType(Message::EMPTY_ANSWER, FullDestination());
 }
 
-/*static*/
-Message::eStatus StreamSession::accept(I2pSocket& socket, const std::string& sessionID, bool silent)
-{
-    return request(socket, Message::streamAccept(sessionID, silent));
-}
-
-/*static*/
-Message::eStatus StreamSession::connect(I2pSocket& socket, const std::string& sessionID, const std::string& destination, bool silent)
-{
-    return request(socket, Message::streamConnect(sessionID, destination, silent));
-}
-
 /*static*/
 Message::eStatus StreamSession::forward(I2pSocket& socket, const std::string& sessionID, const std::string& host, uint16_t port, bool silent)
 {
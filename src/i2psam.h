@@ -14,18 +14,25 @@
 
 #include <string>
 #include <list>
+#include <vector>
 #include <stdint.h>
 #include <memory>
 #include <utility>
 
+#include <boost/thread/mutex.hpp>
+
 #define SAM_DEFAULT_ADDRESS         "127.0.0.1"
 #define SAM_DEFAULT_PORT            7656
 #define SAM_DEFAULT_MIN_VER         "3.0"
-#define SAM_DEFAULT_MAX_VER         "3.0"
+#define SAM_DEFAULT_MAX_VER         "3.2"     // 3.2 allows several STREAM ACCEPTs outstanding on one session
 #define SAM_GENERATE_MY_DESTINATION "TRANSIENT"
 #define SAM_MY_NAME                 "ME"
 #define SAM_DEFAULT_I2P_OPTIONS     ""
 
+#define SAM_DEFAULT_CONNECT_POOL    4       // Handshaken control sockets kept ready for STREAM CONNECT
+#define SAM_DEFAULT_CONNECT_TIMEOUT 60000   // Milliseconds, building a tunnel to a new peer can take quite a while
+#define SAM_CONNECT_POOL_MAX_IDLE   120000  // Milliseconds a pooled control socket is kept before it's replaced
+
 #define SAM_NAME_INBOUND_QUANTITY           "inbound.quantity"
 #define SAM_DEFAULT_INBOUND_QUANTITY        3 // Three tunnels is default now
 #define SAM_NAME_INBOUND_LENGTH             "inbound.length"
@@ -247,6 +254,100 @@ private:
     I2pSocket& operator=(const I2pSocket&);
 };
 
+/**
+ * Non-blocking STREAM CONNECT client.  Every attempt is a small state machine running on its own
+ * non-blocking socket: TCP connect to the bridge, HELLO, STREAM CONNECT and finally the stream.
+ * All attempts given to one connect() call advance together in a single poll loop, so the tunnel
+ * builds towards several peers overlap instead of adding up.  Control sockets which already passed
+ * the HELLO handshake are kept in a pool and used first, most connects then only have to wait for
+ * the STREAM STATUS reply.  Spare attempts topping up the pool run in the same loop.  STREAM ACCEPTs
+ * go through the same machinery, for them an OK STREAM STATUS means the accept is armed.
+ */
+class StreamConnector
+{
+public:
+    struct Result
+    {
+        SOCKET socket;
+        Message::eStatus status;
+        std::string value;          // VALUE of a NAMING REPLY
+
+        Result()
+            : socket(INVALID_SOCKET), status(Message::TIMEOUT) {}
+    };
+
+    StreamConnector(const sockaddr_in& addr, const std::string& minVer, const std::string& maxVer,
+                    size_t poolSize = SAM_DEFAULT_CONNECT_POOL, int timeoutMs = SAM_DEFAULT_CONNECT_TIMEOUT);
+    ~StreamConnector();
+
+    // The results are in the order of the destinations, sockets of successful attempts are left non-blocking
+    std::vector<Result> connect(const std::string& sessionID, const std::vector<std::string>& destinations, bool silent);
+    // Issues count STREAM ACCEPTs, the returned sockets wait for the destination line of an incoming peer
+    std::vector<Result> accept(const std::string& sessionID, size_t count, bool silent);
+    // Sends all NAMING LOOKUPs at once, the control sockets go back to the pool once answered
+    std::vector<Result> lookup(const std::vector<std::string>& names);
+    // Tops up the pool of handshaken control sockets, waiting at most timeoutMs for the handshakes to finish
+    void refill(int timeoutMs);
+    void clear();
+
+    void setPoolSize(size_t poolSize);
+    void setTimeout(int timeoutMs);
+    size_t getPoolSize() const;
+    int getTimeout() const;
+    size_t getReadyCount() const;
+
+private:
+    struct Attempt
+    {
+        enum State
+        {
+            CONNECTING,     // waiting for the TCP connect to the bridge
+            HELLO_SENT,     // waiting for the HELLO REPLY
+            READY,          // handshaken control socket, no command sent yet
+            STREAM_SENT,    // waiting for the STREAM STATUS or NAMING REPLY
+            DONE,           // the socket is a stream to the peer now, or the lookup was answered
+            FAILED
+        };
+
+        SOCKET socket;
+        State state;
+        std::string sendBuffer;
+        std::string recvBuffer;
+        std::string request;        // STREAM or NAMING command to send once READY, empty for pool refills
+        std::string value;          // VALUE of the NAMING REPLY
+        size_t index;               // Position in the destinations given to connect()
+        int64_t lastActive;         // Start of the current handshake step, for expiring pooled sockets
+        Message::eStatus status;
+
+        Attempt()
+            : socket(INVALID_SOCKET), state(FAILED), index(0), lastActive(0), status(Message::TIMEOUT) {}
+    };
+
+    typedef std::list<Attempt> AttemptList;
+
+    const sockaddr_in servAddr_;
+    const std::string minVer_;
+    const std::string maxVer_;
+    size_t poolSize_;
+    int timeoutMs_;
+    AttemptList pool_;              // Ready or still handshaking control sockets
+    mutable boost::mutex mtx_;
+
+    std::vector<Result> execute(const std::vector<std::string>& requests, bool streams);
+    void start(Attempt& attempt) const;
+    void advance(Attempt& attempt, bool readable, bool writable) const;
+    void run(AttemptList& attempts, int timeoutMs, bool untilRequestsDone) const;
+    size_t takeFromPool(AttemptList& attempts, size_t count);
+    void returnToPool(AttemptList& attempts);
+
+    static void fail(Attempt& attempt, Message::eStatus status);
+    static bool flush(Attempt& attempt);
+    static bool readLine(Attempt& attempt, std::string& line);
+
+    StreamConnector(const StreamConnector&);
+    StreamConnector& operator=(const StreamConnector&);
+};
+
 struct FullDestination
 {
     std::string pub;
@@ -342,8 +443,9 @@ public:
 
     static std::string generateSessionID();
 
-    RequestResult<std::auto_ptr<I2pSocket> > accept(bool silent);
-    RequestResult<std::auto_ptr<I2pSocket> > connect(const std::string& destination, bool silent);
+    std::vector<StreamConnector::Result> accept(size_t count, bool silent);
+    std::vector<StreamConnector::Result> connect(const std::vector<std::string>& destinations, bool silent);
+    std::vector<StreamConnector::Result> namingLookup(const std::vector<std::string>& names);
     RequestResult<void> forward(const std::string& host, uint16_t port, bool silent);
     RequestResult<const std::string> namingLookup(const std::string& name) const;
     RequestResult<const FullDestination> destGenerate() const;
@@ -351,6 +453,9 @@ public:
     void stopForwarding(const std::string& host, uint16_t port);
     void stopForwardingAll();
 
+    void setConnectOptions(size_t poolSize, int timeoutMs);
+    void refillConnectPool(int timeoutMs);
+
     const FullDestination& getMyDestination() const;
 
     const sockaddr_in& getSAMAddress() const;
@@ -383,6 +488,7 @@ private:
     typedef std::list<ForwardedStream> ForwardedStreamsContainer;
 
     I2pSocket socket_;
+    StreamConnector connector_;
     const std::string nickname_;
     const std::string sessionID_;
     FullDestination myDestination_;
@@ -391,6 +497,7 @@ private:
     mutable bool isSick_;
 
     void fallSick() const;
+    void checkResults(const std::vector<StreamConnector::Result>& results) const;
     FullDestination createStreamSession(const std::string &destination);
 
     static Message::Answer<const std::string> rawRequest(I2pSocket& socket, const std::string& requestStr);
@@ -401,8 +508,6 @@ private:
     static Message::Answer<const std::string> namingLookup(I2pSocket& socket, const std::string& name);
     static Message::Answer<const FullDestination> destGenerate(I2pSocket& socket);
 
-    static Message::eStatus accept(I2pSocket& socket, const std::string& sessionID, bool silent);
-    static Message::eStatus connect(I2pSocket& socket, const std::string& sessionID, const std::string& destination, bool silent);
     static Message::eStatus forward(I2pSocket& socket, const std::string& sessionID, const std::string& host, uint16_t port, bool silent);
 };
 
@@ -105,18 +105,23 @@ namespace SAM
         return s.isSick();
     }
 
-    SAM::SOCKET StreamSessionAdapter::accept(bool silent)
+    std::vector<SAM::StreamConnector::Result> StreamSessionAdapter::accept(size_t count, bool silent)
     {
-        SAM::RequestResult<std::auto_ptr<SAM::I2pSocket> > result = sessionHolder_->getSession().accept(silent);
-        // call I2pSocket::release
-        return result.isOk ? result.value->release() : INVALID_SOCKET;
+        return sessionHolder_->getSession().accept(count, silent);
     }
 
     SAM::SOCKET StreamSessionAdapter::connect(const std::string& destination, bool silent)
     {
-        SAM::RequestResult<std::auto_ptr<SAM::I2pSocket> > result = sessionHolder_->getSession().connect(destination, silent);
-        // call I2pSocket::release
-        return result.isOk ? result.value->release() : INVALID_SOCKET;
+        return connect(std::vector<std::string>(1, destination), silent)[0];
+    }
+
+    std::vector<SAM::SOCKET> StreamSessionAdapter::connect(const std::vector<std::string>& destinations, bool silent)
+    {
+        std::vector<SAM::StreamConnector::Result> results = sessionHolder_->getSession().connect(destinations, silent);
+        std::vector<SAM::SOCKET> sockets(results.size());
+        for (size_t i = 0; i < results.size(); i++)
+            sockets[i] = results[i].socket;
+        return sockets;
     }
 
     bool StreamSessionAdapter::forward(const std::string& host, uint16_t port, bool silent)
@@ -130,6 +135,19 @@ namespace SAM
         return result.isOk ? result.value : std::string();
     }
 
+    std::vector<std::string> StreamSessionAdapter::namingLookup(const std::vector<std::string>& names, std::vector<bool>& answered)
+    {
+        std::vector<SAM::StreamConnector::Result> results = sessionHolder_->getSession().namingLookup(names);
+        std::vector<std::string> values(results.size());
+        answered.assign(results.size(), false);
+        for (size_t i = 0; i < results.size(); i++) {
+            if (results[i].status == SAM::Message::OK)
+                values[i] = results[i].value;
+            answered[i] = results[i].status == SAM::Message::OK || results[i].status == SAM::Message::KEY_NOT_FOUND;
+        }
+        return values;
+    }
+
     SAM::FullDestination StreamSessionAdapter::destGenerate() const
     {
         SAM::RequestResult<const SAM::FullDestination> result = sessionHolder_->getSession().destGenerate();
@@ -146,6 +164,16 @@ namespace SAM
         sessionHolder_->getSession().stopForwardingAll();
     }
 
+    void StreamSessionAdapter::setConnectOptions(size_t poolSize, int timeoutMs)
+    {
+        sessionHolder_->getSession().setConnectOptions(poolSize, timeoutMs);
+    }
+
+    void StreamSessionAdapter::refillConnectPool(int timeoutMs)
+    {
+        sessionHolder_->getSession().refillConnectPool(timeoutMs);
+    }
+
     const SAM::FullDestination& StreamSessionAdapter::getMyDestination() const
     {
         return sessionHolder_->getSession().getMyDestination();
@@ -204,6 +232,8 @@ static std::string sHost = SAM_DEFAULT_ADDRESS;
 static uint16_t uPort = SAM_DEFAULT_PORT;
 static std::string sDestination = SAM_GENERATE_MY_DESTINATION;
 static std::string sOptions;
+static size_t nSamConnectPool = SAM_DEFAULT_CONNECT_POOL;
+static int nSamConnectTimeout = SAM_DEFAULT_CONNECT_TIMEOUT;
 
 I2PSession::I2PSession() : SAM::StreamSessionAdapter( sSession, sHost, uPort, sDestination, sOptions )
 {
@@ -213,6 +243,11 @@ I2PSession::I2PSession() : SAM::StreamSessionAdapter( sSession, sHost, uPort, sD
     /* ::sDestination = this->getMyDestination().priv; */
     // That line causes a command cycle on the session, when it should not, if the
     // router connection failed to open.
+
+    // Have the first outbound connections start from handshaken control sockets
+    setConnectOptions(nSamConnectPool, nSamConnectTimeout);
+    if (!isSick())
+        refillConnectPool(1000);
 }
 
 I2PSession::~I2PSession()
@@ -315,6 +350,8 @@ void InitializeI2pSettings( const bool fGenerated )
     uPort = (uint16_t)GetArg( "-i2p.options.samport", SAM_DEFAULT_PORT );
     sSession = GetArg( "-i2p.options.sessionname", I2P_SESSION_NAME_DEFAULT );
     sHost = GetArg( "-i2p.options.samhost", SAM_DEFAULT_ADDRESS );
+    nSamConnectPool = (size_t)std::max( GetArg( "-i2p.options.connectpool", SAM_DEFAULT_CONNECT_POOL ), (int64_t)1 );
+    nSamConnectTimeout = (int)std::max( GetArg( "-i2p.options.connecttimeout", SAM_DEFAULT_CONNECT_TIMEOUT / 1000 ), (int64_t)1 ) * 1000;
     // Critical to check here, if we are in dynamic destination mode, the intial session destination MUSTBE default too.
     //  Which may not be what the user has set in the anoncoin.conf file.
     // If the .static i2p destination is to be used, set it now, if not set the TRANSIENT value so the router generates it for us
@@ -28,16 +28,22 @@ namespace SAM
 
             ~StreamSessionAdapter();
 
-            SAM::SOCKET accept(bool silent);
+            std::vector<SAM::StreamConnector::Result> accept(size_t count, bool silent);
             SAM::SOCKET connect(const std::string& destination, bool silent);
+            std::vector<SAM::SOCKET> connect(const std::vector<std::string>& destinations, bool silent);
             bool forward(const std::string& host, uint16_t port, bool silent);
             std::string namingLookup(const std::string& name) const;
+            //! Empty where the router has no destination, answered tells a KEY_NOT_FOUND from a lookup that failed
+            std::vector<std::string> namingLookup(const std::vector<std::string>& names, std::vector<bool>& answered);
             SAM::FullDestination destGenerate() const;
             bool isSick( void )const;
 
             void stopForwarding(const std::string& host, uint16_t port);
             void stopForwardingAll();
 
+            void setConnectOptions(size_t poolSize, int timeoutMs);
+            void refillConnectPool(int timeoutMs);
+
             const SAM::FullDestination& getMyDestination() const;
 
             const sockaddr_in& getSAMAddress() const;
@@ -145,7 +145,7 @@ public:
     // Writes do not need similar protection, as failure to write is handled by the caller.
 };
 
-static CCoinsViewDB *pcoinsdbview = NULL;
+CCoinsViewDB *pcoinsdbview = NULL;
 static CCoinsViewErrorCatcher *pcoinscatcher = NULL;
 
 void Shutdown()
@@ -283,8 +283,14 @@ std::string HelpMessage(HelpMessageMode hmm)
         strUsage += "  -daemon                " + _("Run in the background as a daemon and accept commands") + "\n";
 #endif
     }
+    strUsage += "  -addrindex             " + strprintf(_("Maintain an index of outputs by address, used by the getaddressoutputs rpc call (default: %u)"), 0) + "\n";
     strUsage += "  -datadir=<dir>         " + _("Specify data directory") + "\n";
     strUsage += "  -dbcache=<n>           " + strprintf(_("Set database cache size in megabytes (%d to %d, default: %d)"), nMinDbCache, nMaxDbCache, nDefaultDbCache) + "\n";
+    strUsage += "  -<db>.blocksize=<n>    " + strprintf(_("Set the LevelDB block size in KiB of <db>, chainstate or blockindex (default: %u)"), 4) + "\n";
+    strUsage += "  -<db>.bloombits=<n>    " + strprintf(_("Set the LevelDB bloom filter bits per key of <db>, 0 disables the filter (default: %u)"), 10) + "\n";
+    strUsage += "  -<db>.compression=<n>  " + strprintf(_("Use snappy compression for new LevelDB tables of <db> (default: %u)"), 0) + "\n";
+    strUsage += "  -<db>.maxopenfiles=<n> " + strprintf(_("Set the maximum number of LevelDB table files <db> keeps open (default: %u)"), 64) + "\n";
+    strUsage += "  -<db>.writebuffer=<n>  " + _("Set the LevelDB write buffer of <db> in megabytes (default: a quarter of its cache)") + "\n";
     strUsage += "  -loadblock=<file>      " + _("Imports blocks from external blk000??.dat file") + " " + _("on startup") + "\n";
     strUsage += "  -maxorphantx=<n>       " + strprintf(_("Keep at most <n> unconnectable transactions in memory (default: %u)"), DEFAULT_MAX_ORPHAN_TRANSACTIONS) + "\n";
     strUsage += "  -par=<n>               " + strprintf(_("Set the number of script verification threads (%u to %d, 0 = auto, <0 = leave that many cores free, default: %d)"), -(int)boost::thread::hardware_concurrency(), MAX_SCRIPTCHECK_THREADS, DEFAULT_SCRIPTCHECK_THREADS) + "\n";
@@ -303,12 +309,14 @@ std::string HelpMessage(HelpMessageMode hmm)
     strUsage += "  -discover              " + _("Discover own IP address (default: 1 when listening and no -externalip)") + "\n";
     strUsage += "  -dns                   " + _("Allow DNS lookups for -addnode, -seednode and -connect") + " " + _("(default: 1)") + "\n";
     strUsage += "  -dnsseed               " + _("Query for peer addresses via DNS lookup, if low on addresses (default: 1 unless -connect)") + "\n";
+    strUsage += "  -epoll                 " + strprintf(_("Use epoll instead of select() to wait on the peer sockets where available (default: %u)"), 1) + "\n";
     strUsage += "  -externalip=<ip>       " + _("Specify your own public address") + "\n";
     strUsage += "  -forcednsseed          " + strprintf(_("Always query for peer addresses via DNS lookup (default: %u)"), 0) + "\n";
     strUsage += "  -listen                " + _("Accept connections from outside (default: 1 if no -proxy or -connect)") + "\n";
     strUsage += "  -maxconnections=<n>    " + strprintf(_("Maintain at most <n> connections to peers (default: %u)"), 125) + "\n";
     strUsage += "  -maxreceivebuffer=<n>  " + strprintf(_("Maximum per-connection receive buffer, <n>*1000 bytes (default: %u)"), 5000) + "\n";
     strUsage += "  -maxsendbuffer=<n>     " + strprintf(_("Maximum per-connection send buffer, <n>*1000 bytes (default: %u)"), 1000) + "\n";
+    strUsage += "  -msghandlers=<n>       " + strprintf(_("Number of threads processing peer messages, each peer is handled by one of them (1 to %d, default: %d)"), MAX_MESSAGE_HANDLER_THREADS, DEFAULT_MESSAGE_HANDLER_THREADS) + "\n";
     strUsage += "  -onion=<ip:port>       " + strprintf(_("Use separate SOCKS5 proxy to reach peers via Tor hidden services (default: %s)"), "-proxy") + "\n";
     strUsage += "  -onlynet=<net>         " + _("Only connect to nodes in network <net> (ipv4, ipv6, onion, tor or i2p). Cumulative is allowed eg: onlynet=i2p onlynet=tor turn into darknet only mode.") + "\n";
     strUsage += "  -port=<port>           " + strprintf(_("Listen for connections on <port> (default: %u or testnet: %u)"), 9377, 19377) + "\n";
@@ -341,6 +349,7 @@ std::string HelpMessage(HelpMessageMode hmm)
     strUsage += "  -maxtxfee=<amt>        " + strprintf(_("Maximum total fees to use in a single wallet transaction, setting too low may abort large transactions (default: %s)"), FormatMoney(maxTxFee)) + "\n";
     strUsage += "  -upgradewallet         " + _("Upgrade wallet to latest format") + " " + _("on startup") + "\n";
     strUsage += "  -wallet=<file>         " + _("Specify wallet file (within data directory)") + " " + strprintf(_("(default: %s)"), "wallet.dat") + "\n";
+    strUsage += "  -walletdurability=<n>  " + strprintf(_("Wallet database commits: 0 = kept in memory until the next flush, 1 = written to the log, 2 = log synced to disk (default: %u)"), DEFAULT_WALLET_DURABILITY) + "\n";
     strUsage += "  -walletnotify=<cmd>    " + _("Execute command when a wallet transaction changes (%s in cmd is replaced by TxID)") + "\n";
     strUsage += "  -zapwallettxes         " + _("Clear list of wallet transactions (diagnostic tool; implies -rescan)") + "\n";
 #endif
@@ -428,6 +437,9 @@ std::string HelpMessage(HelpMessageMode hmm)
     strUsage += "  -i2p.options.samhost=<ip or host name>          " + _("Address of the SAM bridge host. If it is not specified, value will be \"127.0.0.1\".") + "\n";
     strUsage += "  -i2p.options.samport=<port>                     " + _("Port number of the SAM bridge host. If it is not specified, value will be \"7656\".") + "\n";
     strUsage += "  -i2p.options.sessionname=<session name>         " + _("Name of an I2P session. If it is not specified, value will be \"Anoncoin-client\"") + "\n";
+    strUsage += "  -i2p.options.connectpool=<n>                    " + strprintf(_("Number of handshaken SAM sockets kept ready, also the number of I2P peers connected to at once (default: %u)"), 4) + "\n";
+    strUsage += "  -i2p.options.connecttimeout=<n>                 " + strprintf(_("Seconds to wait for a stream to an I2P peer (default: %u)"), 60) + "\n";
+    strUsage += "  -i2p.options.acceptpool=<n>                     " + strprintf(_("Number of STREAM ACCEPTs kept armed for incoming I2P peers (default: %u)"), 4) + "\n";
 
     return strUsage;
 }
@@ -843,6 +855,12 @@ bool AppInit2(boost::thread_group& threadGroup)
     if (nScriptCheckThreads) {
         for (int i=0; i<nScriptCheckThreads-1; i++)
             threadGroup.create_thread(&ThreadScriptCheck);
+        for (int i=0; i<nScriptCheckThreads-1; i++)
+            threadGroup.create_thread(&ThreadHeaderHashCheck);
+        //! Building the address index from scratch gets its own set of workers
+        if (GetBoolArg("-addrindex", false) && GetBoolArg("-reindex", false))
+            for (int i=0; i<nScriptCheckThreads-1; i++)
+                threadGroup.create_thread(&ThreadAddrIndexCheck);
     }
 
     /**
@@ -1402,6 +1420,12 @@ bool AppInit2(boost::thread_group& threadGroup)
                 if (fReindex)
                     pblocktree->WriteReindexing(true);
 
+                // A coins snapshot load that did not finish leaves a partial chainstate behind
+                if (pcoinsdbview->IsLoadingSnapshot()) {
+                    strLoadError = _("The loading of a coins snapshot was interrupted");
+                    break;
+                }
+
                 if (!LoadBlockIndex()) {
                     strLoadError = _("Error loading block database");
                     break;
@@ -1424,6 +1448,12 @@ bool AppInit2(boost::thread_group& threadGroup)
                     break;
                 }
 
+                // Check for changed -addrindex state
+                if (fAddrIndex != GetBoolArg("-addrindex", false)) {
+                    strLoadError = _("You need to rebuild the database using -reindex to change -addrindex");
+                    break;
+                }
+
                 uiInterface.InitMessage(_("Verifying latest blocks..."));
                 if (!VerifyDB(GetArg("-checklevel", 3),
                               GetArg("-checkblocks", 980))) {
@@ -1636,6 +1666,12 @@ bool AppInit2(boost::thread_group& threadGroup)
                         copyTo->WriteToDisk(&walletdb);
                     }
                 }
+
+                // wtxOrdered is still keyed by the order positions the rescan gave out
+                {
+                    LOCK2(cs_main, pwalletMain->cs_wallet);
+                    pwalletMain->RebuildTxIndex();
+                }
             }
         }
     } // (!fDisableWallet)
@@ -28,14 +28,34 @@ void HandleError(const leveldb::Status& status) throw(leveldb_error)
     throw leveldb_error("Unknown database error");
 }
 
-static leveldb::Options GetOptions(size_t nCacheSize)
+CCriticalSection cs_mapLevelDB;
+std::map<std::string, CLevelDBWrapper*> mapLevelDB;
+
+//! A write taking longer than this has almost certainly been held up by compaction
+static const int64_t LEVELDB_SLOW_WRITE_MICROS = 100000;
+
+//! Fetch a per-database tuning option, -<name>.<option> (ie -chainstate.bloombits), when the database has a name
+static int64_t GetLevelDBArg(const std::string& strName, const std::string& strOption, int64_t nDefault)
+{
+    if (strName.empty())
+        return nDefault;
+    return GetArg("-" + strName + "." + strOption, nDefault);
+}
+
+static leveldb::Options GetLevelDBOptions(size_t nCacheSize, const std::string& strName)
 {
     leveldb::Options options;
     options.block_cache = leveldb::NewLRUCache(nCacheSize / 2);
-    options.write_buffer_size = nCacheSize / 4; // up to two write buffers may be held in memory simultaneously
-    options.filter_policy = leveldb::NewBloomFilterPolicy(10);
-    options.compression = leveldb::kNoCompression;
-    options.max_open_files = 64;
+    int64_t nWriteBufferMiB = GetLevelDBArg(strName, "writebuffer", 0);
+    if (nWriteBufferMiB > 0)
+        options.write_buffer_size = nWriteBufferMiB << 20;
+    else
+        options.write_buffer_size = nCacheSize / 4; // up to two write buffers may be held in memory simultaneously
+    options.block_size = std::max((int64_t)1, GetLevelDBArg(strName, "blocksize", 4)) << 10;
+    int nBloomBits = GetLevelDBArg(strName, "bloombits", 10);
+    options.filter_policy = nBloomBits > 0 ? leveldb::NewBloomFilterPolicy(nBloomBits) : NULL;
+    options.compression = GetLevelDBArg(strName, "compression", 0) ? leveldb::kSnappyCompression : leveldb::kNoCompression;
+    options.max_open_files = std::max((int64_t)16, GetLevelDBArg(strName, "maxopenfiles", 64));
     if (leveldb::kMajorVersion > 1 || (leveldb::kMajorVersion == 1 && leveldb::kMinorVersion >= 16)) {
         // LevelDB versions before 1.16 consider short writes to be corruption. Only trigger error
         // on corruption in later versions.
@@ -44,14 +64,14 @@ static leveldb::Options GetOptions(size_t nCacheSize)
     return options;
 }
 
-CLevelDBWrapper::CLevelDBWrapper(const boost::filesystem::path& path, size_t nCacheSize, bool fMemory, bool fWipe)
+CLevelDBWrapper::CLevelDBWrapper(const boost::filesystem::path& path, size_t nCacheSize, bool fMemory, bool fWipe, const std::string& strNameIn) : strName(strNameIn)
 {
     penv = NULL;
     readoptions.verify_checksums = true;
     iteroptions.verify_checksums = true;
     iteroptions.fill_cache = false;
     syncoptions.sync = true;
-    options = GetOptions(nCacheSize);
+    options = GetLevelDBOptions(nCacheSize, strName);
     options.create_if_missing = true;
     if (fMemory) {
         penv = leveldb::NewMemEnv(leveldb::Env::Default());
@@ -67,10 +87,24 @@ CLevelDBWrapper::CLevelDBWrapper(const boost::filesystem::path& path, size_t nCa
     leveldb::Status status = leveldb::DB::Open(options, path.string(), &pdb);
     HandleError(status);
     LogPrintf("Opened LevelDB successfully\n");
+    if (!strName.empty()) {
+        LogPrint("leveldb", "LevelDB %s options: block size %u, bloom bits %d, write buffer %u, max open files %d, compression %d\n",
+                 strName, options.block_size, GetLevelDBArg(strName, "bloombits", 10), options.write_buffer_size,
+                 options.max_open_files, options.compression != leveldb::kNoCompression);
+        if (!fMemory) {
+            LOCK(cs_mapLevelDB);
+            mapLevelDB[strName] = this;
+        }
+    }
 }
 
 CLevelDBWrapper::~CLevelDBWrapper()
 {
+    if (!strName.empty()) {
+        LOCK(cs_mapLevelDB);
+        if (mapLevelDB.count(strName) && mapLevelDB[strName] == this)
+            mapLevelDB.erase(strName);
+    }
     delete pdb;
     pdb = NULL;
     delete options.filter_policy;
@@ -83,7 +117,39 @@ CLevelDBWrapper::~CLevelDBWrapper()
 
 bool CLevelDBWrapper::WriteBatch(CLevelDBBatch& batch, bool fSync) throw(leveldb_error)
 {
+    int64_t nStart = GetTimeMicros();
     leveldb::Status status = pdb->Write(fSync ? syncoptions : writeoptions, &batch.batch);
+    int64_t nElapsed = GetTimeMicros() - nStart;
+    {
+        LOCK(cs_stats);
+        stats.nWrites++;
+        stats.nWriteBytes += batch.SizeEstimate();
+        stats.nWriteMicros += nElapsed;
+        stats.nMaxWriteMicros = std::max(stats.nMaxWriteMicros, nElapsed);
+        if (nElapsed > LEVELDB_SLOW_WRITE_MICROS)
+            stats.nSlowWrites++;
+    }
+    if (nElapsed > LEVELDB_SLOW_WRITE_MICROS)
+        LogPrint("leveldb", "LevelDB %s write of %u bytes stalled for %.2fms\n", strName, batch.SizeEstimate(), 0.001 * nElapsed);
     HandleError(status);
     return true;
 }
+
+bool CLevelDBWrapper::GetProperty(const std::string& strProperty, std::string& strValue) const
+{
+    return pdb->GetProperty(strProperty, &strValue);
+}
+
+void CLevelDBWrapper::Compact()
+{
+    LogPrintf("Compacting LevelDB %s...\n", strName);
+    int64_t nStart = GetTimeMicros();
+    pdb->CompactRange(NULL, NULL);
+    int64_t nElapsed = GetTimeMicros() - nStart;
+    {
+        LOCK(cs_stats);
+        stats.nCompactions++;
+        stats.nCompactionMicros += nElapsed;
+    }
+    LogPrintf("Compacted LevelDB %s in %.2fs\n", strName, 0.000001 * nElapsed);
+}
@@ -9,9 +9,13 @@
 #include "clientversion.h"
 #include "serialize.h"
 #include "streams.h"
+#include "sync.h"
 #include "util.h"
 #include "version.h"
 
+#include <map>
+#include <string>
+
 #include <boost/filesystem/path.hpp>
 
 #include <leveldb/db.h>
@@ -25,6 +29,31 @@ public:
 
 void HandleError(const leveldb::Status& status) throw(leveldb_error);
 
+class CLevelDBWrapper;
+
+//! Open databases which have a name, by that name ("chainstate", "blockindex"), for the RPC stats and compaction calls
+extern CCriticalSection cs_mapLevelDB;
+extern std::map<std::string, CLevelDBWrapper*> mapLevelDB;
+
+/** Read, write and compaction counters kept by each CLevelDBWrapper */
+struct CLevelDBStats
+{
+    uint64_t nReads;
+    uint64_t nReadMisses;
+    uint64_t nReadBytes;
+    uint64_t nWrites;
+    uint64_t nWriteBytes;
+    //! Time spent inside LevelDB writes, long writes are stalls waiting on background compaction
+    int64_t nWriteMicros;
+    int64_t nMaxWriteMicros;
+    uint64_t nSlowWrites;
+    uint64_t nCompactions;
+    int64_t nCompactionMicros;
+
+    CLevelDBStats() : nReads(0), nReadMisses(0), nReadBytes(0), nWrites(0), nWriteBytes(0), nWriteMicros(0),
+                      nMaxWriteMicros(0), nSlowWrites(0), nCompactions(0), nCompactionMicros(0) {}
+};
+
 /** Batch of changes queued to be written to a CLevelDBWrapper */
 class CLevelDBBatch
 {
@@ -32,8 +61,14 @@ class CLevelDBBatch
 
 private:
     leveldb::WriteBatch batch;
+    size_t nSize;
 
 public:
+    CLevelDBBatch() : nSize(0) {}
+
+    //! Serialized size of the keys and values written so far
+    size_t SizeEstimate() const { return nSize; }
+
     template <typename K, typename V>
     void Write(const K& key, const V& value)
     {
@@ -48,6 +83,7 @@ public:
         leveldb::Slice slValue(&ssValue[0], ssValue.size());
 
         batch.Put(slKey, slValue);
+        nSize += ssKey.size() + ssValue.size();
     }
 
     template <typename K>
@@ -59,6 +95,7 @@ public:
         leveldb::Slice slKey(&ssKey[0], ssKey.size());
 
         batch.Delete(slKey);
+        nSize += ssKey.size();
     }
 };
 
@@ -86,8 +123,25 @@ private:
     //! the database itself
     leveldb::DB* pdb;
 
+    //! name the database is registered under in mapLevelDB, and its tuning options are read for
+    std::string strName;
+
+    //! usage counters, kept for the getdbstats rpc call
+    mutable CCriticalSection cs_stats;
+    mutable CLevelDBStats stats;
+
+    void RecordRead(size_t nBytes, bool fFound) const
+    {
+        LOCK(cs_stats);
+        stats.nReads++;
+        if (fFound)
+            stats.nReadBytes += nBytes;
+        else
+            stats.nReadMisses++;
+    }
+
 public:
-    CLevelDBWrapper(const boost::filesystem::path& path, size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+    CLevelDBWrapper(const boost::filesystem::path& path, size_t nCacheSize, bool fMemory = false, bool fWipe = false, const std::string& strNameIn = "");
     ~CLevelDBWrapper();
 
     template <typename K, typename V>
@@ -101,11 +155,14 @@ public:
         std::string strValue;
         leveldb::Status status = pdb->Get(readoptions, slKey, &strValue);
         if (!status.ok()) {
-            if (status.IsNotFound())
+            if (status.IsNotFound()) {
+                RecordRead(0, false);
                 return false;
+            }
             LogPrintf("LevelDB read failure: %s\n", status.ToString());
             HandleError(status);
         }
+        RecordRead(strValue.size(), true);
         try {
             CDataStream ssValue(strValue.data(), strValue.data() + strValue.size(), SER_DISK, CLIENT_VERSION);
             ssValue >> value;
@@ -134,11 +191,14 @@ public:
         std::string strValue;
         leveldb::Status status = pdb->Get(readoptions, slKey, &strValue);
         if (!status.ok()) {
-            if (status.IsNotFound())
+            if (status.IsNotFound()) {
+                RecordRead(0, false);
                 return false;
+            }
             LogPrintf("LevelDB read failure: %s\n", status.ToString());
             HandleError(status);
         }
+        RecordRead(strValue.size(), true);
         return true;
     }
 
@@ -169,6 +229,18 @@ public:
     {
         return pdb->NewIterator(iteroptions);
     }
+
+    const std::string& GetName() const { return strName; }
+    const leveldb::Options& GetOptions() const { return options; }
+    CLevelDBStats GetStats() const
+    {
+        LOCK(cs_stats);
+        return stats;
+    }
+    //! Query a LevelDB property such as "leveldb.stats" or "leveldb.num-files-at-level0"
+    bool GetProperty(const std::string& strProperty, std::string& strValue) const;
+    //! Compact the whole key range, this blocks until LevelDB has finished
+    void Compact();
 };
 
 #endif // ANONCOIN_LEVELDBWRAPPER_H
@@ -130,6 +130,7 @@ CCriticalSection cs_main;
 BlockMap mapBlockIndex;
 CChain chainActive;
 CBlockIndex *pindexBestHeader = NULL;
+CBlockIndex *pindexSnapshotBase = NULL;
 int64_t nTimeBestReceived = 0;
 CWaitableCriticalSection csBestBlock;
 CConditionVariable cvBlockChange;
@@ -138,6 +139,7 @@ int nScriptCheckThreads = 0;
 bool fImporting = false;
 bool fReindex = false;
 bool fTxIndex = false;
+bool fAddrIndex = false;
 bool fIsBareMultisigStd = true;
 bool fCheckBlockIndex = false;
 uint32_t nCoinCacheSize = 5000;
@@ -279,6 +281,8 @@ CMainSignals& GetMainSignals() { return g_signals; }
 
 void RegisterValidationInterface(CValidationInterface* pInterfaceIn) {
     g_signals.SyncTransaction.connect(boost::bind(&CValidationInterface::SyncTransaction, pInterfaceIn, _1, _2));
+    g_signals.BeginSyncBatch.connect(boost::bind(&CValidationInterface::BeginSyncBatch, pInterfaceIn));
+    g_signals.EndSyncBatch.connect(boost::bind(&CValidationInterface::EndSyncBatch, pInterfaceIn));
     g_signals.UpdatedTransaction.connect(boost::bind(&CValidationInterface::UpdatedTransaction, pInterfaceIn, _1));
     g_signals.SetBestChain.connect(boost::bind(&CValidationInterface::SetBestChain, pInterfaceIn, _1));
     g_signals.Inventory.connect(boost::bind(&CValidationInterface::Inventory, pInterfaceIn, _1));
@@ -296,6 +300,8 @@ void UnregisterValidationInterface(CValidationInterface* pInterfaceIn) {
     g_signals.Inventory.disconnect(boost::bind(&CValidationInterface::Inventory, pInterfaceIn, _1));
     g_signals.SetBestChain.disconnect(boost::bind(&CValidationInterface::SetBestChain, pInterfaceIn, _1));
     g_signals.UpdatedTransaction.disconnect(boost::bind(&CValidationInterface::UpdatedTransaction, pInterfaceIn, _1));
+    g_signals.EndSyncBatch.disconnect(boost::bind(&CValidationInterface::EndSyncBatch, pInterfaceIn));
+    g_signals.BeginSyncBatch.disconnect(boost::bind(&CValidationInterface::BeginSyncBatch, pInterfaceIn));
     g_signals.SyncTransaction.disconnect(boost::bind(&CValidationInterface::SyncTransaction, pInterfaceIn, _1, _2));
 }
 
@@ -308,12 +314,22 @@ void UnregisterAllValidationInterfaces() {
     g_signals.SetBestChain.disconnect_all_slots();
     g_signals.UpdatedTransaction.disconnect_all_slots();
     g_signals.SyncTransaction.disconnect_all_slots();
+    g_signals.BeginSyncBatch.disconnect_all_slots();
+    g_signals.EndSyncBatch.disconnect_all_slots();
 }
 
 void SyncWithWallets(const CTransaction &tx, const CBlock *pblock) {
     g_signals.SyncTransaction(tx, pblock);
 }
 
+/** Brackets the wallet notifications for one block, see CMainSignals::BeginSyncBatch */
+class CSyncBatchScope
+{
+public:
+    CSyncBatchScope() { g_signals.BeginSyncBatch(); }
+    ~CSyncBatchScope() { g_signals.EndSyncBatch(); }
+};
+
 //////////////////////////////////////////////////////////////////////////////
 //
 // Registration of network node signals.
@@ -465,7 +481,7 @@ void ProcessBlockAvailability(NodeId nodeid) {
     if (!state->hashLastUnknownBlock.IsNull()) {
         uint256 aRealHash = state->hashLastUnknownBlock.GetRealHash();
         BlockMap::iterator itOld = (aRealHash != 0) ? mapBlockIndex.find(aRealHash) : mapBlockIndex.end();
-        if (itOld != mapBlockIndex.end() && itOld->second->nChainWork > 0) {
+        if (itOld != mapBlockIndex.end() && !itOld->second->nChainWork.IsNull()) {
             if (state->pindexBestKnownBlock == NULL || itOld->second->nChainWork >= state->pindexBestKnownBlock->nChainWork)
                 state->pindexBestKnownBlock = itOld->second;
             state->hashLastUnknownBlock.SetNull();
@@ -481,7 +497,7 @@ void UpdateBlockAvailability(NodeId nodeid, const uintFakeHash &hash) {
     ProcessBlockAvailability(nodeid);
     uint256 aRealHash = hash.GetRealHash();
     BlockMap::iterator it = ( aRealHash != 0 ) ? mapBlockIndex.find( aRealHash ) : mapBlockIndex.end();
-    if (it != mapBlockIndex.end() && it->second->nChainWork > 0) {
+    if (it != mapBlockIndex.end() && !it->second->nChainWork.IsNull()) {
         // An actually better block was announced.
         if (state->pindexBestKnownBlock == NULL || it->second->nChainWork >= state->pindexBestKnownBlock->nChainWork)
             state->pindexBestKnownBlock = it->second;
@@ -1400,7 +1416,7 @@ void CheckForkWarningConditions()
     if (pindexBestForkTip && chainActive.Height() - pindexBestForkTip->nHeight >= 240)
         pindexBestForkTip = NULL;
 
-    if (pindexBestForkTip || (pindexBestInvalid && pindexBestInvalid->nChainWork > chainActive.Tip()->nChainWork + (GetBlockProof(*chainActive.Tip()) * 6)))
+    if (pindexBestForkTip || (pindexBestInvalid && pindexBestInvalid->nChainWork.GetWork() > chainActive.Tip()->nChainWork.GetWork() + (GetBlockProof(*chainActive.Tip()) * 6)))
     {
         if (!fLargeWorkForkFound && pindexBestForkBase)
         {
@@ -1452,7 +1468,7 @@ void CheckForkWarningConditionsOnNewFork(CBlockIndex* pindexNewForkTip)
     // the 20-block condition and from this always have the most-likely-to-cause-warning fork
     // ToDo: Note to team--> GR Adjusted values based on Anoncoin 3min target time, although setting 20 blocks was arbitrary
     if (pfork && (!pindexBestForkTip || (pindexBestForkTip && pindexNewForkTip->nHeight > pindexBestForkTip->nHeight)) &&
-            pindexNewForkTip->nChainWork - pfork->nChainWork > (GetBlockProof(*pfork) * 20) &&
+            pindexNewForkTip->nChainWork.GetWork() - pfork->nChainWork.GetWork() > (GetBlockProof(*pfork) * 20) &&
             chainActive.Height() - pindexNewForkTip->nHeight < 240)
     {
         pindexBestForkTip = pindexNewForkTip;
@@ -1468,6 +1484,8 @@ void Misbehaving(NodeId pnode, int howmuch)
     if (howmuch == 0)
         return;
 
+    //! Message handler threads call this for messages they process without holding cs_main
+    LOCK(cs_main);
     CNodeState *state = State(pnode);
     if (state == NULL)
         return;
@@ -1489,10 +1507,10 @@ void static InvalidChainFound(CBlockIndex* pindexNew)
 
     LogPrintf("InvalidChainFound: invalid block=%s  height=%d  log2_work=%.8g  date=%s\n",
       pindexNew->GetBlockHash().ToString(), pindexNew->nHeight,
-      GetLog2Work(pindexNew->nChainWork), DateTimeStrFormat("%Y-%m-%d %H:%M:%S",
+      GetLog2Work(pindexNew->nChainWork.GetWork()), DateTimeStrFormat("%Y-%m-%d %H:%M:%S",
       pindexNew->GetBlockTime()));
     LogPrintf("InvalidChainFound:  current best=%s  height=%d  log2_work=%.8g  date=%s\n",
-      chainActive.Tip()->GetBlockHash().ToString(), chainActive.Height(), GetLog2Work(chainActive.Tip()->nChainWork),
+      chainActive.Tip()->GetBlockHash().ToString(), chainActive.Height(), GetLog2Work(chainActive.Tip()->nChainWork.GetWork()),
       DateTimeStrFormat("%Y-%m-%d %H:%M:%S", chainActive.Tip()->GetBlockTime()));
     CheckForkWarningConditions();
 }
@@ -1669,7 +1687,19 @@ bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsVi
 
 
 
-bool DisconnectBlock(CBlock& block, CValidationState& state, CBlockIndex* pindex, CCoinsViewCache& view, bool* pfClean)
+void GetAddrIndexEntries(const CTransaction& tx, int nHeight, std::vector<std::pair<CAddrIndexKey, CAddrIndexValue> >& vEntries)
+{
+    const uint256& hash = tx.GetHash();
+    for (unsigned int i = 0; i < tx.vout.size(); i++) {
+        const CTxOut& out = tx.vout[i];
+        if (out.scriptPubKey.IsUnspendable())
+            continue;
+        uint160 hashScript = Hash160(out.scriptPubKey.begin(), out.scriptPubKey.end());
+        vEntries.push_back(std::make_pair(CAddrIndexKey(hashScript, hash, i), CAddrIndexValue(nHeight, out.nValue)));
+    }
+}
+
+bool DisconnectBlock(CBlock& block, CValidationState& state, CBlockIndex* pindex, CCoinsViewCache& view, bool* pfClean, bool fJustCheck)
 {
     assert(pindex->GetBlockHash() == view.GetBestBlock());
 
@@ -1745,6 +1775,19 @@ bool DisconnectBlock(CBlock& block, CValidationState& state, CBlockIndex* pindex
         }
     }
 
+    // remove the outputs this block created from the address index
+    if (fAddrIndex && !fJustCheck) {
+        std::vector<std::pair<CAddrIndexKey, CAddrIndexValue> > vEntries;
+        BOOST_FOREACH(const CTransaction& tx, block.vtx)
+            GetAddrIndexEntries(tx, pindex->nHeight, vEntries);
+        std::vector<CAddrIndexKey> vKeys;
+        vKeys.reserve(vEntries.size());
+        for (unsigned int i = 0; i < vEntries.size(); i++)
+            vKeys.push_back(vEntries[i].first);
+        if (!pblocktree->EraseAddrIndex(vKeys))
+            return state.Abort(_("Failed to erase address index"));
+    }
+
     // move best block pointer to prevout block
     view.SetBestBlock(pindex->pprev->GetBlockHash());
 
@@ -1788,6 +1831,45 @@ void ThreadScriptCheck() {
     scriptcheckqueue.Thread();
 }
 
+//! While reindexing, the address index entries of a block are hashed on these workers, in parallel with connecting its inputs
+static CCheckQueue<CAddrIndexCheck> addrindexqueue(128);
+
+void ThreadAddrIndexCheck() {
+    RenameThread("anoncoin-addridx");
+    addrindexqueue.Thread();
+}
+
+//! Scrypt dominates header sync, so the headers of a message are hashed on these workers. The queue assumes a
+//! single master thread, the mutex serializes callers.
+static CCheckQueue<CHeaderHashCheck> headerhashqueue(16);
+static boost::mutex csHeaderHashQueue;
+
+void ThreadHeaderHashCheck() {
+    RenameThread("anoncoin-hdrhash");
+    headerhashqueue.Thread();
+}
+
+void HashBlockHeaders(const std::vector<CBlockHeader>& vHeaders)
+{
+    if (vHeaders.empty())
+        return;
+    if (!nScriptCheckThreads) {
+        BOOST_FOREACH(const CBlockHeader& header, vHeaders) {
+            header.GetHash();
+            header.CalcSha256dHash();
+        }
+        return;
+    }
+    boost::unique_lock<boost::mutex> lock(csHeaderHashQueue);
+    CCheckQueueControl<CHeaderHashCheck> control(&headerhashqueue);
+    std::vector<CHeaderHashCheck> vChecks;
+    vChecks.reserve(vHeaders.size());
+    BOOST_FOREACH(const CBlockHeader& header, vHeaders)
+        vChecks.push_back(CHeaderHashCheck(header));
+    control.Add(vChecks);
+    control.Wait();
+}
+
 static int64_t nTimeVerify = 0;
 static int64_t nTimeConnect = 0;
 static int64_t nTimeIndex = 0;
@@ -1866,6 +1948,19 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
 
     CCheckQueueControl<CScriptCheck> control(fScriptChecks && nScriptCheckThreads ? &scriptcheckqueue : NULL);
 
+    //! The address index only depends on the outputs, so when reindexing it is queued up front and built while the inputs are connected
+    std::vector<std::vector<std::pair<CAddrIndexKey, CAddrIndexValue> > > vAddrEntries;
+    bool fAddrIndexQueue = fAddrIndex && !fJustCheck && fReindex && nScriptCheckThreads;
+    CCheckQueueControl<CAddrIndexCheck> addrcontrol(fAddrIndexQueue ? &addrindexqueue : NULL);
+    if (fAddrIndexQueue) {
+        vAddrEntries.resize(block.vtx.size());
+        std::vector<CAddrIndexCheck> vAddrChecks;
+        vAddrChecks.reserve(block.vtx.size());
+        for (unsigned int i = 0; i < block.vtx.size(); i++)
+            vAddrChecks.push_back(CAddrIndexCheck(block.vtx[i], pindex->nHeight, &vAddrEntries[i]));
+        addrcontrol.Add(vAddrChecks);
+    }
+
     int64_t nTimeStart = GetTimeMicros();
     int64_t nFees = 0;
     int nInputs = 0;
@@ -1954,10 +2049,25 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
         setDirtyBlockIndex.insert(pindex);
     }
 
+    //! Index entries are only queued here, they reach the disk with the next FlushStateToDisk()
     if (fTxIndex)
         if (!pblocktree->WriteTxIndex(vPos))
             return state.Abort(_("Failed to write transaction index"));
 
+    if (fAddrIndex) {
+        std::vector<std::pair<CAddrIndexKey, CAddrIndexValue> > vEntries;
+        if (fAddrIndexQueue) {
+            addrcontrol.Wait();
+            for (unsigned int i = 0; i < vAddrEntries.size(); i++)
+                vEntries.insert(vEntries.end(), vAddrEntries[i].begin(), vAddrEntries[i].end());
+        } else {
+            BOOST_FOREACH(const CTransaction& tx, block.vtx)
+                GetAddrIndexEntries(tx, pindex->nHeight, vEntries);
+        }
+        if (!pblocktree->WriteAddrIndex(vEntries))
+            return state.Abort(_("Failed to write address index"));
+    }
+
     // add this block to the view's block chain
     view.SetBestBlock(pindex->GetBlockHash());
 
@@ -2000,7 +2110,7 @@ bool static FlushStateToDisk(CValidationState &state, FlushStateMode mode) {
     static int64_t nLastWrite = 0;
     try {
     if ((mode == FLUSH_STATE_ALWAYS) ||
-        ((mode == FLUSH_STATE_PERIODIC || mode == FLUSH_STATE_IF_NEEDED) && pcoinsTip->GetCacheSize() > nCoinCacheSize) ||
+        ((mode == FLUSH_STATE_PERIODIC || mode == FLUSH_STATE_IF_NEEDED) && pcoinsTip->GetCacheSize() + pblocktree->GetPendingIndexSize() > nCoinCacheSize) ||
         (mode == FLUSH_STATE_PERIODIC && GetTimeMicros() > nLastWrite + DATABASE_WRITE_INTERVAL * 1000000)) {
         // Typical CCoins structures on disk are around 100 bytes in size.
         // Pushing a new one to the database can cause it to be written
@@ -2029,6 +2139,10 @@ bool static FlushStateToDisk(CValidationState &state, FlushStateMode mode) {
              }
              setDirtyBlockIndex.erase(it++);
         }
+        // The transaction and address index entries queued by ConnectBlock go out in one batch, before the
+        // chainstate which depends on them, a crash in between just means those blocks are connected again.
+        if (!pblocktree->FlushPendingIndex())
+            return state.Abort("Failed to write to block index");
         pblocktree->Sync();
         // Finally flush the chainstate (which may refer to block index entries).
         if (!pcoinsTip->Flush())
@@ -2070,7 +2184,7 @@ void static UpdateTip(CBlockIndex *pindexNew) {
     // Limit the log output allot with this if your initializing the blockchain
     if( !nReportInterval || chainActive.Height() % nReportInterval == 0 )
         LogPrintf("UpdateTip: new best=%s  height=%d  log2_work=%.8g  tx=%lu  date=%s progress=%f  cache=%u\n",
-          chainActive.Tip()->GetBlockHash().ToString(), chainActive.Height(), GetLog2Work(chainActive.Tip()->nChainWork), (unsigned long)chainActive.Tip()->nChainTx,
+          chainActive.Tip()->GetBlockHash().ToString(), chainActive.Height(), GetLog2Work(chainActive.Tip()->nChainWork.GetWork()), (unsigned long)chainActive.Tip()->nChainTx,
           DateTimeStrFormat("%Y-%m-%d %H:%M:%S", chainActive.Tip()->GetBlockTime()),
           Checkpoints::GuessVerificationProgress(chainActive.Tip()), (unsigned int)pcoinsTip->GetCacheSize());
 
@@ -2106,6 +2220,9 @@ void static UpdateTip(CBlockIndex *pindexNew) {
 bool static DisconnectTip(CValidationState &state) {
     CBlockIndex *pindexDelete = chainActive.Tip();
     assert(pindexDelete);
+    if (pindexSnapshotBase && pindexDelete->nHeight <= pindexSnapshotBase->nHeight)
+        return error("DisconnectTip() : block %s at height %d is part of the chainstate loaded from a UTXO snapshot at height %d, it can not be disconnected",
+                     pindexDelete->GetBlockHash().ToString(), pindexDelete->nHeight, pindexSnapshotBase->nHeight);
     mempool.check(pcoinsTip);
     // Read block from disk.
     CBlock block;
@@ -2137,6 +2254,7 @@ bool static DisconnectTip(CValidationState &state) {
     UpdateTip(pindexDelete->pprev);
     // Let wallets know transactions went from 1-confirmed to
     // 0-confirmed or conflicted:
+    CSyncBatchScope syncBatch;
     BOOST_FOREACH(const CTransaction &tx, block.vtx) {
         SyncWithWallets(tx, NULL);
     }
@@ -2205,6 +2323,7 @@ bool static ConnectTip(CValidationState &state, CBlockIndex *pindexNew, CBlock *
 
     // Tell wallet about transactions that went from mempool
     // to conflicted:
+    CSyncBatchScope syncBatch;
     BOOST_FOREACH(const CTransaction &tx, txConflicted) {
         SyncWithWallets(tx, NULL);
     }
@@ -2396,6 +2515,73 @@ bool ActivateBestChain(CValidationState &state, CBlock *pblock) {
     return true;
 }
 
+bool ActivateCoinsSnapshot(CBlockIndex *pindex) {
+    AssertLockHeld(cs_main);
+
+    //! The blocks between the old tip and the snapshot are assumed valid, like the coins they produced. Those
+    //! we have no data for get a placeholder transaction count, so the blocks after them can still be linked.
+    std::vector<CBlockIndex*> vAssumed;
+    for (CBlockIndex *pindexWalk = pindex; pindexWalk && !chainActive.Contains(pindexWalk); pindexWalk = pindexWalk->pprev)
+        vAssumed.push_back(pindexWalk);
+    deque<CBlockIndex*> queue;
+    BOOST_REVERSE_FOREACH(CBlockIndex *pindexWalk, vAssumed) {
+        if (pindexWalk->nTx == 0)
+            pindexWalk->nTx = 1;
+        pindexWalk->nChainTx = (pindexWalk->pprev ? pindexWalk->pprev->nChainTx : 0) + pindexWalk->nTx;
+        pindexWalk->RaiseValidity(BLOCK_VALID_SCRIPTS);
+        setDirtyBlockIndex.insert(pindexWalk);
+        //! Blocks with data that were waiting on this one, pindexWalk itself included, are linked now
+        std::pair<std::multimap<CBlockIndex*, CBlockIndex*>::iterator, std::multimap<CBlockIndex*, CBlockIndex*>::iterator> range = mapBlocksUnlinked.equal_range(pindexWalk->pprev);
+        while (range.first != range.second) {
+            std::multimap<CBlockIndex*, CBlockIndex*>::iterator it = range.first++;
+            if (it->second != pindexWalk)
+                queue.push_back(it->second);
+            mapBlocksUnlinked.erase(it);
+        }
+    }
+    std::pair<std::multimap<CBlockIndex*, CBlockIndex*>::iterator, std::multimap<CBlockIndex*, CBlockIndex*>::iterator> rangeTip = mapBlocksUnlinked.equal_range(pindex);
+    while (rangeTip.first != rangeTip.second) {
+        queue.push_back(rangeTip.first->second);
+        mapBlocksUnlinked.erase(rangeTip.first++);
+    }
+
+    //! Persist the base before the tip moves past blocks without undo data
+    if (!pblocktree->WriteSnapshotBase(pindex->GetBlockHash()))
+        return error("%s : Failed to record the snapshot base", __func__);
+    pindexSnapshotBase = pindex;
+
+    //! The coins cache was flushed and is empty, it only needs to learn the new best block
+    pcoinsTip->SetBestBlock(pindex->GetBlockHash());
+    //! Transactions in the pool were checked against the old tip
+    mempool.clear();
+    UpdateTip(pindex);
+    setBlockIndexCandidates.insert(pindex);
+
+    //! Same as in ReceivedBlockTransactions(), for the descendants that can be connected now
+    while (!queue.empty()) {
+        CBlockIndex *pindexLinked = queue.front();
+        queue.pop_front();
+        pindexLinked->nChainTx = pindexLinked->pprev->nChainTx + pindexLinked->nTx;
+        {
+            LOCK(cs_nBlockSequenceId);
+            pindexLinked->nSequenceId = nBlockSequenceId++;
+        }
+        if (!setBlockIndexCandidates.value_comp()(pindexLinked, chainActive.Tip()))
+            setBlockIndexCandidates.insert(pindexLinked);
+        std::pair<std::multimap<CBlockIndex*, CBlockIndex*>::iterator, std::multimap<CBlockIndex*, CBlockIndex*>::iterator> range = mapBlocksUnlinked.equal_range(pindexLinked);
+        while (range.first != range.second) {
+            queue.push_back(range.first->second);
+            mapBlocksUnlinked.erase(range.first++);
+        }
+    }
+    PruneBlockIndexCandidates();
+    uiInterface.NotifyBlockTip(pindex->GetBlockHash());
+    LogPrintf("%s : chainstate loaded from a snapshot at height %d, wallets need a -rescan to see the blocks skipped\n", __func__, pindex->nHeight);
+
+    CValidationState state;
+    return FlushStateToDisk(state, FLUSH_STATE_ALWAYS);
+}
+
 bool InvalidateBlock(CValidationState& state, CBlockIndex *pindex) {
     AssertLockHeld(cs_main);
 
@@ -2471,9 +2657,9 @@ static CBlockIndex* AddToBlockIndex(const CBlockHeader& aHeader)
     if (it != mapBlockIndex.end())                  //! Bingo, got it already
         return it->second;
 
-    //! Construct new block index object, filling in the initial basic header values
-    CBlockIndex* pindexNew = new CBlockIndex(aHeader);
-    assert(pindexNew);
+    //! Construct new block index object in the map, filling in the initial basic header values
+    CBlockIndex* pindexNew = mapBlockIndex.insert(uintRealHash);
+    pindexNew->SetBlockHeader(aHeader);
     //! Time complexity is much higher now, it really shows up in reindexing...ToDo:
     pindexNew->fakeBIhash = aHeader.CalcSha256dHash();      //! Now store it in the new index object
     pindexNew->fakeBIhash.SetRealHash( uintRealHash );      //! Make sure we keep our cross reference lookup map full and fast
@@ -2482,8 +2668,6 @@ static CBlockIndex* AddToBlockIndex(const CBlockHeader& aHeader)
     //! to avoid miners withholding blocks but broadcasting headers, to get a
     //! competitive advantage.
     pindexNew->nSequenceId = 0;
-    BlockMap::iterator mi = mapBlockIndex.insert(make_pair(uintRealHash, pindexNew)).first;
-    pindexNew->phashBlock = &((*mi).first);
     if( aHeader.hashPrevBlock != 0 ) {
         //! We can do this now because the call to new CBlockIndex calculated both hashes and updated
         //! the cross reference map for the sha256d hash.
@@ -2498,7 +2682,7 @@ static CBlockIndex* AddToBlockIndex(const CBlockHeader& aHeader)
         assert( uintRealHash == Params().HashGenesisBlock() );
     // ToDo: Above, instead of crashing due to assertion failure, if the previous block hash is zero..or the realhash isn't found,
     // log them or something better, perhaps log a reindex blockchain request & start shutdown?
-    pindexNew->nChainWork = (pindexNew->pprev ? pindexNew->pprev->nChainWork : 0) + GetBlockProof(*pindexNew);
+    pindexNew->nChainWork = (pindexNew->pprev ? pindexNew->pprev->nChainWork.GetWork() : 0) + GetBlockProof(*pindexNew);
     pindexNew->RaiseValidity(BLOCK_VALID_TREE);
     if (pindexBestHeader == NULL || pindexBestHeader->nChainWork < pindexNew->nChainWork)
         pindexBestHeader = pindexNew;
@@ -3064,21 +3248,17 @@ CBlockIndex * InsertBlockIndex(uint256 hash)
         return (*mi).second;
 
     // Create new
-    CBlockIndex* pindexNew = new CBlockIndex();
-    if (!pindexNew)
-        throw runtime_error("LoadBlockIndex() : new CBlockIndex failed");
-    mi = mapBlockIndex.insert(make_pair(hash, pindexNew)).first;
-    pindexNew->phashBlock = &((*mi).first);
-
-    return pindexNew;
+    return mapBlockIndex.insert(hash);
 }
 #endif
 bool static LoadBlockIndexDB()
 {
-    //! Load the blockindex guts & build a vector of blockindex pointers sorted by height...
+    //! Load the blockindex guts & build a vector of blockindex entries sorted by height...
+    int64_t nTimeStart = GetTimeMicros();
     vector<BlockTreeEntry> vSortedByHeight;
     if( !pblocktree->LoadBlockIndexGuts( vSortedByHeight ) )
         return false;
+    int64_t nTimeGuts = GetTimeMicros();
 
     //! If there are no blocks to sort, that is ok, the genesis block has not even been created
     //! and setup yet on disk...we're done
@@ -3096,6 +3276,7 @@ bool static LoadBlockIndexDB()
 
     uint32_t nBIsize = vSortedByHeight.size();
     LogPrintf( "%s : Sorted %d blockindex entries by height.\n", __func__, nBIsize );
+    int64_t nTimeSort = GetTimeMicros();
 
     //! Now with minimal time complexity we can finally build the cross reference index,
     //! initialize the mapBlockIndex and CBlockIndex structure pointers and values.
@@ -3114,15 +3295,15 @@ bool static LoadBlockIndexDB()
     uint64_t nStartTime = GetTime() - 16;
     uint8_t msgcnt = 0;
     BOOST_FOREACH(const BlockTreeEntry& entry, vSortedByHeight) {
-        CBlockIndex* pindex = entry.pBlockIndex;
+        const CDiskBlockIndex& diskindex = entry.diskindex;
         //! ONLY the Genesis block should not have a previous hash
-        assert( pindex->fakeBIhash != 0 || pindex->nHeight == 0 );
-        aHeader.nVersion        = pindex->nVersion;
-        aHeader.hashPrevBlock   = pindex->fakeBIhash; //! Temporarily stored the prev block sha256d hash here
-        aHeader.hashMerkleRoot  = pindex->hashMerkleRoot;
-        aHeader.nTime           = pindex->nTime;
-        aHeader.nBits           = pindex->nBits;
-        aHeader.nNonce          = pindex->nNonce;
+        assert( diskindex.hashPrev != 0 || diskindex.nHeight == 0 );
+        aHeader.nVersion        = diskindex.nVersion;
+        aHeader.hashPrevBlock   = diskindex.hashPrev;
+        aHeader.hashMerkleRoot  = diskindex.hashMerkleRoot;
+        aHeader.nTime           = diskindex.nTime;
+        aHeader.nBits           = diskindex.nBits;
+        aHeader.nNonce          = diskindex.nNonce;
         //! Calling GetHash & CalcSha256dHash with true, invalidates any previously calculated hashes for this block, as they have changed
         uintFakeHash aFakeHash  = aHeader.CalcSha256dHash(true);    //! Calculate the sha256d hash, even for the genesis block
         uint256 aRealHash;
@@ -3142,7 +3323,7 @@ bool static LoadBlockIndexDB()
 
         //! Could do a quick check of the nBits to confirm pow here...its fast.
         if( !CheckProofOfWork( aRealHash, aHeader.nBits ) )
-            return error("%s : CheckProofOfWork failed: %s", __func__, pindex->ToString());
+            return error("%s : CheckProofOfWork failed at height %d: %s", __func__, diskindex.nHeight, aRealHash.ToString());
         // LogPrintf( "fakeBIhash: %s aRealHash: %s Height=%d\n", aFakeHash.ToString(), aRealHash.ToString(), nHeight );
         vFakeHashes[nHeight++] = aFakeHash; //! Save it for later on the 2nd pass
         aFakeHash.SetRealHash( aRealHash ); //! Update our cross reference unordered fast hash lookup map
@@ -3171,33 +3352,44 @@ bool static LoadBlockIndexDB()
     }
     LogPrintf( "%s : Cross referenced %s block sha256d hashes, using real proof-of-work for the index.\n", __func__, mapBlockHashCrossReference.size() );
     uiInterface.InitMessage(_("Finishing block index setup..."));
+    int64_t nTimeCrossRef = GetTimeMicros();
 
-    //! Now that is finally done, we can build the main softwares mapBlockIndex and fix the BlockIndex
-    //! Structures variables and pointers.
+    //! Now that is finally done, we can build the main softwares mapBlockIndex and the BlockIndex
+    //! Structures variables and pointers.  The entries are allocated from the slab pool here, in
+    //! height order, so they are laid out in memory the way the chain is walked.
     nHeight = 0;
     assert( mapBlockIndex.size() == 0 );
     mapBlockIndex.reserve( nBIsize );                               //! Pre-allocate the number of entries
-    BOOST_FOREACH(const BlockTreeEntry& entry, vSortedByHeight) {
-        CBlockIndex* pindex = entry.pBlockIndex;
-        BlockMap::iterator mi = mapBlockIndex.insert(make_pair(entry.uintRealHash, pindex)).first;
-        pindex->phashBlock = &((*mi).first);                        //! Keeps a pointer to the hash in the BI
+    BOOST_FOREACH(BlockTreeEntry& entry, vSortedByHeight) {
+        const CDiskBlockIndex& diskindex = entry.diskindex;
+        CBlockIndex* pindex = mapBlockIndex.insert(entry.uintRealHash);
+        entry.pBlockIndex = pindex;
+        pindex->nHeight        = diskindex.nHeight;
+        pindex->nFile          = diskindex.nFile;
+        pindex->nDataPos       = diskindex.nDataPos;
+        pindex->nUndoPos       = diskindex.nUndoPos;
+        pindex->nVersion       = diskindex.nVersion;
+        pindex->hashMerkleRoot = diskindex.hashMerkleRoot;
+        pindex->nTime          = diskindex.nTime;
+        pindex->nBits          = diskindex.nBits;
+        pindex->nNonce         = diskindex.nNonce;
+        pindex->nStatus        = diskindex.nStatus;
+        pindex->nTx            = diskindex.nTx;
         //! Now find the real hash of this blocks previous block, and set the pointer up correctly.
         //! It should already be in the mapBlockIndex
-        if( pindex->fakeBIhash != 0 ) {      //! Can't do that for the genesis though
-            uint256 aRealHash = pindex->fakeBIhash.GetRealHash();
+        if( diskindex.hashPrev != 0 ) {      //! Can't do that for the genesis though
+            uint256 aRealHash = diskindex.hashPrev.GetRealHash();
             BlockMap::iterator mi2 = ( aRealHash != 0 ) ? mapBlockIndex.find( aRealHash ) : mapBlockIndex.end();
-            // LogPrintf( "fakeBIhash: %s aRealHash: %s  mi2 at end? %s Height=%d\n", pindex->fakeBIhash.ToString(), aRealHash.ToString(), (mi2 == mapBlockIndex.end()) ? "yes" : "no", pindex->nHeight );
             assert(mi2 != mapBlockIndex.end());
             pindex->pprev = (*mi2).second;
         }
-        //! Finally we can wipe out the previous blocks fake hash that was stored here temporarily
-        //! and now set it correct for what this blocks sha256d hash is, which we remembered from
-        //! the 1st pass...and was the original design intention of the field.
+        //! Finally set the sha256d hash of this block, which we remembered from the 1st pass.
         pindex->fakeBIhash = vFakeHashes[nHeight++];
     }
     vFakeHashes.clear();
     SetThreadPriority(THREAD_PRIORITY_NORMAL);      //! Return to normal processing priority, the hard work has been finished
     LogPrintf( "%s : Completed building the BlockIndex map with %d real proof-of-work hashes.\n", __func__, mapBlockIndex.size() );
+    int64_t nTimeBuild = GetTimeMicros();
 
     //! Another day, another pass...returning to the standard coding...
     //! Calculate nChainWork
@@ -3205,11 +3397,12 @@ bool static LoadBlockIndexDB()
     BOOST_FOREACH(const BlockTreeEntry& entry, vSortedByHeight)
     {
         CBlockIndex* pindex = entry.pBlockIndex;
-        pindex->nChainWork = (pindex->pprev ? pindex->pprev->nChainWork : 0) + GetBlockProof(*pindex);
+        pindex->nChainWork = (pindex->pprev ? pindex->pprev->nChainWork.GetWork() : 0) + GetBlockProof(*pindex);
         if( (nHeight < 25000 && nHeight % 5000 == 0 ) || nHeight % 25000 == 0 )
             LogPrintf( "%s : Block @ Height=%6d, ChainWork=%s\n", __func__, entry.nHeight, pindex->nChainWork.ToString() );
         nHeight++;
-        if (pindex->nStatus & BLOCK_HAVE_DATA) {
+        //! Blocks assumed by a UTXO snapshot have a placeholder transaction count without their data
+        if (pindex->nTx > 0) {
             if (pindex->pprev) {
                 if (pindex->pprev->nChainTx) {
                     pindex->nChainTx = pindex->pprev->nChainTx + pindex->nTx;
@@ -3231,6 +3424,12 @@ bool static LoadBlockIndexDB()
             pindexBestHeader = pindex;
     }
     vSortedByHeight.clear();
+    int64_t nTimeEnd = GetTimeMicros();
+    LogPrint("bench", "%s : read %.2fms, sort %.2fms, cross reference %.2fms, build map %.2fms, chain work %.2fms [%.2fs]\n", __func__,
+        0.001 * (nTimeGuts - nTimeStart), 0.001 * (nTimeSort - nTimeGuts), 0.001 * (nTimeCrossRef - nTimeSort),
+        0.001 * (nTimeBuild - nTimeCrossRef), 0.001 * (nTimeEnd - nTimeBuild), 0.000001 * (nTimeEnd - nTimeStart));
+    LogPrint("bench", "%s : block index uses %uKiB for %u entries (%u bytes per entry)\n", __func__,
+        mapBlockIndex.DynamicMemoryUsage() >> 10, mapBlockIndex.size(), mapBlockIndex.DynamicMemoryUsage() / mapBlockIndex.size());
     LogPrintf( "%s : setBlockIndexCandidates size=%d\n", __func__, setBlockIndexCandidates.size() );
     LogPrintf( "%s : mapBlocksUnlinked       size=%d\n", __func__, mapBlocksUnlinked.size() );
     LogPrintf( "%s : pindexBestHeader points to block=%d\n", __func__, pindexBestHeader ? pindexBestHeader->nHeight : 0 );
@@ -3276,6 +3475,16 @@ bool static LoadBlockIndexDB()
         }
     }
 
+    // Check whether the chainstate was loaded from a UTXO snapshot
+    uint256 hashSnapshotBase;
+    if (pblocktree->ReadSnapshotBase(hashSnapshotBase)) {
+        BlockMap::iterator mi = mapBlockIndex.find(hashSnapshotBase);
+        if (mi == mapBlockIndex.end())
+            return error("%s : UTXO snapshot base block %s not found in the block index", __func__, hashSnapshotBase.ToString());
+        pindexSnapshotBase = mi->second;
+        LogPrintf("%s : chainstate loaded from a UTXO snapshot at height %d\n", __func__, pindexSnapshotBase->nHeight);
+    }
+
     // Check whether we need to continue reindexing
     bool fReindexing = false;
     pblocktree->ReadReindexing(fReindexing);
@@ -3285,6 +3494,10 @@ bool static LoadBlockIndexDB()
     pblocktree->ReadFlag("txindex", fTxIndex);
     LogPrintf("%s : transaction index %s\n", __func__, fTxIndex ? "enabled" : "disabled");
 
+    // Check whether we have an address index
+    pblocktree->ReadFlag("addrindex", fAddrIndex);
+    LogPrintf("%s : address index %s\n", __func__, fAddrIndex ? "enabled" : "disabled");
+
     // Load pointer to end of best chain
     uint256 viewBestBlock = pcoinsTip->GetBestBlock();
     BlockMap::iterator itBM = (viewBestBlock != 0) ? mapBlockIndex.find( viewBestBlock ) : mapBlockIndex.end();
@@ -3332,6 +3545,9 @@ bool VerifyDB(int nCheckLevel, int nCheckDepth)
         boost::this_thread::interruption_point();
         if (pindex->nHeight < chainActive.Height()-nCheckDepth)
             break;
+        // Blocks up to a UTXO snapshot were never connected, they have no undo data and maybe no block data
+        if (pindexSnapshotBase && pindex->nHeight <= pindexSnapshotBase->nHeight)
+            break;
         CBlock block;
         // check level 0: read from disk
         if (!ReadBlockFromDisk(block, pindex))
@@ -3365,7 +3581,7 @@ bool VerifyDB(int nCheckLevel, int nCheckDepth)
         // check level 3: check for inconsistencies during memory-only disconnect of tip blocks
         if (nCheckLevel >= 3 && pindex == pindexState && (coins.GetCacheSize() + pcoinsTip->GetCacheSize()) <= 2*nCoinCacheSize + 32000) {
             bool fClean = true;
-            if (!DisconnectBlock(block, state, pindex, coins, &fClean))
+            if (!DisconnectBlock(block, state, pindex, coins, &fClean, true))
                 return error("VerifyDB() : *** irrecoverable inconsistency in block data at %d, hash=%s", pindex->nHeight, pindex->GetBlockHash().ToString());
             pindexState = pindex->pprev;
             if (!fClean) {
@@ -3410,6 +3626,7 @@ void UnloadBlockIndex()
     chainActive.SetTip(NULL);
     pindexBestInvalid = NULL;
     pindexBestHeader = NULL;
+    pindexSnapshotBase = NULL;
     mempool.clear();
     mapOrphanTransactions.clear();
     mapOrphanTransactionsByPrev.clear();
@@ -3426,9 +3643,7 @@ void UnloadBlockIndex()
     setDirtyFileInfo.clear();
     mapNodeState.clear();
 
-    BOOST_FOREACH(BlockMap::value_type& entry, mapBlockIndex) {
-        delete entry.second;
-    }
+    //! The map owns the entries, this releases them too
     mapBlockIndex.clear();
     // cross reference block hash map
     mapBlockHashCrossReference.clear();
@@ -3451,6 +3666,8 @@ bool InitBlockIndex() {
     // Use the provided setting for -txindex in the new database
     fTxIndex = GetBoolArg("-txindex", false);
     pblocktree->WriteFlag("txindex", fTxIndex);
+    fAddrIndex = GetBoolArg("-addrindex", false);
+    pblocktree->WriteFlag("addrindex", fAddrIndex);
     LogPrintf("Initializing databases...\n");
 
     // Only add the genesis block if not reindexing (in which case we reuse the one already on disk)
@@ -3591,6 +3808,12 @@ bool LoadExternalBlockFile(FILE* fileIn, CDiskBlockPos *dbp)
     return nLoaded > 0;
 }
 
+//! Whether pindex is the UTXO snapshot base or one of its ancestors, which count as connected without their data
+static bool IsAssumedBySnapshot(const CBlockIndex* pindex)
+{
+    return pindexSnapshotBase && pindex->nHeight <= pindexSnapshotBase->nHeight && pindexSnapshotBase->GetAncestor(pindex->nHeight) == pindex;
+}
+
 void static CheckBlockIndex()
 {
     if (!fCheckBlockIndex) {
@@ -3625,7 +3848,7 @@ void static CheckBlockIndex()
     while (pindex != NULL) {
         nNodes++;
         if (pindexFirstInvalid == NULL && pindex->nStatus & BLOCK_FAILED_VALID) pindexFirstInvalid = pindex;
-        if (pindexFirstMissing == NULL && !(pindex->nStatus & BLOCK_HAVE_DATA)) pindexFirstMissing = pindex;
+        if (pindexFirstMissing == NULL && !(pindex->nStatus & BLOCK_HAVE_DATA) && !IsAssumedBySnapshot(pindex)) pindexFirstMissing = pindex;
         if (pindex->pprev != NULL && pindexFirstNotTreeValid == NULL && (pindex->nStatus & BLOCK_VALID_MASK) < BLOCK_VALID_TREE) pindexFirstNotTreeValid = pindex;
         if (pindex->pprev != NULL && pindexFirstNotChainValid == NULL && (pindex->nStatus & BLOCK_VALID_MASK) < BLOCK_VALID_CHAIN) pindexFirstNotChainValid = pindex;
         if (pindex->pprev != NULL && pindexFirstNotScriptsValid == NULL && (pindex->nStatus & BLOCK_VALID_MASK) < BLOCK_VALID_SCRIPTS) pindexFirstNotScriptsValid = pindex;
@@ -3886,7 +4109,10 @@ void static ProcessGetData(CNode* pfrom)
                 BlockMap::iterator mi = ( aRealHash != 0 ) ? mapBlockIndex.find( aRealHash ) : mapBlockIndex.end();
                 if (mi != mapBlockIndex.end())
                 {
-                    if (chainActive.Contains(mi->second)) {
+                    if (!(mi->second->nStatus & BLOCK_HAVE_DATA)) {
+                        // Skipped by a UTXO snapshot, there is nothing to send
+                        send = false;
+                    } else if (chainActive.Contains(mi->second)) {
                         send = true;
                     } else {
                         // To prevent fingerprinting attacks, only send blocks outside of the active
@@ -3901,31 +4127,45 @@ void static ProcessGetData(CNode* pfrom)
                 }
                 if (send)
                 {
-                    // Send block from disk
-                    CBlock block;
-                    ReadBlockFromDisk(block, (*mi).second);
-                    if (inv.type == MSG_BLOCK)
-                        pfrom->PushMessage("block", block);
-                    else // MSG_FILTERED_BLOCK)
+                    //! Peers tend to ask for the same new block right after each other, the last block
+                    //! sent is kept serialized and its payload queued for all of them.
+                    static uint256 hashLastBlockSent;
+                    static CSharedPayload payloadLastBlockSent;
+                    if (inv.type == MSG_BLOCK && aRealHash == hashLastBlockSent && !payloadLastBlockSent.IsNull())
+                        pfrom->PushSharedMessage("block", payloadLastBlockSent);
+                    else
                     {
-                        LOCK(pfrom->cs_filter);
-                        if (pfrom->pfilter)
+                        // Send block from disk
+                        // A block that failed to load is neither cached nor sent
+                        CBlock block;
+                        if (!ReadBlockFromDisk(block, (*mi).second))
+                            error("%s : failed to read block %s from disk", __func__, inv.hash.ToString());
+                        else if (inv.type == MSG_BLOCK) {
+                            payloadLastBlockSent = CSharedPayload::Make(block);
+                            hashLastBlockSent = aRealHash;
+                            pfrom->PushSharedMessage("block", payloadLastBlockSent);
+                        }
+                        else // MSG_FILTERED_BLOCK)
                         {
-                            CMerkleBlock merkleBlock(block, *pfrom->pfilter);
-                            pfrom->PushMessage("merkleblock", merkleBlock);
-                            // CMerkleBlock just contains hashes, so also push any transactions in the block the client did not see
-                            // This avoids hurting performance by pointlessly requiring a round-trip
-                            // Note that there is currently no way for a node to request any single transactions we didnt send here -
-                            // they must either disconnect and retry or request the full block.
-                            // Thus, the protocol spec specified allows for us to provide duplicate txn here,
-                            // however we MUST always provide at least what the remote peer needs
-                            typedef std::pair<unsigned int, uint256> PairType;
-                            BOOST_FOREACH(PairType& pair, merkleBlock.vMatchedTxn)
-                                if (!pfrom->setInventoryKnown.count(CInv(MSG_TX, pair.second)))
-                                    pfrom->PushMessage("tx", block.vtx[pair.first]);
+                            LOCK(pfrom->cs_filter);
+                            if (pfrom->pfilter)
+                            {
+                                CMerkleBlock merkleBlock(block, *pfrom->pfilter);
+                                pfrom->PushMessage("merkleblock", merkleBlock);
+                                // CMerkleBlock just contains hashes, so also push any transactions in the block the client did not see
+                                // This avoids hurting performance by pointlessly requiring a round-trip
+                                // Note that there is currently no way for a node to request any single transactions we didnt send here -
+                                // they must either disconnect and retry or request the full block.
+                                // Thus, the protocol spec specified allows for us to provide duplicate txn here,
+                                // however we MUST always provide at least what the remote peer needs
+                                typedef std::pair<unsigned int, uint256> PairType;
+                                BOOST_FOREACH(PairType& pair, merkleBlock.vMatchedTxn)
+                                    if (!pfrom->setInventoryKnown.count(CInv(MSG_TX, pair.second)))
+                                        pfrom->PushMessage("tx", block.vtx[pair.first]);
+                            }
+                            // else
+                                // no response
                         }
-                        // else
-                            // no response
                     }
 
                     // Trigger them to send a getblocks request for the next batch of inventory
@@ -3947,9 +4187,9 @@ void static ProcessGetData(CNode* pfrom)
                 bool pushed = false;
                 {
                     LOCK(cs_mapRelay);
-                    map<CInv, CDataStream>::iterator mi = mapRelay.find(inv);
+                    map<CInv, CSharedPayload>::iterator mi = mapRelay.find(inv);
                     if (mi != mapRelay.end()) {
-                        pfrom->PushMessage(inv.GetCommand(), (*mi).second);
+                        pfrom->PushSharedMessage(inv.GetCommand(), (*mi).second);
                         pushed = true;
                     }
                 }
@@ -3990,7 +4230,19 @@ void static ProcessGetData(CNode* pfrom)
     }
 }
 
-bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv)
+//! Salts for the deterministic choices of address relay peers and of trickled transactions. Every
+//! message handler thread uses them, so they are set up exactly once.
+static uint256 hashAddrRelaySalt;
+static uint256 hashTrickleSalt;
+static boost::once_flag relaySaltInitFlag = BOOST_ONCE_INIT;
+
+static void RelaySaltInit()
+{
+    hashAddrRelaySalt = GetRandHash();
+    hashTrickleSalt = GetRandHash();
+}
+
+bool static ProcessMessage(CNode* pfrom, string strCommand, CNetRecvStream& vRecv)
 {
     RandAddSeedPerfmon();
 
@@ -4271,7 +4523,10 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv)
         pfrom->fClient = !(pfrom->nServices & NODE_NETWORK);
 
         //! Potentially mark this peer as a preferred download peer.
-        UpdatePreferredDownload(pfrom, State(pfrom->GetId()));
+        {
+            LOCK(cs_main);
+            UpdatePreferredDownload(pfrom, State(pfrom->GetId()));
+        }
 
         //! Change version
         pfrom->PushMessage("verack");
@@ -4528,11 +4783,9 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv)
                     LOCK(cs_vNodes);
                     //! Use deterministic randomness to send to the same nodes for 24 hours
                     //! at a time so the addrKnowns of the chosen nodes prevent repeats
-                    static uint256 hashSalt;
-                    if (hashSalt == 0)
-                        hashSalt = GetRandHash();
+                    boost::call_once(&RelaySaltInit, relaySaltInitFlag);
                     uint64_t hashAddr = addr.GetHash();
-                    uint256 hashRand = hashSalt ^ (hashAddr<<32) ^ ((GetTime()+hashAddr)/(24*60*60));
+                    uint256 hashRand = hashAddrRelaySalt ^ (hashAddr<<32) ^ ((GetTime()+hashAddr)/(24*60*60));
                     hashRand = Hash(BEGIN(hashRand), END(hashRand));
                     multimap<uint256, CNode*> mapMix;
                     BOOST_FOREACH(CNode* pnode, vNodes)
@@ -4580,6 +4833,10 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv)
             return error("message inv size() = %u", vInv.size());
         }
 
+        //! Bookkeeping of what the peer knows about needs no cs_main, don't make others wait for it
+        BOOST_FOREACH(const CInv& inv, vInv)
+            pfrom->AddInventoryKnown(inv);
+
         LOCK(cs_main);
 
         std::vector<CInv> vToFetch;
@@ -4590,7 +4847,6 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv)
             const CInv &inv = vInv[nInv];
 
             boost::this_thread::interruption_point();
-            pfrom->AddInventoryKnown(inv);
 
             bool fAlreadyHave = AlreadyHave(inv);
             LogPrint("net", "  got inventory: %s  %s\n", inv.ToString(), fAlreadyHave ? "have" : "new");
@@ -4897,6 +5153,12 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv)
             ReadCompactSize(vRecv); // ignore tx count; assume it is 0.
         }
 
+        //! All the scrypt work is done up front in parallel and without cs_main, from here on every
+        //! header hash is a cached value.
+        int64_t nTimeStart = GetTimeMicros();
+        HashBlockHeaders(headers);
+        LogPrint("bench", "Hashed %u headers in %.2fms\n", nCount, 0.001 * (GetTimeMicros() - nTimeStart));
+
         LOCK(cs_main);
 
         if (nCount == 0) {
@@ -4904,14 +5166,22 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv)
             return true;
         }
 
-        CBlockIndex *pindexLast = NULL;
-        BOOST_FOREACH(const CBlockHeader& header, headers) {
-            CValidationState state;
-            uint256 aRealHash = header.hashPrevBlock.GetRealHash();
-            if (pindexLast != NULL && aRealHash != 0 && aRealHash != pindexLast->GetBlockHash()) {
+        //! The linkage of the whole sequence is checked before any of it is accepted
+        for (unsigned int n = 1; n < nCount; n++) {
+            if (headers[n].hashPrevBlock != headers[n - 1].CalcSha256dHash()) {
                 Misbehaving(pfrom->GetId(), 20);
                 return error("non-continuous headers sequence");
             }
+        }
+
+        //! Make room for the whole batch at once, rather than rehashing the lookup maps as they grow
+        mapBlockIndex.reserve(mapBlockIndex.size() + nCount);
+        mapBlockHashCrossReference.reserve(mapBlockHashCrossReference.size() + nCount);
+
+        //! Proof of work against nBits and GetNextWorkRequired() are verified in order by AcceptBlockHeader()
+        CBlockIndex *pindexLast = NULL;
+        BOOST_FOREACH(const CBlockHeader& header, headers) {
+            CValidationState state;
             if (!AcceptBlockHeader(header, state, &pindexLast)) {         
                 int nDoS;
                 if (state.IsInvalid(nDoS)) {          
@@ -4988,7 +5258,10 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv)
         }
 
         LogPrint("addrman", "addrman: getaddr received from %s (startheight:%d) nVersion %d \n", GetPeerLogStr(pfrom), pfrom->nStartingHeight, pfrom->nVersion);
-        pfrom->vAddrToSend.clear();
+        {
+            LOCK(pfrom->cs_inventory);
+            pfrom->vAddrToSend.clear();
+        }
         bool fIpOnly = (pfrom->addr.nServices & NODE_I2P) != 0;
         bool fI2pOnly = pfrom->addr.IsI2P();
         vector<CAddress> vAddr = addrman.GetAddr( fIpOnly, fI2pOnly );
@@ -5273,8 +5546,8 @@ bool ProcessMessages(CNode* pfrom)
         unsigned int nMessageSize = hdr.nMessageSize;
 
         // Checksum
-        CDataStream& vRecv = msg.vRecv;
-        uint256 hash = Hash(vRecv.begin(), vRecv.begin() + nMessageSize);
+        CNetRecvStream& vRecv = msg.vRecv;
+        uint256 hash = vRecv.GetHash();
         unsigned int nChecksum = 0;
         memcpy(&nChecksum, &hash, sizeof(nChecksum));
         if (nChecksum != hdr.nChecksum)
@@ -5331,6 +5604,9 @@ bool ProcessMessages(CNode* pfrom)
     return fOk;
 }
 
+//! Last address refresh broadcast, SendMessages runs on every message handler thread
+static CCriticalSection cs_rebroadcast;
+static int64_t nLastRebroadcast = 0;
 
 bool SendMessages(CNode* pto, bool fSendTrickle)
 {
@@ -5366,22 +5642,26 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
         if (!lockMain)
             return true;
 
-        // Address refresh broadcast
-        static int64_t nLastRebroadcast;
-        if (!IsInitialBlockDownload() && (GetTime() - nLastRebroadcast > 24 * 60 * 60))
+        // Address refresh broadcast, the first handler to find it due does it for all peers
         {
-            LOCK(cs_vNodes);
-            BOOST_FOREACH(CNode* pnode, vNodes)
+            LOCK(cs_rebroadcast);
+            if (!IsInitialBlockDownload() && (GetTime() - nLastRebroadcast > 24 * 60 * 60))
             {
-                // Periodically clear addrKnown to allow refresh broadcasts
-                if (nLastRebroadcast)
-                    pnode->addrKnown.clear();
+                LOCK(cs_vNodes);
+                BOOST_FOREACH(CNode* pnode, vNodes)
+                {
+                    // Periodically clear addrKnown to allow refresh broadcasts
+                    if (nLastRebroadcast) {
+                        LOCK(pnode->cs_inventory);
+                        pnode->addrKnown.clear();
+                    }
 
-                // Rebroadcast our address
-                AdvertizeLocal(pnode);
+                    // Rebroadcast our address
+                    AdvertizeLocal(pnode);
+                }
+                if (!vNodes.empty())
+                    nLastRebroadcast = GetTime();
             }
-            if (!vNodes.empty())
-                nLastRebroadcast = GetTime();
         }
 
         //
@@ -5389,13 +5669,25 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
         //
         if (fSendTrickle)
         {
+            //! Other peers' message handlers relay addresses to this one, take them all at once
+            vector<CAddress> vAddrToSend;
+            {
+                LOCK(pto->cs_inventory);
+                vAddrToSend.swap(pto->vAddrToSend);
+            }
             vector<CAddress> vAddr;
-            vAddr.reserve(pto->vAddrToSend.size());
-            BOOST_FOREACH(const CAddress& addr, pto->vAddrToSend)
+            vAddr.reserve(vAddrToSend.size());
+            BOOST_FOREACH(const CAddress& addr, vAddrToSend)
             {
-                if (!pto->addrKnown.contains(addr.GetKey()))
+                bool fKnown;
+                {
+                    LOCK(pto->cs_inventory);
+                    fKnown = pto->addrKnown.contains(addr.GetKey());
+                    if (!fKnown)
+                        pto->addrKnown.insert(addr.GetKey());
+                }
+                if (!fKnown)
                  {
-                    pto->addrKnown.insert(addr.GetKey());
                      vAddr.push_back(addr);
                     //! I2P addresses are MUCH larger than IP addresses, a trickle set to 1K is over 1/2 megabyte of payload
                     //! over 33x larger per addr, so lets reduce that amount, down to what the max addrman will return
@@ -5417,7 +5709,6 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
                     }
                 }
             }
-            pto->vAddrToSend.clear();
             if (!vAddr.empty())
                 pto->PushMessage("addr", vAddr);
         }
@@ -5493,10 +5784,8 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
                 if (inv.type == MSG_TX && !fSendTrickle)
                 {
                     // 1/4 of tx invs blast to all immediately
-                    static uint256 hashSalt;
-                    if (hashSalt == 0)
-                        hashSalt = GetRandHash();
-                    uint256 hashRand = inv.hash ^ hashSalt;
+                    boost::call_once(&RelaySaltInit, relaySaltInitFlag);
+                    uint256 hashRand = inv.hash ^ hashTrickleSalt;
                     hashRand = Hash(BEGIN(hashRand), END(hashRand));
                     bool fTrickleWait = ((hashRand & 3) != 0);
 
@@ -5660,9 +5949,6 @@ public:
         // ToDo: Detail everything in main the could be taking up memory and specifically deallocate it.
 
         // block headers
-        BlockMap::iterator it1 = mapBlockIndex.begin();
-        for (; it1 != mapBlockIndex.end(); it1++)
-            delete (*it1).second;
         mapBlockIndex.clear();
         // cross reference block hash map
         mapBlockHashCrossReference.clear();
@@ -109,23 +109,19 @@ extern const uint8_t REJECT_DUST;
 extern const uint8_t REJECT_INSUFFICIENTFEE;
 extern const uint8_t REJECT_CHECKPOINT;
 
-// New BlockIndex map concept, using boost unordered_map technology offers us a
-// faster block locator than std::map which uses a binary tree search, this does
-// it by hash, and we define it to use a very fast 'Cheap' hash, the lower 64bits
-// of the longer block hash we have anyway as the key.  Now throughout the code
-// you can simply reference the same old mapBLockIndex we keep in memory, create
-// BlockMap iterators as you need them, this really fast find function is another
-// great idea that came from bitcoin v10 development.  Thank goes to them from
-// this developer.....GR
-struct BlockHasher
-{
-    size_t operator()(const uint256& hash) const { return hash.GetLow64(); }
-};
-
+// New BlockIndex map concept, a hash lookup offers us a faster block locator than
+// std::map which uses a binary tree search, and we use a very fast 'Cheap' hash,
+// the lower 64bits of the longer block hash we have anyway as the key.  Now
+// throughout the code you can simply reference the same old mapBLockIndex we keep
+// in memory, create BlockMap iterators as you need them, this really fast find
+// function is another great idea that came from bitcoin v10 development.  Thank
+// goes to them from this developer.....GR
+// The map is now a flat table over slab allocated entries, see CBlockIndexMap in
+// chain.h, entries are owned by the map and released by mapBlockIndex.clear().
 extern CScript COINBASE_FLAGS;
 extern CCriticalSection cs_main;
 extern CTxMemPool mempool;
-typedef boost::unordered_map<uint256, CBlockIndex*, BlockHasher> BlockMap;
+typedef CBlockIndexMap BlockMap;
 extern BlockMap mapBlockIndex;
 extern const std::string strMessageMagic;
 extern int64_t nTimeBestReceived;
@@ -135,6 +131,7 @@ extern bool fImporting;
 extern bool fReindex;
 extern int nScriptCheckThreads;
 extern bool fTxIndex;
+extern bool fAddrIndex;
 extern bool fIsBareMultisigStd;
 extern bool fCheckBlockIndex;
 extern unsigned int nCoinCacheSize;
@@ -145,6 +142,13 @@ extern bool fGenerateInitialTestNetState;
 /** Best header we've seen so far (used for getheaders queries' starting points). */
 extern CBlockIndex *pindexBestHeader;
 
+/**
+ * Block the chainstate was loaded from a UTXO snapshot at, or NULL. It and its ancestors were never
+ * connected here, they have no undo data and may have no block data either, so they can not be
+ * disconnected or verified.
+ */
+extern CBlockIndex *pindexSnapshotBase;
+
 /** Register a wallet to receive updates from core */
 void RegisterValidationInterface(CValidationInterface* pInterfaceIn);
 /** Unregister a wallet from core */
@@ -203,6 +207,10 @@ bool ProcessMessages(CNode* pfrom);
 bool SendMessages(CNode* pto, bool fSendTrickle);
 /** Run an instance of the script checking thread */
 void ThreadScriptCheck();
+/** Run an instance of the address index building thread, used while reindexing */
+void ThreadAddrIndexCheck();
+/** Run an instance of the block header hashing thread */
+void ThreadHeaderHashCheck();
 /** Check whether we are doing an initial block download (synchronizing from disk or network) */
 bool IsInitialBlockDownload();
 /** Format a string that describes several potential problems detected by the core */
@@ -264,6 +272,56 @@ struct CDiskTxPos : public CDiskBlockPos
     }
 };
 
+/** Address index key, the Hash160 of an output scriptPubKey followed by the outpoint which created it.
+ *  Serialized with the script hash first, so all outputs paying one script are adjacent on disk. */
+struct CAddrIndexKey
+{
+    uint160 hashScript;
+    uint256 txid;
+    uint32_t n;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+        READWRITE(hashScript);
+        READWRITE(txid);
+        READWRITE(n);
+    }
+
+    CAddrIndexKey(const uint160& hashScriptIn, const uint256& txidIn, uint32_t nIn) : hashScript(hashScriptIn), txid(txidIn), n(nIn) {}
+    CAddrIndexKey() : n(0) {}
+
+    friend bool operator<(const CAddrIndexKey& a, const CAddrIndexKey& b) {
+        if (a.hashScript != b.hashScript)
+            return a.hashScript < b.hashScript;
+        if (a.txid != b.txid)
+            return a.txid < b.txid;
+        return a.n < b.n;
+    }
+};
+
+/** Address index value, where in the chain the output was created and what it is worth */
+struct CAddrIndexValue
+{
+    int nHeight;
+    CAmount nValue;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+        READWRITE(VARINT(nHeight));
+        READWRITE(nValue);
+    }
+
+    CAddrIndexValue(int nHeightIn, CAmount nValueIn) : nHeight(nHeightIn), nValue(nValueIn) {}
+    CAddrIndexValue() { SetNull(); }
+
+    void SetNull() { nHeight = -1; nValue = 0; }
+    bool IsNull() const { return nHeight == -1; }
+};
+
 
 CAmount GetMinRelayFee(const CTransaction& tx, unsigned int nBytes, bool fAllowFree);
 
@@ -377,6 +435,64 @@ public:
     ScriptError GetScriptError() const { return error; }
 };
 
+/**
+ * Closure computing the scrypt proof-of-work hash and the sha256d identity hash of one block header
+ * Both are cached inside the header, so the in-order checks which follow do not compute them again
+ */
+class CHeaderHashCheck
+{
+private:
+    const CBlockHeader *pheader;
+
+public:
+    CHeaderHashCheck(): pheader(0) {}
+    CHeaderHashCheck(const CBlockHeader& headerIn) : pheader(&headerIn) { }
+
+    bool operator()() {
+        pheader->GetHash();
+        pheader->CalcSha256dHash();
+        return true;
+    }
+
+    void swap(CHeaderHashCheck &check) {
+        std::swap(pheader, check.pheader);
+    }
+};
+
+/** Compute the hashes of a batch of headers on the header hashing threads, before any of them is accepted */
+void HashBlockHeaders(const std::vector<CBlockHeader>& vHeaders);
+
+/** Collect the address index entries for every spendable output of a transaction */
+void GetAddrIndexEntries(const CTransaction& tx, int nHeight, std::vector<std::pair<CAddrIndexKey, CAddrIndexValue> >& vEntries);
+
+/**
+ * Closure computing the address index entries of one transaction
+ * Note that this stores references to the transaction and the result vector
+ */
+class CAddrIndexCheck
+{
+private:
+    const CTransaction *ptx;
+    int nHeight;
+    std::vector<std::pair<CAddrIndexKey, CAddrIndexValue> > *pvEntries;
+
+public:
+    CAddrIndexCheck(): ptx(0), nHeight(0), pvEntries(0) {}
+    CAddrIndexCheck(const CTransaction& txIn, int nHeightIn, std::vector<std::pair<CAddrIndexKey, CAddrIndexValue> > *pvEntriesIn) :
+        ptx(&txIn), nHeight(nHeightIn), pvEntries(pvEntriesIn) { }
+
+    bool operator()() {
+        GetAddrIndexEntries(*ptx, nHeight, *pvEntries);
+        return true;
+    }
+
+    void swap(CAddrIndexCheck &check) {
+        std::swap(ptx, check.ptx);
+        std::swap(nHeight, check.nHeight);
+        std::swap(pvEntries, check.pvEntries);
+    }
+};
+
 
 /** Functions for disk access for blocks */
 bool WriteBlockToDisk(CBlock& block, CDiskBlockPos& pos);
@@ -389,8 +505,9 @@ bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex);
 /** Undo the effects of this block (with given index) on the UTXO set represented by coins.
  *  In case pfClean is provided, operation will try to be tolerant about errors, and *pfClean
  *  will be true if no problems were found. Otherwise, the return value will be false in case
- *  of problems. Note that in any case, coins may be modified. */
-bool DisconnectBlock(CBlock& block, CValidationState& state, CBlockIndex* pindex, CCoinsViewCache& coins, bool* pfClean = NULL);
+ *  of problems. Note that in any case, coins may be modified. With fJustCheck set the address
+ *  index is left untouched, as is needed for a memory-only disconnect. */
+bool DisconnectBlock(CBlock& block, CValidationState& state, CBlockIndex* pindex, CCoinsViewCache& coins, bool* pfClean = NULL, bool fJustCheck = false);
 
 /** Apply the effects of this block (with given index) on the UTXO set represented by coins */
 bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pindex, CCoinsViewCache& view, bool fJustCheck = false);
@@ -540,6 +657,12 @@ public:
 /** Find the last common block between the parameter chain and a locator. */
 CBlockIndex* FindForkInGlobalIndex(const CChain& chain, const CBlockLocator& locator);
 
+/**
+ * Make pindex the chain tip, after the coins database was loaded from a snapshot taken at that block. Only its
+ * header is needed, it and the blocks below it are marked valid and pindex is recorded as pindexSnapshotBase.
+ */
+bool ActivateCoinsSnapshot(CBlockIndex *pindex);
+
 /** Mark a block as invalid. */
 bool InvalidateBlock(CValidationState& state, CBlockIndex *pindex);
 
@@ -566,6 +689,8 @@ struct CBlockTemplate
 class CValidationInterface {
 protected:
     virtual void SyncTransaction(const CTransaction& tx, const CBlock* pblock) {};
+    virtual void BeginSyncBatch() {};
+    virtual void EndSyncBatch() {};
     virtual void SetBestChain(const CBlockLocator& locator) {};
     virtual void UpdatedTransaction(const uint256& uintTxHash) {};
     virtual void Inventory(const uintFakeHash& uintShad) {};
@@ -581,6 +706,9 @@ protected:
 struct CMainSignals {
     /** Notifies listeners of updated transaction data (transaction, and optionally the block it is found in. */
     boost::signals2::signal<void (const CTransaction&, const CBlock*)> SyncTransaction;
+    /** Bracket the SyncTransaction calls made for one connected or disconnected block, so listeners can group their writes. */
+    boost::signals2::signal<void ()> BeginSyncBatch;
+    boost::signals2::signal<void ()> EndSyncBatch;
     /** Notifies listeners of an updated transaction without new data (for now: a coinbase potentially becoming visible). */
     boost::signals2::signal<void (const uint256&)> UpdatedTransaction;
     /** Notifies listeners of a new active block chain. */
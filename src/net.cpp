@@ -16,6 +16,8 @@
 #include "i2pwrapper.h"
 #endif
 
+#include <limits>
+
 #ifdef WIN32
 #include <string.h>
 #else
@@ -29,6 +31,16 @@
 #include <miniupnpc/upnperrors.h>
 #endif
 
+#ifndef WIN32
+#include <sys/uio.h>
+#endif
+
+#if defined(HAVE_SYS_EPOLL_H) && defined(HAVE_POLL_H)
+#define USE_EPOLL 1
+#include <poll.h>
+#include <sys/epoll.h>
+#endif
+
 #include <boost/algorithm/string/predicate.hpp> // for startswith() and endswith()
 #include <boost/filesystem.hpp>
 #include <boost/thread.hpp>
@@ -77,16 +89,42 @@ const bool DEFAULT_UPNP = false;
 #endif
 /** The maximum number of entries in mapAskFor */
 const size_t MAPASKFOR_MAX_SZ = MAX_INV_SZ;
+const int DEFAULT_MESSAGE_HANDLER_THREADS = 4;
+const int MAX_MESSAGE_HANDLER_THREADS = 16;
+#ifdef ENABLE_I2PSAM
+const int DEFAULT_I2P_ACCEPT_POOL = 4;
+const int MAX_I2P_ACCEPT_POOL = 32;
+#endif
 
 namespace {
     const int MAX_OUTBOUND_CONNECTIONS = 16;
 
+    //! Lets a message handler thread sleep until one of its peers has something for it to do
+    struct CMessageHandlerSignal {
+        boost::mutex mutex;
+        boost::condition_variable cond;
+        bool fWake;
+
+        CMessageHandlerSignal() : fWake(false) {}
+    };
+
     struct ListenSocket {
         SOCKET socket;
         bool whitelisted;
 
         ListenSocket(SOCKET socket, bool whitelisted) : socket(socket), whitelisted(whitelisted) {}
     };
+
+#ifdef ENABLE_I2PSAM
+    //! An armed STREAM ACCEPT, waiting for the bridge to send the destination of an incoming peer
+    struct I2PListenSocket {
+        SOCKET socket;
+        int64_t nTimeArmed;
+        std::string strLine;            // The part of the destination line received so far
+
+        I2PListenSocket(SOCKET socket, int64_t nTimeArmed) : socket(socket), nTimeArmed(nTimeArmed) {}
+    };
+#endif
 }
 
 //
@@ -129,6 +167,11 @@ static bool vfReachable[NET_MAX] = {};
 static bool vfLimited[NET_MAX] = {};
 static CNode* pnodeLocalHost = NULL;
 static std::vector<ListenSocket> vhListenSocket;
+static int nMessageHandlerThreads = 1;
+static CMessageHandlerSignal vMessageHandlerSignals[MAX_MESSAGE_HANDLER_THREADS];
+static CCriticalSection cs_trickle;
+static int64_t nTrickleRound = -1;              //! The 100ms round idTrickle was picked for
+static NodeId idTrickle = -1;
 
 uint64_t nLocalServices = NODE_NETWORK | NODE_I2P; // Add the I2P protocol(.h) bit to our local services list
 CCriticalSection cs_mapLocalHost;
@@ -149,12 +192,23 @@ bool fAddressesInitialized = false;
  * we actually start talking with read/write of data to it.  This is from the v8 design era, and plans are in the
  * works to remove it in the future, it is not really needed.
  */
-static std::vector<SOCKET> vhI2PListenSocket;                   // We maintain a separate vector for I2P network SOCKET's
+static std::vector<I2PListenSocket> vhI2PListenSocket;          // We maintain a separate vector for I2P network SOCKET's
+
+/**
+ * The accept pool: ThreadI2PAcceptPool keeps -i2p.options.acceptpool STREAM ACCEPTs armed at the bridge
+ * and queues the new ones in vI2PAcceptArmed, from where the socket thread takes them over into
+ * vhI2PListenSocket.  The queue and the stats are guarded by mutexI2PAccept, condI2PAccept wakes
+ * the pool thread once an accept got used up.
+ */
+static boost::mutex mutexI2PAccept;
+static boost::condition_variable condI2PAccept;
+static std::vector<I2PListenSocket> vI2PAcceptArmed;
+static CI2PAcceptStats i2pAcceptStats;
 #endif
 
 vector<CNode*> vNodes;
 CCriticalSection cs_vNodes;
-map<CInv, CDataStream> mapRelay;
+map<CInv, CSharedPayload> mapRelay;
 deque<pair<int64_t, CInv> > vRelayExpiration;
 CCriticalSection cs_mapRelay;
 limitedmap<CInv, int64_t> mapAlreadyAskedFor(MAX_INV_SZ);
@@ -560,6 +614,40 @@ uint64_t CNode::nTotalBytesSent = 0;
 CCriticalSection CNode::cs_totalBytesRecv;
 CCriticalSection CNode::cs_totalBytesSent;
 
+#ifdef USE_EPOLL
+//! The epoll instance ThreadSocketHandler waits on, -1 when it uses select() instead
+static int hEpoll = -1;
+//! Most events collected from the epoll instance per loop, the rest are picked up on the next one
+static const int MAX_EPOLL_EVENTS = 256;
+#endif
+
+//! Adds a peer to the socket engine, called once the node is in vNodes. With select() every
+//! node is looked at each loop and there is nothing to do.
+static void RegisterNodeSocket(CNode* pnode)
+{
+#ifdef USE_EPOLL
+    if (hEpoll == -1 || pnode->hSocket == INVALID_SOCKET)
+        return;
+    //! Edge triggered, ThreadSocketHandler keeps track of what it has not consumed yet
+    struct epoll_event event;
+    event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    event.data.ptr = pnode;
+    if (epoll_ctl(hEpoll, EPOLL_CTL_ADD, pnode->hSocket, &event) != 0) {
+        LogPrintf("%s : epoll_ctl failed for peer %s: %s\n", __func__, GetPeerLogStr(pnode), NetworkErrorString(WSAGetLastError()));
+        pnode->fDisconnect = true;
+    }
+#endif
+}
+
+//! Removes a peer from the socket engine, right before its socket is closed
+static void UnregisterNodeSocket(CNode* pnode)
+{
+#ifdef USE_EPOLL
+    if (hEpoll != -1 && pnode->hSocket != INVALID_SOCKET)
+        epoll_ctl(hEpoll, EPOLL_CTL_DEL, pnode->hSocket, NULL);
+#endif
+}
+
 CNode* FindNode(const CNetAddr& ip)
 {
     LOCK(cs_vNodes);
@@ -587,6 +675,37 @@ CNode* FindNode(const CService& addr)
     return NULL;
 }
 
+//! Adds the node for an established outbound connection
+static CNode* AddOutboundNode(const CAddress& addrConnect, SOCKET hSocket, const char *pszDest)
+{
+    //! Regardless of the outcome, while trying to connect, mark it as an Attempt
+    //! This will not work however until ConnectSocketByName has been called for i2p addresses,
+    //! during an addnode or any command calling ConnectNode with a string.
+    //! So first we mark it here, now that a socket was successfully created.  Later on, if the
+    //! version handshake happens addrman.Add/Good will get called to finish updates on the address (or not)
+    // ToDo: Investigate how an issue here should best be solved.  When addnode xxx onetry is executed, and its not a full i2p destination
+    // there will be no entry found in addrman for that connection attempt, if the address is not one already there.
+    // The attempt fails, and returns false.
+    // GR Update: Do not think this is still a problem, testing is underway or I would delete that comment as its been fixed?
+    addrman.Attempt(addrConnect);
+
+    LogPrint("net", "connected %s\n", pszDest ? pszDest : addrConnect.ToString());
+
+    // Add node
+    CNode* pnode = new CNode(hSocket, addrConnect, pszDest ? pszDest : "", false);
+    pnode->AddRef();
+
+    {
+        LOCK(cs_vNodes);
+        vNodes.push_back(pnode);
+        RegisterNodeSocket(pnode);
+    }
+
+    pnode->nTimeConnected = GetTime();
+
+    return pnode;
+}
+
 CNode* ConnectNode(CAddress addrConnect, const char *pszDest)
 {
     if (pszDest == NULL) {
@@ -614,31 +733,7 @@ CNode* ConnectNode(CAddress addrConnect, const char *pszDest)
     if (pszDest ? ConnectSocketByName(addrConnect, hSocket, pszDest, nPort, nConnectTimeout, &proxyConnectionFailed) :
                   ConnectSocket(addrConnect, hSocket, nConnectTimeout, &proxyConnectionFailed))
     {
-        //! Regardless of the outcome, while trying to connect, mark it as an Attempt
-        //! This will not work however until ConnectSocketByName has been called for i2p addresses,
-        //! during an addnode or any command calling ConnectNode with a string.
-        //! So first we mark it here, now that a socket was successfully created.  Later on, if the
-        //! version handshake happens addrman.Add/Good will get called to finish updates on the address (or not)
-        // ToDo: Investigate how an issue here should best be solved.  When addnode xxx onetry is executed, and its not a full i2p destination
-        // there will be no entry found in addrman for that connection attempt, if the address is not one already there.
-        // The attempt fails, and returns false.
-        // GR Update: Do not think this is still a problem, testing is underway or I would delete that comment as its been fixed?
-        addrman.Attempt(addrConnect);
-
-        LogPrint("net", "connected %s\n", pszDest ? pszDest : addrConnect.ToString());
-
-        // Add node
-        CNode* pnode = new CNode(hSocket, addrConnect, pszDest ? pszDest : "", false);
-        pnode->AddRef();
-
-        {
-            LOCK(cs_vNodes);
-            vNodes.push_back(pnode);
-        }
-
-        pnode->nTimeConnected = GetTime();
-
-        return pnode;
+        return AddOutboundNode(addrConnect, hSocket, pszDest);
     } else if (!proxyConnectionFailed) {
         //! If connecting to the node failed, and failure is not caused by a problem connecting to the proxy, mark this as an attempt.
         //! This next line of code is missing from v9 builds, and causes allot of problems with addrman working correctly because it
@@ -662,13 +757,16 @@ void CNode::CloseSocketDisconnect()
     if (hSocket != INVALID_SOCKET)
     {
         LogPrint("net", "disconnecting peer %s\n", GetPeerLogStr(this));
+        UnregisterNodeSocket(this);
         CloseSocket(hSocket);
     }
 
     // in case this fails, we'll empty the recv buffer when the CNode is deleted
     TRY_LOCK(cs_vRecvMsg, lockRecv);
-    if (lockRecv)
+    if (lockRecv) {
         vRecvMsg.clear();
+        pRecvChunk.reset();
+    }
 }
 
 void CNode::PushVersion()
@@ -784,9 +882,134 @@ void CNode::copyStats(CNodeStats &stats)
 }
 #undef X
 
+//! Up to 16MB of released chunks are kept around
+CNetRecvChunkPool netRecvChunkPool(256);
+
+CNetRecvChunkPool::~CNetRecvChunkPool()
+{
+    BOOST_FOREACH(CNetRecvChunk* pchunk, vFree)
+        delete pchunk;
+}
+
+CNetRecvChunkRef CNetRecvChunkPool::Allocate()
+{
+    CNetRecvChunk* pchunk = NULL;
+    {
+        LOCK(cs);
+        if (!vFree.empty()) {
+            pchunk = vFree.back();
+            vFree.pop_back();
+        }
+    }
+    if (pchunk == NULL)
+        pchunk = new CNetRecvChunk;
+    CDeleter deleter;
+    deleter.pool = this;
+    return CNetRecvChunkRef(pchunk, deleter);
+}
+
+void CNetRecvChunkPool::Free(CNetRecvChunk* pchunk)
+{
+    {
+        LOCK(cs);
+        if (vFree.size() < nMaxFree) {
+            vFree.push_back(pchunk);
+            return;
+        }
+    }
+    delete pchunk;
+}
+
+void CNetRecvStream::Append(const CNetRecvChunkRef& chunk, unsigned int nBegin, unsigned int nEnd)
+{
+    assert(nBegin <= nEnd && nEnd <= NET_RECV_CHUNK_SIZE);
+    if (nBegin == nEnd)
+        return;
+    nSize += nEnd - nBegin;
+    // Consecutive reads into the same chunk extend its segment
+    if (!vSegments.empty() && vSegments.back().chunk == chunk && vSegments.back().nEnd == nBegin) {
+        vSegments.back().nEnd = nEnd;
+        return;
+    }
+    CSegment segment;
+    segment.chunk = chunk;
+    segment.nBegin = nBegin;
+    segment.nEnd = nEnd;
+    vSegments.push_back(segment);
+    if (vSegments.size() == 1)
+        nReadPos = nBegin;
+}
+
+CNetRecvStream& CNetRecvStream::read(char* pch, size_t nSize)
+{
+    if (nSize > this->nSize)
+        throw std::ios_base::failure("CNetRecvStream::read() : end of data");
+    this->nSize -= nSize;
+    while (nSize > 0) {
+        const CSegment& segment = vSegments[nSegment];
+        unsigned int nCopy = std::min((size_t)(segment.nEnd - nReadPos), nSize);
+        memcpy(pch, &segment.chunk->data[nReadPos], nCopy);
+        pch += nCopy;
+        nSize -= nCopy;
+        nReadPos += nCopy;
+        if (nReadPos == segment.nEnd && nSegment + 1 < vSegments.size())
+            nReadPos = vSegments[++nSegment].nBegin;
+    }
+    return (*this);
+}
+
+CNetRecvStream& CNetRecvStream::ignore(int nSize)
+{
+    assert(nSize >= 0);
+    if ((unsigned int)nSize > this->nSize)
+        throw std::ios_base::failure("CNetRecvStream::ignore() : end of data");
+    this->nSize -= nSize;
+    while (nSize > 0) {
+        const CSegment& segment = vSegments[nSegment];
+        unsigned int nSkip = std::min(segment.nEnd - nReadPos, (unsigned int)nSize);
+        nSize -= nSkip;
+        nReadPos += nSkip;
+        if (nReadPos == segment.nEnd && nSegment + 1 < vSegments.size())
+            nReadPos = vSegments[++nSegment].nBegin;
+    }
+    return (*this);
+}
+
+uint256 CNetRecvStream::GetHash() const
+{
+    CHash256 hasher;
+    unsigned int nPos = nReadPos;
+    for (unsigned int i = nSegment; i < vSegments.size(); i++) {
+        if (i != nSegment)
+            nPos = vSegments[i].nBegin;
+        hasher.Write((const unsigned char*)&vSegments[i].chunk->data[nPos], vSegments[i].nEnd - nPos);
+    }
+    uint256 hash;
+    hasher.Finalize((unsigned char*)&hash);
+    return hash;
+}
+
 // requires LOCK(cs_vRecvMsg)
-bool CNode::ReceiveMsgBytes(const char *pch, unsigned int nBytes)
+char* CNode::GetRecvBuffer(unsigned int& nSpace)
 {
+    // Once every message in the chunk has been processed it can be filled again from the start
+    if (pRecvChunk && pRecvChunk.unique())
+        nRecvChunkPos = 0;
+    if (!pRecvChunk || NET_RECV_CHUNK_SIZE - nRecvChunkPos < NET_RECV_CHUNK_MIN_SPACE) {
+        pRecvChunk = netRecvChunkPool.Allocate();
+        nRecvChunkPos = 0;
+    }
+    nSpace = NET_RECV_CHUNK_SIZE - nRecvChunkPos;
+    return &pRecvChunk->data[nRecvChunkPos];
+}
+
+// requires LOCK(cs_vRecvMsg)
+bool CNode::ReceiveMsgBytes(unsigned int nBytes)
+{
+    assert(pRecvChunk && nRecvChunkPos + nBytes <= NET_RECV_CHUNK_SIZE);
+    unsigned int nPos = nRecvChunkPos;
+    nRecvChunkPos += nBytes;
+
     while (nBytes > 0) {
 
         // get current incomplete message, or create a new one
@@ -799,9 +1022,9 @@ bool CNode::ReceiveMsgBytes(const char *pch, unsigned int nBytes)
         // absorb network data
         int handled;
         if (!msg.in_data)
-            handled = msg.readHeader(pch, nBytes);
+            handled = msg.readHeader(&pRecvChunk->data[nPos], nBytes);
         else
-            handled = msg.readData(pch, nBytes);
+            handled = msg.readData(pRecvChunk, nPos, nBytes);
 
         if (handled < 0)
                 return false;
@@ -811,7 +1034,7 @@ bool CNode::ReceiveMsgBytes(const char *pch, unsigned int nBytes)
             return false;
         }
 
-        pch += handled;
+        nPos += handled;
         nBytes -= handled;
 
         if (msg.complete())
@@ -852,20 +1075,16 @@ int CNetMessage::readHeader(const char *pch, unsigned int nBytes)
     return nCopy;
 }
 
-int CNetMessage::readData(const char *pch, unsigned int nBytes)
+int CNetMessage::readData(const CNetRecvChunkRef& chunk, unsigned int nPos, unsigned int nBytes)
 {
     unsigned int nRemaining = hdr.nMessageSize - nDataPos;
-    unsigned int nCopy = std::min(nRemaining, nBytes);
+    unsigned int nTake = std::min(nRemaining, nBytes);
 
-    if (vRecv.size() < nDataPos + nCopy) {
-        // Allocate up to 256 KiB ahead, but never more than the total message size.
-        vRecv.resize(std::min(hdr.nMessageSize, nDataPos + nCopy + 256 * 1024));
-    }
+    // The payload stays where it was received
+    vRecv.Append(chunk, nPos, nPos + nTake);
+    nDataPos += nTake;
 
-    memcpy(&vRecv[nDataPos], pch, nCopy);
-    nDataPos += nCopy;
-
-    return nCopy;
+    return nTake;
 }
 
 
@@ -876,26 +1095,80 @@ int CNetMessage::readData(const char *pch, unsigned int nBytes)
 
 
 
+CSharedPayload CSharedPayload::FromStream(CDataStream& ss)
+{
+    CSharedPayload payload;
+    uint256 hash = Hash(ss.begin(), ss.end());
+    memcpy(&payload.nChecksum, &hash, sizeof(payload.nChecksum));
+    CSerializeData* pdata = new CSerializeData;
+    ss.TakeData(*pdata);
+    payload.data.reset(pdata);
+    return payload;
+}
+
+#ifndef WIN32
+//! Most buffers handed to the kernel in a single call
+static const int MAX_SEND_IOV = 64;
+#endif
+
+//! Offers as much of the send queue to the socket as one call can take, nOffered is set to the
+//! number of bytes offered
+static int SendQueuedBuffers(CNode* pnode, size_t& nOffered)
+{
+#ifdef WIN32
+    const CSerializeData& data = *pnode->vSendMsg.front();
+    nOffered = data.size() - pnode->nSendOffset;
+    return send(pnode->hSocket, &data[pnode->nSendOffset], nOffered, MSG_NOSIGNAL | MSG_DONTWAIT);
+#else
+    struct iovec iov[MAX_SEND_IOV];
+    int nIov = 0;
+    size_t nOffset = pnode->nSendOffset;
+    nOffered = 0;
+    for (std::deque<CSendBufferRef>::const_iterator it = pnode->vSendMsg.begin(); it != pnode->vSendMsg.end() && nIov < MAX_SEND_IOV; ++it) {
+        const CSerializeData& data = **it;
+        assert(data.size() > nOffset);
+        iov[nIov].iov_base = (void*)&data[nOffset];
+        iov[nIov].iov_len = data.size() - nOffset;
+        nOffered += iov[nIov].iov_len;
+        nIov++;
+        nOffset = 0;
+    }
+    // sendmsg() rather than writev(), only it takes MSG_NOSIGNAL
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = nIov;
+    return sendmsg(pnode->hSocket, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+#endif
+}
+
 // requires LOCK(cs_vSend)
 void SocketSendData(CNode *pnode)
 {
-    std::deque<CSerializeData>::iterator it = pnode->vSendMsg.begin();
+    bool fSendBufferFull = pnode->nSendSize >= SendBufferSize();
 
-    while (it != pnode->vSendMsg.end()) {
-        const CSerializeData &data = *it;
-        assert(data.size() > pnode->nSendOffset);
-        int nBytes = send(pnode->hSocket, &data[pnode->nSendOffset], data.size() - pnode->nSendOffset, MSG_NOSIGNAL | MSG_DONTWAIT);
+    while (!pnode->vSendMsg.empty()) {
+        size_t nOffered;
+        int nBytes = SendQueuedBuffers(pnode, nOffered);
         if (nBytes > 0) {
             pnode->nLastSend = GetTime();
             pnode->nSendBytes += nBytes;
-            pnode->nSendOffset += nBytes;
             pnode->RecordBytesSent(nBytes);
-            if (pnode->nSendOffset == data.size()) {
+            // drop the buffers that went out completely
+            size_t nLeft = nBytes;
+            while (nLeft > 0) {
+                size_t nSize = pnode->vSendMsg.front()->size();
+                if (nLeft < nSize - pnode->nSendOffset) {
+                    pnode->nSendOffset += nLeft;
+                    break;
+                }
+                nLeft -= nSize - pnode->nSendOffset;
                 pnode->nSendOffset = 0;
-                pnode->nSendSize -= data.size();
-                it++;
-            } else {
-                // could not send full message; stop sending more
+                pnode->nSendSize -= nSize;
+                pnode->vSendMsg.pop_front();
+            }
+            if ((size_t)nBytes < nOffered) {
+                // could not send everything; stop sending more
                 break;
             }
         } else {
@@ -913,11 +1186,14 @@ void SocketSendData(CNode *pnode)
         }
     }
 
-    if (it == pnode->vSendMsg.end()) {
+    if (pnode->vSendMsg.empty()) {
         assert(pnode->nSendOffset == 0);
         assert(pnode->nSendSize == 0);
     }
-    pnode->vSendMsg.erase(pnode->vSendMsg.begin(), it);
+
+    // The message handler stops processing a peer's messages while its send buffer is full
+    if (fSendBufferFull && pnode->nSendSize < SendBufferSize())
+        WakeMessageHandler(pnode);
 }
 
 static list<CNode*> vNodesDisconnected;
@@ -967,15 +1243,392 @@ static void AddIncomingI2pConnection(SOCKET hSocket, const CAddress& addr)
         {
             LOCK(cs_vNodes);
             vNodes.push_back(pnode);
+            RegisterNodeSocket(pnode);
         }
     }
 }
+
+/**
+ * Issues nCount STREAM ACCEPTs at once and queues the armed sockets for the socket thread.
+ * Returns how many got armed.  A bridge speaking SAM 3.0 or 3.1 refuses a second accept on the
+ * session with ALREADY_ACCEPTING, the pool then shrinks to what the bridge allows.
+ */
+static int ArmI2PAccepts(int nCount)
+{
+    int64_t nStart = GetTimeMillis();
+    std::vector<SAM::StreamConnector::Result> vResults = I2PSession::Instance().accept(nCount, false);
+    int64_t nNow = GetTimeMillis();
+
+    std::vector<I2PListenSocket> vArmed;
+    bool fAlreadyAccepting = false;
+    BOOST_FOREACH(const SAM::StreamConnector::Result& result, vResults) {
+        if (result.status == SAM::Message::ALREADY_ACCEPTING)
+            fAlreadyAccepting = true;
+        if (result.status != SAM::Message::OK)
+            continue;
+        SOCKET hSocket = result.socket;
+        if (SetSocketNonBlocking(hSocket, true))
+            vArmed.push_back(I2PListenSocket(hSocket, nNow));
+        else {
+            LogPrintf( "ERROR - Unable to set I2P Socket options to non-blocking, after I2P accept was issued.\n" );
+            CloseSocket(hSocket);
+        }
+    }
+
+    int nTarget = 0;
+    {
+        boost::lock_guard<boost::mutex> lock(mutexI2PAccept);
+        CI2PAcceptStats& stats = i2pAcceptStats;
+        vI2PAcceptArmed.insert(vI2PAcceptArmed.end(), vArmed.begin(), vArmed.end());
+        stats.nOutstanding += vArmed.size();
+        stats.nArmed += vArmed.size();
+        stats.nFailed += vResults.size() - vArmed.size();
+        stats.nArmTimeTotal += (nNow - nStart) * vArmed.size();
+        stats.nArmTimeMax = std::max(stats.nArmTimeMax, nNow - nStart);
+        if (fAlreadyAccepting && stats.nTarget > std::max(1, stats.nOutstanding))
+            nTarget = stats.nTarget = std::max(1, stats.nOutstanding);
+    }
+    if (nTarget)
+        LogPrintf("I2P accept pool reduced to %d, the SAM %s bridge allows no more STREAM ACCEPTs on the session\n", nTarget, I2PSession::Instance().getSAMVersion());
+    LogPrint("net", "armed %d of %d I2P accepts in %dms\n", vArmed.size(), nCount, nNow - nStart);
+    return vArmed.size();
+}
+
+//! Moves the accepts armed by the pool thread over to the socket thread's listen sockets
+static void AdoptI2PAccepts()
+{
+    boost::lock_guard<boost::mutex> lock(mutexI2PAccept);
+    vhI2PListenSocket.insert(vhI2PListenSocket.end(), vI2PAcceptArmed.begin(), vI2PAcceptArmed.end());
+    vI2PAcceptArmed.clear();
+}
+
+//! An armed accept got used up, either by a peer or because the bridge closed it
+static void I2PAcceptDone(const I2PListenSocket& hI2PListenSocket, bool fAccepted)
+{
+    boost::lock_guard<boost::mutex> lock(mutexI2PAccept);
+    CI2PAcceptStats& stats = i2pAcceptStats;
+    stats.nOutstanding--;
+    if (fAccepted) {
+        int64_t nWait = GetTimeMillis() - hI2PListenSocket.nTimeArmed;
+        stats.nAccepted++;
+        stats.nWaitTimeTotal += nWait;
+        stats.nWaitTimeMax = std::max(stats.nWaitTimeMax, nWait);
+    } else
+        stats.nEmpty++;
+    condI2PAccept.notify_one();
+}
+
+/**
+ * Reads the destination line the bridge sends once a peer connected to an armed accept and turns
+ * the socket into an inbound node.  Returns false while the line is incomplete, true once the accept
+ * is used up, fAccepted tells whether that was by a peer.  What arrived of the line is consumed into
+ * strLine, so the socket does not stay readable until the rest shows up.  Only the line is consumed,
+ * whatever the peer sent right behind it belongs to the node.
+ */
+static bool ReceiveI2PAcceptLine(I2PListenSocket& hI2PListenSocket, bool& fAccepted)
+{
+    fAccepted = false;
+    SOCKET& hSocket = hI2PListenSocket.socket;
+    std::string& strLine = hI2PListenSocket.strLine;
+    const size_t bufSize = 1024;            // Same as i2pd has set on the other end
+    char pchBuf[bufSize + 1];
+    int nBytes = recv(hSocket, pchBuf, bufSize - strLine.size(), MSG_PEEK | MSG_DONTWAIT);
+    if (nBytes > 0)
+    {
+        pchBuf[nBytes] = 0;
+        // When a '/n' return shows up we got their destination identity
+        // See this url for destination specifications https://geti2p.net/en/docs/spec/common-structures#struct_Destination
+        // Although over I2P Sam we get it as a base64 string.
+        char *pNewLine = (char*)memchr( pchBuf, '\n', nBytes );
+        int nConsume = pNewLine ? pNewLine - pchBuf + 1 : nBytes;
+        if (recv(hSocket, pchBuf, nConsume, MSG_DONTWAIT) != nConsume) {
+            LogPrintf("WARNING - I2P listen socket lost data it had shown, will attempt to open a new one.\n");
+            CloseSocket(hSocket);
+            return true;
+        }
+        strLine.append(pchBuf, pNewLine ? nConsume - 1 : nConsume);
+        if( !pNewLine ) {
+            if( strLine.size() < bufSize )  // The rest of the line is still on its way
+                return false;
+            LogPrintf("WARNING - No eol found in destination address from router, size & data received (%d) [%s]\n", strLine.size(), strLine);
+            CloseSocket(hSocket);
+            return true;
+        }
+        // SAM 3.2 appends FROM_PORT and TO_PORT behind the destination
+        std::string incomingAddr = strLine.substr(0, strLine.find(' '));
+        // Lets make sure it looks correct as a base64 i2p destination string
+        if( incomingAddr.size() == NATIVE_I2P_DESTINATION_SIZE )
+        {
+            // Fantastic if it checks out, we have another node!
+            // The socket will be bound to that and used for message communications
+            CAddress addr;
+            if( addr.SetI2pDestination(incomingAddr) ) {
+                AddIncomingI2pConnection(hSocket, addr);
+                fAccepted = true;
+            } else {
+                LogPrintf("WARNING - Invalid incoming destination address, unable to setup node.  Received (%s)\n", incomingAddr.c_str());
+                CloseSocket(hSocket);
+            }
+        } else {
+            LogPrintf("WARNING - Destination size mismatch. Only 516 chars+newline allowed. Received (%d) bytes or limit(1024), the string in []:\n[%s]", strLine.size(), strLine);
+            CloseSocket(hSocket);
+        }
+    }
+    else if (nBytes == 0)
+    {
+        // socket closed gracefully, but why?  This shouldn't have happened
+        LogPrintf("WARNING - I2P listen socket was closed unexpectedly, with no data received.  Will attempt to open a new one.\n");
+        CloseSocket(hSocket);
+    }
+    else
+    {
+        const int nErr = WSAGetLastError();
+        if (nErr == WSAEWOULDBLOCK || nErr == WSAEMSGSIZE || nErr == WSAEINTR || nErr == WSAEINPROGRESS)
+            return false;
+        LogPrintf("WARNING - I2P listen socket recv error %d, Will attempt to open a new one.\n", nErr);
+        CloseSocket(hSocket);
+    }
+    return true;
+}
+
+/**
+ * Keeps the accept pool full.  Every accept a peer used up is replaced from here, so the socket
+ * thread never waits on the bridge and several peers can come in at the same time.  While the bridge
+ * refuses accepts the thread backs off, up to 30 seconds between attempts.
+ */
+static void ThreadI2PAcceptPool()
+{
+    int64_t nBackoff = 0;
+    while (true)
+    {
+        int nMissing;
+        {
+            boost::unique_lock<boost::mutex> lock(mutexI2PAccept);
+            while (i2pAcceptStats.nOutstanding >= i2pAcceptStats.nTarget)
+                condI2PAccept.timed_wait(lock, boost::posix_time::seconds(1));
+            nMissing = i2pAcceptStats.nTarget - i2pAcceptStats.nOutstanding;
+        }
+        if (!IsLimited(NET_I2P) && ArmI2PAccepts(nMissing) > 0) {
+            nBackoff = 0;
+            continue;
+        }
+        nBackoff = nBackoff ? std::min(nBackoff * 2, (int64_t)30000) : 500;
+        MilliSleep(nBackoff);
+    }
+}
+#endif // ENABLE_I2PSAM
+
+//! Reads once from the peer's socket, the caller holds cs_vRecvMsg. Returns false when there
+//! was nothing to read or the socket got closed.
+static bool SocketRecvData(CNode* pnode)
+{
+    // typical socket buffer is 8K-64K
+    unsigned int nSpace;
+    char* pchBuf = pnode->GetRecvBuffer(nSpace);
+    int nBytes = recv(pnode->hSocket, pchBuf, nSpace, MSG_DONTWAIT);
+    if (nBytes > 0)
+    {
+        if (!pnode->ReceiveMsgBytes(nBytes))
+            pnode->CloseSocketDisconnect();
+        pnode->nLastRecv = GetTime();
+        pnode->nRecvBytes += nBytes;
+        pnode->RecordBytesRecv(nBytes);
+        if (!pnode->vRecvMsg.empty() && pnode->vRecvMsg.front().complete())
+            WakeMessageHandler(pnode);
+        return pnode->hSocket != INVALID_SOCKET;
+    }
+    else if (nBytes == 0)
+    {
+        // socket closed gracefully
+        if (!pnode->fDisconnect)
+            LogPrint("net", "socket closed\n");
+        pnode->CloseSocketDisconnect();
+    }
+    else if (nBytes < 0)
+    {
+        // error
+        int nErr = WSAGetLastError();
+        if (nErr != WSAEWOULDBLOCK && nErr != WSAEMSGSIZE && nErr != WSAEINTR && nErr != WSAEINPROGRESS)
+        {
+            if (!pnode->fDisconnect)
+                LogPrintf("socket recv error %s\n", NetworkErrorString(nErr));
+            pnode->CloseSocketDisconnect();
+        }
+    }
+    return false;
+}
+
+static void CheckNodeInactivity(CNode* pnode)
+{
+    int64_t nTime = GetTime();
+    if (nTime - pnode->nTimeConnected > 60)
+    {
+        if (pnode->nLastRecv == 0 || pnode->nLastSend == 0)
+        {
+            LogPrint("net", "socket no message in first 60 seconds, %d %d from %s\n", pnode->nLastRecv != 0, pnode->nLastSend != 0, GetPeerLogStr(pnode));
+            pnode->fDisconnect = true;
+        }
+        else if (nTime - pnode->nLastSend > TIMEOUT_INTERVAL)
+        {
+            LogPrintf("socket sending timeout: %is\n", nTime - pnode->nLastSend);
+            pnode->fDisconnect = true;
+        }
+        else if (nTime - pnode->nLastRecv > TIMEOUT_INTERVAL)
+        {
+            LogPrintf("socket receive timeout: %is\n", nTime - pnode->nLastRecv);
+            pnode->fDisconnect = true;
+        }
+        else if (pnode->nPingNonceSent && pnode->nPingUsecStart + TIMEOUT_INTERVAL * 1000000 < GetTimeMicros())
+        {
+            LogPrintf("ping timeout: %fs\n", 0.000001 * (GetTimeMicros() - pnode->nPingUsecStart));
+            pnode->fDisconnect = true;
+        }
+    }
+}
+
+static bool IsEpollActive()
+{
+#ifdef USE_EPOLL
+    return hEpoll != -1;
+#else
+    return false;
+#endif
+}
+
+#ifdef USE_EPOLL
+//! Peers with socket events ThreadSocketHandler has not fully consumed yet, each holding a reference
+static std::set<CNode*> setPollPending;
+
+//! Waits for socket events, with epoll the cost of a loop no longer grows with the number of peers.
+//! The listen sockets are few and watched with poll() next to the epoll descriptor, the peers that
+//! have events are added to setPollPending. When the last loop made progress on pending peers we
+//! don't sleep at all, when they are only waiting on the message handler we check back shortly.
+static void WaitForEpollEvents(std::set<SOCKET>& setListenReady, bool fProgress)
+{
+    std::vector<struct pollfd> vPollFds;
+    struct pollfd pollEpoll;
+    pollEpoll.fd = hEpoll;
+    pollEpoll.events = POLLIN;
+    pollEpoll.revents = 0;
+    vPollFds.push_back(pollEpoll);
+    BOOST_FOREACH(const ListenSocket& hListenSocket, vhListenSocket) {
+        if (hListenSocket.socket == INVALID_SOCKET)
+            continue;
+        struct pollfd pollListen;
+        pollListen.fd = hListenSocket.socket;
+        pollListen.events = POLLIN;
+        pollListen.revents = 0;
+        vPollFds.push_back(pollListen);
+    }
+#ifdef ENABLE_I2PSAM
+    BOOST_FOREACH(const I2PListenSocket& hI2PListenSocket, vhI2PListenSocket) {
+        struct pollfd pollListen;
+        pollListen.fd = hI2PListenSocket.socket;
+        pollListen.events = POLLIN;
+        pollListen.revents = 0;
+        vPollFds.push_back(pollListen);
+    }
 #endif // ENABLE_I2PSAM
 
+    int nTimeout = fProgress ? 0 : (setPollPending.empty() ? 50 : 10);
+    if (poll(&vPollFds[0], vPollFds.size(), nTimeout) < 0)
+    {
+        int nErr = WSAGetLastError();
+        if (nErr != WSAEINTR)
+            LogPrintf("socket poll error %s\n", NetworkErrorString(nErr));
+        MilliSleep(nTimeout);
+        return;
+    }
+    boost::this_thread::interruption_point();
+
+    for (unsigned int i = 1; i < vPollFds.size(); i++)
+        if (vPollFds[i].revents)
+            setListenReady.insert(vPollFds[i].fd);
+    if (!vPollFds[0].revents)
+        return;
+
+    struct epoll_event events[MAX_EPOLL_EVENTS];
+    LOCK(cs_vNodes);
+    int nEvents = epoll_wait(hEpoll, events, MAX_EPOLL_EVENTS, 0);
+    for (int i = 0; i < nEvents; i++)
+    {
+        CNode* pnode = (CNode*)events[i].data.ptr;
+        // Hangups and errors are found out about by reading from the socket
+        if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+            pnode->fPollRecv = true;
+        if (events[i].events & EPOLLOUT)
+            pnode->fPollSend = true;
+        if (setPollPending.insert(pnode).second)
+            pnode->AddRef();
+    }
+}
+
+//! Services the peers with pending socket events. Sending goes first, and like with select() a
+//! peer with queued data is not read from until the queue drained, to keep TCP flow control
+//! working. Returns whether any data moved.
+static bool ServiceEpollNodes()
+{
+    bool fProgress = false;
+    std::vector<CNode*> vNodesDone;
+    BOOST_FOREACH(CNode* pnode, setPollPending)
+    {
+        boost::this_thread::interruption_point();
+
+        bool fSendQueued = false;
+        if (pnode->hSocket != INVALID_SOCKET)
+        {
+            TRY_LOCK(pnode->cs_vSend, lockSend);
+            if (lockSend)
+            {
+                if (pnode->fPollSend && !pnode->vSendMsg.empty()) {
+                    SocketSendData(pnode);
+                    fProgress = true;
+                }
+                // Until the send buffer fills up again, any new data is written optimistically
+                pnode->fPollSend = false;
+                fSendQueued = !pnode->vSendMsg.empty();
+            }
+        }
+
+        if (pnode->hSocket != INVALID_SOCKET && pnode->fPollRecv && !fSendQueued)
+        {
+            TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
+            if (lockRecv)
+            {
+                // A few reads at most, so a single busy peer doesn't hold up the others
+                for (int i = 0; i < 4 && pnode->fPollRecv; i++)
+                {
+                    if (!pnode->vRecvMsg.empty() && pnode->vRecvMsg.front().complete() &&
+                        pnode->GetTotalRecvSize() > ReceiveFloodSize())
+                        break;
+                    if (SocketRecvData(pnode))
+                        fProgress = true;
+                    else
+                        pnode->fPollRecv = false;
+                }
+            }
+        }
+
+        if (pnode->hSocket == INVALID_SOCKET || (!pnode->fPollRecv && !pnode->fPollSend))
+            vNodesDone.push_back(pnode);
+    }
+
+    LOCK(cs_vNodes);
+    BOOST_FOREACH(CNode* pnode, vNodesDone)
+    {
+        setPollPending.erase(pnode);
+        pnode->Release();
+    }
+    return fProgress;
+}
+#endif // USE_EPOLL
+
  //! Main Thread that handles socket's & their housekeeping...
 void ThreadSocketHandler()
 {
     unsigned int nPrevNodeCount = 0;
+    int64_t nLastInactivityCheck = 0;
+    bool fPollProgress = false;
     while (true)
     {
         //
@@ -1050,93 +1703,111 @@ void ThreadSocketHandler()
         //
         // Find which sockets have data to receive
         //
-        struct timeval timeout;
-        timeout.tv_sec  = 0;
-        timeout.tv_usec = 50000; // frequency to poll pnode->vSend
-
         fd_set fdsetRecv;
         fd_set fdsetSend;
         fd_set fdsetError;
         FD_ZERO(&fdsetRecv);
         FD_ZERO(&fdsetSend);
         FD_ZERO(&fdsetError);
-        SOCKET hSocketMax = 0;
-        bool have_fds = false;
+        std::set<SOCKET> setListenReady;
+
+        if (IsEpollActive())
+        {
+#ifdef USE_EPOLL
+            WaitForEpollEvents(setListenReady, fPollProgress);
+#endif
+        }
+        else
+        {
+            struct timeval timeout;
+            timeout.tv_sec  = 0;
+            timeout.tv_usec = 50000; // frequency to poll pnode->vSend
+
+            SOCKET hSocketMax = 0;
+            bool have_fds = false;
 
 #ifdef ENABLE_I2PSAM
-        BOOST_FOREACH(SOCKET hI2PListenSocket, vhI2PListenSocket) {
-            if (hI2PListenSocket != INVALID_SOCKET) {
-                FD_SET(hI2PListenSocket, &fdsetRecv);
-                hSocketMax = max(hSocketMax, hI2PListenSocket);
+            BOOST_FOREACH(const I2PListenSocket& hI2PListenSocket, vhI2PListenSocket) {
+                FD_SET(hI2PListenSocket.socket, &fdsetRecv);
+                hSocketMax = max(hSocketMax, hI2PListenSocket.socket);
                 have_fds = true;
             }
-        }
 #endif // ENABLE_I2PSAM
 
-        BOOST_FOREACH(const ListenSocket& hListenSocket, vhListenSocket) {
-            FD_SET(hListenSocket.socket, &fdsetRecv);
-            hSocketMax = max(hSocketMax, hListenSocket.socket);
-            have_fds = true;
-        }
-
-        {
-            LOCK(cs_vNodes);
-            BOOST_FOREACH(CNode* pnode, vNodes)
-            {
-                if (pnode->hSocket == INVALID_SOCKET)
-                    continue;
-                FD_SET(pnode->hSocket, &fdsetError);
-                hSocketMax = max(hSocketMax, pnode->hSocket);
+            BOOST_FOREACH(const ListenSocket& hListenSocket, vhListenSocket) {
+                FD_SET(hListenSocket.socket, &fdsetRecv);
+                hSocketMax = max(hSocketMax, hListenSocket.socket);
                 have_fds = true;
+            }
 
-                // Implement the following logic:
-                // * If there is data to send, select() for sending data. As this only
-                //   happens when optimistic write failed, we choose to first drain the
-                //   write buffer in this case before receiving more. This avoids
-                //   needlessly queueing received data, if the remote peer is not themselves
-                //   receiving data. This means properly utilizing TCP flow control signalling.
-                // * Otherwise, if there is no (complete) message in the receive buffer,
-                //   or there is space left in the buffer, select() for receiving data.
-                // * (if neither of the above applies, there is certainly one message
-                //   in the receiver buffer ready to be processed).
-                // Together, that means that at least one of the following is always possible,
-                // so we don't deadlock:
-                // * We send some data.
-                // * We wait for data to be received (and disconnect after timeout).
-                // * We process a message in the buffer (message handler thread).
+            {
+                LOCK(cs_vNodes);
+                BOOST_FOREACH(CNode* pnode, vNodes)
                 {
-                    TRY_LOCK(pnode->cs_vSend, lockSend);
-                    if (lockSend && !pnode->vSendMsg.empty()) {
-                        FD_SET(pnode->hSocket, &fdsetSend);
+                    if (pnode->hSocket == INVALID_SOCKET)
                         continue;
+                    FD_SET(pnode->hSocket, &fdsetError);
+                    hSocketMax = max(hSocketMax, pnode->hSocket);
+                    have_fds = true;
+
+                    // Implement the following logic:
+                    // * If there is data to send, select() for sending data. As this only
+                    //   happens when optimistic write failed, we choose to first drain the
+                    //   write buffer in this case before receiving more. This avoids
+                    //   needlessly queueing received data, if the remote peer is not themselves
+                    //   receiving data. This means properly utilizing TCP flow control signalling.
+                    // * Otherwise, if there is no (complete) message in the receive buffer,
+                    //   or there is space left in the buffer, select() for receiving data.
+                    // * (if neither of the above applies, there is certainly one message
+                    //   in the receiver buffer ready to be processed).
+                    // Together, that means that at least one of the following is always possible,
+                    // so we don't deadlock:
+                    // * We send some data.
+                    // * We wait for data to be received (and disconnect after timeout).
+                    // * We process a message in the buffer (message handler thread).
+                    {
+                        TRY_LOCK(pnode->cs_vSend, lockSend);
+                        if (lockSend && !pnode->vSendMsg.empty()) {
+                            FD_SET(pnode->hSocket, &fdsetSend);
+                            continue;
+                        }
+                    }
+                    {
+                        TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
+                        if (lockRecv && (
+                            pnode->vRecvMsg.empty() || !pnode->vRecvMsg.front().complete() ||
+                            pnode->GetTotalRecvSize() <= ReceiveFloodSize()))
+                            FD_SET(pnode->hSocket, &fdsetRecv);
                     }
-                }
-                {
-                    TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
-                    if (lockRecv && (
-                        pnode->vRecvMsg.empty() || !pnode->vRecvMsg.front().complete() ||
-                        pnode->GetTotalRecvSize() <= ReceiveFloodSize()))
-                        FD_SET(pnode->hSocket, &fdsetRecv);
                 }
             }
-        }
 
-        int nSelect = select(have_fds ? hSocketMax + 1 : 0,
-                             &fdsetRecv, &fdsetSend, &fdsetError, &timeout);
-        boost::this_thread::interruption_point();
+            int nSelect = select(have_fds ? hSocketMax + 1 : 0,
+                                 &fdsetRecv, &fdsetSend, &fdsetError, &timeout);
+            boost::this_thread::interruption_point();
 
-        if (nSelect == SOCKET_ERROR)
-        {
-            if (have_fds)
+            if (nSelect == SOCKET_ERROR)
             {
-                int nErr = WSAGetLastError();
-                LogPrintf("socket select error %s\n", NetworkErrorString(nErr));
-                for (unsigned int i = 0; i <= hSocketMax; i++)
-                    FD_SET(i, &fdsetRecv);
+                if (have_fds)
+                {
+                    int nErr = WSAGetLastError();
+                    LogPrintf("socket select error %s\n", NetworkErrorString(nErr));
+                    for (unsigned int i = 0; i <= hSocketMax; i++)
+                        FD_SET(i, &fdsetRecv);
+                }
+                FD_ZERO(&fdsetSend);
+                FD_ZERO(&fdsetError);
+                MilliSleep(timeout.tv_usec/1000);
             }
-            FD_ZERO(&fdsetSend);
-            FD_ZERO(&fdsetError);
-            MilliSleep(timeout.tv_usec/1000);
+
+            BOOST_FOREACH(const ListenSocket& hListenSocket, vhListenSocket)
+                if (hListenSocket.socket != INVALID_SOCKET && FD_ISSET(hListenSocket.socket, &fdsetRecv))
+                    setListenReady.insert(hListenSocket.socket);
+#ifdef ENABLE_I2PSAM
+            BOOST_FOREACH(const I2PListenSocket& hI2PListenSocket, vhI2PListenSocket)
+                if (FD_ISSET(hI2PListenSocket.socket, &fdsetRecv))
+                    setListenReady.insert(hI2PListenSocket.socket);
+#endif // ENABLE_I2PSAM
         }
 
         //
@@ -1145,7 +1816,7 @@ void ThreadSocketHandler()
         if( !IsI2POnly() ) {    //If I2P is the onlynet, we do not execute listen code for clearnet
         BOOST_FOREACH(const ListenSocket& hListenSocket, vhListenSocket)
         {
-            if (hListenSocket.socket != INVALID_SOCKET && FD_ISSET(hListenSocket.socket, &fdsetRecv))
+            if (hListenSocket.socket != INVALID_SOCKET && setListenReady.count(hListenSocket.socket))
             {
                 struct sockaddr_storage sockaddr;
                 socklen_t len = sizeof(sockaddr);
@@ -1189,6 +1860,7 @@ void ThreadSocketHandler()
                     {
                         LOCK(cs_vNodes);
                         vNodes.push_back(pnode);
+                        RegisterNodeSocket(pnode);
                     }
                 }
             }
@@ -1198,78 +1870,20 @@ void ThreadSocketHandler()
         //
         // Accept new incoming I2P connections
         //
-        {
-            std::vector<SOCKET>::iterator it = vhI2PListenSocket.begin();       // Start at the beginning of the list of listening sockets
-            // As long as the router is still up & there are some sockets to listen on, keep trying to accept new connections
-            while( !IsLimited( NET_I2P ) &&  it != vhI2PListenSocket.end() )
+        AdoptI2PAccepts();
+        if( !IsLimited( NET_I2P ) ) {
+            std::vector<I2PListenSocket>::iterator it = vhI2PListenSocket.begin();
+            while( it != vhI2PListenSocket.end() )
             {
-                SOCKET& hI2PListenSocket = *it;
-                if( hI2PListenSocket == INVALID_SOCKET ) {
-                    it = vhI2PListenSocket.erase(it);
-                    if( !BindListenNativeI2P() )
-                        break;
-                    it = vhI2PListenSocket.begin();             // Start over from the beginning
+                // At this point we have an armed accept, lets see if anyone is knocking...
+                bool fAccepted;
+                if( !setListenReady.count(it->socket) || !ReceiveI2PAcceptLine(*it, fAccepted) ) {
+                    it++;
                     continue;
                 }
-                // At this point we have a valid socket setup to accept inbound connections, lets see if anyone is knocking...
-                if (FD_ISSET(hI2PListenSocket, &fdsetRecv))
-                {
-                    const size_t bufSize = 1024;            // Same as i2pd has set on the other end
-                    char pchBuf[bufSize];
-                    memset(pchBuf, 0, bufSize);             // Yap someone is trying, lets find out who
-                    int nBytes = recv(hI2PListenSocket, pchBuf, sizeof(pchBuf), MSG_DONTWAIT);
-                    if (nBytes > 0)
-                    {
-                        // When a '/n' return shows up we got their destination identity
-                        // See this url for destination specifications https://geti2p.net/en/docs/spec/common-structures#struct_Destination
-                        // Although over I2P Sam we get it as a base64 string.
-                        char *pNewLine = strchr( pchBuf, '\n' );
-                        if( pNewLine ) {                     // Yap the address is all here, pNewLine would be null otherwise.
-                            // Lets make sure it looks correct as a base64 i2p destination string
-                            // We've been waiting for a valid base64 string, followed by a '\n' character, we got that.
-                            if( strlen(pchBuf) == NATIVE_I2P_DESTINATION_SIZE + 1 )
-                            {
-                                // Fantastic if it checks out, we have another node!
-                                // The socket will be bound to that and used for message communications
-                                std::string incomingAddr(pchBuf, pchBuf + NATIVE_I2P_DESTINATION_SIZE);
-                                CAddress addr;
-                                if( addr.SetI2pDestination(incomingAddr) )
-                                    AddIncomingI2pConnection(hI2PListenSocket, addr);
-                                else {
-                                    LogPrintf("WARNING - Invalid incoming destination address, unable to setup node.  Received (%s)\n", incomingAddr.c_str());
-                                    CloseSocket(hI2PListenSocket);
-                                }
-                            } else {
-                                LogPrintf("WARNING - Destination size mismatch. Only 516 chars+newline allowed. Received (%d) bytes or limit(1024), the string in []:\n[%s]", nBytes, pchBuf);
-                                CloseSocket(hI2PListenSocket);
-                            }
-                        } else {
-                            LogPrintf("WARNING - No eol found in destination address from router, size & data received (%d) [%s]\n", nBytes, pchBuf);
-                            CloseSocket(hI2PListenSocket);
-                        }
-                    }
-                    else if (nBytes == 0)
-                    {
-                        // socket closed gracefully, but why?  This shouldn't have happened
-                        LogPrintf("WARNING - I2P listen socket was closed unexpectedly, with no data received.  Will attempt to open a new one.\n");
-                        CloseSocket(hI2PListenSocket);
-                    }
-                    else if (nBytes < 0)
-                    {
-                        // error
-                        const int nErr = WSAGetLastError();
-                        if (nErr == WSAEWOULDBLOCK || nErr == WSAEMSGSIZE || nErr == WSAEINTR || nErr == WSAEINPROGRESS)
-                            continue;
-
-                        LogPrintf("WARNING - I2P listen socket recv error %d, Will attempt to open a new one.\n", nErr);
-                        CloseSocket(hI2PListenSocket);
-                    }
-                    // We now need to invalidate that socket from accepting new inbound connections,
-                    // it was either closed do to an error, or hopefully a new node was added to our peers list as inbound.
-                    // It will be sweep away and erased, then a new acceptor added later
-                    *it++ = INVALID_SOCKET;
-                } else                                      // Just keep looking
-                    it++;
+                // The accept is used up, a new peer was added or the socket was closed.  The pool thread arms a new one
+                I2PAcceptDone(*it, fAccepted);
+                it = vhI2PListenSocket.erase(it);
             }
         }
 #endif  // ENABLE_I2PSAM
@@ -1277,8 +1891,18 @@ void ThreadSocketHandler()
         //
         // Service each socket
         //
+        // With epoll only the peers that had socket events are serviced, every peer still gets
+        // its inactivity checks once a second.
+        bool fServiceAll = !IsEpollActive();
+        bool fCheckInactivity = fServiceAll || GetTimeMillis() - nLastInactivityCheck >= 1000;
+#ifdef USE_EPOLL
+        if (!fServiceAll)
+            fPollProgress = ServiceEpollNodes();
+#endif
         vector<CNode*> vNodesCopy;
+        if (fCheckInactivity)
         {
+            nLastInactivityCheck = GetTimeMillis();
             LOCK(cs_vNodes);
             vNodesCopy = vNodes;
             BOOST_FOREACH(CNode* pnode, vNodesCopy)
@@ -1288,89 +1912,47 @@ void ThreadSocketHandler()
         {
             boost::this_thread::interruption_point();
 
-            //
-            // Receive
-            //
             if (pnode->hSocket == INVALID_SOCKET)
                 continue;
-            if (FD_ISSET(pnode->hSocket, &fdsetRecv) || FD_ISSET(pnode->hSocket, &fdsetError))
+            if (fServiceAll)
             {
-                TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
-                if (lockRecv)
+                //
+                // Receive
+                //
+                if (FD_ISSET(pnode->hSocket, &fdsetRecv) || FD_ISSET(pnode->hSocket, &fdsetError))
                 {
-                    {
-                        // typical socket buffer is 8K-64K
-                        char pchBuf[0x10000];
-                        int nBytes = recv(pnode->hSocket, pchBuf, sizeof(pchBuf), MSG_DONTWAIT);
-                        if (nBytes > 0)
-                        {
-                            if (!pnode->ReceiveMsgBytes(pchBuf, nBytes))
-                                pnode->CloseSocketDisconnect();
-                            pnode->nLastRecv = GetTime();
-                            pnode->nRecvBytes += nBytes;
-                            pnode->RecordBytesRecv(nBytes);
-                        }
-                        else if (nBytes == 0)
-                        {
-                            // socket closed gracefully
-                            if (!pnode->fDisconnect)
-                                LogPrint("net", "socket closed\n");
-                            pnode->CloseSocketDisconnect();
-                        }
-                        else if (nBytes < 0)
-                        {
-                            // error
-                            int nErr = WSAGetLastError();
-                            if (nErr != WSAEWOULDBLOCK && nErr != WSAEMSGSIZE && nErr != WSAEINTR && nErr != WSAEINPROGRESS)
-                            {
-                                if (!pnode->fDisconnect)
-                                    LogPrintf("socket recv error %s\n", NetworkErrorString(nErr));
-                                pnode->CloseSocketDisconnect();
-                            }
-                        }
-                    }
+                    TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
+                    if (lockRecv)
+                        SocketRecvData(pnode);
                 }
-            }
 
-            //
-            // Send
-            //
-            if (pnode->hSocket == INVALID_SOCKET)
-                continue;
-            if (FD_ISSET(pnode->hSocket, &fdsetSend))
+                //
+                // Send
+                //
+                if (pnode->hSocket == INVALID_SOCKET)
+                    continue;
+                if (FD_ISSET(pnode->hSocket, &fdsetSend))
+                {
+                    TRY_LOCK(pnode->cs_vSend, lockSend);
+                    if (lockSend)
+                        SocketSendData(pnode);
+                }
+            }
+#ifdef USE_EPOLL
+            else if (pnode->nSendSize > 0)
             {
-                TRY_LOCK(pnode->cs_vSend, lockSend);
-                if (lockSend)
-                    SocketSendData(pnode);
+                // Should an edge ever get lost, queued data still goes out within a second
+                LOCK(cs_vNodes);
+                pnode->fPollSend = true;
+                if (setPollPending.insert(pnode).second)
+                    pnode->AddRef();
             }
+#endif
 
             //
             // Inactivity checking
             //
-            int64_t nTime = GetTime();
-            if (nTime - pnode->nTimeConnected > 60)
-            {
-                if (pnode->nLastRecv == 0 || pnode->nLastSend == 0)
-                {
-                    LogPrint("net", "socket no message in first 60 seconds, %d %d from %s\n", pnode->nLastRecv != 0, pnode->nLastSend != 0, GetPeerLogStr(pnode));
-                    pnode->fDisconnect = true;
-                }
-                else if (nTime - pnode->nLastSend > TIMEOUT_INTERVAL)
-                {
-                    LogPrintf("socket sending timeout: %is\n", nTime - pnode->nLastSend);
-                    pnode->fDisconnect = true;
-                }
-                else if (nTime - pnode->nLastRecv > TIMEOUT_INTERVAL)
-                {
-                    LogPrintf("socket receive timeout: %is\n", nTime - pnode->nLastRecv);
-                    pnode->fDisconnect = true;
-                }
-                else if (pnode->nPingNonceSent && pnode->nPingUsecStart + TIMEOUT_INTERVAL * 1000000 < GetTimeMicros())
-                {
-                    LogPrintf("ping timeout: %fs\n", 0.000001 * (GetTimeMicros() - pnode->nPingUsecStart));
-                    pnode->fDisconnect = true;
-                }
-            }
+            CheckNodeInactivity(pnode);
         }
         {
             LOCK(cs_vNodes);
@@ -1529,6 +2111,11 @@ void ThreadDNSAddressSeed()
         LogPrintf("Loading b32.i2p destination seednodes...\n");
         const vector<CDNSSeedData> &i2pvSeeds = Params().i2pDNSSeeds();
         vector<CAddress> vAdd;
+        // Have the router look them all up at once, SetSpecial() below joins those lookups
+        vector<string> vSeedNames;
+        BOOST_FOREACH(const CDNSSeedData &seed, i2pvSeeds)
+            vSeedNames.push_back(seed.host);
+        i2pnames.Prefetch(vSeedNames);
         BOOST_FOREACH(const CDNSSeedData &seed, i2pvSeeds) {
             CAddress addrSeed;
             // Lookup the b32.i2p destination, if it returns true, then the full Base64 destination is loaded,
@@ -1595,6 +2182,9 @@ void DumpAddresses()
 
     CAddrDB adb;
     adb.Write(addrman);
+#ifdef ENABLE_I2PSAM
+    adb.Write(i2pnames);
+#endif
 
     LogPrint("net", "Flushed %d addresses to peers.dat  %dms\n",
            addrman.size(), GetTimeMillis() - nStart);
@@ -1618,6 +2208,109 @@ void static ProcessOneShot()
     }
 }
 
+//! Chooses the next outbound peer from addrman, an invalid address if none fits right now
+static CAddress SelectOutboundAddress(const set<vector<unsigned char> >& setConnected, int64_t nANow)
+{
+    CAddress addrConnect;
+    int nTries = 0;
+    while (true)
+    {
+        // use an nUnkBias between 10 (no outgoing connections), and we need to try to connect to good nodes,
+        // that have been tried before and found to be likely good connections, out to 90% where almost every
+        // node tried will be a new and untested node address.
+        // At min pass 10(%) to Select when no outbound connections, if we're at the target outbound level,
+        // we want to pass pass 90(%) to the select() as the bias amount.
+        // Where addrman will mostly always try connections that are new and have not been tried before.
+        // In order to correctly allow the programmer to change the MAX_OUTBOUND_CONNECTIONS from 8 to 20 or whatever
+        // value, we need better math here to scale the value passed to addrman select.
+        // The programmed target range is now 10..90% using fast integer math, other than that point, any
+        // value can be now set and this will approximate the correct percentage.
+        // int nNewBias = (nOutbound * 80) / MAX_OUTBOUND_CONNECTIONS;
+        // Keep the max value less than 100%, as the routine expects
+        // nNewBias = min( nNewBias, 99 );
+        // CSlave removed
+        CAddrInfo addr = addrman.Select();
+
+        // if we selected an invalid address, restart
+        if (!addr.IsValid() || setConnected.count(addr.GetGroup()) || IsLocal(addr))
+            break;
+
+        // If we didn't find an appropriate destination after trying 100 addresses fetched from addrman,
+        // stop this loop, and let the outer loop run again (which sleeps, adds seed nodes, recalculates
+        // already-connected network ranges, ...) before trying new addrman addresses.
+        nTries++;
+        if (nTries > 100)
+            break;
+
+        if (IsLimited(addr))
+            continue;
+
+        // only consider very recently tried nodes after 30 failed attempts
+        if (nANow - addr.nLastTry < 180 && nTries < 30)
+            continue;
+
+        // do not allow non-default ports, unless after 50 invalid addresses selected already
+        if( !addr.IsI2P() && addr.GetPort() != Params().GetDefaultPort() && nTries < 50 )
+            continue;
+
+        addrConnect = addr;
+        break;
+    }
+    return addrConnect;
+}
+
+#ifdef ENABLE_I2PSAM
+//! Opening a stream to an I2P peer is mostly waiting for the tunnels towards it.  Once addrman
+//! handed out an I2P destination, more of them are picked for the free outbound slots, up to the
+//! size of the SAM connect pool, and all of them are connected at once.
+static void OpenI2PNetworkConnections(const CAddress& addrFirst, CSemaphoreGrant& grantFirst, set<vector<unsigned char> >& setConnected, int64_t nANow)
+{
+    vector<CAddress> vAddrConnect;
+    vector<boost::shared_ptr<CSemaphoreGrant> > vGrants;
+    const size_t nMaxConnect = (size_t)std::max(GetArg("-i2p.options.connectpool", SAM_DEFAULT_CONNECT_POOL), (int64_t)1);
+
+    CAddress addr = addrFirst;
+    boost::shared_ptr<CSemaphoreGrant> grant(new CSemaphoreGrant());
+    grantFirst.MoveTo(*grant);
+    while (true)
+    {
+        setConnected.insert(addr.GetGroup());
+        if (!IsLocal(addr) && !FindNode((CNetAddr)addr) && !CNode::IsBanned(addr)) {
+            vAddrConnect.push_back(addr);
+            vGrants.push_back(grant);
+            LogPrint("net", "trying connection %s lastseen=%.1fhrs\n", addr.ToString(), (double)(GetAdjustedTime() - addr.nTime)/3600.0);
+        }
+        if (vAddrConnect.size() >= nMaxConnect)
+            break;
+        grant.reset(new CSemaphoreGrant(*semOutbound, true));
+        if (!*grant)
+            break;
+        addr = SelectOutboundAddress(setConnected, nANow);
+        if (!addr.IsValid() || !addr.IsI2P())
+            break;
+    }
+    if (vAddrConnect.empty())
+        return;
+
+    int64_t nStart = GetTimeMillis();
+    vector<CService> vAddrDest(vAddrConnect.begin(), vAddrConnect.end());
+    vector<SOCKET> vSockets;
+    int nConnected = ConnectI2PSockets(vAddrDest, vSockets);
+    LogPrint("net", "connected %d of %u I2P destinations in %dms\n", nConnected, vAddrConnect.size(), GetTimeMillis() - nStart);
+
+    for (unsigned int i = 0; i < vAddrConnect.size(); i++) {
+        if (vSockets[i] == INVALID_SOCKET) {
+            addrman.Attempt(vAddrConnect[i]);
+            continue;
+        }
+        CNode* pnode = AddOutboundNode(vAddrConnect[i], vSockets[i], NULL);
+        vGrants[i]->MoveTo(pnode->grantOutbound);
+        pnode->fNetworkNode = true;
+    }
+    boost::this_thread::interruption_point();
+}
+#endif // ENABLE_I2PSAM
+
 void ThreadOpenConnections()
 {
     // Connect to specific addresses
@@ -1690,7 +2383,6 @@ void ThreadOpenConnections()
         //
         // Choose an address to connect to based on most recently seen
         //
-        CAddress addrConnect;
 
         // Only connect out to one peer per network group (/16 for IPv4).
         // Do this here so we don't have to critsect vNodes inside mapAddresses critsect.
@@ -1708,50 +2400,13 @@ void ThreadOpenConnections()
 
         int64_t nANow = GetAdjustedTime();
 
-        int nTries = 0;
-        while (true)
-        {
-            // use an nUnkBias between 10 (no outgoing connections), and we need to try to connect to good nodes,
-            // that have been tried before and found to be likely good connections, out to 90% where almost every
-            // node tried will be a new and untested node address.
-            // At min pass 10(%) to Select when no outbound connections, if we're at the target outbound level,
-            // we want to pass pass 90(%) to the select() as the bias amount.
-            // Where addrman will mostly always try connections that are new and have not been tried before.
-            // In order to correctly allow the programmer to change the MAX_OUTBOUND_CONNECTIONS from 8 to 20 or whatever
-            // value, we need better math here to scale the value passed to addrman select.
-            // The programmed target range is now 10..90% using fast integer math, other than that point, any
-            // value can be now set and this will approximate the correct percentage.
-            // int nNewBias = (nOutbound * 80) / MAX_OUTBOUND_CONNECTIONS;
-            // Keep the max value less than 100%, as the routine expects
-            // nNewBias = min( nNewBias, 99 );
-            // CSlave removed
-            CAddrInfo addr = addrman.Select();
-
-            // if we selected an invalid address, restart
-            if (!addr.IsValid() || setConnected.count(addr.GetGroup()) || IsLocal(addr))
-                break;
-
-            // If we didn't find an appropriate destination after trying 100 addresses fetched from addrman,
-            // stop this loop, and let the outer loop run again (which sleeps, adds seed nodes, recalculates
-            // already-connected network ranges, ...) before trying new addrman addresses.
-            nTries++;
-            if (nTries > 100)
-                break;
-
-            if (IsLimited(addr))
-                continue;
-
-            // only consider very recently tried nodes after 30 failed attempts
-            if (nANow - addr.nLastTry < 180 && nTries < 30)
-                continue;
-
-            // do not allow non-default ports, unless after 50 invalid addresses selected already
-            if( !addr.IsI2P() && addr.GetPort() != Params().GetDefaultPort() && nTries < 50 )
-                continue;
-
-            addrConnect = addr;
-            break;
+        CAddress addrConnect = SelectOutboundAddress(setConnected, nANow);
+#ifdef ENABLE_I2PSAM
+        if (addrConnect.IsValid() && addrConnect.IsI2P() && IsI2PEnabled()) {
+            OpenI2PNetworkConnections(addrConnect, grant, setConnected, nANow);
+            continue;
         }
+#endif
         if (addrConnect.IsValid())
             OpenNetworkConnection(addrConnect, &grant);
     }
@@ -1790,6 +2445,10 @@ void ThreadOpenAddedConnections()
             BOOST_FOREACH(string& strAddNode, vAddedNodes)
                 lAddresses.push_back(strAddNode);
         }
+#ifdef ENABLE_I2PSAM
+        if( fNameLookup && IsI2PEnabled() )
+            i2pnames.Prefetch(vector<string>(lAddresses.begin(), lAddresses.end()));
+#endif
 
         list<vector<CService> > lservAddressesToAdd(0);
         BOOST_FOREACH(string& strAddNode, lAddresses)
@@ -1893,24 +2552,67 @@ bool OpenNetworkConnection(const CAddress& addrConnect, CSemaphoreGrant *grantOu
 }
 
 
-void ThreadMessageHandler()
+//! Each peer is handled by one message handler thread, so its messages are processed in order
+static int GetMessageHandler(const CNode* pnode)
+{
+    return pnode->id % nMessageHandlerThreads;
+}
+
+void WakeMessageHandler(CNode* pnode)
+{
+    CMessageHandlerSignal& signal = vMessageHandlerSignals[GetMessageHandler(pnode)];
+    {
+        boost::lock_guard<boost::mutex> lock(signal.mutex);
+        signal.fWake = true;
+    }
+    signal.cond.notify_one();
+}
+
+//! One peer out of all of them gets the trickled addresses and inventory each 100ms round, the longest a
+//! handler sleeps, however many handler threads share the peers
+static NodeId GetTrickleNode()
+{
+    LOCK(cs_trickle);
+    int64_t nRound = GetTimeMillis() / 100;
+    if (nRound != nTrickleRound) {
+        nTrickleRound = nRound;
+        idTrickle = -1;
+        LOCK(cs_vNodes);
+        if (!vNodes.empty())
+            idTrickle = vNodes[GetRand(vNodes.size())]->id;
+    }
+    return idTrickle;
+}
+
+//! One of the -msghandlers threads, processing and sending messages for the peers pinned to it.
+//! Peers with nothing to process don't keep it spinning, it sleeps until woken up by the socket
+//! thread when a message completes or a full send buffer drains, and at the latest after 100ms
+//! for SendMessages' timed work (pings, trickling, ...).
+void ThreadMessageHandler(int nHandler)
 {
     SetThreadPriority(THREAD_PRIORITY_BELOW_NORMAL);
+    CMessageHandlerSignal& signal = vMessageHandlerSignals[nHandler];
     while (true)
     {
+        {
+            // Wakeups from here on make the next pass run right away
+            boost::lock_guard<boost::mutex> lock(signal.mutex);
+            signal.fWake = false;
+        }
+
         vector<CNode*> vNodesCopy;
         {
             LOCK(cs_vNodes);
-            vNodesCopy = vNodes;
-            BOOST_FOREACH(CNode* pnode, vNodesCopy) {
+            BOOST_FOREACH(CNode* pnode, vNodes) {
+                if (GetMessageHandler(pnode) != nHandler)
+                    continue;
+                vNodesCopy.push_back(pnode);
                 pnode->AddRef();
             }
         }
 
         // Poll the connected nodes for messages
-        CNode* pnodeTrickle = NULL;
-        if (!vNodesCopy.empty())
-            pnodeTrickle = vNodesCopy[GetRand(vNodesCopy.size())];
+        NodeId idTrickleRound = GetTrickleNode();
 
         bool fSleep = true;
 
@@ -1942,7 +2644,7 @@ void ThreadMessageHandler()
             {
                 TRY_LOCK(pnode->cs_vSend, lockSend);
                 if (lockSend)
-                    n_signals.SendMessages(pnode, pnode == pnodeTrickle || pnode->fWhitelisted);
+                    n_signals.SendMessages(pnode, pnode->id == idTrickleRound || pnode->fWhitelisted);
             }
             boost::this_thread::interruption_point();
         }
@@ -1954,7 +2656,11 @@ void ThreadMessageHandler()
         }
 
         if (fSleep)
-            MilliSleep(100);
+        {
+            boost::unique_lock<boost::mutex> lock(signal.mutex);
+            if (!signal.fWake)
+                signal.cond.timed_wait(lock, boost::posix_time::milliseconds(100));
+        }
     }
 }
 
@@ -2056,27 +2762,29 @@ bool BindListenPort(const CService &addrBind, string& strError, bool fWhiteliste
  */
 bool BindListenNativeI2P()
 {
-    SOCKET hNewI2PListenSocket = INVALID_SOCKET;
-    if (!BindListenNativeI2P(hNewI2PListenSocket))
+    if( IsLimited( NET_I2P ) ) {
+        LogPrintf( "ERROR - Unexpected I2P BIND request. Ignored, network access is limited.\n" );
         return false;
-    vhI2PListenSocket.push_back(hNewI2PListenSocket);
-    return true;
+    }
+    int nTarget = std::max(1, std::min((int)GetArg("-i2p.options.acceptpool", DEFAULT_I2P_ACCEPT_POOL), MAX_I2P_ACCEPT_POOL));
+    {
+        boost::lock_guard<boost::mutex> lock(mutexI2PAccept);
+        i2pAcceptStats.nTarget = nTarget;
+    }
+    // The first accepts are armed right away, ThreadI2PAcceptPool keeps them topped up once the node runs
+    if( !ArmI2PAccepts(nTarget) ) {
+        LogPrintf( "ERROR - Unable to issue an I2P STREAM ACCEPT to the SAM bridge.\n" );
+        return false;
+    }
+    string sDest = GetArg( "-i2p.mydestination.publickey", "" );
+    CService addrBind( sDest, 0 );
+    return AddLocal( addrBind, LOCAL_BIND );
 }
 
-bool BindListenNativeI2P(SOCKET& hSocket)
+void GetI2PAcceptStats(CI2PAcceptStats& stats)
 {
-    if( !IsLimited( NET_I2P ) ) {
-        hSocket = I2PSession::Instance().accept(false);
-        if (SetSocketNonBlocking(hSocket, true)) { // Set to non-blocking
-            string sDest = GetArg( "-i2p.mydestination.publickey", "" );
-            CService addrBind( sDest, 0 );
-            return AddLocal( addrBind, LOCAL_BIND );
-        } else
-            LogPrintf( "ERROR - Unable to set I2P Socket options to non-blocking, after I2P accept was issued.\n" );
-    }
-    else
-        LogPrintf( "ERROR - Unexpected I2P BIND request. Ignored, network access is limited.\n" );
-
+    boost::lock_guard<boost::mutex> lock(mutexI2PAccept);
+    stats = i2pAcceptStats;
 }
 #endif // ENABLE_I2PSAM
 
@@ -2149,6 +2857,13 @@ void StartNode(boost::thread_group& threadGroup)
     }
     LogPrintf("Loaded %i addresses from peers.dat in %dms and setup a %d entry address book for b32.i2p destinations.\n",
            addrman.size(), GetTimeMillis() - nStart, addrman.b32HashTableSize() );
+#ifdef ENABLE_I2PSAM
+    {
+        CAddrDB adb;
+        if (adb.Read(i2pnames))
+            LogPrintf("Loaded %u b32.i2p names from i2pnames.dat\n", i2pnames.size());
+    }
+#endif
     fAddressesInitialized = true;
 
     if (semOutbound == NULL) {
@@ -2166,6 +2881,16 @@ void StartNode(boost::thread_group& threadGroup)
     // Start threads
     //
 
+    // Peers are pinned to a message handler thread from the moment the socket thread sees them
+    nMessageHandlerThreads = std::max(1, std::min((int)GetArg("-msghandlers", DEFAULT_MESSAGE_HANDLER_THREADS), MAX_MESSAGE_HANDLER_THREADS));
+    LogPrintf("Using %d message handler threads\n", nMessageHandlerThreads);
+
+#ifdef ENABLE_I2PSAM
+    // Resolve b32.i2p names in the background, the DNS seeds and -addnode queue theirs up front
+    if (IsI2PEnabled())
+        threadGroup.create_thread(boost::bind(&TraceThread<void (*)()>, "i2pnames", &ThreadI2pNameLookup));
+#endif
+
     if (!GetBoolArg("-dnsseed", true))
         LogPrintf("DNS seeding disabled\n");
     else
@@ -2175,8 +2900,24 @@ void StartNode(boost::thread_group& threadGroup)
     MapPort(GetBoolArg("-upnp", DEFAULT_UPNP));
 
     // Send and receive from sockets, accept connections
+#ifdef USE_EPOLL
+    if (GetBoolArg("-epoll", true) && hEpoll == -1) {
+        hEpoll = epoll_create1(EPOLL_CLOEXEC);
+        if (hEpoll == -1)
+            LogPrintf("epoll_create1 failed: %s, falling back to select()\n", NetworkErrorString(WSAGetLastError()));
+    }
+#endif
+    LogPrintf("Using %s for the peer sockets\n", IsEpollActive() ? "epoll" : "select");
     threadGroup.create_thread(boost::bind(&TraceThread<void (*)()>, "net", &ThreadSocketHandler));
 
+#ifdef ENABLE_I2PSAM
+    // Refill the I2P accepts the socket thread used up
+    CI2PAcceptStats acceptStats;
+    GetI2PAcceptStats(acceptStats);
+    if (acceptStats.nTarget > 0)
+        threadGroup.create_thread(boost::bind(&TraceThread<void (*)()>, "i2paccept", &ThreadI2PAcceptPool));
+#endif
+
     // Initiate outbound connections from -addnode
     threadGroup.create_thread(boost::bind(&TraceThread<void (*)()>, "addcon", &ThreadOpenAddedConnections));
 
@@ -2184,7 +2925,8 @@ void StartNode(boost::thread_group& threadGroup)
     threadGroup.create_thread(boost::bind(&TraceThread<void (*)()>, "opencon", &ThreadOpenConnections));
 
     // Process messages
-    threadGroup.create_thread(boost::bind(&TraceThread<void (*)()>, "msghand", &ThreadMessageHandler));
+    for (int i = 0; i < nMessageHandlerThreads; i++)
+        threadGroup.create_thread(boost::bind(&TraceThread<boost::function<void()> >, "msghand", boost::function<void()>(boost::bind(&ThreadMessageHandler, i))));
 
     // Dump network addresses
     threadGroup.create_thread(boost::bind(&LoopForever<void (*)()>, "dumpaddr", &DumpAddresses, DUMP_ADDRESSES_INTERVAL * 1000));
@@ -2223,10 +2965,12 @@ public:
                 if (!CloseSocket(hListenSocket.socket))
                     LogPrintf("CloseSocket(hListenSocket) failed with error %s\n", NetworkErrorString(WSAGetLastError()));
 #ifdef ENABLE_I2PSAM
-        BOOST_FOREACH(SOCKET& hI2PListenSocket, vhI2PListenSocket)
-            if (hI2PListenSocket != INVALID_SOCKET)
-                if( !CloseSocket(hI2PListenSocket) )
+        AdoptI2PAccepts();
+        BOOST_FOREACH(I2PListenSocket& hI2PListenSocket, vhI2PListenSocket)
+            if (hI2PListenSocket.socket != INVALID_SOCKET)
+                if( !CloseSocket(hI2PListenSocket.socket) )
                     LogPrintf("I2P closesocket(hI2PListenSocket) failed with error %d\n", WSAGetLastError());
+        vhI2PListenSocket.clear();
 #endif // ENABLE_I2PSAM
 
         // clean up some globals (to help leak detection)
@@ -2237,6 +2981,12 @@ public:
         vNodes.clear();
         vNodesDisconnected.clear();
         vhListenSocket.clear();
+#ifdef USE_EPOLL
+        setPollPending.clear();
+        if (hEpoll != -1)
+            close(hEpoll);
+        hEpoll = -1;
+#endif
         delete semOutbound;
         semOutbound = NULL;
         delete pnodeLocalHost;
@@ -2258,13 +3008,10 @@ instance_of_cnetcleanup;
 
 void RelayTransaction(const CTransaction& tx)
 {
-    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
-    ss.reserve(10000);
-    ss << tx;
-    RelayTransaction(tx, ss);
+    RelayTransaction(tx, CSharedPayload::Make(tx));
 }
 
-void RelayTransaction(const CTransaction& tx, const CDataStream& ss)
+void RelayTransaction(const CTransaction& tx, const CSharedPayload& payload)
 {
     CInv inv(MSG_TX, tx.GetHash());
     {
@@ -2276,8 +3023,9 @@ void RelayTransaction(const CTransaction& tx, const CDataStream& ss)
             vRelayExpiration.pop_front();
         }
 
-        // Save original serialized message so newer versions are preserved
-        mapRelay.insert(std::make_pair(inv, ss));
+        // Save original serialized message so newer versions are preserved, it is shared by
+        // every peer asking for it
+        mapRelay.insert(std::make_pair(inv, payload));
         vRelayExpiration.push_back(std::make_pair(GetTime() + 15 * 60, inv));
     }
     LOCK(cs_vNodes);
@@ -2361,21 +3109,23 @@ void CNode::Fuzz(int nChance)
 CAddrDB::CAddrDB()
 {
     pathAddr = GetDataDir() / "peers.dat";
+    pathNames = GetDataDir() / "i2pnames.dat";
 }
 
-bool CAddrDB::Write(const CAddrMan& addr)
+template <typename Data>
+static bool SerializeFileDB(const std::string& prefix, const boost::filesystem::path& path, const Data& data)
 {
     // Generate random temporary filename
     unsigned short randv = 0;
     GetRandBytes((unsigned char*)&randv, sizeof(randv));
-    std::string tmpfn = strprintf("peers.dat.%04x", randv);
+    std::string tmpfn = strprintf("%s.%04x", prefix, randv);
 
-    // serialize addresses, checksum data up to that point, then append csum
-    CDataStream ssPeers(SER_DISK, CLIENT_VERSION);
-    ssPeers << FLATDATA(Params().MessageStart());
-    ssPeers << addr;
-    uint256 hash = Hash(ssPeers.begin(), ssPeers.end());
-    ssPeers << hash;
+    // serialize, checksum data up to that point, then append csum
+    CDataStream ssData(SER_DISK, CLIENT_VERSION);
+    ssData << FLATDATA(Params().MessageStart());
+    ssData << data;
+    uint256 hash = Hash(ssData.begin(), ssData.end());
+    ssData << hash;
 
     // open temp output file, and associate with CAutoFile
     boost::filesystem::path pathTmp = GetDataDir() / tmpfn;
@@ -2386,7 +3136,7 @@ bool CAddrDB::Write(const CAddrMan& addr)
 
     // Write and commit header, data
     try {
-        fileout << ssPeers;
+        fileout << ssData;
     }
     catch (std::exception &e) {
         return error("%s : Serialize or I/O error - %s", __func__, e.what());
@@ -2394,23 +3144,24 @@ bool CAddrDB::Write(const CAddrMan& addr)
     FileCommit(fileout.Get());
     fileout.fclose();
 
-    // replace existing peers.dat, if any, with new peers.dat.XXXX
-    if (!RenameOver(pathTmp, pathAddr))
+    // replace existing file, if any, with new file.XXXX
+    if (!RenameOver(pathTmp, path))
         return error("%s : Rename-into-place failed", __func__);
 
     return true;
 }
 
-bool CAddrDB::Read(CAddrMan& addr)
+template <typename Data>
+static bool DeserializeFileDB(const boost::filesystem::path& path, Data& data)
 {
     // open input file, and associate with CAutoFile
-    FILE *file = fopen(pathAddr.string().c_str(), "rb");
+    FILE *file = fopen(path.string().c_str(), "rb");
     CAutoFile filein(file, SER_DISK, CLIENT_VERSION);
     if (filein.IsNull())
-        return error("%s : Failed to open file %s", __func__, pathAddr.string());
+        return error("%s : Failed to open file %s", __func__, path.string());
 
     // use file size to size memory buffer
-    int fileSize = boost::filesystem::file_size(pathAddr);
+    int fileSize = boost::filesystem::file_size(path);
     int dataSize = fileSize - sizeof(uint256);
     // Don't try to resize to a negative number if file is small
     if (dataSize < 0)
@@ -2429,24 +3180,24 @@ bool CAddrDB::Read(CAddrMan& addr)
     }
     filein.fclose();
 
-    CDataStream ssPeers(vchData, SER_DISK, CLIENT_VERSION);
+    CDataStream ssData(vchData, SER_DISK, CLIENT_VERSION);
 
     // verify stored checksum matches input data
-    uint256 hashTmp = Hash(ssPeers.begin(), ssPeers.end());
+    uint256 hashTmp = Hash(ssData.begin(), ssData.end());
     if (hashIn != hashTmp)
         return error("%s : Checksum mismatch, data corrupted", __func__);
 
     unsigned char pchMsgTmp[4];
     try {
         // de-serialize file header (network specific magic number) and ..
-        ssPeers >> FLATDATA(pchMsgTmp);
+        ssData >> FLATDATA(pchMsgTmp);
 
         // ... verify the network matches ours
         if (memcmp(pchMsgTmp, Params().MessageStart(), sizeof(pchMsgTmp)))
             return error("%s : Invalid network magic number", __func__);
 
-        // de-serialize address data into one CAddrMan object
-        ssPeers >> addr;
+        // de-serialize the data
+        ssData >> data;
     }
     catch (std::exception &e) {
         return error("%s : Deserialize or I/O error - %s", __func__, e.what());
@@ -2455,13 +3206,33 @@ bool CAddrDB::Read(CAddrMan& addr)
     return true;
 }
 
+bool CAddrDB::Write(const CAddrMan& addr)
+{
+    return SerializeFileDB("peers.dat", pathAddr, addr);
+}
+
+bool CAddrDB::Read(CAddrMan& addr)
+{
+    return DeserializeFileDB(pathAddr, addr);
+}
+
+bool CAddrDB::Write(const CI2pNameCache& names)
+{
+    return SerializeFileDB("i2pnames.dat", pathNames, names);
+}
+
+bool CAddrDB::Read(CI2pNameCache& names)
+{
+    return DeserializeFileDB(pathNames, names);
+}
+
 unsigned int ReceiveFloodSize() { return 1000*GetArg("-maxreceivebuffer", 5*1000); }
 unsigned int SendBufferSize() { return 1000*GetArg("-maxsendbuffer", 1*1000); }
 
 //! As i2p addrs are MUCH larger than ip addresses, we're reducing the most-recently-used(mru) setAddrKnown to 1250, to have a smaller memory profile per node.
 CNode::CNode(SOCKET hSocketIn, CAddress addrIn, std::string addrNameIn, bool fInboundIn) :
     ssSend(SER_NETWORK, INIT_PROTO_VERSION),
-    addrKnown(1250, 0.001, insecure_rand())
+    addrKnown(1250, 0.001, GetRand(std::numeric_limits<uint32_t>::max()))
     {
     //! Protocol 70009 changes the node creation process so it is deterministic.
     //! Every node starts out with an IP only stream type, except for I2P addresses, they are set immediately to a full size address space.
@@ -2500,6 +3271,9 @@ CNode::CNode(SOCKET hSocketIn, CAddress addrIn, std::string addrNameIn, bool fIn
     nRefCount = 0;
     nSendSize = 0;
     nSendOffset = 0;
+    fPollRecv = false;
+    fPollSend = false;
+    nRecvChunkPos = 0;
     hashContinue = 0;
     nStartingHeight = -1;
     fGetAddr = false;
@@ -2615,17 +3389,45 @@ void CNode::EndMessage() UNLOCK_FUNCTION(cs_vSend)
 
     LogPrint( "net", "(%d bytes) to %s\n", nSize, GetPeerLogStr(this) );
 
-    std::deque<CSerializeData>::iterator it = vSendMsg.insert(vSendMsg.end(), CSerializeData());
-    ssSend.GetAndClear(*it);
-    nSendSize += (*it).size();
+    // The serialized message moves into the queue, it is not copied
+    CSerializeData* pdata = new CSerializeData;
+    ssSend.TakeData(*pdata);
+    vSendMsg.push_back(CSendBufferRef(pdata));
+    nSendSize += pdata->size();
 
     // If write queue empty, attempt "optimistic write"
-    if (it == vSendMsg.begin())
+    if (vSendMsg.size() == 1)
         SocketSendData(this);
 
     LEAVE_CRITICAL_SECTION(cs_vSend);
 }
 
+void CNode::PushSharedMessage(const char* pszCommand, const CSharedPayload& payload)
+{
+    assert(!payload.IsNull());
+    CMessageHeader hdr(pszCommand, payload.data->size());
+    hdr.nChecksum = payload.nChecksum;
+    CDataStream ssHeader(SER_NETWORK, PROTOCOL_VERSION);
+    ssHeader << hdr;
+    CSerializeData* pheader = new CSerializeData;
+    ssHeader.TakeData(*pheader);
+
+    LOCK(cs_vSend);
+    LogPrint("net", "sending: %s (%d bytes, shared) to %s\n", SanitizeString(pszCommand), payload.data->size(), GetPeerLogStr(this));
+    bool fQueueEmpty = vSendMsg.empty();
+    vSendMsg.push_back(CSendBufferRef(pheader));
+    nSendSize += pheader->size();
+    // An empty payload is never queued, SocketSendData expects something to send in every buffer
+    if (!payload.data->empty()) {
+        vSendMsg.push_back(payload.data);
+        nSendSize += payload.data->size();
+    }
+
+    // If write queue empty, attempt "optimistic write"
+    if (fQueueEmpty)
+        SocketSendData(this);
+}
+
 string GetPeerLogStr( const CNode* pfrom )
 {
     string remoteAddr = _("peer");
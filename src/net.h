@@ -33,11 +33,13 @@
 
 #include <boost/filesystem/path.hpp>
 #include <boost/foreach.hpp>
+#include <boost/shared_ptr.hpp>
 #include <boost/signals2/signal.hpp>
 
 class CAddrMan;
 class CBlockIndex;
 class CNode;
+class CSharedPayload;
 
 namespace boost {
     class thread_group;
@@ -59,6 +61,34 @@ extern const bool DEFAULT_LISTEN;
 extern const bool DEFAULT_UPNP;
 /** The maximum number of entries in mapAskFor */
 extern const size_t MAPASKFOR_MAX_SZ;
+/** -msghandlers default, the number of message handler threads */
+extern const int DEFAULT_MESSAGE_HANDLER_THREADS;
+/** Upper limit for -msghandlers */
+extern const int MAX_MESSAGE_HANDLER_THREADS;
+#ifdef ENABLE_I2PSAM
+/** -i2p.options.acceptpool default, the number of STREAM ACCEPTs kept armed at the SAM bridge */
+extern const int DEFAULT_I2P_ACCEPT_POOL;
+/** Upper limit for -i2p.options.acceptpool */
+extern const int MAX_I2P_ACCEPT_POOL;
+
+/** Counters of the I2P accept pool, times are in milliseconds */
+struct CI2PAcceptStats
+{
+    int nTarget;                //! Accepts the pool tries to keep armed
+    int nOutstanding;           //! Accepts armed right now
+    uint64_t nArmed;            //! Accepts armed so far
+    uint64_t nAccepted;         //! Accepts used up by an incoming peer
+    uint64_t nEmpty;            //! Accepts the bridge closed without a peer
+    uint64_t nFailed;           //! Accepts the bridge refused
+    int64_t nArmTimeTotal;      //! Time until the bridge confirmed the accepts
+    int64_t nArmTimeMax;
+    int64_t nWaitTimeTotal;     //! Time the accepts waited for their peer
+    int64_t nWaitTimeMax;
+
+    CI2PAcceptStats() : nTarget(0), nOutstanding(0), nArmed(0), nAccepted(0), nEmpty(0), nFailed(0),
+                        nArmTimeTotal(0), nArmTimeMax(0), nWaitTimeTotal(0), nWaitTimeMax(0) {}
+};
+#endif
 
 unsigned int ReceiveFloodSize();
 unsigned int SendBufferSize();
@@ -77,12 +107,13 @@ unsigned short GetListenPort();
 bool BindListenPort(const CService &bindAddr, std::string& strError, bool fWhitelisted = false);
 #ifdef ENABLE_I2PSAM
 bool BindListenNativeI2P();
-bool BindListenNativeI2P(SOCKET& hSocket);
+void GetI2PAcceptStats(CI2PAcceptStats& stats);
 #endif
 void StartNode(boost::thread_group& threadGroup);
 bool StopNode();
 void SocketSendData(CNode *pnode);
 void AdvertizeLocal();
+void WakeMessageHandler(CNode* pnode);
 
 typedef int NodeId;
 
@@ -139,7 +170,7 @@ extern int nMaxConnections;
 
 extern std::vector<CNode*> vNodes;
 extern CCriticalSection cs_vNodes;
-extern std::map<CInv, CDataStream> mapRelay;
+extern std::map<CInv, CSharedPayload> mapRelay;
 extern std::deque<std::pair<int64_t, CInv> > vRelayExpiration;
 extern CCriticalSection cs_mapRelay;
 extern limitedmap<CInv, int64_t> mapAlreadyAskedFor;
@@ -182,6 +213,122 @@ public:
 
 
 
+/** Size of the buffers peer data is received into */
+static const unsigned int NET_RECV_CHUNK_SIZE = 64 * 1024;
+/** A new chunk is started once the current one has less than this much room left */
+static const unsigned int NET_RECV_CHUNK_MIN_SPACE = 8 * 1024;
+
+/** Fixed size receive buffer. The socket is read straight into it and the messages received
+ *  refer to their bytes in place, it goes back to the pool when the last of them is gone. */
+struct CNetRecvChunk
+{
+    char data[NET_RECV_CHUNK_SIZE];
+};
+typedef boost::shared_ptr<CNetRecvChunk> CNetRecvChunkRef;
+
+/** Keeps released receive chunks for reuse, so busy peers don't churn the allocator */
+class CNetRecvChunkPool
+{
+private:
+    struct CDeleter
+    {
+        CNetRecvChunkPool* pool;
+        void operator()(CNetRecvChunk* pchunk) const { pool->Free(pchunk); }
+    };
+
+    CCriticalSection cs;
+    std::vector<CNetRecvChunk*> vFree;
+    size_t nMaxFree;
+
+    void Free(CNetRecvChunk* pchunk);
+
+public:
+    explicit CNetRecvChunkPool(size_t nMaxFreeIn) : nMaxFree(nMaxFreeIn) {}
+    ~CNetRecvChunkPool();
+
+    CNetRecvChunkRef Allocate();
+};
+
+extern CNetRecvChunkPool netRecvChunkPool;
+
+/** Read view over a message whose payload is spread over one or more receive chunks. It
+ *  deserializes straight out of them, the payload is never copied into a buffer of its own. */
+class CNetRecvStream
+{
+private:
+    struct CSegment
+    {
+        CNetRecvChunkRef chunk;
+        unsigned int nBegin;
+        unsigned int nEnd;
+    };
+    std::vector<CSegment> vSegments;
+    unsigned int nSegment;          // segment being read
+    unsigned int nReadPos;          // read position inside it
+    unsigned int nSize;             // bytes left to read
+
+public:
+    int nType;
+    int nVersion;
+
+    CNetRecvStream(int nTypeIn, int nVersionIn) : nSegment(0), nReadPos(0), nSize(0), nType(nTypeIn), nVersion(nVersionIn) {}
+
+    //! Adds bytes nBegin..nEnd of a chunk to the end of the stream
+    void Append(const CNetRecvChunkRef& chunk, unsigned int nBegin, unsigned int nEnd);
+
+    unsigned int size() const    { return nSize; }
+    bool empty() const           { return nSize == 0; }
+    bool eof() const             { return nSize == 0; }
+    int in_avail()               { return nSize; }
+    unsigned int GetSegmentCount() const { return vSegments.size(); }
+
+    void SetType(int n)          { nType = n; }
+    int GetType()                { return nType; }
+    void SetVersion(int n)       { nVersion = n; }
+    int GetVersion()             { return nVersion; }
+
+    CNetRecvStream& read(char* pch, size_t nSize);
+    CNetRecvStream& ignore(int nSize);
+
+    //! Double SHA256 of what is left to read, the message checksum is taken from it
+    uint256 GetHash() const;
+
+    template<typename T>
+    CNetRecvStream& operator>>(T& obj)
+    {
+        // Unserialize from this stream
+        ::Unserialize(*this, obj, nType, nVersion);
+        return (*this);
+    }
+};
+
+/** A buffer queued for sending. Immutable once queued, so the same one can go to many peers */
+typedef boost::shared_ptr<const CSerializeData> CSendBufferRef;
+
+/** A serialized message payload with its checksum, made once and queued as is for every peer
+ *  it is sent to. Only for payloads that serialize the same for every peer (blocks, transactions). */
+class CSharedPayload
+{
+public:
+    CSendBufferRef data;
+    unsigned int nChecksum;
+
+    CSharedPayload() : nChecksum(0) {}
+
+    bool IsNull() const { return !data; }
+
+    template<typename T>
+    static CSharedPayload Make(const T& obj)
+    {
+        CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+        ss << obj;
+        return FromStream(ss);
+    }
+
+    //! Takes over the contents of ss
+    static CSharedPayload FromStream(CDataStream& ss);
+};
+
 class CNetMessage {
 public:
     bool in_data;                   // parsing header (false) or data (true)
@@ -190,7 +337,7 @@ public:
     CMessageHeader hdr;             // complete header
     unsigned int nHdrPos;
 
-    CDataStream vRecv;              // received message data
+    CNetRecvStream vRecv;           // received message data
     unsigned int nDataPos;
 
     int64_t nTime;                  // time (in microseconds) of message receipt.
@@ -217,7 +364,7 @@ public:
     }
 
     int readHeader(const char *pch, unsigned int nBytes);
-    int readData(const char *pch, unsigned int nBytes);
+    int readData(const CNetRecvChunkRef& chunk, unsigned int nPos, unsigned int nBytes);
 };
 
 
@@ -235,14 +382,19 @@ public:
     size_t nSendSize; // total size of all vSendMsg entries
     size_t nSendOffset; // offset inside the first vSendMsg already sent
     uint64_t nSendBytes;
-    std::deque<CSerializeData> vSendMsg;
+    std::deque<CSendBufferRef> vSendMsg;
     CCriticalSection cs_vSend;
 
     std::deque<CInv> vRecvGetData;
     std::deque<CNetMessage> vRecvMsg;
     CCriticalSection cs_vRecvMsg;
+    CNetRecvChunkRef pRecvChunk;    // chunk the socket is read into, guarded by cs_vRecvMsg
+    unsigned int nRecvChunkPos;     // bytes of it already received
     uint64_t nRecvBytes;
     int nRecvVersion;
+    // Socket events seen by the epoll engine and not yet consumed, only used by ThreadSocketHandler
+    bool fPollRecv;
+    bool fPollSend;
 
     int64_t nLastSend;
     int64_t nLastRecv;
@@ -292,7 +444,8 @@ public:
     uintFakeHash hashContinue;              // This value is stored as a sha256d hash
     int nStartingHeight;
 
-    // flood relay
+    // flood relay, vAddrToSend and addrKnown are guarded by cs_inventory as other peers' message
+    // handlers push addresses to us
     std::vector<CAddress> vAddrToSend;
     CRollingBloomFilter addrKnown;
     bool fGetAddr;
@@ -379,12 +532,17 @@ public:
     {
         unsigned int total = 0;
         BOOST_FOREACH(const CNetMessage &msg, vRecvMsg)
-            total += msg.vRecv.size() + 24;
+            total += msg.nDataPos + 24;
         return total;
     }
 
     // requires LOCK(cs_vRecvMsg)
-    bool ReceiveMsgBytes(const char *pch, unsigned int nBytes);
+    //! Room in the receive chunk for the socket to be read into, at least NET_RECV_CHUNK_MIN_SPACE bytes
+    char* GetRecvBuffer(unsigned int& nSpace);
+
+    // requires LOCK(cs_vRecvMsg)
+    //! Takes in nBytes just read into the buffer returned by GetRecvBuffer()
+    bool ReceiveMsgBytes(unsigned int nBytes);
 
     // requires LOCK(cs_vRecvMsg)
     void SetRecvVersion(int nVersionIn)
@@ -409,6 +567,7 @@ public:
 
     void AddAddressKnown(const CAddress& addr)
     {
+        LOCK(cs_inventory);
         addrKnown.insert(addr.GetKey());
     }
 
@@ -417,9 +576,10 @@ public:
         // Known checking here is only to save space from duplicates.
         // SendMessages will filter it again for knowns that were added
         // after addresses were pushed.
+        LOCK(cs_inventory);
         if (addr.IsValid() && !addrKnown.contains(addr.GetKey())) {
              if (vAddrToSend.size() >= MAX_ADDR_TO_SEND) {
-                 vAddrToSend[insecure_rand() % vAddrToSend.size()] = addr;
+                 vAddrToSend[GetRand(vAddrToSend.size())] = addr;
              } else {
             vAddrToSend.push_back(addr);
             } 
@@ -455,6 +615,9 @@ public:
     // TODO: Document the precondition of this function.  Is cs_vSend locked?
     void EndMessage() UNLOCK_FUNCTION(cs_vSend);
 
+    //! Queues a message with a payload serialized beforehand, only its header is made for this peer
+    void PushSharedMessage(const char* pszCommand, const CSharedPayload& payload);
+
     void PushVersion();
 
 
@@ -655,17 +818,20 @@ public:
 
 class CTransaction;
 void RelayTransaction(const CTransaction& tx);
-void RelayTransaction(const CTransaction& tx, const CDataStream& ss);
+void RelayTransaction(const CTransaction& tx, const CSharedPayload& payload);
 
-/** Access to the (IP) address database (peers.dat) */
+/** Access to the (IP) address database (peers.dat) and the b32.i2p name cache (i2pnames.dat) */
 class CAddrDB
 {
 private:
     boost::filesystem::path pathAddr;
+    boost::filesystem::path pathNames;
 public:
     CAddrDB();
     bool Write(const CAddrMan& addr);
     bool Read(CAddrMan& addr);
+    bool Write(const CI2pNameCache& names);
+    bool Read(CI2pNameCache& names);
 };
 
 #endif // ANONCOIN_NET_H
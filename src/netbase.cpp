@@ -26,6 +26,7 @@
 
 #include <boost/algorithm/string/case_conv.hpp> // for to_lower()
 #include <boost/algorithm/string/predicate.hpp> // for startswith() and endswith()
+#include <boost/foreach.hpp>
 #include <boost/thread.hpp>
 #include <openssl/sha.h>
 
@@ -41,6 +42,14 @@ const int32_t DEFAULT_CONNECT_TIMEOUT = 20000;
 //! ToDo: Further analysis from debugging i2p connections may reveal that this setting needs more adjustment.
 //!       Connected peer table entries show ping times >13000ms  20000 sets this number's default
 //!       to 4 times what btc had (5000) .. Or possibly we need to add a new variable for I2p specifically.
+/** Seconds a destination the router found for a b32.i2p address is kept, renewed each time it is used */
+const int64_t I2P_NAME_CACHE_TTL = 30 * 24 * 60 * 60;
+/** Seconds a b32.i2p address the router could not find is not asked for again */
+const int64_t I2P_NAME_CACHE_NEGATIVE_TTL = 10 * 60;
+/** Most b32.i2p addresses kept in the cache */
+const unsigned int I2P_NAME_CACHE_MAX_SIZE = 4096;
+/** Most names sent to the router in one batch of concurrent NAMING LOOKUPs */
+const unsigned int I2P_NAME_LOOKUP_BATCH = 16;
 
 // Settings
 static proxyType proxyInfo[NET_MAX];
@@ -49,6 +58,7 @@ static CCriticalSection cs_proxyInfos;
 int nConnectTimeout = DEFAULT_CONNECT_TIMEOUT;      //! See netbase.h for setting value, i2p requires setting this higher
 bool fNameLookup = false;
 CAddrMan addrman;               //! This must be here, not in net.cpp so that lib_common can contain CAddrman code, as well as timedata
+CI2pNameCache i2pnames;
 
 static const unsigned char pchIPv4[12] = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff };
 
@@ -645,6 +655,29 @@ bool ConnectSocket(const CService &addrDest, SOCKET& hSocketRet, int nTimeout, b
     return true;
 }
 
+#ifdef ENABLE_I2PSAM
+int ConnectI2PSockets(const std::vector<CService>& vAddrDest, std::vector<SOCKET>& vSocketRet)
+{
+    std::vector<std::string> vDestinations;
+    BOOST_FOREACH(const CService& addrDest, vAddrDest) {
+        assert( addrDest.IsNativeI2P() );
+        vDestinations.push_back( addrDest.GetI2pDestination() );
+    }
+    vSocketRet = I2PSession::Instance().connect(vDestinations, false);
+
+    int nConnected = 0;
+    BOOST_FOREACH(SOCKET& hSocket, vSocketRet) {
+        if( hSocket == INVALID_SOCKET )
+            continue;
+        if( !SetSocketNonBlocking(hSocket, true) )
+            CloseSocket(hSocket);
+        else
+            nConnected++;
+    }
+    return nConnected;
+}
+#endif // ENABLE_I2PSAM
+
 bool ConnectSocketByName(CService &addr, SOCKET& hSocketRet, const char *pszDest, int portDefault, int nTimeout, bool *outProxyConnectionFailed)
 {
     string strDest;
@@ -687,13 +720,15 @@ bool ConnectSocketByName(CService &addr, SOCKET& hSocketRet, const char *pszDest
 void CNetAddr::Init()
 {
     memset(ip, 0, sizeof(ip));
-    memset(i2pDest, 0, I2P_DESTINATION_STORE);
+    memset(i2pDest, 0, I2P_DESTINATION_BYTES);
+    i2pHash = 0;
 }
 
 void CNetAddr::SetIP(const CNetAddr& ipIn)
 {
     memcpy(ip, ipIn.ip, sizeof(ip));
-    memcpy(i2pDest, ipIn.i2pDest, I2P_DESTINATION_STORE);
+    memcpy(i2pDest, ipIn.i2pDest, I2P_DESTINATION_BYTES);
+    i2pHash = ipIn.i2pHash;
 }
 
 void CNetAddr::SetRaw(Network network, const uint8_t *ip_in)
@@ -710,7 +745,8 @@ void CNetAddr::SetRaw(Network network, const uint8_t *ip_in)
         default:
             assert(!"invalid network");
     }
-    memset(i2pDest, 0, I2P_DESTINATION_STORE);
+    memset(i2pDest, 0, I2P_DESTINATION_BYTES);
+    i2pHash = 0;
 }
 
 static const unsigned char pchOnionCat[] = {0xFD,0x87,0xD8,0x7E,0xEB,0x43};
@@ -750,7 +786,7 @@ bool CNetAddr::SetSpecial(const std::string &strName)
                 int64_t iNow = GetTime();
                 if( !addr.size() )                                          // If we couldn't find it, much more to do..
 #ifdef ENABLE_I2PSAM
-                    addr = I2PSession::Instance().namingLookup(strName);    // Expensive, but lets try, this could take a very long while...
+                    addr = i2pnames.Resolve(strName);                       // Expensive, but lets try, this could take a very long while...
 #else
                     LogPrintf( "This Build does NOT support I2P Communications, network lookup failed for: %s\n", strName );
 #endif
@@ -769,10 +805,9 @@ bool CNetAddr::SetSpecial(const std::string &strName)
         } else                                                              // It was a native I2P address to begin with
             addr = strName;                                                 // Prep for memcpy()
         // If we make it here 'addr' has i2p destination address as a base 64 string...
-        // Now we can build the output array of bytes as we need for protocol 70009+ by using the concept of a IP6 string we call pchGarlicCat
-        memcpy(ip, pchGarlicCat, sizeof(pchGarlicCat));
-        memcpy(i2pDest, addr.c_str(), I2P_DESTINATION_STORE);         // So now copy it to our CNetAddr object variable
-        return true;                                                        // Special handling taken care of
+        // Now we can build the output array of bytes as we need for protocol 70009+ by using the concept of a IP6 string we call pchGarlicCat,
+        // and the destination itself is kept in binary
+        return SetI2pDestination( addr );                                   // Special handling taken care of
     }
 
     if (strName.size()>6 && strName.substr(strName.size() - 6, 6) == ".onion") {
@@ -919,17 +954,92 @@ bool CNetAddr::IsI2P() const
 
 bool CNetAddr::IsNativeI2P() const
 {
-    static const unsigned char pchAAAA[] = {'A','A','A','A'};
-    // For unsigned char [] it's quicker here to just do a memory comparison .verses. conversion to a string.
-    // In order for this to work however, it's important that the memory has been cleared when this object
-    // was created.
-    // ToDo: More work could be done here to confirm it will never mistakenly see a valid native i2p address.
-    return (i2pDest[0] != 0) && (memcmp(i2pDest + I2P_DESTINATION_STORE - sizeof(pchAAAA), pchAAAA, sizeof(pchAAAA)) == 0);
+    // Only a valid destination gets its hash set, see SetI2pDestinationRaw()
+    return !i2pHash.IsNull();
 }
 
 std::string CNetAddr::GetI2pDestination() const
 {
-    return IsNativeI2P() ? std::string(i2pDest, i2pDest + I2P_DESTINATION_STORE) : std::string();
+    if( !IsNativeI2P() )
+        return std::string();
+    char pszBase64[I2P_DESTINATION_STORE];
+    GetI2pDestinationBase64(pszBase64);
+    return std::string(pszBase64, pszBase64 + I2P_DESTINATION_STORE);
+}
+
+//! The I2P base64 alphabet, '-' and '~' take the place of '+' and '/'
+static const char pszI2pBase64[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-~";
+
+static signed char I2pBase64Value(char c)
+{
+    if (c >= 'A' && c <= 'Z') return c - 'A';
+    if (c >= 'a' && c <= 'z') return c - 'a' + 26;
+    if (c >= '0' && c <= '9') return c - '0' + 52;
+    if (c == '-') return 62;
+    if (c == '~') return 63;
+    return -1;
+}
+
+/** \brief Takes the destination from its binary form
+ *  A destination with anything but a null certificate, or no destination at all, clears the field
+ *
+ * \param pchDest const unsigned char* I2P_DESTINATION_BYTES of binary destination
+ * \return bool true if the address now holds a valid i2p destination
+ *
+ */
+bool CNetAddr::SetI2pDestinationRaw(const unsigned char* pchDest)
+{
+    static const unsigned char pchNullCert[3] = { 0, 0, 0 };
+    if( pchDest != i2pDest )
+        memmove(i2pDest, pchDest, I2P_DESTINATION_BYTES);
+    bool fValid = memcmp(i2pDest + I2P_DESTINATION_BYTES - sizeof(pchNullCert), pchNullCert, sizeof(pchNullCert)) == 0;
+    if( fValid ) {
+        fValid = false;
+        for( int i = 0; i < I2P_DESTINATION_BYTES - (int)sizeof(pchNullCert) && !fValid; i++ )
+            fValid = i2pDest[i] != 0;
+    }
+    if( !fValid ) {
+        memset(i2pDest, 0, I2P_DESTINATION_BYTES);
+        i2pHash = 0;
+        return false;
+    }
+    SHA256(i2pDest, I2P_DESTINATION_BYTES, (unsigned char*)&i2pHash);
+    return true;
+}
+
+//! Writes exactly I2P_DESTINATION_STORE chars, all zero without a destination the way they always went out to the network
+void CNetAddr::GetI2pDestinationBase64(char* pszBase64) const
+{
+    if( !IsNativeI2P() ) {
+        memset(pszBase64, 0, I2P_DESTINATION_STORE);
+        return;
+    }
+    for( int i = 0, j = 0; i < I2P_DESTINATION_BYTES; i += 3, j += 4 ) {
+        uint32_t n = (i2pDest[i] << 16) | (i2pDest[i + 1] << 8) | i2pDest[i + 2];
+        pszBase64[j] = pszI2pBase64[(n >> 18) & 63];
+        pszBase64[j + 1] = pszI2pBase64[(n >> 12) & 63];
+        pszBase64[j + 2] = pszI2pBase64[(n >> 6) & 63];
+        pszBase64[j + 3] = pszI2pBase64[n & 63];
+    }
+}
+
+//! Reads exactly I2P_DESTINATION_STORE chars, anything that isn't a valid destination clears the field
+bool CNetAddr::SetI2pDestinationBase64(const char* pszBase64)
+{
+    unsigned char pchDest[I2P_DESTINATION_BYTES];
+    for( int i = 0, j = 0; i < I2P_DESTINATION_BYTES; i += 3, j += 4 ) {
+        signed char c0 = I2pBase64Value(pszBase64[j]), c1 = I2pBase64Value(pszBase64[j + 1]);
+        signed char c2 = I2pBase64Value(pszBase64[j + 2]), c3 = I2pBase64Value(pszBase64[j + 3]);
+        if( (c0 | c1 | c2 | c3) < 0 ) {
+            memset(pchDest, 0, I2P_DESTINATION_BYTES);
+            break;
+        }
+        uint32_t n = (c0 << 18) | (c1 << 12) | (c2 << 6) | c3;
+        pchDest[i] = n >> 16;
+        pchDest[i + 1] = (n >> 8) & 0xFF;
+        pchDest[i + 2] = n & 0xFF;
+    }
+    return SetI2pDestinationRaw(pchDest);
 }
 
 /** \brief Checks for a valid i2p destination, if the garlic field is not set correctly, it makes sure that field is set properly
@@ -961,19 +1071,19 @@ bool CNetAddr::SetI2pDestination( const std::string& sBase64Dest )
     if( iSize ) {
         Init();
         memcpy(ip, pchGarlicCat, sizeof(pchGarlicCat));
-    } else          // First & always if we're given some non-zero value, Make sure the whole field is zeroed out
-        memset(i2pDest, 0, I2P_DESTINATION_STORE);
+    } else {        // First & always if we're given some non-zero value, Make sure the whole field is zeroed out
+        memset(i2pDest, 0, I2P_DESTINATION_BYTES);
+        i2pHash = 0;
+    }
 
-    // Copy what the caller wants put there, up to the max size
-    // Its not going to be valid, if the size is wrong, but do it anyway
-    if( iSize ) memcpy( i2pDest, sBase64Dest.c_str(), iSize < I2P_DESTINATION_STORE ? iSize : I2P_DESTINATION_STORE );
-    return (iSize == I2P_DESTINATION_STORE) && IsNativeI2P();
+    // Its not going to be valid if the size is wrong, the destination is left cleared then
+    return (iSize == I2P_DESTINATION_STORE) && SetI2pDestinationBase64( sBase64Dest.c_str() );
 }
 
 // Convert this netaddress objects native i2p address into a b32.i2p address
 std::string CNetAddr::ToB32String() const
 {
-    return B32AddressFromDestination( GetI2pDestination() );
+    return B32AddressFromHash( i2pHash );
 }
 
 bool CNetAddr::IsLocal() const
@@ -1115,17 +1225,18 @@ std::string CNetAddr::ToString() const
 
 bool operator==(const CNetAddr& a, const CNetAddr& b)
 {
-    return (memcmp(a.ip, b.ip, 16) == 0 && memcmp(a.i2pDest, b.i2pDest, I2P_DESTINATION_STORE) == 0);
+    return (memcmp(a.ip, b.ip, 16) == 0 && a.i2pHash == b.i2pHash);
 }
 
 bool operator!=(const CNetAddr& a, const CNetAddr& b)
 {
-    return (memcmp(a.ip, b.ip, 16) != 0 || memcmp(a.i2pDest, b.i2pDest, I2P_DESTINATION_STORE) != 0);
+    return (memcmp(a.ip, b.ip, 16) != 0 || a.i2pHash != b.i2pHash);
 }
 
 bool operator<(const CNetAddr& a, const CNetAddr& b)
 {
-    return (memcmp(a.ip, b.ip, 16) < 0 || (memcmp(a.ip, b.ip, 16) == 0 && memcmp(a.i2pDest, b.i2pDest, I2P_DESTINATION_STORE) < 0));
+    int nCmp = memcmp(a.ip, b.ip, 16);
+    return (nCmp < 0 || (nCmp == 0 && memcmp(a.i2pHash.begin(), b.i2pHash.begin(), a.i2pHash.size()) < 0));
 }
 
 bool CNetAddr::GetInAddr(struct in_addr* pipv4Addr) const
@@ -1153,9 +1264,9 @@ std::vector<unsigned char> CNetAddr::GetGroup() const
     int nBits = 16;
 
     if( IsI2P() ) {
-        vchRet.resize(I2P_DESTINATION_STORE + 1);
+        vchRet.resize(i2pHash.size() + 1);
         vchRet[0] = NET_I2P;
-        memcpy(&vchRet[1], i2pDest, I2P_DESTINATION_STORE);
+        memcpy(&vchRet[1], i2pHash.begin(), i2pHash.size());
         return vchRet;
     }
 
@@ -1221,7 +1332,7 @@ std::vector<unsigned char> CNetAddr::GetGroup() const
 
 uint64_t CNetAddr::GetHash() const
 {
-    uint256 hash = IsI2P() ? Hash(i2pDest, i2pDest + I2P_DESTINATION_STORE) : Hash(&ip[0], &ip[16]);
+    uint256 hash = IsI2P() ? Hash(i2pHash.begin(), i2pHash.end()) : Hash(&ip[0], &ip[16]);
     uint64_t nRet;
     memcpy(&nRet, &hash, sizeof(nRet));
     return nRet;
@@ -1440,6 +1551,16 @@ bool CService::GetSockAddr(struct sockaddr* paddr, socklen_t *addrlen) const
     return false;
 }
 
+uint64_t CNetAddr::GetSaltedHash(const uint256& salt) const
+{
+    // Addresses without a destination have a null hash, those with one all share the garlicat prefix
+    uint256 key = i2pHash;
+    unsigned char* pchKey = key.begin();
+    for (int i = 0; i < 16; i++)
+        pchKey[i] ^= ip[i];
+    return key.GetHash(salt);
+}
+
 std::vector<unsigned char> CService::GetKey() const
 {
      std::vector<unsigned char> vKey;
@@ -1447,8 +1568,7 @@ std::vector<unsigned char> CService::GetKey() const
     if (IsNativeI2P())
     {
         assert( IsI2P() );
-        vKey.resize(I2P_DESTINATION_STORE);
-        memcpy(&vKey[0], i2pDest, I2P_DESTINATION_STORE);
+        vKey.assign(i2pHash.begin(), i2pHash.end());
         return vKey;
     }
      vKey.resize(18);
@@ -1682,9 +1802,9 @@ bool SetSocketNonBlocking(SOCKET& hSocket, bool fNonBlocking)
 //! is defined and used in the hardware specific code.  The later is defined for this module and determines the exact
 //! storage allocated in the CNetAddr object so we can support I2P destination address space.
 //!
-//! We plan on changing the details inside that object for addresses, In the future we'll store them in binary, not
-//! base64, and have variable length certificates at the end of the keys, conforming to the new I2P definition, yet
-//! not changing the size of of the object here in each CNetAddr.
+//! The CNetAddr object keeps destinations in binary, I2P_DESTINATION_BYTES long, along with their b32 hash.  They are
+//! only converted to base64 for the SAM bridge and the p2p network.  Variable length certificates at the end of the
+//! keys, conforming to the new I2P definition, are still to come.
 bool IsTorOnly()
 {
     bool torOnly = false;
@@ -1758,9 +1878,200 @@ uint256 GetI2pDestinationHash( const std::string& destination )
 
 std::string B32AddressFromDestination(const std::string& destination)
 {
-    uint256 b32hash = GetI2pDestinationHash( destination );
+    return B32AddressFromHash( GetI2pDestinationHash( destination ) );
+}
+
+std::string B32AddressFromHash(const uint256& b32hash)
+{
     std::string result = EncodeBase32(b32hash.begin(), b32hash.end() - b32hash.begin()) + ".b32.i2p";
     for (size_t pos = result.find_first_of('='); pos != std::string::npos; pos = result.find_first_of('=', pos-1))
         result.erase(pos, 1);
     return result;
 }
+
+//! Base32 is case insensitive, the cache keeps names in lower case
+static std::string NormalizeB32(const std::string& strB32)
+{
+    return boost::to_lower_copy(strB32);
+}
+
+bool CI2pNameCache::Get(const std::string& strB32, std::string& strDest)
+{
+    boost::unique_lock<boost::mutex> lock(cs);
+    std::map<std::string, CEntry>::iterator it = mapNames.find(NormalizeB32(strB32));
+    int64_t nNow = GetTime();
+    if (it == mapNames.end() || it->second.nExpires <= nNow)
+        return false;
+    if (!it->second.strDest.empty())
+        it->second.nExpires = nNow + I2P_NAME_CACHE_TTL;
+    strDest = it->second.strDest;
+    nHits++;
+    return true;
+}
+
+void CI2pNameCache::Put(const std::string& strB32, const std::string& strDest)
+{
+    boost::unique_lock<boost::mutex> lock(cs);
+    PutLocked(NormalizeB32(strB32), strDest, GetTime());
+}
+
+void CI2pNameCache::PutLocked(const std::string& strB32, const std::string& strDest, int64_t nNow)
+{
+    if (mapNames.size() >= I2P_NAME_CACHE_MAX_SIZE && !mapNames.count(strB32)) {
+        Expire();
+        //! Still full, make room by dropping the entry closest to expiring
+        if (mapNames.size() >= I2P_NAME_CACHE_MAX_SIZE) {
+            std::map<std::string, CEntry>::iterator itOldest = mapNames.begin();
+            for (std::map<std::string, CEntry>::iterator it = mapNames.begin(); it != mapNames.end(); ++it)
+                if (it->second.nExpires < itOldest->second.nExpires)
+                    itOldest = it;
+            mapNames.erase(itOldest);
+        }
+    }
+    mapNames[strB32] = CEntry(strDest, nNow + (strDest.empty() ? I2P_NAME_CACHE_NEGATIVE_TTL : I2P_NAME_CACHE_TTL));
+}
+
+void CI2pNameCache::Expire()
+{
+    int64_t nNow = GetTime();
+    for (std::map<std::string, CEntry>::iterator it = mapNames.begin(); it != mapNames.end(); ) {
+        if (it->second.nExpires <= nNow)
+            mapNames.erase(it++);
+        else
+            ++it;
+    }
+}
+
+std::string CI2pNameCache::Resolve(const std::string& strB32In)
+{
+    std::string strB32 = NormalizeB32(strB32In);
+    std::string strDest;
+    if (Get(strB32, strDest))
+        return strDest;
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        if (setInFlight.count(strB32)) {
+            //! Someone already asked the router, their answer is ours as well
+            while (setInFlight.count(strB32))
+                cond.wait(lock);
+            std::map<std::string, CEntry>::iterator it = mapNames.find(strB32);
+            return it == mapNames.end() ? std::string() : it->second.strDest;
+        }
+        //! Don't wait for ThreadI2pNameLookup to get to a queued name, look it up right away
+        vQueued.erase(std::remove(vQueued.begin(), vQueued.end(), strB32), vQueued.end());
+        setInFlight.insert(strB32);
+    }
+    Lookup(std::vector<std::string>(1, strB32));
+
+    boost::unique_lock<boost::mutex> lock(cs);
+    std::map<std::string, CEntry>::iterator it = mapNames.find(strB32);
+    return it == mapNames.end() ? std::string() : it->second.strDest;
+}
+
+void CI2pNameCache::Prefetch(const std::vector<std::string>& vB32)
+{
+    boost::unique_lock<boost::mutex> lock(cs);
+    int64_t nNow = GetTime();
+    BOOST_FOREACH(const std::string& strName, vB32) {
+        std::string strB32 = NormalizeB32(strName);
+        std::map<std::string, CEntry>::iterator it = mapNames.find(strB32);
+        if (!isValidI2pB32(strB32) || (it != mapNames.end() && it->second.nExpires > nNow) || setInFlight.count(strB32) ||
+            std::find(vQueued.begin(), vQueued.end(), strB32) != vQueued.end())
+            continue;
+        vQueued.push_back(strB32);
+    }
+    cond.notify_all();
+}
+
+void CI2pNameCache::ProcessQueue()
+{
+    std::vector<std::string> vBatch;
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        while (vQueued.empty())
+            cond.wait(lock);
+        size_t nBatch = std::min<size_t>(vQueued.size(), I2P_NAME_LOOKUP_BATCH);
+        vBatch.assign(vQueued.begin(), vQueued.begin() + nBatch);
+        vQueued.erase(vQueued.begin(), vQueued.begin() + nBatch);
+        setInFlight.insert(vBatch.begin(), vBatch.end());
+    }
+    Lookup(vBatch);
+}
+
+//! The names must be in setInFlight, they are taken out again and whoever waits for them is woken up
+void CI2pNameCache::Lookup(const std::vector<std::string>& vB32)
+{
+    std::vector<std::string> vDest;
+    std::vector<bool> vAnswered;
+    try {
+        vDest = LookupNames(vB32, vAnswered);
+    } catch (...) {
+        boost::unique_lock<boost::mutex> lock(cs);
+        BOOST_FOREACH(const std::string& strB32, vB32)
+            setInFlight.erase(strB32);
+        cond.notify_all();
+        throw;
+    }
+    vDest.resize(vB32.size());
+    vAnswered.resize(vB32.size(), false);
+
+    boost::unique_lock<boost::mutex> lock(cs);
+    int64_t nNow = GetTime();
+    nLookups += vB32.size();
+    for (unsigned int i = 0; i < vB32.size(); i++) {
+        setInFlight.erase(vB32[i]);
+        //! Only a router that answered KEY_NOT_FOUND makes the name unknown, a failed lookup is tried again next time
+        if (!vAnswered[i]) {
+            LogPrint("net", "NAMING LOOKUP for %s failed, not caching it\n", vB32[i]);
+            continue;
+        }
+        //! Only keep what really is the destination behind the b32 address
+        if (!vDest[i].empty() && (!isValidI2pAddress(vDest[i]) || B32AddressFromDestination(vDest[i]) != vB32[i])) {
+            LogPrint("net", "Router returned a destination for %s that doesn't match it\n", vB32[i]);
+            vDest[i].clear();
+        }
+        PutLocked(vB32[i], vDest[i], nNow);
+    }
+    cond.notify_all();
+}
+
+std::vector<std::string> CI2pNameCache::LookupNames(const std::vector<std::string>& vB32, std::vector<bool>& vAnswered)
+{
+#ifdef ENABLE_I2PSAM
+    return I2PSession::Instance().namingLookup(vB32, vAnswered);
+#else
+    vAnswered.assign(vB32.size(), false);
+    return std::vector<std::string>(vB32.size());
+#endif
+}
+
+void CI2pNameCache::Clear()
+{
+    boost::unique_lock<boost::mutex> lock(cs);
+    mapNames.clear();
+    vQueued.clear();
+}
+
+size_t CI2pNameCache::size()
+{
+    boost::unique_lock<boost::mutex> lock(cs);
+    return mapNames.size();
+}
+
+uint64_t CI2pNameCache::GetLookups()
+{
+    boost::unique_lock<boost::mutex> lock(cs);
+    return nLookups;
+}
+
+uint64_t CI2pNameCache::GetHits()
+{
+    boost::unique_lock<boost::mutex> lock(cs);
+    return nHits;
+}
+
+void ThreadI2pNameLookup()
+{
+    while (true)
+        i2pnames.ProcessQueue();
+}
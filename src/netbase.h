@@ -12,7 +12,11 @@
 
 #include "compat.h"
 #include "serialize.h"
+#include "sync.h"
+#include "uint256.h"
 
+#include <map>
+#include <set>
 #include <stdint.h>
 #include <string>
 #include <vector>
@@ -32,7 +36,8 @@ extern const int32_t DEFAULT_CONNECT_TIMEOUT;
 #include "i2pwrapper.h"
 #endif
 
-#define I2P_DESTINATION_STORE 516
+#define I2P_DESTINATION_STORE 516     // Length of a base64 I2P destination, as the SAM bridge and the p2p network see it
+#define I2P_DESTINATION_BYTES 387     // The same destination in binary, a null certificate has its last 3 bytes zero
 #define NATIVE_I2P_B32ADDR_SIZE 60
 
 enum Network
@@ -56,7 +61,35 @@ class CNetAddr
 {
     protected:
         unsigned char ip[16]; // in network byte order
-        unsigned char i2pDest[I2P_DESTINATION_STORE]; // I2P Destination
+        unsigned char i2pDest[I2P_DESTINATION_BYTES]; // I2P Destination, in binary
+        uint256 i2pHash;                              // SHA256 of i2pDest, the b32.i2p address.  Null without a destination
+
+        bool SetI2pDestinationRaw(const unsigned char* pchDest);
+        void GetI2pDestinationBase64(char* pszBase64) const;
+        bool SetI2pDestinationBase64(const char* pszBase64);
+
+        /**
+         * Destinations travel the p2p network in base64, as they always have, but peers.dat keeps them in
+         * binary.  SER_I2PBASE64 reads a peers.dat written before that.
+         */
+        template <typename Stream, typename Operation>
+        inline void SerializeI2pDest(Stream& s, Operation ser_action, int nType, int nVersion) {
+            if (nType & SER_IPADDRONLY)
+                return;
+            if ((nType & SER_DISK) && !(nType & SER_I2PBASE64)) {
+                READWRITE(FLATDATA(i2pDest));
+                if (ser_action.ForRead())
+                    SetI2pDestinationRaw(i2pDest);
+            } else {
+                char pszBase64[I2P_DESTINATION_STORE];
+                if (!ser_action.ForRead())
+                    GetI2pDestinationBase64(pszBase64);
+                READWRITE(FLATDATA(pszBase64));
+                if (ser_action.ForRead())
+                    SetI2pDestinationBase64(pszBase64);
+            }
+        }
+
     public:
         CNetAddr();
         CNetAddr(const struct in_addr& ipv4Addr);
@@ -96,6 +129,7 @@ class CNetAddr
         std::string ToStringIP() const;
         unsigned int GetByte(int n) const;
         uint64_t GetHash() const;
+        uint64_t GetSaltedHash(const uint256& salt) const;   // Cheap, for hash tables with a secret salt
         bool GetInAddr(struct in_addr* pipv4Addr) const;
         std::vector<unsigned char> GetGroup() const;
         int GetReachabilityFrom(const CNetAddr *paddrPartner = NULL) const;
@@ -109,6 +143,7 @@ class CNetAddr
         bool CheckAndSetGarlicCat( void );
         std::string GetI2pDestination() const;
         bool SetI2pDestination( const std::string& sBase64Dest );
+        const uint256& GetI2pDestinationHash() const { return i2pHash; }
         std::string ToB32String() const;
 
         friend bool operator==(const CNetAddr& a, const CNetAddr& b);
@@ -120,9 +155,7 @@ class CNetAddr
         template <typename Stream, typename Operation>
         inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
             READWRITE(FLATDATA(ip));
-             if (!(nType & SER_IPADDRONLY)) {
-                READWRITE(FLATDATA(i2pDest));
-             }
+            SerializeI2pDest(s, ser_action, nType, nVersion);
         }
 };
 
@@ -186,9 +219,7 @@ class CService : public CNetAddr
         template <typename Stream, typename Operation>
         inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
             READWRITE(FLATDATA(ip));
-             if (!(nType & SER_IPADDRONLY)) {
-                READWRITE(FLATDATA(i2pDest));
-             }
+            SerializeI2pDest(s, ser_action, nType, nVersion);
             unsigned short portN = htons(port);
             READWRITE(portN);
             if (ser_action.ForRead())
@@ -212,6 +243,10 @@ bool Lookup(const char *pszName, std::vector<CService>& vAddr, int portDefault =
 bool LookupNumeric(const char *pszName, CService& addr, int portDefault = 0);
 bool ConnectSocket(const CService &addr, SOCKET& hSocketRet, int nTimeout, bool *outProxyConnectionFailed = 0);
 bool ConnectSocketByName(CService &addr, SOCKET& hSocketRet, const char *pszDest, int portDefault, int nTimeout, bool *outProxyConnectionFailed = 0);
+#ifdef ENABLE_I2PSAM
+/** Open streams to several I2P destinations concurrently, returns how many succeeded. Failed ones are INVALID_SOCKET */
+int ConnectI2PSockets(const std::vector<CService>& vAddrDest, std::vector<SOCKET>& vSocketRet);
+#endif
 
 /** Return readable error string for a network error code */
 std::string NetworkErrorString(int err);
@@ -231,6 +266,98 @@ bool isValidI2pAddress( const std::string& I2pAddr );
 bool isValidI2pB32( const std::string& B32Address );
 bool isStringI2pDestination( const std::string & strName );
 std::string B32AddressFromDestination(const std::string& destination);
+std::string B32AddressFromHash(const uint256& b32hash);
 uint256 GetI2pDestinationHash( const std::string& destination );
 
+/** Seconds a destination the router found for a b32.i2p address is kept, renewed each time it is used */
+extern const int64_t I2P_NAME_CACHE_TTL;
+/** Seconds a b32.i2p address the router could not find is not asked for again */
+extern const int64_t I2P_NAME_CACHE_NEGATIVE_TTL;
+/** Most b32.i2p addresses kept in the cache */
+extern const unsigned int I2P_NAME_CACHE_MAX_SIZE;
+/** Most names sent to the router in one batch of concurrent NAMING LOOKUPs */
+extern const unsigned int I2P_NAME_LOOKUP_BATCH;
+
+/**
+ * b32.i2p addresses the router resolved to base64 destinations, so connecting to the same peers again,
+ * -addnode and -connect included, doesn't cost a NAMING LOOKUP each time.  Destinations are checked
+ * against the b32 address they were looked up for before they are kept.
+ *
+ * Lookups are coalesced: Resolve() joins a lookup already under way for the same name instead of
+ * asking the router again, and Prefetch() queues names for ThreadI2pNameLookup, which sends them to
+ * the router in concurrent batches.  The cache is written to i2pnames.dat next to peers.dat.
+ */
+class CI2pNameCache
+{
+public:
+    struct CEntry
+    {
+        std::string strDest;        //! Empty if the router could not find the name
+        int64_t nExpires;
+
+        CEntry() : nExpires(0) {}
+        CEntry(const std::string& strDestIn, int64_t nExpiresIn) : strDest(strDestIn), nExpires(nExpiresIn) {}
+
+        ADD_SERIALIZE_METHODS;
+
+        template <typename Stream, typename Operation>
+        inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+            READWRITE(strDest);
+            READWRITE(nExpires);
+        }
+    };
+
+    CI2pNameCache() : nLookups(0), nHits(0) {}
+    virtual ~CI2pNameCache() {}
+
+    //! True if strB32 is cached, strDest is left empty for a name the router could not find
+    bool Get(const std::string& strB32, std::string& strDest);
+    //! Keeps the destination found for strB32, or remembers that none was if strDest is empty
+    void Put(const std::string& strB32, const std::string& strDest);
+    //! Returns the destination for strB32, asking the router or waiting for a lookup already under way if needed
+    std::string Resolve(const std::string& strB32);
+    //! Queues the names that are neither cached nor being looked up for ThreadI2pNameLookup
+    void Prefetch(const std::vector<std::string>& vB32);
+    //! Waits for queued names and looks up to I2P_NAME_LOOKUP_BATCH of them at once
+    void ProcessQueue();
+    void Clear();
+
+    size_t size();
+    uint64_t GetLookups();
+    uint64_t GetHits();
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+        boost::unique_lock<boost::mutex> lock(cs);
+        READWRITE(mapNames);
+        if (ser_action.ForRead())
+            Expire();
+    }
+
+protected:
+    //! Asks the router for the destinations, an empty one for each name it could not find.  vAnswered is false
+    //! where no NAMING REPLY came back (a timeout, a sick session or a closed socket), those names aren't cached
+    virtual std::vector<std::string> LookupNames(const std::vector<std::string>& vB32, std::vector<bool>& vAnswered);
+
+private:
+    CWaitableCriticalSection cs;
+    CConditionVariable cond;
+    std::map<std::string, CEntry> mapNames;
+    std::vector<std::string> vQueued;           //! Names waiting for ThreadI2pNameLookup
+    std::set<std::string> setInFlight;          //! Names the router is being asked for
+    uint64_t nLookups;                          //! Names sent to the router
+    uint64_t nHits;                             //! Names answered from the cache
+
+    void Lookup(const std::vector<std::string>& vB32);
+    void PutLocked(const std::string& strB32, const std::string& strDest, int64_t nNow);
+    void Expire();
+};
+
+extern CI2pNameCache i2pnames;
+
+/** Resolves the b32.i2p names Prefetch() queued, runs until the thread is interrupted */
+void ThreadI2pNameLookup();
+
 #endif // ANONCOIN_NETBASE_H
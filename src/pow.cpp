@@ -194,7 +194,7 @@ int64_t CalcNetworkHashPS( const CBlockIndex* pBI, int32_t nLookup )
 
     //! The calculation will be wrong by one time difference, because spacing is 1 less than the number of blocks, unless we carefully
     //! scale the values before dividing them.  Chain work proofs have already been calculated for us, and are in the index, so we use them.
-    uint256 uintWorkDiff = pBI->nChainWork - pBI0->nChainWork;
+    uint256 uintWorkDiff = pBI->nChainWork.GetWork() - pBI0->nChainWork.GetWork();
     double dWorkDiff = uintWorkDiff.getdouble() / (double)nLookup;
     double dTimeDiff = (double)( maxTime - minTime ) / (double)(nLookup - 1);
 
@@ -1373,7 +1373,7 @@ void CRetargetPidController::RunReports( const CBlockIndex* pIndex, const CBlock
         double dMinerKHPS = GetFastMiningKHPS();
         csvfile << dNetKHPS << "," << dMinerKHPS << ",";
         //! Calculate and add the Log2 work calculations
-        csvfile << GetLog2Work(uintPrevDiffCalculated) << "," << GetLog2Work(uintTargetAfterLimits) << "," << GetLog2Work(pIndex->nChainWork) << ",";
+        csvfile << GetLog2Work(uintPrevDiffCalculated) << "," << GetLog2Work(uintTargetAfterLimits) << "," << GetLog2Work(pIndex->nChainWork.GetWork()) << ",";
 #if defined( HARDFORK_BLOCK )
         if( isMainNetwork() && pIndex->nHeight <= HARDFORK_BLOCK ) {
 #else
@@ -8,8 +8,11 @@
 // anoncoin-config.h loaded...
 
 #include "checkpoints.h"
+#include "init.h"
+#include "leveldbwrapper.h"
 #include "main.h"
 #include "sync.h"
+#include "txdb.h"
 #include "util.h"
 
 #ifdef ENABLE_WALLET
@@ -18,6 +21,8 @@
 
 #include <stdint.h>
 
+#include <boost/filesystem.hpp>
+
 #include "json/json_spirit_value.h"
 
 using namespace json_spirit;
@@ -372,6 +377,246 @@ Value gettxoutsetinfo(const Array& params, bool fHelp)
     return ret;
 }
 
+Value dumptxoutset(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() != 1)
+        throw runtime_error(
+            "dumptxoutset \"filename\"\n"
+            "\n Writes the unspent transaction output set at the current tip to a snapshot file, which another node can\n"
+            " load with loadtxoutset. The coins are read from a consistent view of the database, the node keeps running.\n"
+            "\nArguments:\n"
+            " 1. \"filename\"    (string, required) the snapshot file, relative to the data directory unless absolute\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"filename\": \"path\",       (string) The full path of the snapshot file\n"
+            "  \"height\":n,                (numeric) The height of the block the snapshot was taken at\n"
+            "  \"bestblock\": \"hex\",        (string) the block hash hex\n"
+            "  \"transactions\": n,         (numeric) The number of transactions\n"
+            "  \"txouts\": n,               (numeric) The number of output transactions\n"
+            "  \"hash_serialized\": \"hash\", (string) The serialized hash, pass it to loadtxoutset\n"
+            "  \"total_amount\": x.xxx      (numeric) The total amount\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("dumptxoutset", "\"utxo.dat\"")
+            + HelpExampleRpc("dumptxoutset", "\"utxo.dat\"")
+        );
+
+    boost::filesystem::path path = boost::filesystem::absolute(params[0].get_str(), GetDataDir());
+    if (boost::filesystem::exists(path))
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "File " + path.string() + " already exists");
+
+    boost::scoped_ptr<CCoinsViewDBCursor> pcursor;
+    int nHeight = 0;
+    {
+        LOCK(cs_main);
+        FlushStateToDisk();
+        pcursor.reset(pcoinsdbview->Cursor());
+        BlockMap::iterator mi = mapBlockIndex.find(pcursor->GetBestBlock());
+        if (mi == mapBlockIndex.end())
+            throw JSONRPCError(RPC_DATABASE_ERROR, "The best block of the chainstate is not in the block index");
+        nHeight = mi->second->nHeight;
+    }
+
+    CCoinsStats stats;
+    if (!DumpCoinsSnapshot(*pcursor, nHeight, path, stats))
+        throw JSONRPCError(RPC_MISC_ERROR, "Failed to write the snapshot file, see debug.log");
+
+    Object ret;
+    ret.push_back(Pair("filename", path.string()));
+    ret.push_back(Pair("height", (int64_t)stats.nHeight));
+    ret.push_back(Pair("bestblock", stats.hashBlock.GetHex()));
+    ret.push_back(Pair("transactions", (int64_t)stats.nTransactions));
+    ret.push_back(Pair("txouts", (int64_t)stats.nTransactionOutputs));
+    ret.push_back(Pair("hash_serialized", stats.hashSerialized.GetHex()));
+    ret.push_back(Pair("total_amount", ValueFromAmount(stats.nTotalAmount)));
+    return ret;
+}
+
+Value loadtxoutset(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() != 2)
+        throw runtime_error(
+            "loadtxoutset \"filename\" \"hash_serialized\"\n"
+            "\n Replaces the chainstate with the unspent transaction output set of a snapshot file written by dumptxoutset.\n"
+            " The whole file is checked first, its coins must hash to the given hash_serialized, as reported by\n"
+            " gettxoutsetinfo on a trusted node at the snapshot height. The snapshot block must extend the active chain,\n"
+            " only its header is needed. The blocks up to it are not validated and can not be disconnected or served to\n"
+            " peers, wallets need a -rescan afterwards. Not available with -txindex or -addrindex.\n"
+            "\nArguments:\n"
+            " 1. \"filename\"          (string, required) the snapshot file, relative to the data directory unless absolute\n"
+            " 2. \"hash_serialized\"   (string, required) the expected serialized hash of the coins\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"height\":n,                (numeric) The new chain height\n"
+            "  \"bestblock\": \"hex\",        (string) the new best block hash hex\n"
+            "  \"transactions\": n,         (numeric) The number of transactions loaded\n"
+            "  \"txouts\": n,               (numeric) The number of output transactions loaded\n"
+            "  \"total_amount\": x.xxx      (numeric) The total amount\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("loadtxoutset", "\"utxo.dat\" \"5d4f...\"")
+            + HelpExampleRpc("loadtxoutset", "\"utxo.dat\", \"5d4f...\"")
+        );
+
+    boost::filesystem::path path = boost::filesystem::absolute(params[0].get_str(), GetDataDir());
+    uint256 hashExpected = ParseHashV(params[1], "hash_serialized");
+
+    //! Reading and hashing the whole file does not need any lock
+    CCoinsSnapshotHeader header;
+    CCoinsStats stats;
+    if (!VerifyCoinsSnapshot(path, header, stats))
+        throw JSONRPCError(RPC_DESERIALIZATION_ERROR, "The snapshot file is unreadable or corrupt, see debug.log");
+    if (stats.hashSerialized != hashExpected)
+        throw JSONRPCError(RPC_VERIFY_ERROR, "The snapshot coins hash to " + stats.hashSerialized.GetHex() + ", not the expected hash");
+
+    LOCK(cs_main);
+    if (fTxIndex || fAddrIndex)
+        throw JSONRPCError(RPC_MISC_ERROR, "Not available with -txindex or -addrindex, they would miss the skipped blocks");
+    BlockMap::iterator mi = mapBlockIndex.find(header.hashBlock);
+    if (mi == mapBlockIndex.end())
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "The snapshot block is not known yet");
+    CBlockIndex* pindex = mi->second;
+    if (pindex->nHeight != header.nHeight)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "The snapshot height does not match its block");
+    if (pindex->nStatus & BLOCK_FAILED_MASK)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "The snapshot block is invalid");
+    if (!pindex->IsValid(BLOCK_VALID_TREE))
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "The header of the snapshot block has not been validated");
+    if (chainActive.Height() >= pindex->nHeight || (chainActive.Tip() && pindex->GetAncestor(chainActive.Height()) != chainActive.Tip()))
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "The snapshot block does not extend the active chain");
+
+    FlushStateToDisk();
+    if (!pcoinsdbview->LoadSnapshot(path, header, std::max(nScriptCheckThreads, 1))) {
+        StartShutdown();
+        throw JSONRPCError(RPC_DATABASE_ERROR, "Failed to load the snapshot, the node is shutting down and needs a -reindex");
+    }
+    if (!ActivateCoinsSnapshot(pindex))
+        throw JSONRPCError(RPC_DATABASE_ERROR, "Failed to activate the snapshot block, see debug.log");
+
+    Object ret;
+    ret.push_back(Pair("height", (int64_t)pindex->nHeight));
+    ret.push_back(Pair("bestblock", pindex->GetBlockHash().GetHex()));
+    ret.push_back(Pair("transactions", (int64_t)stats.nTransactions));
+    ret.push_back(Pair("txouts", (int64_t)stats.nTransactionOutputs));
+    ret.push_back(Pair("total_amount", ValueFromAmount(stats.nTotalAmount)));
+    return ret;
+}
+
+//! Returns the named LevelDB databases to report on, all of them when strName is empty
+static std::vector<CLevelDBWrapper*> GetLevelDBs(const std::string& strName)
+{
+    AssertLockHeld(cs_mapLevelDB);
+    std::vector<CLevelDBWrapper*> vDBs;
+    for (std::map<std::string, CLevelDBWrapper*>::const_iterator it = mapLevelDB.begin(); it != mapLevelDB.end(); it++)
+        if (strName.empty() || it->first == strName)
+            vDBs.push_back(it->second);
+    if (!strName.empty() && vDBs.empty())
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Unknown database, use chainstate or blockindex");
+    return vDBs;
+}
+
+Value getdbstats(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() > 1)
+        throw runtime_error(
+            "getdbstats [\"database\"]\n"
+            "\n Returns the tuning options, usage counters and LevelDB internal statistics of the block databases.\n"
+            "\nArguments:\n"
+            " 1. \"database\"      (string, optional) chainstate or blockindex, default is both\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"chainstate\": {\n"
+            "    \"blocksize\": n,          (numeric) LevelDB block size in bytes\n"
+            "    \"writebuffer\": n,        (numeric) LevelDB write buffer size in bytes\n"
+            "    \"maxopenfiles\": n,       (numeric) Maximum number of open table files\n"
+            "    \"compression\": true|false, (boolean) If snappy compression is used for new tables\n"
+            "    \"reads\": n,              (numeric) Number of reads since startup\n"
+            "    \"readmisses\": n,         (numeric) Number of reads for a key which was not found\n"
+            "    \"readbytes\": n,          (numeric) Bytes of values read\n"
+            "    \"writes\": n,             (numeric) Number of batches written\n"
+            "    \"writebytes\": n,         (numeric) Approximate bytes written\n"
+            "    \"writetime\": x.xxx,      (numeric) Seconds spent writing\n"
+            "    \"maxwritetime\": x.xxx,   (numeric) Seconds taken by the longest write\n"
+            "    \"slowwrites\": n,         (numeric) Writes which stalled for over 100ms, usually on compaction\n"
+            "    \"compactions\": n,        (numeric) Number of manual compactions run\n"
+            "    \"compactiontime\": x.xxx, (numeric) Seconds spent in manual compactions\n"
+            "    \"filesatlevel\": [n,...], (array) Number of table files at each level\n"
+            "    \"leveldbstats\": \"str\"    (string) The leveldb.stats compaction table\n"
+            "  },\n"
+            "  ...\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getdbstats", "")
+            + HelpExampleCli("getdbstats", "\"chainstate\"")
+            + HelpExampleRpc("getdbstats", "\"chainstate\"")
+        );
+
+    std::string strName = params.size() > 0 ? params[0].get_str() : "";
+
+    LOCK(cs_mapLevelDB);
+    Object ret;
+    BOOST_FOREACH(const CLevelDBWrapper* pdb, GetLevelDBs(strName)) {
+        const leveldb::Options& options = pdb->GetOptions();
+        CLevelDBStats stats = pdb->GetStats();
+        Object obj;
+        obj.push_back(Pair("blocksize", (int64_t)options.block_size));
+        obj.push_back(Pair("writebuffer", (int64_t)options.write_buffer_size));
+        obj.push_back(Pair("maxopenfiles", options.max_open_files));
+        obj.push_back(Pair("compression", options.compression != leveldb::kNoCompression));
+        obj.push_back(Pair("reads", (int64_t)stats.nReads));
+        obj.push_back(Pair("readmisses", (int64_t)stats.nReadMisses));
+        obj.push_back(Pair("readbytes", (int64_t)stats.nReadBytes));
+        obj.push_back(Pair("writes", (int64_t)stats.nWrites));
+        obj.push_back(Pair("writebytes", (int64_t)stats.nWriteBytes));
+        obj.push_back(Pair("writetime", 0.000001 * stats.nWriteMicros));
+        obj.push_back(Pair("maxwritetime", 0.000001 * stats.nMaxWriteMicros));
+        obj.push_back(Pair("slowwrites", (int64_t)stats.nSlowWrites));
+        obj.push_back(Pair("compactions", (int64_t)stats.nCompactions));
+        obj.push_back(Pair("compactiontime", 0.000001 * stats.nCompactionMicros));
+        Array levels;
+        std::string strValue;
+        for (int nLevel = 0; pdb->GetProperty(strprintf("leveldb.num-files-at-level%d", nLevel), strValue); nLevel++)
+            levels.push_back(atoi(strValue));
+        obj.push_back(Pair("filesatlevel", levels));
+        if (pdb->GetProperty("leveldb.stats", strValue))
+            obj.push_back(Pair("leveldbstats", strValue));
+        ret.push_back(Pair(pdb->GetName(), obj));
+    }
+    return ret;
+}
+
+Value compactdb(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() > 1)
+        throw runtime_error(
+            "compactdb [\"database\"]\n"
+            "\n Runs a full manual compaction of the block databases, best done off-peak.\n"
+            " This call blocks until LevelDB has finished, which can take minutes. Block processing carries on meanwhile.\n"
+            "\nArguments:\n"
+            " 1. \"database\"      (string, optional) chainstate or blockindex, default is both\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"chainstate\": x.xxx,       (numeric) Seconds the compaction took\n"
+            "  ...\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("compactdb", "\"chainstate\"")
+            + HelpExampleRpc("compactdb", "\"chainstate\"")
+        );
+
+    std::string strName = params.size() > 0 ? params[0].get_str() : "";
+
+    //! cs_main is deliberately not taken, LevelDB compacts concurrently with ongoing reads and writes
+    LOCK(cs_mapLevelDB);
+    Object ret;
+    BOOST_FOREACH(CLevelDBWrapper* pdb, GetLevelDBs(strName)) {
+        int64_t nStart = GetTimeMicros();
+        pdb->Compact();
+        ret.push_back(Pair(pdb->GetName(), 0.000001 * (GetTimeMicros() - nStart)));
+    }
+    return ret;
+}
+
 Value gettxout(const Array& params, bool fHelp)
 {
     if (fHelp || params.size() < 2 || params.size() > 3)
@@ -564,6 +564,22 @@ Value getnetworkinfo(const Array& params, bool fHelp)
             "    \"port\": xxx,               (numeric) network port\n"
             "    \"score\": xxx               (numeric) relative score\n"
             "  ]\n"
+            "  \"i2paccept\": {             (object, optional) the I2P accept pool, when I2P is enabled\n"
+            "    \"target\": xxx,             (numeric) accepts kept armed at the SAM bridge\n"
+            "    \"outstanding\": xxx,        (numeric) accepts armed right now\n"
+            "    \"accepted\": xxx,           (numeric) accepts used up by an incoming peer\n"
+            "    \"empty\": xxx,              (numeric) accepts closed by the bridge without a peer\n"
+            "    \"failed\": xxx,             (numeric) accepts refused by the bridge\n"
+            "    \"armtimeavg\": xxx,         (numeric) average milliseconds until the bridge confirmed an accept\n"
+            "    \"armtimemax\": xxx,         (numeric) maximum of those\n"
+            "    \"waittimeavg\": xxx,        (numeric) average milliseconds an accept waited for its peer\n"
+            "    \"waittimemax\": xxx         (numeric) maximum of those\n"
+            "  }\n"
+            "  \"i2pnames\": {              (object, optional) the b32.i2p name cache, when I2P is enabled\n"
+            "    \"cached\": xxx,             (numeric) names kept, including those the router could not find\n"
+            "    \"lookups\": xxx,            (numeric) names sent to the router\n"
+            "    \"hits\": xxx                (numeric) names answered from the cache\n"
+            "  }\n"
             "  \"alerts\": [                  (array) list of alerts on network\n"
             "    \"alertid\": \"xxx\",          (numeric) the ID number for this alert\n"
             "    \"priority\": xxx,           (numeric) the alert priority\n"
@@ -604,6 +620,29 @@ Value getnetworkinfo(const Array& params, bool fHelp)
         }
     }
     obj.push_back(Pair("localaddresses", localAddresses));
+#ifdef ENABLE_I2PSAM
+    if (IsI2PEnabled()) {
+        CI2PAcceptStats stats;
+        GetI2PAcceptStats(stats);
+        Object i2pAccept;
+        i2pAccept.push_back(Pair("target", stats.nTarget));
+        i2pAccept.push_back(Pair("outstanding", stats.nOutstanding));
+        i2pAccept.push_back(Pair("accepted", stats.nAccepted));
+        i2pAccept.push_back(Pair("empty", stats.nEmpty));
+        i2pAccept.push_back(Pair("failed", stats.nFailed));
+        i2pAccept.push_back(Pair("armtimeavg", stats.nArmed ? stats.nArmTimeTotal / (int64_t)stats.nArmed : 0));
+        i2pAccept.push_back(Pair("armtimemax", stats.nArmTimeMax));
+        i2pAccept.push_back(Pair("waittimeavg", stats.nAccepted ? stats.nWaitTimeTotal / (int64_t)stats.nAccepted : 0));
+        i2pAccept.push_back(Pair("waittimemax", stats.nWaitTimeMax));
+        obj.push_back(Pair("i2paccept", i2pAccept));
+
+        Object i2pNames;
+        i2pNames.push_back(Pair("cached", (uint64_t)i2pnames.size()));
+        i2pNames.push_back(Pair("lookups", i2pnames.GetLookups()));
+        i2pNames.push_back(Pair("hits", i2pnames.GetHits()));
+        obj.push_back(Pair("i2pnames", i2pNames));
+    }
+#endif
 
     // Add in the list of alerts currently on the network
     Array localAlerts;
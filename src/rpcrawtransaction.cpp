@@ -19,6 +19,7 @@
 #include "sign.h"
 #include "sync.h"
 #include "transaction.h"
+#include "txdb.h"
 #include "uint256.h"
 #ifdef ENABLE_WALLET
 #include "wallet.h"
@@ -200,6 +201,63 @@ Value getrawtransaction(const Array& params, bool fHelp)
     return result;
 }
 
+Value getaddressoutputs(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() != 1)
+        throw runtime_error(
+            "getaddressoutputs <\"anoncoinaddress\">\n"
+            "\nReturns every output ever paid to the given address, taken from the address index.\n"
+            " This requires the -addrindex command line option.\n"
+
+            "\nArguments:\n"
+            " 1. \"anoncoinaddress\"           (string, required) The anoncoin address\n"
+
+            "\nResult:\n"
+            "[                               (array of json objects)\n"
+            "  {\n"
+            "    \"txid\" : \"id\",               (string) The transaction id\n"
+            "    \"vout\" : n,                  (numeric) The output index\n"
+            "    \"height\" : n,                (numeric) The height of the block which created the output\n"
+            "    \"amount\" : x.xxx,            (numeric) The output value in anc\n"
+            "    \"spent\" : true|false         (boolean) If the output has been spent in the active chain\n"
+            "  }\n"
+            "  ,...\n"
+            "]\n"
+
+            "\nExamples:\n"
+            + HelpExampleCli("getaddressoutputs", "\"AH6PLNDHFeNAngkjkeLhbDsFZQTYFH94i3\"")
+            + HelpExampleRpc("getaddressoutputs", "\"AH6PLNDHFeNAngkjkeLhbDsFZQTYFH94i3\"")
+        );
+
+    if (!fAddrIndex)
+        throw JSONRPCError(RPC_MISC_ERROR, "Address index not enabled, restart with -addrindex and -reindex");
+
+    CAnoncoinAddress address(params[0].get_str());
+    if (!address.IsValid())
+        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid Anoncoin address");
+    CScript scriptPubKey = GetScriptForDestination(address.Get());
+    uint160 hashScript = Hash160(scriptPubKey.begin(), scriptPubKey.end());
+
+    LOCK(cs_main);
+
+    std::vector<std::pair<CAddrIndexKey, CAddrIndexValue> > vEntries;
+    if (!pblocktree->ReadAddrIndex(hashScript, vEntries))
+        throw JSONRPCError(RPC_DATABASE_ERROR, "Unable to read the address index");
+
+    Array results;
+    for (std::vector<std::pair<CAddrIndexKey, CAddrIndexValue> >::const_iterator it = vEntries.begin(); it != vEntries.end(); it++) {
+        const CCoins* coins = pcoinsTip->AccessCoins(it->first.txid);
+        Object entry;
+        entry.push_back(Pair("txid", it->first.txid.GetHex()));
+        entry.push_back(Pair("vout", (int)it->first.n));
+        entry.push_back(Pair("height", it->second.nHeight));
+        entry.push_back(Pair("amount", ValueFromAmount(it->second.nValue)));
+        entry.push_back(Pair("spent", !(coins && coins->IsAvailable(it->first.n))));
+        results.push_back(entry);
+    }
+    return results;
+}
+
 Value gettxoutproof(const Array& params, bool fHelp)
 {
     if (fHelp || (params.size() != 1 && params.size() != 2))
@@ -26,6 +26,7 @@
 #include <boost/foreach.hpp>
 #include <boost/iostreams/concepts.hpp>
 #include <boost/iostreams/stream.hpp>
+#include <boost/scoped_ptr.hpp>
 #include <boost/shared_ptr.hpp>
 #include <boost/signals2/signal.hpp>
 #include <boost/thread.hpp>
@@ -322,6 +323,10 @@ static const CRPCCommand vRPCCommands[] =
     { "blockchain",         "gettxoutproof",          &gettxoutproof,          true  },
     { "blockchain",         "verifytxoutproof",       &verifytxoutproof,       true  },
     { "blockchain",         "gettxoutsetinfo",        &gettxoutsetinfo,        true  },
+    { "blockchain",         "dumptxoutset",           &dumptxoutset,           true  },
+    { "blockchain",         "loadtxoutset",           &loadtxoutset,           false },
+    { "blockchain",         "getdbstats",             &getdbstats,             true  },
+    { "blockchain",         "compactdb",              &compactdb,              true  },
     { "blockchain",         "verifychain",            &verifychain,            true  },
     { "blockchain",         "invalidateblock",        &invalidateblock,        true  },
     { "blockchain",         "reconsiderblock",        &reconsiderblock,        true  },
@@ -345,6 +350,7 @@ static const CRPCCommand vRPCCommands[] =
     { "rawtransactions",    "decoderawtransaction",   &decoderawtransaction,   true  },
     { "rawtransactions",    "decodescript",           &decodescript,           true  },
     { "rawtransactions",    "getrawtransaction",      &getrawtransaction,      true  },
+    { "rawtransactions",    "getaddressoutputs",      &getaddressoutputs,      true  },
     { "rawtransactions",    "sendrawtransaction",     &sendrawtransaction,     false },
     { "rawtransactions",    "signrawtransaction",     &signrawtransaction,     false }, /* uses wallet if enabled */
 
@@ -1063,8 +1069,20 @@ json_spirit::Value CRPCTable::execute(const std::string &strMethod, const json_s
 
     try
     {
+#ifdef ENABLE_WALLET
+        // The wallet writes of a wallet command are committed together once it returns
+        boost::scoped_ptr<CDBBatch> pbatch;
+        if (pwalletMain && pcmd->category == "wallet")
+            pbatch.reset(new CDBBatch(pwalletMain->strWalletFile));
+#endif
         // Execute
-        return pcmd->actor(params, false);
+        json_spirit::Value result = pcmd->actor(params, false);
+#ifdef ENABLE_WALLET
+        // Only report success once the changes are on disk
+        if (pbatch && !pbatch->Commit())
+            throw JSONRPCError(RPC_DATABASE_ERROR, "Failed to write the wallet changes to disk");
+#endif
+        return result;
     }
     catch (const std::exception& e)
     {
@@ -720,10 +720,10 @@ Value getbalance(const Array& params, bool fHelp)
             + HelpExampleRpc("getbalance", "\"tabby\", 6")
         );
 
-    LOCK2(cs_main, pwalletMain->cs_wallet);
-
     if (params.size() == 0)
-        return  ValueFromAmount(pwalletMain->GetBalance());
+        return  ValueFromAmount(pwalletMain->GetSnapshot()->balances.nTrusted);
+
+    LOCK2(cs_main, pwalletMain->cs_wallet);
 
     int nMinDepth = 1;
     if (params.size() > 1)
@@ -777,9 +777,8 @@ Value getunconfirmedbalance(const Array &params, bool fHelp)
         throw runtime_error(
                 "getunconfirmedbalance\n"
                 "Returns the server's total unconfirmed balance\n");
-    LOCK2(cs_main, pwalletMain->cs_wallet);
 
-    return ValueFromAmount(pwalletMain->GetUnconfirmedBalance());
+    return ValueFromAmount(pwalletMain->GetSnapshot()->balances.nUnconfirmed);
 }
 
 
@@ -835,7 +834,7 @@ Value movecmd(const Array& params, bool fHelp)
     debit.nTime = nNow;
     debit.strOtherAccount = strTo;
     debit.strComment = strComment;
-    walletdb.WriteAccountingEntry(debit);
+    pwalletMain->AddAccountingEntry(debit, walletdb);
 
     // Credit
     CAccountingEntry credit;
@@ -845,7 +844,7 @@ Value movecmd(const Array& params, bool fHelp)
     credit.nTime = nNow;
     credit.strOtherAccount = strFrom;
     credit.strComment = strComment;
-    walletdb.WriteAccountingEntry(credit);
+    pwalletMain->AddAccountingEntry(credit, walletdb);
 
     if (!walletdb.TxnCommit())
         throw JSONRPCError(RPC_DATABASE_ERROR, "database error");
@@ -1348,14 +1347,31 @@ void AcentryToJSON(const CAccountingEntry& acentry, const string& strAccount, Ar
     }
 }
 
+//! Reads a listtransactions cursor, "<order position>:<entry>"
+static bool ParseTxCursor(const string& strCursor, int64_t& nOrderPos, int& nEntry)
+{
+    size_t nColon = strCursor.find(':');
+    if (nColon == string::npos)
+        return false;
+    string strPos = strCursor.substr(0, nColon);
+    nOrderPos = atoi64(strPos);
+    if (strPos.empty() || i64tostr(nOrderPos) != strPos || nOrderPos < 0)
+        return false;
+    int32_t n;
+    if (!ParseInt32(strCursor.substr(nColon + 1), &n) || n < 0)
+        return false;
+    nEntry = n;
+    return true;
+}
+
 Value listtransactions(const Array& params, bool fHelp)
 {
     if (!EnsureWalletIsAvailable(fHelp))
         return Value::null;
 
-    if (fHelp || params.size() > 4)
+    if (fHelp || params.size() > 5)
         throw runtime_error(
-            "listtransactions [\"account\"] [count] [from] [includeWatchonly]\n"
+            "listtransactions [\"account\"] [count] [from] [includeWatchonly] [\"cursor\"]\n"
             "\n Returns up to 'count' most recent transactions skipping the first 'from' transactions for account 'account'.\n"
             "\nArguments:\n"
             " 1. \"account\"        (string, optional) The account name. If not included, it will list all transactions for all accounts.\n"
@@ -1363,6 +1379,7 @@ Value listtransactions(const Array& params, bool fHelp)
             " 2. count            (numeric, optional, default=10) The number of transactions to return\n"
             " 3. from             (numeric, optional, default=0) The number of transactions to skip\n"
             " 4. includeWatchonly (bool, optional, default=false) Include transactions to/from watchonly addresses (see 'importaddress')\n"
+            " 5. \"cursor\"         (string, optional) Only list transactions older than the entry with this cursor, 'from' then counts from there\n"
             "\nResult:\n"
             "[\n"
             "  {\n"
@@ -1392,6 +1409,7 @@ Value listtransactions(const Array& params, bool fHelp)
             "    \"comment\": \"...\",            (string)  If a comment is associated with the transaction.\n"
             "    \"otheraccount\": \"account\",   (string) For the 'move' category of transactions, the account the funds came from,\n"
             "                                          (for receiving funds, positive amounts), or went to (for sending funds,negative amounts).\n"
+            "    \"cursor\": \"cursor\",         (string) Position of this entry in the wallet history, pass the first one back to get the page before\n"
             "  }\n"
             "]\n"
 
@@ -1402,6 +1420,8 @@ Value listtransactions(const Array& params, bool fHelp)
             + HelpExampleCli("listtransactions", "\"tabby\"") +
             "\nList transactions 100 to 120 from the tabby account\n"
             + HelpExampleCli("listtransactions", "\"tabby\" 20 100") +
+            "\nList the 20 transactions before the one with cursor 1234:0\n"
+            + HelpExampleCli("listtransactions", "\"*\" 20 0 false \"1234:0\"") +
             "\nAs a json rpc call\n"
             + HelpExampleRpc("listtransactions", "\"tabby\", 20, 100")
         );
@@ -1422,6 +1442,11 @@ Value listtransactions(const Array& params, bool fHelp)
         if(params[3].get_bool())
             filter = filter | ISMINE_WATCH_ONLY;
 
+    int64_t nCursorPos = std::numeric_limits<int64_t>::max();
+    int nCursorEntry = -1;
+    if (params.size() > 4 && !ParseTxCursor(params[4].get_str(), nCursorPos, nCursorEntry))
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid cursor");
+
     if (nCount < 0)
         throw JSONRPCError(RPC_INVALID_PARAMETER, "Negative count");
     if (nFrom < 0)
@@ -1429,18 +1454,26 @@ Value listtransactions(const Array& params, bool fHelp)
 
     Array ret;
 
-    std::list<CAccountingEntry> acentries;
-    CWallet::TxItems txOrdered = pwalletMain->OrderedTxItems(acentries, strAccount);
-
-    // iterate backwards until we have nCount items to return:
-    for (CWallet::TxItems::reverse_iterator it = txOrdered.rbegin(); it != txOrdered.rend(); ++it)
+    // iterate backwards from the cursor through the activity log until we have nCount items to return:
+    const CWallet::TxItems& txOrdered = pwalletMain->wtxOrdered;
+    for (CWallet::TxItems::const_reverse_iterator it(txOrdered.upper_bound(nCursorPos)); it != txOrdered.rend(); ++it)
     {
+        Array entries;
         CWalletTx *const pwtx = (*it).second.first;
         if (pwtx != 0)
-            ListTransactions(*pwtx, strAccount, 0, true, ret, filter);
+            ListTransactions(*pwtx, strAccount, 0, true, entries, filter);
         CAccountingEntry *const pacentry = (*it).second.second;
         if (pacentry != 0)
-            AcentryToJSON(*pacentry, strAccount, ret);
+            AcentryToJSON(*pacentry, strAccount, entries);
+
+        // Entries of the cursor's own transaction up to the cursor were on the previous page
+        int nEntry = ((*it).first == nCursorPos) ? nCursorEntry + 1 : 0;
+        for (; nEntry < (int)entries.size() && (int)ret.size() < (nCount+nFrom); nEntry++)
+        {
+            Object entry = entries[nEntry].get_obj();
+            entry.push_back(Pair("cursor", strprintf("%d:%d", (*it).first, nEntry)));
+            ret.push_back(entry);
+        }
 
         if ((int)ret.size() >= (nCount+nFrom)) break;
     }
@@ -1618,10 +1651,20 @@ Value listsinceblock(const Array& params, bool fHelp)
 
     Array transactions;
 
-    for (map<uint256, CWalletTx>::iterator it = pwalletMain->mapWallet.begin(); it != pwalletMain->mapWallet.end(); it++)
+    // Only transactions in blocks above the given one, or in no active block at all, can be less deep.
+    // The height index hands out exactly those: confirmed ones by height first, then the rest.
+    const multimap<int, CWalletTx*>& mapTxByHeight = pwalletMain->mapTxByHeight;
+    multimap<int, CWalletTx*>::const_iterator it = mapTxByHeight.upper_bound(pindex ? pindex->nHeight : -1);
+    for (; it != mapTxByHeight.end(); ++it)
     {
-        CWalletTx tx = (*it).second;
-
+        const CWalletTx& tx = *it->second;
+        if (depth == -1 || tx.GetDepthInMainChain() < depth)
+            ListTransactions(tx, "*", 0, true, transactions, filter);
+    }
+    pair<multimap<int, CWalletTx*>::const_iterator, multimap<int, CWalletTx*>::const_iterator> range = mapTxByHeight.equal_range(-1);
+    for (it = range.first; it != range.second; ++it)
+    {
+        const CWalletTx& tx = *it->second;
         if (depth == -1 || tx.GetDepthInMainChain() < depth)
             ListTransactions(tx, "*", 0, true, transactions, filter);
     }
@@ -1756,8 +1799,6 @@ Value keypoolrefill(const Array& params, bool fHelp)
             + HelpExampleRpc("keypoolrefill", "")
         );
 
-    LOCK2(cs_main, pwalletMain->cs_wallet);
-
     // 0 is interpreted by TopUpKeyPool() as the default keypool size given by -keypool
     uint32_t kpSize = 0;
     if (params.size() > 0) {
@@ -1766,9 +1807,14 @@ Value keypoolrefill(const Array& params, bool fHelp)
         kpSize = (unsigned int)params[0].get_int();
     }
 
-    EnsureWalletIsUnlocked();
+    {
+        LOCK2(cs_main, pwalletMain->cs_wallet);
+        EnsureWalletIsUnlocked();
+    }
+    // Not holding the wallet lock, TopUpKeyPool() only takes it to write the derived keys
     pwalletMain->TopUpKeyPool(kpSize);
 
+    LOCK(pwalletMain->cs_wallet);
     if (pwalletMain->GetKeyPoolSize() < kpSize)
         throw JSONRPCError(RPC_WALLET_ERROR, "Error refreshing keypool.");
 
@@ -2176,11 +2222,12 @@ Value getwalletinfo(const Array& params, bool fHelp)
             + HelpExampleRpc("getwalletinfo", "")
         );
 
-    LOCK2(cs_main, pwalletMain->cs_wallet);
+    CAmount nBalance = pwalletMain->GetSnapshot()->balances.nTrusted;
+    LOCK(pwalletMain->cs_wallet);
 
     Object obj;
     obj.push_back(Pair("walletversion", pwalletMain->GetVersion()));
-    obj.push_back(Pair("balance",       ValueFromAmount(pwalletMain->GetBalance())));
+    obj.push_back(Pair("balance",       ValueFromAmount(nBalance)));
     obj.push_back(Pair("txcount",       (int)pwalletMain->mapWallet.size()));
     obj.push_back(Pair("keypoololdest", pwalletMain->GetOldestKeyPoolTime()));
     obj.push_back(Pair("keypoolsize",   (int)pwalletMain->GetKeyPoolSize()));
@@ -2276,30 +2323,30 @@ Value listunspent(const Array& params, bool fHelp)
     }
 
     Array results;
-    vector<COutput> vecOutputs;
     assert(pwalletMain != NULL);
-    LOCK2(cs_main, pwalletMain->cs_wallet);
-    pwalletMain->AvailableCoins(vecOutputs, false);
-    BOOST_FOREACH(const COutput& out, vecOutputs) {
+    // Outputs and depths come from the wallet snapshot, only the address book and scripts need cs_wallet
+    boost::shared_ptr<const CWalletSnapshot> pSnapshot = pwalletMain->GetSnapshot();
+    LOCK(pwalletMain->cs_wallet);
+    BOOST_FOREACH(const CSnapshotOutput& out, pSnapshot->vCoins) {
         if (out.nDepth < nMinDepth || out.nDepth > nMaxDepth)
             continue;
 
         if (setAddress.size()) {
             CTxDestination address;
-            if (!ExtractDestination(out.tx->vout[out.i].scriptPubKey, address))
+            if (!ExtractDestination(out.txout.scriptPubKey, address))
                 continue;
 
             if (!setAddress.count(address))
                 continue;
         }
 
-        int64_t nValue = out.tx->vout[out.i].nValue;
-        const CScript& pk = out.tx->vout[out.i].scriptPubKey;
+        int64_t nValue = out.txout.nValue;
+        const CScript& pk = out.txout.scriptPubKey;
         Object entry;
-        entry.push_back(Pair("txid", out.tx->GetHash().GetHex()));
+        entry.push_back(Pair("txid", out.txid.GetHex()));
         entry.push_back(Pair("vout", out.i));
         CTxDestination address;
-        if (ExtractDestination(out.tx->vout[out.i].scriptPubKey, address)) {
+        if (ExtractDestination(out.txout.scriptPubKey, address)) {
             entry.push_back(Pair("address", CAnoncoinAddress(address).ToString()));
             if (pwalletMain->mapAddressBook.count(address))
                 entry.push_back(Pair("account", pwalletMain->mapAddressBook[address].name));
@@ -91,6 +91,7 @@ enum
     SER_GETHASH         = (1 << 2),
 #ifdef ENABLE_I2PSAM
     SER_IPADDRONLY      = (1 << 18),
+    SER_I2PBASE64       = (1 << 19),    // I2P destinations on disk are base64, as in peers.dat before addrman version 2
 #endif
 };
 
@@ -292,6 +292,15 @@ public:
         return (*this);
     }
 
+    //! Hands the unread data over to vchOut without copying it, leaving the stream empty
+    void TakeData(CSerializeData& vchOut)
+    {
+        vch.erase(vch.begin(), vch.begin() + nReadPos);
+        nReadPos = 0;
+        vchOut.swap(vch);
+        vch.clear();
+    }
+
     void GetAndClear(CSerializeData &data) {
         data.insert(data.end(), begin(), end());
         clear();
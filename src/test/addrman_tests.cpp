@@ -0,0 +1,149 @@
+// Copyright (c) 2013-2017 The Anoncoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "addrman.h"
+#include "clientversion.h"
+#include "netutil.h"
+#include "random.h"
+#include "streams.h"
+#include "timedata.h"
+#include "util.h"
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include <boost/foreach.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/test/unit_test.hpp>
+
+BOOST_AUTO_TEST_SUITE(addrman_tests)
+
+BOOST_AUTO_TEST_CASE(addrman_simple)
+{
+    // CAddrMan keeps its bucket tables inline, keep it off the stack
+    boost::scoped_ptr<CAddrMan> paddrman(new CAddrMan());
+    CAddrMan& addrman = *paddrman;
+    CNetAddr source = TestAddress(8191);
+
+    BOOST_CHECK_EQUAL(addrman.size(), 0);
+    BOOST_CHECK(!addrman.Select().IsValid());
+
+    CAddress addr1 = TestAddress(1);
+    BOOST_CHECK(addrman.Add(addr1, source));
+    BOOST_CHECK(!addrman.Add(addr1, source));
+    BOOST_CHECK_EQUAL(addrman.size(), 1);
+    BOOST_CHECK(addrman.Select() == addr1);
+
+    // Unroutable addresses never make it in
+    CAddress addrLocal(CService("127.0.0.1", 9377), NODE_NETWORK);
+    BOOST_CHECK(!addrman.Add(addrLocal, source));
+    BOOST_CHECK_EQUAL(addrman.size(), 1);
+
+    // Once tried, the entry stays the only one Select() can find
+    addrman.Good(addr1);
+    BOOST_CHECK_EQUAL(addrman.size(), 1);
+    BOOST_CHECK(addrman.Select() == addr1);
+
+    CAddress addr2 = TestAddress(2);
+    BOOST_CHECK(addrman.Add(addr2, source));
+    BOOST_CHECK_EQUAL(addrman.size(), 2);
+    for (int i = 0; i < 20; i++) {
+        CAddress addr = addrman.Select();
+        BOOST_CHECK(addr == addr1 || addr == addr2);
+    }
+
+    addrman.Clear();
+    BOOST_CHECK_EQUAL(addrman.size(), 0);
+    BOOST_CHECK(!addrman.Select().IsValid());
+    BOOST_CHECK(addrman.Add(addr2, source));
+    BOOST_CHECK(addrman.Select() == addr2);
+}
+
+BOOST_AUTO_TEST_CASE(addrman_i2p_lookup)
+{
+    boost::scoped_ptr<CAddrMan> paddrman(new CAddrMan());
+    CAddrMan& addrman = *paddrman;
+    CNetAddr source = TestAddress(8191);
+
+    std::string strDest = RandomI2pDestination();
+    CNetAddr i2pAddr;
+    BOOST_REQUIRE(i2pAddr.SetI2pDestination(strDest));
+    CAddress addr(CService(i2pAddr, 0), NODE_NETWORK);
+    addr.nTime = GetAdjustedTime();
+    BOOST_CHECK(addrman.Add(addr, source));
+    BOOST_CHECK_EQUAL(addrman.b32HashTableSize(), 1);
+    BOOST_CHECK_EQUAL(addrman.GetI2pBase64Destination(B32AddressFromDestination(strDest)), strDest);
+
+    // The index survives a trip through peers.dat
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << addrman;
+    boost::scoped_ptr<CAddrMan> paddrman2(new CAddrMan());
+    ss >> *paddrman2;
+    BOOST_CHECK_EQUAL(paddrman2->size(), 1);
+    BOOST_CHECK_EQUAL(paddrman2->b32HashTableSize(), 1);
+    BOOST_CHECK_EQUAL(paddrman2->GetI2pBase64Destination(B32AddressFromDestination(strDest)), strDest);
+}
+
+BOOST_AUTO_TEST_CASE(addrman_i2p_migration)
+{
+    boost::scoped_ptr<CAddrMan> paddrman(new CAddrMan());
+    CAddrMan& addrman = *paddrman;
+    CNetAddr source = TestAddress(8191);
+
+    // Eight I2P peers, the first three of them tried, next to a tried and a new IPv4 peer
+    const unsigned int nI2p = 8, nI2pTried = 3;
+    std::vector<std::string> vDest;
+    for (unsigned int i = 0; i < nI2p; i++) {
+        vDest.push_back(RandomI2pDestination());
+        CNetAddr i2pAddr;
+        BOOST_REQUIRE(i2pAddr.SetI2pDestination(vDest.back()));
+        CAddress addr(CService(i2pAddr, 0), NODE_NETWORK);
+        addr.nTime = GetAdjustedTime();
+        BOOST_CHECK(addrman.Add(addr, source));
+        if (i < nI2pTried)
+            addrman.Good(addr);
+    }
+    BOOST_CHECK(addrman.Add(TestAddress(1), source));
+    BOOST_CHECK(addrman.Add(TestAddress(2), source));
+    addrman.Good(TestAddress(1));
+    BOOST_REQUIRE_EQUAL(addrman.size(), (int)nI2p + 2);
+
+    // A version 1 peers.dat has the same layout, with the destinations kept in base64
+    CDataStream ssWrite(SER_DISK | SER_I2PBASE64, CLIENT_VERSION);
+    ssWrite << addrman;
+    BOOST_REQUIRE_EQUAL(ssWrite[0], 2);
+    ssWrite[0] = 1;
+    CDataStream ssV1(ssWrite.begin(), ssWrite.end(), SER_DISK, CLIENT_VERSION);
+    BOOST_CHECK(std::search(ssV1.begin(), ssV1.end(), vDest[0].begin(), vDest[0].end()) != ssV1.end());
+
+    // Read back as version 1, then through a version 2 file of its own
+    boost::scoped_ptr<CAddrMan> paddrmanV1(new CAddrMan());
+    ssV1 >> *paddrmanV1;
+    BOOST_CHECK(ssV1.empty());
+    CDataStream ssV2(SER_DISK, CLIENT_VERSION);
+    ssV2 << *paddrmanV1;
+    BOOST_CHECK_EQUAL(ssV2[0], 2);
+    BOOST_CHECK(std::search(ssV2.begin(), ssV2.end(), vDest[0].begin(), vDest[0].end()) == ssV2.end());
+    boost::scoped_ptr<CAddrMan> paddrmanV2(new CAddrMan());
+    ssV2 >> *paddrmanV2;
+
+    CAddrMan* vRead[] = { paddrmanV1.get(), paddrmanV2.get() };
+    BOOST_FOREACH(CAddrMan* pread, vRead) {
+        BOOST_CHECK_EQUAL(pread->size(), (int)nI2p + 2);
+        BOOST_CHECK_EQUAL(pread->b32HashTableSize(), (int)nI2p);
+        for (unsigned int i = 0; i < nI2p; i++)
+            BOOST_CHECK_EQUAL(pread->GetI2pBase64Destination(B32AddressFromDestination(vDest[i])), vDest[i]);
+        std::vector<CDestinationStats> vStats;
+        BOOST_CHECK_EQUAL(pread->CopyDestinationStats(vStats), (int)nI2p);
+        BOOST_FOREACH(const CDestinationStats& stats, vStats) {
+            std::vector<std::string>::iterator it = std::find(vDest.begin(), vDest.end(), stats.sBase64);
+            BOOST_REQUIRE(it != vDest.end());
+            BOOST_CHECK_EQUAL(stats.fInTried, it - vDest.begin() < (int)nI2pTried);
+            BOOST_CHECK_EQUAL(stats.uPort, 0);
+        }
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
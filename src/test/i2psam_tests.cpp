@@ -0,0 +1,372 @@
+// Copyright (c) 2013-2017 The Anoncoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "i2psam.h"
+#include "i2pwrapper.h"
+#include "netbase.h"
+#include "sammock.h"
+#include "streams.h"
+#include "util.h"
+#include "version.h"
+
+#include <string>
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+#include <boost/algorithm/string/case_conv.hpp>
+#include <boost/thread.hpp>
+
+#ifndef WIN32
+static void ResolveInto(CTestNameCache* pcache, const std::string& strB32, std::string* pstrDest)
+{
+    *pstrDest = pcache->Resolve(strB32);
+}
+
+BOOST_AUTO_TEST_SUITE(i2psam_tests)
+
+BOOST_AUTO_TEST_CASE(connector_pool_concurrency)
+{
+    CMockSamBridge bridge;
+    bridge.CreateSession("TEST");
+    bridge.SetReplyDelay(200);
+    bridge.AddUnreachable("peer3");
+
+    SAM::StreamConnector connector(bridge.GetAddress(), "3.0", "3.0", 3, 5000);
+    connector.refill(2000);
+    BOOST_CHECK_EQUAL(connector.getReadyCount(), 3U);
+    BOOST_CHECK_EQUAL(bridge.GetHellos(), 3);
+
+    std::vector<std::string> vDest;
+    for (int i = 0; i < 5; i++)
+        vDest.push_back(strprintf("peer%d", i));
+    int64_t nStart = GetTimeMillis();
+    std::vector<SAM::StreamConnector::Result> vResults = connector.connect("TEST", vDest, false);
+    BOOST_CHECK(GetTimeMillis() - nStart >= 200);
+
+    //! All replies were waited for at once, not one after the other
+    BOOST_CHECK(bridge.GetMaxDelayed() > 1);
+    BOOST_REQUIRE_EQUAL(vResults.size(), 5U);
+    for (unsigned int i = 0; i < vResults.size(); i++) {
+        if (i == 3) {
+            BOOST_CHECK_EQUAL(vResults[i].status, SAM::Message::CANT_REACH_PEER);
+            BOOST_CHECK(vResults[i].socket == INVALID_SOCKET);
+            continue;
+        }
+        BOOST_CHECK_EQUAL(vResults[i].status, SAM::Message::OK);
+        BOOST_CHECK(vResults[i].socket != INVALID_SOCKET);
+        //! What the peer sent right behind the STREAM STATUS is still in the stream
+        BOOST_CHECK_EQUAL(ReadStreamLine(vResults[i].socket), vDest[i] + "\n");
+        CloseSocket(vResults[i].socket);
+    }
+
+    //! Three pooled sockets were used, two handshaken on the spot and the pool was refilled meanwhile
+    BOOST_CHECK_EQUAL(connector.getReadyCount(), 3U);
+    BOOST_CHECK_EQUAL(bridge.GetHellos(), 8);
+    BOOST_CHECK_EQUAL(bridge.GetConnections(), 8);
+}
+
+BOOST_AUTO_TEST_CASE(connector_timeout)
+{
+    CMockSamBridge bridge;
+    bridge.CreateSession("TEST");
+    bridge.AddLost("lost");
+
+    SAM::StreamConnector connector(bridge.GetAddress(), "3.0", "3.0", 2, 300);
+    std::vector<std::string> vDest;
+    vDest.push_back("lost");
+    vDest.push_back("peer");
+    int64_t nStart = GetTimeMillis();
+    std::vector<SAM::StreamConnector::Result> vResults = connector.connect("TEST", vDest, false);
+    BOOST_CHECK(GetTimeMillis() - nStart >= 300);
+    BOOST_CHECK_EQUAL(vResults[0].status, SAM::Message::TIMEOUT);
+    BOOST_CHECK(vResults[0].socket == INVALID_SOCKET);
+    BOOST_CHECK_EQUAL(vResults[1].status, SAM::Message::OK);
+    CloseSocket(vResults[1].socket);
+}
+
+BOOST_AUTO_TEST_CASE(connector_stale_pool)
+{
+    CMockSamBridge bridge;
+    bridge.CreateSession("TEST");
+    SAM::StreamConnector connector(bridge.GetAddress(), "3.0", "3.0", 2, 2000);
+    connector.refill(2000);
+    BOOST_CHECK_EQUAL(connector.getReadyCount(), 2U);
+
+    //! Control sockets the bridge dropped while idle are not used for connects
+    bridge.DropClients();
+    MilliSleep(50);
+    std::vector<SAM::StreamConnector::Result> vResults = connector.connect("TEST", std::vector<std::string>(1, "peer"), false);
+    BOOST_CHECK_EQUAL(vResults[0].status, SAM::Message::OK);
+    BOOST_CHECK_EQUAL(ReadStreamLine(vResults[0].socket), "peer\n");
+    CloseSocket(vResults[0].socket);
+    BOOST_CHECK_EQUAL(bridge.GetHellos(), 5);
+
+    //! Without a bridge every attempt fails fast
+    sockaddr_in addrNone = bridge.GetAddress();
+    addrNone.sin_port = 0;
+    SAM::StreamConnector connectorClosed(addrNone, "3.0", "3.0", 0, 2000);
+    vResults = connectorClosed.connect("TEST", std::vector<std::string>(1, "peer"), false);
+    BOOST_CHECK_EQUAL(vResults[0].status, SAM::Message::CLOSED_SOCKET);
+}
+
+BOOST_AUTO_TEST_CASE(connector_multi_accept)
+{
+    CMockSamBridge bridge;
+    bridge.CreateSession("TEST");
+    SAM::StreamConnector connector(bridge.GetAddress(), "3.0", "3.2", 2, 2000);
+    connector.refill(2000);
+
+    //! All accepts are armed together, the pooled control sockets first
+    std::vector<SAM::StreamConnector::Result> vResults = connector.accept("TEST", 3, false);
+    BOOST_REQUIRE_EQUAL(vResults.size(), 3U);
+    for (unsigned int i = 0; i < vResults.size(); i++) {
+        BOOST_CHECK_EQUAL(vResults[i].status, SAM::Message::OK);
+        BOOST_CHECK(vResults[i].socket != INVALID_SOCKET);
+        CloseSocket(vResults[i].socket);
+    }
+    BOOST_CHECK_EQUAL(bridge.GetHellos(), 5);
+
+    //! An older bridge takes a single accept per session and refuses the rest
+    CMockSamBridge bridgeOld;
+    bridgeOld.SetVersion("3.1");
+    bridgeOld.CreateSession("TEST");
+    SAM::StreamConnector connectorOld(bridgeOld.GetAddress(), "3.0", "3.2", 0, 2000);
+    vResults = connectorOld.accept("TEST", 3, false);
+    int nOk = 0, nRefused = 0;
+    for (unsigned int i = 0; i < vResults.size(); i++) {
+        if (vResults[i].status == SAM::Message::OK) {
+            nOk++;
+            CloseSocket(vResults[i].socket);
+        } else if (vResults[i].status == SAM::Message::ALREADY_ACCEPTING) {
+            nRefused++;
+            BOOST_CHECK(vResults[i].socket == INVALID_SOCKET);
+        }
+    }
+    BOOST_CHECK_EQUAL(nOk, 1);
+    BOOST_CHECK_EQUAL(nRefused, 2);
+}
+
+BOOST_AUTO_TEST_CASE(connector_lookup_batch)
+{
+    CMockSamBridge bridge;
+    bridge.SetLookupDelay(200);
+    std::vector<std::string> vNames;
+    for (int i = 0; i < 5; i++) {
+        vNames.push_back(strprintf("peer%d.i2p", i));
+        if (i != 2)
+            bridge.AddName(vNames.back(), bridge.CreateSession(strprintf("PEER%d", i)));
+    }
+
+    SAM::StreamConnector connector(bridge.GetAddress(), "3.0", "3.2", 2, 2000);
+    connector.refill(2000);
+    std::vector<SAM::StreamConnector::Result> vResults = connector.lookup(vNames);
+    BOOST_CHECK(bridge.GetMaxDelayed() > 1);
+    BOOST_REQUIRE_EQUAL(vResults.size(), 5U);
+    for (unsigned int i = 0; i < vResults.size(); i++) {
+        BOOST_CHECK(vResults[i].socket == INVALID_SOCKET);
+        BOOST_CHECK_EQUAL(vResults[i].status, i == 2 ? SAM::Message::KEY_NOT_FOUND : SAM::Message::OK);
+        BOOST_CHECK_EQUAL(vResults[i].value.size(), i == 2 ? 0U : 516U);
+    }
+    BOOST_CHECK_EQUAL(bridge.GetLookups(), 5);
+
+    //! Answered lookups, found or not, leave their control sockets to the pool
+    BOOST_CHECK_EQUAL(connector.getReadyCount(), 2U);
+    int nHellos = bridge.GetHellos();
+    vResults = connector.lookup(std::vector<std::string>(2, vNames[0]));
+    BOOST_CHECK_EQUAL(vResults[1].status, SAM::Message::OK);
+    BOOST_CHECK_EQUAL(bridge.GetHellos(), nHellos + 2);
+}
+
+BOOST_AUTO_TEST_CASE(name_cache)
+{
+    CMockSamBridge bridge;
+    SAM::StreamSessionAdapter session("test", "127.0.0.1", bridge.GetPort());
+    CTestNameCache cache(&session);
+    std::vector<std::string> vDest, vB32;
+    for (int i = 0; i < 4; i++) {
+        vDest.push_back(bridge.CreateSession(strprintf("PEER%d", i)));
+        vB32.push_back(B32AddressFromDestination(vDest.back()));
+    }
+    bridge.AddName(vB32[0], vDest[0]);
+    bridge.AddName(vB32[1], vDest[1]);
+    //! A router handing out something else than the destination behind the name is not believed
+    bridge.AddName(vB32[3], vDest[0]);
+    bridge.SetLookupDelay(200);
+    int nLookups = bridge.GetLookups();
+
+    //! Everybody asking for the same name at once shares one lookup
+    std::string vstrResolved[4];
+    boost::thread_group threads;
+    for (int i = 0; i < 4; i++)
+        threads.create_thread(boost::bind(&ResolveInto, &cache, vB32[0], &vstrResolved[i]));
+    threads.join_all();
+    for (int i = 0; i < 4; i++)
+        BOOST_CHECK_EQUAL(vstrResolved[i], vDest[0]);
+    BOOST_CHECK_EQUAL(bridge.GetLookups(), nLookups + 1);
+
+    //! After that it is answered from the cache, b32 addresses are case insensitive
+    BOOST_CHECK_EQUAL(cache.Resolve(boost::to_upper_copy(vB32[0])), vDest[0]);
+    BOOST_CHECK_EQUAL(cache.Resolve(vB32[0]), vDest[0]);
+    BOOST_CHECK_EQUAL(bridge.GetLookups(), nLookups + 1);
+
+    //! Queued names go to the router in one batch, unknown and mismatching names are cached as not found
+    std::vector<std::string> vPrefetch(vB32.begin() + 1, vB32.end());
+    vPrefetch.push_back("not a b32 address");
+    cache.Prefetch(vPrefetch);
+    cache.ProcessQueue();
+    BOOST_CHECK_EQUAL(bridge.GetLookups(), nLookups + 4);
+    std::string strDest;
+    BOOST_CHECK(cache.Get(vB32[1], strDest));
+    BOOST_CHECK_EQUAL(strDest, vDest[1]);
+    BOOST_CHECK(cache.Get(vB32[2], strDest));
+    BOOST_CHECK(strDest.empty());
+    BOOST_CHECK(cache.Get(vB32[3], strDest));
+    BOOST_CHECK(strDest.empty());
+    BOOST_CHECK(cache.Resolve(vB32[2]).empty());
+    BOOST_CHECK_EQUAL(bridge.GetLookups(), nLookups + 4);
+    BOOST_CHECK_EQUAL(cache.size(), 4U);
+
+    //! What i2pnames.dat keeps, expired entries are dropped on the way in
+    CDataStream ss(SER_DISK, PROTOCOL_VERSION);
+    ss << cache;
+    CTestNameCache cacheRead;
+    ss >> cacheRead;
+    BOOST_CHECK_EQUAL(cacheRead.size(), 4U);
+    BOOST_CHECK(cacheRead.Get(vB32[1], strDest));
+    BOOST_CHECK_EQUAL(strDest, vDest[1]);
+    SetMockTime(GetTime() + I2P_NAME_CACHE_NEGATIVE_TTL + 1);
+    BOOST_CHECK(!cacheRead.Get(vB32[2], strDest));
+    ss << cache;
+    CTestNameCache cacheLater;
+    ss >> cacheLater;
+    BOOST_CHECK_EQUAL(cacheLater.size(), 2U);
+    SetMockTime(0);
+
+    //! Only a KEY_NOT_FOUND is cached, a lookup that timed out or had no router to ask is tried again
+    std::string strDestLate = bridge.CreateSession("LATE");
+    std::string strB32Late = B32AddressFromDestination(strDestLate);
+    bridge.AddName(strB32Late, strDestLate);
+    session.setConnectOptions(1, 100);
+    BOOST_CHECK(cache.Resolve(strB32Late).empty());
+    BOOST_CHECK(!cache.Get(strB32Late, strDest));
+    BOOST_CHECK(!session.isSick());
+    bridge.SetLookupDelay(0);
+    BOOST_CHECK_EQUAL(cache.Resolve(strB32Late), strDestLate);
+    CTestNameCache cacheNoRouter;
+    BOOST_CHECK(cacheNoRouter.Resolve(vB32[1]).empty());
+    BOOST_CHECK(!cacheNoRouter.Get(vB32[1], strDest));
+    BOOST_CHECK_EQUAL(cacheNoRouter.size(), 0U);
+}
+
+BOOST_AUTO_TEST_CASE(session_requests)
+{
+    CMockSamBridge bridge;
+    SAM::StreamSessionAdapter session("test", "127.0.0.1", bridge.GetPort());
+    BOOST_CHECK(!session.isSick());
+    BOOST_CHECK_EQUAL(session.getSAMVersion(), "3.2");
+    BOOST_CHECK_EQUAL(session.getMyDestination().pub.size(), 516U);
+    BOOST_CHECK(session.getMyDestination().isGenerated);
+
+    SAM::FullDestination dest = session.destGenerate();
+    BOOST_CHECK_EQUAL(dest.pub, dest.priv.substr(0, 516));
+    bridge.AddName("peer.i2p", dest.pub);
+    BOOST_CHECK_EQUAL(session.namingLookup("peer.i2p"), dest.pub);
+    BOOST_CHECK(session.namingLookup("nobody.i2p").empty());
+
+    //! A session with our destination already exists on the bridge
+    SAM::StreamSessionAdapter duplicate("test", "127.0.0.1", bridge.GetPort(), session.getMyDestination().priv);
+    BOOST_CHECK(duplicate.isSick());
+    BOOST_CHECK_EQUAL(bridge.GetSessions(), 1);
+}
+
+BOOST_AUTO_TEST_CASE(session_stream_forward)
+{
+    CMockSamBridge bridge;
+    SAM::StreamSessionAdapter sessionFrom("from", "127.0.0.1", bridge.GetPort());
+    SAM::StreamSessionAdapter sessionTo("to", "127.0.0.1", bridge.GetPort());
+
+    SOCKET hListenSocket = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr = bridge.GetAddress();
+    addr.sin_port = 0;
+    socklen_t len = sizeof(addr);
+    BOOST_REQUIRE(bind(hListenSocket, (struct sockaddr*)&addr, sizeof(addr)) == 0);
+    BOOST_REQUIRE(getsockname(hListenSocket, (struct sockaddr*)&addr, &len) == 0);
+    BOOST_REQUIRE(listen(hListenSocket, 4) == 0);
+    BOOST_CHECK(sessionTo.forward("127.0.0.1", ntohs(addr.sin_port), false));
+
+    //! The forwarded stream starts with the destination of the peer, then carries its data
+    SOCKET hSocket = sessionFrom.connect(sessionTo.getMyDestination().pub, false);
+    BOOST_REQUIRE(hSocket != INVALID_SOCKET);
+    BOOST_CHECK(send(hSocket, "version", 7, MSG_NOSIGNAL) == 7);
+    SOCKET hForwarded = accept(hListenSocket, NULL, NULL);
+    BOOST_REQUIRE(hForwarded != INVALID_SOCKET);
+    BOOST_CHECK_EQUAL(ReadStreamLine(hForwarded), sessionFrom.getMyDestination().pub + "\n");
+    char pchBuf[7];
+    BOOST_CHECK(RecvAll(hForwarded, pchBuf, sizeof(pchBuf)));
+    BOOST_CHECK_EQUAL(std::string(pchBuf, sizeof(pchBuf)), "version");
+
+    CloseSocket(hSocket);
+    CloseSocket(hForwarded);
+    sessionTo.stopForwardingAll();
+    CloseSocket(hListenSocket);
+}
+
+BOOST_AUTO_TEST_CASE(session_connect_loss)
+{
+    CMockSamBridge bridge;
+    bridge.SetLossRate(100);
+    SAM::StreamSessionAdapter session("test", "127.0.0.1", bridge.GetPort());
+    session.setConnectOptions(1, 300);
+    int64_t nStart = GetTimeMillis();
+    BOOST_CHECK(session.connect(bridge.CreateSession("peer"), false) == INVALID_SOCKET);
+    BOOST_CHECK(GetTimeMillis() - nStart >= 300);
+    //! A lost request is no reason to give up on the session
+    BOOST_CHECK(!session.isSick());
+}
+
+BOOST_AUTO_TEST_CASE(session_connect_accept)
+{
+    CMockSamBridge bridge;
+    bridge.SetReplyDelay(20);
+    SAM::StreamSessionAdapter sessionFrom("from", "127.0.0.1", bridge.GetPort());
+    SAM::StreamSessionAdapter sessionTo("to", "127.0.0.1", bridge.GetPort());
+    sessionFrom.setConnectOptions(8, 5000);
+    sessionFrom.refillConnectPool(2000);
+
+    //! Every armed accept gets one of the streams, the tunnel builds overlap
+    const int nStreams = 16;
+    std::vector<SAM::StreamConnector::Result> vAccepts = sessionTo.accept(nStreams, false);
+    std::vector<SAM::SOCKET> vSockets = sessionFrom.connect(std::vector<std::string>(nStreams, sessionTo.getMyDestination().pub), false);
+    BOOST_REQUIRE_EQUAL(vAccepts.size(), (unsigned int)nStreams);
+    BOOST_REQUIRE_EQUAL(vSockets.size(), (unsigned int)nStreams);
+    int nAccepted = 0;
+    for (unsigned int i = 0; i < vAccepts.size(); i++) {
+        if (vAccepts[i].socket != INVALID_SOCKET && ReadAcceptLine(vAccepts[i].socket) == sessionFrom.getMyDestination().pub)
+            nAccepted++;
+        CloseSocket(vAccepts[i].socket);
+    }
+    BOOST_CHECK_EQUAL(nAccepted, nStreams);
+    BOOST_CHECK(bridge.GetMaxDelayed() > 1);
+
+    //! Data goes both ways over the accepted stream
+    vAccepts = sessionTo.accept(1, false);
+    BOOST_REQUIRE_EQUAL(vAccepts[0].status, SAM::Message::OK);
+    SOCKET hFrom = sessionFrom.connect(sessionTo.getMyDestination().pub, false);
+    SOCKET hTo = vAccepts[0].socket;
+    BOOST_REQUIRE(hFrom != INVALID_SOCKET);
+    BOOST_CHECK_EQUAL(ReadAcceptLine(hTo), sessionFrom.getMyDestination().pub);
+    char pchBuf[4];
+    BOOST_CHECK(send(hFrom, "ping", 4, MSG_NOSIGNAL) == 4);
+    BOOST_CHECK(RecvAll(hTo, pchBuf, sizeof(pchBuf)));
+    BOOST_CHECK(send(hTo, pchBuf, sizeof(pchBuf), MSG_NOSIGNAL) == sizeof(pchBuf));
+    BOOST_CHECK(RecvAll(hFrom, pchBuf, sizeof(pchBuf)));
+    BOOST_CHECK_EQUAL(std::string(pchBuf, sizeof(pchBuf)), "ping");
+    CloseSocket(hFrom);
+    CloseSocket(hTo);
+    BOOST_FOREACH(SOCKET hSocket, vSockets)
+        CloseSocket(hSocket);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+#endif
@@ -79,4 +79,24 @@ BOOST_AUTO_TEST_CASE(subsidy_limit_test)
     // printf( "Total Subsidy Sum=%llu\n", nSum);
 }
 
+BOOST_AUTO_TEST_CASE(header_batch_hash_test)
+{
+    std::vector<CBlockHeader> vHeaders(64);
+    for (unsigned int i = 0; i < vHeaders.size(); i++) {
+        vHeaders[i].nTime = 1400000000 + i;
+        vHeaders[i].nBits = 0x1e0ffff0;
+        vHeaders[i].nNonce = i;
+        if (i > 0)
+            vHeaders[i].hashPrevBlock = vHeaders[i - 1].CalcSha256dHash();
+    }
+    HashBlockHeaders(vHeaders);
+    //! The cached values must match a forced recalculation
+    for (unsigned int i = 0; i < vHeaders.size(); i++) {
+        uint256 hashCached = vHeaders[i].GetHash();
+        uintFakeHash sha256dCached = vHeaders[i].CalcSha256dHash();
+        BOOST_CHECK(hashCached == vHeaders[i].GetHash(true));
+        BOOST_CHECK(sha256dCached == vHeaders[i].CalcSha256dHash(true));
+    }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
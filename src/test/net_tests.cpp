@@ -0,0 +1,140 @@
+// Copyright (c) 2013-2017 The Anoncoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "net.h"
+#include "random.h"
+#include "serialize.h"
+#include "streams.h"
+#include "version.h"
+
+#include <string.h>
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+static CDataStream MakeMessage(const char* pszCommand, const std::vector<unsigned char>& vchPayload)
+{
+    CDataStream ssPayload(SER_NETWORK, PROTOCOL_VERSION);
+    ssPayload << vchPayload;
+    CMessageHeader hdr(pszCommand, ssPayload.size());
+    uint256 hash = Hash(ssPayload.begin(), ssPayload.end());
+    memcpy(&hdr.nChecksum, &hash, sizeof(hdr.nChecksum));
+
+    CDataStream ssMessage(SER_NETWORK, PROTOCOL_VERSION);
+    ssMessage << hdr;
+    ssMessage += ssPayload;
+    return ssMessage;
+}
+
+//! Feeds the data to the node the way the socket thread does, at most nMaxRead bytes per recv
+static bool ReceiveAll(CNode& node, const CDataStream& ssData, unsigned int nMaxRead)
+{
+    unsigned int nPos = 0;
+    while (nPos < ssData.size()) {
+        unsigned int nSpace;
+        char* pchBuf = node.GetRecvBuffer(nSpace);
+        BOOST_CHECK(nSpace >= NET_RECV_CHUNK_MIN_SPACE);
+        unsigned int nBytes = std::min(std::min(nSpace, nMaxRead), (unsigned int)ssData.size() - nPos);
+        memcpy(pchBuf, &ssData[nPos], nBytes);
+        if (!node.ReceiveMsgBytes(nBytes))
+            return false;
+        nPos += nBytes;
+    }
+    return true;
+}
+
+BOOST_AUTO_TEST_SUITE(net_tests)
+
+BOOST_AUTO_TEST_CASE(recv_chunk_chains)
+{
+    CAddress addr(CService("10.0.0.1", 9377));
+    CNode node(INVALID_SOCKET, addr, "", true);
+    LOCK(node.cs_vRecvMsg);
+
+    //! A small message, one spanning several chunks and another small one behind it
+    std::vector<unsigned char> vchSmall(100, 0x11);
+    std::vector<unsigned char> vchLarge(3 * NET_RECV_CHUNK_SIZE / 2);
+    for (unsigned int i = 0; i < vchLarge.size(); i++)
+        vchLarge[i] = insecure_rand();
+    CDataStream ssData = MakeMessage("ping", vchSmall);
+    ssData += MakeMessage("block", vchLarge);
+    ssData += MakeMessage("pong", vchSmall);
+    BOOST_CHECK(ReceiveAll(node, ssData, 5000));
+
+    BOOST_CHECK_EQUAL(node.vRecvMsg.size(), 3U);
+    const char* vpszCommands[] = { "ping", "block", "pong" };
+    for (unsigned int i = 0; i < 3; i++) {
+        CNetMessage& msg = node.vRecvMsg[i];
+        BOOST_CHECK(msg.complete());
+        BOOST_CHECK_EQUAL(msg.hdr.GetCommand(), vpszCommands[i]);
+        uint256 hash = msg.vRecv.GetHash();
+        BOOST_CHECK_EQUAL(memcmp(&hash, &msg.hdr.nChecksum, sizeof(msg.hdr.nChecksum)), 0);
+        std::vector<unsigned char> vch;
+        msg.vRecv >> vch;
+        BOOST_CHECK(vch == (i == 1 ? vchLarge : vchSmall));
+        BOOST_CHECK(msg.vRecv.empty());
+        BOOST_CHECK_THROW(msg.vRecv >> vch, std::ios_base::failure);
+    }
+    //! Reads into the same chunk were merged into one segment each
+    BOOST_CHECK_EQUAL(node.vRecvMsg[0].vRecv.GetSegmentCount(), 1U);
+    BOOST_CHECK(node.vRecvMsg[1].vRecv.GetSegmentCount() >= 2U);
+
+    //! Once its messages are gone the chunk is filled from the start again
+    node.vRecvMsg.clear();
+    unsigned int nSpace;
+    node.GetRecvBuffer(nSpace);
+    BOOST_CHECK_EQUAL(nSpace, NET_RECV_CHUNK_SIZE);
+    BOOST_CHECK_EQUAL(node.nRecvChunkPos, 0U);
+}
+
+BOOST_AUTO_TEST_CASE(recv_bad_header)
+{
+    CAddress addr(CService("10.0.0.2", 9377));
+    CNode node(INVALID_SOCKET, addr, "", true);
+    LOCK(node.cs_vRecvMsg);
+
+    CMessageHeader hdr("block", MAX_SIZE + 1);
+    CDataStream ssData(SER_NETWORK, PROTOCOL_VERSION);
+    ssData << hdr;
+    BOOST_CHECK(!ReceiveAll(node, ssData, 7));
+}
+
+#ifndef WIN32
+BOOST_AUTO_TEST_CASE(send_shared_payload)
+{
+    int fds[2];
+    BOOST_REQUIRE(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+    CAddress addr(CService("10.0.0.3", 9377));
+    CNode node(fds[0], addr, "", true);
+
+    //! The same message queued from a shared payload and serialized for this peer only
+    std::vector<unsigned char> vchTx(300, 0x42);
+    CSharedPayload payload = CSharedPayload::Make(vchTx);
+    node.PushSharedMessage("tx", payload);
+    node.PushMessage("tx", vchTx);
+    node.PushSharedMessage("tx", payload);
+    {
+        LOCK(node.cs_vSend);
+        BOOST_CHECK(node.vSendMsg.empty());
+        BOOST_CHECK_EQUAL(node.nSendSize, 0U);
+    }
+    //! Nothing holds on to the payload once it went out
+    BOOST_CHECK(payload.data.unique());
+
+    CDataStream ssExpected = MakeMessage("tx", vchTx);
+    std::vector<char> vchRecv(3 * ssExpected.size());
+    size_t nRecv = 0;
+    while (nRecv < vchRecv.size()) {
+        int nBytes = recv(fds[1], &vchRecv[nRecv], vchRecv.size() - nRecv, 0);
+        BOOST_REQUIRE(nBytes > 0);
+        nRecv += nBytes;
+    }
+    for (unsigned int i = 0; i < 3; i++)
+        BOOST_CHECK(std::equal(ssExpected.begin(), ssExpected.end(), vchRecv.begin() + i * ssExpected.size()));
+    BOOST_CHECK_EQUAL(node.nSendBytes, vchRecv.size());
+    close(fds[1]);
+}
+#endif
+
+BOOST_AUTO_TEST_SUITE_END()
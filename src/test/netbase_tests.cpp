@@ -5,6 +5,14 @@
 
 #include "netbase.h"
 
+#include "clientversion.h"
+#include "netutil.h"
+#include "protocol.h"
+#include "random.h"
+#include "streams.h"
+#include "util.h"
+#include "version.h"
+
 #include <string>
 
 #include <boost/test/unit_test.hpp>
@@ -183,4 +191,65 @@ BOOST_AUTO_TEST_CASE(subnet_test)
     BOOST_CHECK(!CSubNet("fuzzy").IsValid());
 }
 
+BOOST_AUTO_TEST_CASE(i2p_destination_test)
+{
+    std::string strDest = RandomI2pDestination();
+    BOOST_REQUIRE_EQUAL(strDest.size(), (size_t)I2P_DESTINATION_STORE);
+    BOOST_CHECK(isValidI2pAddress(strDest));
+
+    CNetAddr addr;
+    BOOST_CHECK(!addr.IsNativeI2P());
+    BOOST_CHECK(addr.SetI2pDestination(strDest));
+    BOOST_CHECK(addr.IsI2P() && addr.IsNativeI2P());
+    BOOST_CHECK_EQUAL(addr.GetI2pDestination(), strDest);
+    BOOST_CHECK(addr.GetI2pDestinationHash() == GetI2pDestinationHash(strDest));
+    BOOST_CHECK_EQUAL(addr.ToB32String(), B32AddressFromDestination(strDest));
+    BOOST_CHECK(CNetAddr(strDest) == addr);
+
+    // Not base64, or not a null certificate, leaves no destination
+    CNetAddr addrBad;
+    BOOST_CHECK(!addrBad.SetI2pDestination(strDest.substr(0, 100) + "!" + strDest.substr(101)));
+    BOOST_CHECK(!addrBad.IsNativeI2P());
+    BOOST_CHECK(!addrBad.SetI2pDestination(strDest.substr(0, I2P_DESTINATION_STORE - 4) + "AAAB"));
+    BOOST_CHECK(!addrBad.IsNativeI2P());
+    BOOST_CHECK(addrBad.GetI2pDestination().empty());
+    BOOST_CHECK(addr != addrBad);
+
+    // The network sees base64 destinations, peers.dat binary ones
+    CService service(addr, 0);
+    CDataStream ssNet(SER_NETWORK, PROTOCOL_VERSION);
+    ssNet << service;
+    BOOST_CHECK_EQUAL(ssNet.size(), 16U + I2P_DESTINATION_STORE + 2);
+    BOOST_CHECK_EQUAL(std::string(ssNet.begin() + 16, ssNet.begin() + 16 + I2P_DESTINATION_STORE), strDest);
+    CService serviceNet;
+    ssNet >> serviceNet;
+    BOOST_CHECK(serviceNet == service);
+
+    CDataStream ssDisk(SER_DISK, CLIENT_VERSION);
+    ssDisk << service;
+    BOOST_CHECK_EQUAL(ssDisk.size(), 16U + I2P_DESTINATION_BYTES + 2);
+    CService serviceDisk;
+    ssDisk >> serviceDisk;
+    BOOST_CHECK(serviceDisk == service);
+    BOOST_CHECK(serviceDisk.GetI2pDestinationHash() == addr.GetI2pDestinationHash());
+
+    // A peers.dat from before keeps base64 on disk as well
+    CDataStream ssOld(SER_DISK | SER_I2PBASE64, CLIENT_VERSION);
+    ssOld << service;
+    BOOST_CHECK_EQUAL(ssOld.size(), 16U + I2P_DESTINATION_STORE + 2);
+    CService serviceOld;
+    ssOld >> serviceOld;
+    BOOST_CHECK(serviceOld == service);
+
+    // Addresses without a destination still send zeros in its place
+    CDataStream ssIp(SER_NETWORK, PROTOCOL_VERSION);
+    ssIp << CService("1.2.3.4", 9377);
+    BOOST_CHECK_EQUAL(ssIp.size(), 16U + I2P_DESTINATION_STORE + 2);
+    BOOST_CHECK(std::count(ssIp.begin() + 16, ssIp.begin() + 16 + I2P_DESTINATION_STORE, 0) == I2P_DESTINATION_STORE);
+    CService serviceIp;
+    ssIp >> serviceIp;
+    BOOST_CHECK(!serviceIp.IsNativeI2P());
+    BOOST_CHECK_EQUAL(serviceIp.ToString(), "1.2.3.4:9377");
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,42 @@
+// Copyright (c) 2013-2017 The Anoncoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef ANONCOIN_TEST_NETUTIL_H
+#define ANONCOIN_TEST_NETUTIL_H
+
+#include "netbase.h"
+#include "protocol.h"
+#include "random.h"
+#include "timedata.h"
+#include "util.h"
+
+#include <stdint.h>
+#include <string.h>
+#include <string>
+
+//! The n-th address of a routable IPv4 range, spread over 8192 /16 groups
+inline CAddress TestAddress(uint32_t n, uint16_t nPort = 9377)
+{
+    struct in_addr ip4;
+    ip4.s_addr = htonl(0x40000000 + ((n % 8192) << 16) + n / 8192 + 1);
+    CAddress addr(CService(CNetAddr(ip4), nPort), NODE_NETWORK);
+    addr.nTime = GetAdjustedTime();
+    return addr;
+}
+
+//! A random destination with a null certificate, in I2P base64
+inline std::string RandomI2pDestination()
+{
+    unsigned char pchDest[I2P_DESTINATION_BYTES];
+    GetRandBytes(pchDest, sizeof(pchDest));
+    memset(pchDest + sizeof(pchDest) - 3, 0, 3);
+    std::string strDest = EncodeBase64(pchDest, sizeof(pchDest));
+    for (size_t i = 0; i < strDest.size(); i++) {
+        if (strDest[i] == '+') strDest[i] = '-';
+        if (strDest[i] == '/') strDest[i] = '~';
+    }
+    return strDest;
+}
+
+#endif // ANONCOIN_TEST_NETUTIL_H
@@ -7,6 +7,9 @@
 #include "rpcclient.h"
 
 #include "base58.h"
+#include "main.h"
+#include "random.h"
+#include "txmempool.h"
 #include "wallet.h"
 
 #include <boost/algorithm/string.hpp>
@@ -91,4 +94,130 @@ BOOST_AUTO_TEST_CASE(rpc_wallet)
     BOOST_CHECK_THROW(CallRPC("listreceivedbyaccount 0 true extra"), runtime_error);
 }
 
+BOOST_AUTO_TEST_CASE(rpc_listtransactions_cursor)
+{
+    LOCK2(cs_main, pwalletMain->cs_wallet);
+
+    // Each move adds a debit and a credit to the activity log
+    for (int i = 0; i < 5; i++)
+        BOOST_CHECK_NO_THROW(CallRPC("move cursorfrom cursorto 0.01"));
+
+    Value r;
+    BOOST_CHECK_NO_THROW(r = CallRPC("listtransactions * 4"));
+    Array page1 = r.get_array();
+    BOOST_REQUIRE_EQUAL(page1.size(), 4U);
+
+    // The oldest entry of a page leads to the page before it, which lines up with 'from'
+    string strCursor = find_value(page1[0].get_obj(), "cursor").get_str();
+    BOOST_CHECK_NO_THROW(r = CallRPC("listtransactions * 4 0 false " + strCursor));
+    Array page2 = r.get_array();
+    BOOST_REQUIRE_EQUAL(page2.size(), 4U);
+    BOOST_CHECK_NO_THROW(r = CallRPC("listtransactions * 4 4"));
+    Array skipped = r.get_array();
+    BOOST_REQUIRE_EQUAL(skipped.size(), 4U);
+    for (unsigned int i = 0; i < page2.size(); i++)
+        BOOST_CHECK_EQUAL(find_value(page2[i].get_obj(), "cursor").get_str(), find_value(skipped[i].get_obj(), "cursor").get_str());
+    BOOST_CHECK(find_value(page2[3].get_obj(), "cursor").get_str() != strCursor);
+
+    BOOST_CHECK_THROW(CallRPC("listtransactions * 4 0 false 12"), runtime_error);
+    BOOST_CHECK_THROW(CallRPC("listtransactions * 4 0 false -1:0"), runtime_error);
+    BOOST_CHECK_THROW(CallRPC("listtransactions * 4 0 false 1:x"), runtime_error);
+
+    BOOST_CHECK_NO_THROW(CallRPC("listsinceblock"));
+}
+
+//! Puts a transaction paying nOutputs wallet keys as the only one of pindex into the wallet
+static uint256 AddBlockTx(CBlockIndex* pindex, unsigned int nOutputs)
+{
+    CMutableTransaction mtx;
+    mtx.nLockTime = pindex->nHeight;
+    for (unsigned int i = 0; i < nOutputs; i++) {
+        CPubKey pubkey;
+        BOOST_REQUIRE(pwalletMain->GetKeyFromPool(pubkey));
+        mtx.vout.push_back(CTxOut((i + 1) * COIN, GetScriptForDestination(pubkey.GetID())));
+    }
+    CWalletTx wtx(pwalletMain, CTransaction(mtx));
+    pindex->hashMerkleRoot = wtx.GetHash();
+    uintFakeHash hashFake = GetRandHash();
+    hashFake.SetRealHash(pindex->GetBlockHash());
+    wtx.SetTxBlockHash(hashFake);
+    wtx.nIndex = 0;
+    CWalletDB walletdb(pwalletMain->strWalletFile);
+    BOOST_CHECK(pwalletMain->AddToWallet(wtx, false, &walletdb));
+    return wtx.GetHash();
+}
+
+//! Collects the cursors of the entries of txid in a listtransactions or listsinceblock result
+static vector<string> GetTxCursors(const Array& entries, const uint256& txid)
+{
+    vector<string> vCursor;
+    BOOST_FOREACH(const Value& entry, entries) {
+        const Value& txidEntry = find_value(entry.get_obj(), "txid");
+        if (txidEntry.type() == str_type && txidEntry.get_str() == txid.GetHex()) {
+            const Value& cursor = find_value(entry.get_obj(), "cursor");
+            vCursor.push_back(cursor.type() == str_type ? cursor.get_str() : "");
+        }
+    }
+    return vCursor;
+}
+
+BOOST_AUTO_TEST_CASE(rpc_listsinceblock_height)
+{
+    LOCK2(cs_main, pwalletMain->cs_wallet);
+
+    // Three blocks on top of the genesis block, each holding one wallet transaction
+    CBlockIndex* pindexGenesis = chainActive.Tip();
+    BOOST_REQUIRE(pindexGenesis);
+    vector<CBlockIndex*> vBlocks(3);
+    for (unsigned int i = 0; i < vBlocks.size(); i++) {
+        vBlocks[i] = mapBlockIndex.insert(GetRandHash());
+        vBlocks[i]->pprev = i ? vBlocks[i - 1] : pindexGenesis;
+        vBlocks[i]->nHeight = pindexGenesis->nHeight + i + 1;
+        vBlocks[i]->nTime = pindexGenesis->nTime;
+        vBlocks[i]->BuildSkip();
+    }
+    chainActive.SetTip(vBlocks[2]);
+    uint256 txidAt = AddBlockTx(vBlocks[0], 1);
+    uint256 txidAbove = AddBlockTx(vBlocks[1], 2);
+    uint256 txidDisconnected = AddBlockTx(vBlocks[2], 1);
+
+    // The last block leaves the active chain, its transaction goes back to the memory pool and
+    // the wallet hears about it without a block, which moves it out of the height of its block
+    chainActive.SetTip(vBlocks[1]);
+    CWalletTx& wtxDisconnected = pwalletMain->mapWallet[txidDisconnected];
+    mempool.addUnchecked(txidDisconnected, CTxMemPoolEntry(wtxDisconnected, 0, GetTime(), 0.0, chainActive.Height()));
+    pwalletMain->SyncTransaction(wtxDisconnected, NULL);
+    BOOST_CHECK_EQUAL(wtxDisconnected.nIndexHeight, -1);
+
+    Value r;
+    BOOST_CHECK_NO_THROW(r = CallRPC("listsinceblock " + vBlocks[0]->GetBlockHash().GetHex()));
+    Array transactions = find_value(r.get_obj(), "transactions").get_array();
+    BOOST_CHECK(GetTxCursors(transactions, txidAt).empty());
+    BOOST_CHECK_EQUAL(GetTxCursors(transactions, txidAbove).size(), 2U);
+    BOOST_CHECK_EQUAL(GetTxCursors(transactions, txidDisconnected).size(), 1U);
+
+    // A cursor inside a transaction with two entries only leads to the entry after it
+    BOOST_CHECK_NO_THROW(r = CallRPC("listtransactions * 1000"));
+    vector<string> vCursor = GetTxCursors(r.get_array(), txidAbove);
+    BOOST_REQUIRE_EQUAL(vCursor.size(), 2U);
+    BOOST_CHECK(boost::algorithm::ends_with(vCursor[0], ":0") != boost::algorithm::ends_with(vCursor[1], ":0"));
+    string strFirst = boost::algorithm::ends_with(vCursor[0], ":0") ? vCursor[0] : vCursor[1];
+    string strSecond = (strFirst == vCursor[0]) ? vCursor[1] : vCursor[0];
+    BOOST_CHECK_NO_THROW(r = CallRPC("listtransactions * 1000 0 false " + strFirst));
+    Array older = r.get_array();
+    BOOST_REQUIRE(!older.empty());
+    BOOST_CHECK_EQUAL(find_value(older.back().get_obj(), "cursor").get_str(), strSecond);
+    BOOST_CHECK_EQUAL(GetTxCursors(older, txidAbove).size(), 1U);
+    BOOST_CHECK(GetTxCursors(older, txidDisconnected).empty());
+    BOOST_CHECK_NO_THROW(r = CallRPC("listtransactions * 1000 0 false " + strSecond));
+    BOOST_CHECK(GetTxCursors(r.get_array(), txidAbove).empty());
+    BOOST_CHECK_EQUAL(r.get_array().size() + 1, older.size());
+
+    // Put the chain back the way the other tests expect it, the blocks stay in the index as a side branch
+    list<CTransaction> removed;
+    mempool.remove(wtxDisconnected, removed);
+    chainActive.SetTip(pindexGenesis);
+    pwalletMain->RebuildTxIndex();
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,498 @@
+// Copyright (c) 2013-2017 The Anoncoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef ANONCOIN_TEST_SAMMOCK_H
+#define ANONCOIN_TEST_SAMMOCK_H
+
+#include "i2psam.h"
+#include "i2pwrapper.h"
+#include "netbase.h"
+#include "random.h"
+#include "util.h"
+
+#include <algorithm>
+#include <deque>
+#include <iterator>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <boost/bind.hpp>
+#include <boost/foreach.hpp>
+#include <boost/test/unit_test.hpp>
+#include <boost/thread.hpp>
+
+#ifndef WIN32
+#include <poll.h>
+
+/**
+ * A SAM v3 bridge on the loopback interface, so the I2P code can be tested and benchmarked without
+ * a router.  It speaks HELLO, SESSION CREATE, STREAM CONNECT/ACCEPT/FORWARD, NAMING LOOKUP and
+ * DEST GENERATE.
+ *
+ * Sessions on the bridge reach each other: a STREAM CONNECT to the destination of one of them goes
+ * to an armed STREAM ACCEPT or to the STREAM FORWARD target of that session, and from then on the
+ * bridge relays the data between both ends.  Destinations it doesn't know stand for peers out on the
+ * network, those answer with their destination as the first line of the stream.
+ *
+ * SetReplyDelay holds back the answer to STREAM CONNECT the way a tunnel build does, SetLookupDelay that
+ * to NAMING LOOKUP the way a lookup in the network database does, SetLinkDelay delays the relayed data
+ * in each direction and SetLossRate sets the percentage of STREAM CONNECTs that are never answered.  A
+ * bridge set to a version below 3.2 allows one STREAM ACCEPT per session at a time.
+ */
+class CMockSamBridge
+{
+public:
+    CMockSamBridge() : nReplyDelay(0), nLookupDelay(0), nLinkDelay(0), nLossRate(0), strVersion("3.2"), fStop(false),
+                       nConnections(0), nHellos(0), nLookups(0), nDestinations(0), nMaxDelayed(0), fDropClients(false)
+    {
+        hListenSocket = socket(AF_INET, SOCK_STREAM, 0);
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        addr.sin_port = 0;
+        socklen_t len = sizeof(addr);
+        BOOST_REQUIRE(bind(hListenSocket, (struct sockaddr*)&addr, sizeof(addr)) == 0);
+        BOOST_REQUIRE(getsockname(hListenSocket, (struct sockaddr*)&addr, &len) == 0);
+        BOOST_REQUIRE(listen(hListenSocket, 128) == 0);
+        thread = boost::thread(boost::bind(&CMockSamBridge::Run, this));
+    }
+
+    ~CMockSamBridge()
+    {
+        fStop = true;
+        thread.join();
+        CloseSocket(hListenSocket);
+    }
+
+    const sockaddr_in& GetAddress() const { return addr; }
+    uint16_t GetPort() const { return ntohs(addr.sin_port); }
+    int GetConnections() { boost::lock_guard<boost::mutex> lock(mutex); return nConnections; }
+    int GetHellos() { boost::lock_guard<boost::mutex> lock(mutex); return nHellos; }
+    int GetLookups() { boost::lock_guard<boost::mutex> lock(mutex); return nLookups; }
+    int GetSessions() { boost::lock_guard<boost::mutex> lock(mutex); return mapSessions.size(); }
+    //! Most delayed replies held back at once, above one only if a client had several requests outstanding
+    int GetMaxDelayed() { boost::lock_guard<boost::mutex> lock(mutex); return nMaxDelayed; }
+    //! Closes every client socket, the way a restarted router would
+    void DropClients() { boost::lock_guard<boost::mutex> lock(mutex); fDropClients = true; }
+
+    //! The bridge thread reads these while it runs, so they are only changed under the mutex
+    void SetReplyDelay(int nDelay) { boost::lock_guard<boost::mutex> lock(mutex); nReplyDelay = nDelay; }
+    void SetLookupDelay(int nDelay) { boost::lock_guard<boost::mutex> lock(mutex); nLookupDelay = nDelay; }
+    void SetLinkDelay(int nDelay) { boost::lock_guard<boost::mutex> lock(mutex); nLinkDelay = nDelay; }
+    void SetLossRate(int nRate) { boost::lock_guard<boost::mutex> lock(mutex); nLossRate = nRate; }
+    void SetVersion(const std::string& strVersionIn) { boost::lock_guard<boost::mutex> lock(mutex); strVersion = strVersionIn; }
+    //! Makes STREAM CONNECT to strDest fail with CANT_REACH_PEER
+    void AddUnreachable(const std::string& strDest) { boost::lock_guard<boost::mutex> lock(mutex); setUnreachable.insert(strDest); }
+    //! Makes STREAM CONNECT to strDest never get an answer
+    void AddLost(const std::string& strDest) { boost::lock_guard<boost::mutex> lock(mutex); setLost.insert(strDest); }
+
+    //! A session nobody holds a control socket for, returns its public destination
+    std::string CreateSession(const std::string& strID)
+    {
+        boost::lock_guard<boost::mutex> lock(mutex);
+        CSession& session = mapSessions[strID];
+        GenerateDestination(session.strPub, session.strPriv);
+        mapDestinations[session.strPub] = strID;
+        return session.strPub;
+    }
+
+    //! Makes strName resolve to strDest in NAMING LOOKUP
+    void AddName(const std::string& strName, const std::string& strDest)
+    {
+        boost::lock_guard<boost::mutex> lock(mutex);
+        mapNames[strName] = strDest;
+    }
+
+private:
+    struct CClient
+    {
+        std::string strBuf;         //! Command bytes not handled yet
+        std::string strVersion;     //! Agreed on in HELLO
+        SOCKET hPeer;               //! Other end of the stream the bridge relays to
+        bool fStream;               //! Done with commands, everything else is stream data
+
+        CClient() : hPeer(INVALID_SOCKET), fStream(false) {}
+    };
+
+    struct CSession
+    {
+        std::string strPub;
+        std::string strPriv;
+        SOCKET hControl;            //! Closing it ends the session
+        std::deque<SOCKET> dqAccepts;
+        SOCKET hForward;            //! Control socket of the STREAM FORWARD, closing it ends forwarding
+        sockaddr_in addrForward;
+
+        CSession() : hControl(INVALID_SOCKET), hForward(INVALID_SOCKET) {}
+    };
+
+    SOCKET hListenSocket;
+    sockaddr_in addr;
+    boost::thread thread;
+    boost::mutex mutex;
+    int nReplyDelay;
+    int nLookupDelay;
+    int nLinkDelay;
+    int nLossRate;
+    std::string strVersion;
+    std::set<std::string> setUnreachable;   //! Destinations answered with CANT_REACH_PEER
+    std::set<std::string> setLost;          //! Destinations never answered
+    volatile bool fStop;
+    int nConnections;
+    int nHellos;
+    int nLookups;
+    int nDestinations;
+    int nMaxDelayed;
+    bool fDropClients;
+
+    std::map<SOCKET, CClient> mapClients;
+    std::map<std::string, CSession> mapSessions;
+    std::map<std::string, std::string> mapDestinations;                 //! Public destination -> session ID
+    std::map<std::string, std::string> mapNames;
+    std::multimap<int64_t, std::pair<SOCKET, std::string> > mapSends;   //! Replies and relayed data by the time they are due
+
+    void Run()
+    {
+        while (!fStop)
+        {
+            std::vector<pollfd> vfds(1);
+            vfds[0].fd = hListenSocket;
+            vfds[0].events = POLLIN;
+            int nTimeout = 5;
+            {
+                boost::lock_guard<boost::mutex> lock(mutex);
+                for (std::map<SOCKET, CClient>::iterator it = mapClients.begin(); it != mapClients.end(); ++it) {
+                    pollfd fd;
+                    fd.fd = it->first;
+                    fd.events = POLLIN;
+                    vfds.push_back(fd);
+                }
+                if (!mapSends.empty())
+                    nTimeout = std::max((int64_t)0, std::min((int64_t)nTimeout, mapSends.begin()->first - GetTimeMillis()));
+            }
+            poll(&vfds[0], vfds.size(), nTimeout);
+
+            boost::lock_guard<boost::mutex> lock(mutex);
+            if (vfds[0].revents & POLLIN) {
+                SOCKET hSocket = accept(hListenSocket, NULL, NULL);
+                if (hSocket != INVALID_SOCKET) {
+                    mapClients[hSocket] = CClient();
+                    nConnections++;
+                }
+            }
+            for (unsigned int i = 1; i < vfds.size(); i++) {
+                SOCKET hSocket = vfds[i].fd;
+                if (!(vfds[i].revents & (POLLIN | POLLHUP | POLLERR)) || !mapClients.count(hSocket))
+                    continue;
+                char pchBuf[4096];
+                int nBytes = recv(hSocket, pchBuf, sizeof(pchBuf), 0);
+                if (nBytes <= 0)
+                    Drop(hSocket);
+                else
+                    Receive(hSocket, std::string(pchBuf, nBytes));
+            }
+
+            int64_t nNow = GetTimeMillis();
+            while (!mapSends.empty() && mapSends.begin()->first <= nNow) {
+                const std::pair<SOCKET, std::string>& item = mapSends.begin()->second;
+                send(item.first, item.second.data(), item.second.size(), MSG_NOSIGNAL);
+                mapSends.erase(mapSends.begin());
+            }
+
+            if (fDropClients) {
+                while (!mapClients.empty())
+                    Drop(mapClients.begin()->first);
+                fDropClients = false;
+            }
+        }
+        boost::lock_guard<boost::mutex> lock(mutex);
+        while (!mapClients.empty())
+            Drop(mapClients.begin()->first);
+    }
+
+    void Send(SOCKET hSocket, const std::string& strData, int64_t nTime)
+    {
+        mapSends.insert(std::make_pair(nTime, std::make_pair(hSocket, strData)));
+        nMaxDelayed = std::max(nMaxDelayed, (int)std::distance(mapSends.upper_bound(GetTimeMillis()), mapSends.end()));
+    }
+
+    void Receive(SOCKET hSocket, const std::string& strData)
+    {
+        CClient& client = mapClients[hSocket];
+        if (client.fStream) {
+            if (client.hPeer != INVALID_SOCKET)
+                Send(client.hPeer, strData, GetTimeMillis() + nLinkDelay);
+            return;
+        }
+        client.strBuf += strData;
+        size_t nPos;
+        while (!client.fStream && (nPos = client.strBuf.find('\n')) != std::string::npos) {
+            std::string strLine = client.strBuf.substr(0, nPos + 1);
+            client.strBuf.erase(0, nPos + 1);
+            Handle(hSocket, client, strLine);
+        }
+        //! Whatever came right behind the command that opened the stream is stream data
+        if (client.fStream && !client.strBuf.empty()) {
+            std::string strRest;
+            strRest.swap(client.strBuf);
+            Receive(hSocket, strRest);
+        }
+    }
+
+    //! Closes a client, together with the other end of its stream and everything of a session it controlled
+    void Drop(SOCKET hSocket)
+    {
+        std::map<SOCKET, CClient>::iterator it = mapClients.find(hSocket);
+        if (it == mapClients.end())
+            return;
+        SOCKET hPeer = it->second.hPeer;
+        mapClients.erase(it);
+
+        std::vector<SOCKET> vDrop;
+        if (hPeer != INVALID_SOCKET)
+            vDrop.push_back(hPeer);
+        for (std::map<std::string, CSession>::iterator it = mapSessions.begin(); it != mapSessions.end(); ) {
+            CSession& session = it->second;
+            if (session.hControl == hSocket) {
+                vDrop.insert(vDrop.end(), session.dqAccepts.begin(), session.dqAccepts.end());
+                mapDestinations.erase(session.strPub);
+                mapSessions.erase(it++);
+                continue;
+            }
+            session.dqAccepts.erase(std::remove(session.dqAccepts.begin(), session.dqAccepts.end(), hSocket), session.dqAccepts.end());
+            if (session.hForward == hSocket)
+                session.hForward = INVALID_SOCKET;
+            ++it;
+        }
+        //! Nothing still queued may end up on a new client getting the same descriptor
+        for (std::multimap<int64_t, std::pair<SOCKET, std::string> >::iterator it = mapSends.begin(); it != mapSends.end(); ) {
+            if (it->second.first == hSocket)
+                mapSends.erase(it++);
+            else
+                ++it;
+        }
+        CloseSocket(hSocket);
+        BOOST_FOREACH(SOCKET hDrop, vDrop)
+            Drop(hDrop);
+    }
+
+    CSession* FindSession(const std::string& strID)
+    {
+        std::map<std::string, CSession>::iterator it = mapSessions.find(strID);
+        return it == mapSessions.end() ? NULL : &it->second;
+    }
+
+    //! Random looking base64 destinations of the size a router hands out, with a null certificate
+    void GenerateDestination(std::string& strPub, std::string& strPriv)
+    {
+        static const char pszAlphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-~";
+        uint32_t nState = ++nDestinations * 2654435761U;
+        strPriv.clear();
+        for (int i = 0; i < 884; i++) {
+            nState = nState * 1103515245 + 12345;
+            strPriv += pszAlphabet[(nState >> 16) & 63];
+        }
+        strPriv.replace(512, 4, "AAAA");
+        strPub = strPriv.substr(0, 516);
+    }
+
+    void Handle(SOCKET hSocket, CClient& client, const std::string& strLine)
+    {
+        int64_t nNow = GetTimeMillis();
+        std::string strReply;
+        if (strLine.find("HELLO VERSION") == 0) {
+            std::string strMax = SAM::Message::getValue(strLine, "MAX");
+            client.strVersion = (strMax.empty() || strVersion < strMax) ? strVersion : strMax;
+            strReply = "HELLO REPLY RESULT=OK VERSION=" + client.strVersion + "\n";
+            nHellos++;
+        } else if (client.strVersion.empty()) {
+            strReply = "HELLO REPLY RESULT=NOVERSION\n";
+        } else if (strLine.find("SESSION CREATE") == 0) {
+            std::string strID = SAM::Message::getValue(strLine, "ID");
+            std::string strDest = SAM::Message::getValue(strLine, "DESTINATION");
+            CSession session;
+            if (strDest == SAM_GENERATE_MY_DESTINATION)
+                GenerateDestination(session.strPub, session.strPriv);
+            else {
+                session.strPriv = strDest;
+                session.strPub = strDest.substr(0, 516);
+            }
+            if (mapSessions.count(strID))
+                strReply = "SESSION STATUS RESULT=DUPLICATED_ID\n";
+            else if (mapDestinations.count(session.strPub))
+                strReply = "SESSION STATUS RESULT=DUPLICATED_DEST\n";
+            else {
+                session.hControl = hSocket;
+                mapSessions[strID] = session;
+                mapDestinations[session.strPub] = strID;
+                strReply = "SESSION STATUS RESULT=OK DESTINATION=" + session.strPriv + "\n";
+            }
+        } else if (strLine.find("STREAM CONNECT") == 0) {
+            CSession* pSession = FindSession(SAM::Message::getValue(strLine, "ID"));
+            if (!pSession) {
+                Send(hSocket, "STREAM STATUS RESULT=INVALID_ID\n", nNow);
+                return;
+            }
+            std::string strDest = SAM::Message::getValue(strLine, "DESTINATION");
+            if (setLost.count(strDest) || (nLossRate > 0 && (int)(insecure_rand() % 100) < nLossRate))
+                return;
+            Connect(hSocket, client, *pSession, strDest, nNow + nReplyDelay);
+        } else if (strLine.find("STREAM ACCEPT") == 0) {
+            CSession* pSession = FindSession(SAM::Message::getValue(strLine, "ID"));
+            if (!pSession)
+                strReply = "STREAM STATUS RESULT=INVALID_ID\n";
+            else if (!pSession->dqAccepts.empty() && client.strVersion < "3.2")
+                strReply = "STREAM STATUS RESULT=ALREADY_ACCEPTING\n";
+            else {
+                pSession->dqAccepts.push_back(hSocket);
+                client.fStream = true;
+                strReply = "STREAM STATUS RESULT=OK\n";
+            }
+        } else if (strLine.find("STREAM FORWARD") == 0) {
+            CSession* pSession = FindSession(SAM::Message::getValue(strLine, "ID"));
+            std::string strHost = SAM::Message::getValue(strLine, "HOST");
+            if (!pSession)
+                strReply = "STREAM STATUS RESULT=INVALID_ID\n";
+            else {
+                memset(&pSession->addrForward, 0, sizeof(pSession->addrForward));
+                pSession->addrForward.sin_family = AF_INET;
+                pSession->addrForward.sin_addr.s_addr = inet_addr(strHost.empty() ? "127.0.0.1" : strHost.c_str());
+                pSession->addrForward.sin_port = htons(atoi(SAM::Message::getValue(strLine, "PORT")));
+                pSession->hForward = hSocket;
+                strReply = "STREAM STATUS RESULT=OK\n";
+            }
+        } else if (strLine.find("NAMING LOOKUP") == 0) {
+            std::string strName = SAM::Message::getValue(strLine, "NAME");
+            std::string strValue;
+            if (strName == SAM_MY_NAME) {
+                for (std::map<std::string, CSession>::iterator it = mapSessions.begin(); it != mapSessions.end(); ++it)
+                    if (it->second.hControl == hSocket)
+                        strValue = it->second.strPub;
+            } else if (mapNames.count(strName))
+                strValue = mapNames[strName];
+            else if (mapDestinations.count(strName))
+                strValue = strName;
+            nLookups++;
+            Send(hSocket, strValue.empty() ? "NAMING REPLY RESULT=KEY_NOT_FOUND NAME=" + strName + "\n" :
+                                             "NAMING REPLY RESULT=OK NAME=" + strName + " VALUE=" + strValue + "\n",
+                 strName == SAM_MY_NAME ? nNow : nNow + nLookupDelay);
+            return;
+        } else if (strLine.find("DEST GENERATE") == 0) {
+            std::string strPub, strPriv;
+            GenerateDestination(strPub, strPriv);
+            strReply = "DEST REPLY PUB=" + strPub + " PRIV=" + strPriv + "\n";
+        } else
+            strReply = "STREAM STATUS RESULT=I2P_ERROR\n";
+        Send(hSocket, strReply, nNow);
+    }
+
+    void Connect(SOCKET hSocket, CClient& client, const CSession& session, const std::string& strDest, int64_t nReady)
+    {
+        std::map<std::string, std::string>::iterator itDest = mapDestinations.find(strDest);
+        if (itDest == mapDestinations.end()) {
+            if (setUnreachable.count(strDest)) {
+                Send(hSocket, "STREAM STATUS RESULT=CANT_REACH_PEER\n", nReady);
+                return;
+            }
+            client.fStream = true;
+            Send(hSocket, "STREAM STATUS RESULT=OK\n" + strDest + "\n", nReady);
+            return;
+        }
+
+        //! One of our own sessions, hand the stream to an armed accept or the forward target
+        CSession& target = mapSessions[itDest->second];
+        SOCKET hPeer = INVALID_SOCKET;
+        if (!target.dqAccepts.empty()) {
+            hPeer = target.dqAccepts.front();
+            target.dqAccepts.pop_front();
+            Send(hPeer, session.strPub + (mapClients[hPeer].strVersion < "3.2" ? "\n" : " FROM_PORT=0 TO_PORT=0\n"), nReady);
+        } else if (target.hForward != INVALID_SOCKET) {
+            hPeer = socket(AF_INET, SOCK_STREAM, 0);
+            if (connect(hPeer, (struct sockaddr*)&target.addrForward, sizeof(target.addrForward)) != 0)
+                CloseSocket(hPeer);
+            else {
+                mapClients[hPeer].fStream = true;
+                Send(hPeer, session.strPub + "\n", nReady);
+            }
+        }
+        if (hPeer == INVALID_SOCKET) {
+            Send(hSocket, "STREAM STATUS RESULT=CANT_REACH_PEER\n", nReady);
+            return;
+        }
+        client.fStream = true;
+        client.hPeer = hPeer;
+        mapClients[hPeer].hPeer = hSocket;
+        Send(hSocket, "STREAM STATUS RESULT=OK\n", nReady);
+    }
+};
+
+//! Reads the first line the peer sent over an established stream
+inline std::string ReadStreamLine(SOCKET hSocket)
+{
+    std::string strLine;
+    int64_t nStart = GetTimeMillis();
+    while (strLine.empty() || strLine[strLine.size() - 1] != '\n') {
+        if (GetTimeMillis() - nStart > 2000)
+            break;
+        char ch;
+        int nBytes = recv(hSocket, &ch, 1, 0);
+        if (nBytes == 1)
+            strLine += ch;
+        else if (nBytes == 0)
+            break;
+        else
+            MilliSleep(1);
+    }
+    return strLine;
+}
+
+//! Waits for exactly nLen bytes on a non-blocking stream socket
+inline bool RecvAll(SOCKET hSocket, char* pch, size_t nLen)
+{
+    while (nLen > 0) {
+        pollfd fd;
+        fd.fd = hSocket;
+        fd.events = POLLIN;
+        if (poll(&fd, 1, 2000) <= 0)
+            return false;
+        int nBytes = recv(hSocket, pch, nLen, 0);
+        if (nBytes == 0 || (nBytes < 0 && WSAGetLastError() != WSAEWOULDBLOCK))
+            return false;
+        if (nBytes > 0) {
+            pch += nBytes;
+            nLen -= nBytes;
+        }
+    }
+    return true;
+}
+
+//! Reads the line the bridge puts in front of an accepted stream, the destination of the peer
+inline std::string ReadAcceptLine(SOCKET hSocket)
+{
+    std::string strLine = ReadStreamLine(hSocket);
+    return strLine.substr(0, strLine.find_first_of(" \n"));
+}
+
+//! A name cache that asks the mock bridge instead of the router of the node
+class CTestNameCache : public CI2pNameCache
+{
+public:
+    SAM::StreamSessionAdapter* psession;
+
+    CTestNameCache(SAM::StreamSessionAdapter* psessionIn = NULL) : psession(psessionIn) {}
+
+protected:
+    std::vector<std::string> LookupNames(const std::vector<std::string>& vB32, std::vector<bool>& vAnswered)
+    {
+        if (psession)
+            return psession->namingLookup(vB32, vAnswered);
+        vAnswered.assign(vB32.size(), false);
+        return std::vector<std::string>(vB32.size());
+    }
+};
+
+#endif // WIN32
+#endif // ANONCOIN_TEST_SAMMOCK_H
@@ -4,7 +4,7 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "main.h"
-// #include "random.h"
+#include "random.h"
 #include "util.h"
 
 #include <vector>
@@ -100,4 +100,74 @@ BOOST_AUTO_TEST_CASE(getlocator_test)
     }
 }
 
+BOOST_AUTO_TEST_CASE(chainwork_test)
+{
+    uint256 work = (uint256(0x1234) << 96) + uint256(0xabcdef);
+    CChainWork cw(work);
+    BOOST_CHECK(cw.GetWork() == work);
+    BOOST_CHECK_EQUAL(cw.GetHex(), work.GetHex());
+    BOOST_CHECK(CChainWork().IsNull());
+    BOOST_CHECK(!cw.IsNull());
+
+    CChainWork cwMore(work + uint256(1));
+    BOOST_CHECK(cw < cwMore);
+    BOOST_CHECK(cwMore > cw);
+    BOOST_CHECK(cw <= cw && cw >= cw && cw == CChainWork(work));
+    //! The high word dominates the comparison
+    BOOST_CHECK(CChainWork(uint256(1) << 64) > CChainWork(~uint256(0) >> 192));
+}
+
+BOOST_AUTO_TEST_CASE(blockindexmap_test)
+{
+    const unsigned int nEntries = 100000;
+    std::vector<uint256> vHash(nEntries);
+    std::vector<CBlockIndex*> vIndex(nEntries);
+
+    //! Build a chain without reserving, so the table rehashes many times along the way
+    CBlockIndexMap map;
+    for (unsigned int i = 0; i < nEntries; i++) {
+        vHash[i] = GetRandHash();
+        vIndex[i] = map.insert(vHash[i]);
+        vIndex[i]->nHeight = i;
+        vIndex[i]->pprev = i ? vIndex[i - 1] : NULL;
+        vIndex[i]->BuildSkip();
+    }
+    BOOST_CHECK_EQUAL(map.size(), nEntries);
+
+    //! Entries and their hashes never move while the lookup table grows
+    for (unsigned int i = 0; i < nEntries; i++) {
+        BlockMap::iterator it = map.find(vHash[i]);
+        BOOST_CHECK(it != map.end());
+        BOOST_CHECK(it->second == vIndex[i]);
+        BOOST_CHECK(it->first == vHash[i]);
+        BOOST_CHECK(vIndex[i]->GetBlockHash() == vHash[i]);
+    }
+    BOOST_CHECK(vIndex[nEntries - 1]->GetAncestor(nEntries / 2) == vIndex[nEntries / 2]);
+
+    uint256 hashUnknown = GetRandHash();
+    BOOST_CHECK(map.find(hashUnknown) == map.end());
+    BOOST_CHECK_EQUAL(map.count(hashUnknown), 0U);
+    BOOST_CHECK(map[hashUnknown] == NULL);
+    BOOST_CHECK_EQUAL(map.size(), nEntries);
+    BOOST_CHECK(map[vHash[7]] == vIndex[7]);
+
+    unsigned int nVisited = 0;
+    int nHeightSum = 0;
+    BOOST_FOREACH(const PAIRTYPE(uint256, CBlockIndex*)& item, map) {
+        BOOST_CHECK(item.first == item.second->GetBlockHash());
+        nHeightSum += item.second->nHeight % 2;
+        nVisited++;
+    }
+    BOOST_CHECK_EQUAL(nVisited, nEntries);
+    BOOST_CHECK_EQUAL(nHeightSum, (int)nEntries / 2);
+
+    //! The block index should stay well below the cost of a node based map
+    BOOST_CHECK(map.DynamicMemoryUsage() / nEntries < sizeof(uint256) + sizeof(CBlockIndex) + 48);
+
+    map.clear();
+    BOOST_CHECK(map.empty());
+    BOOST_CHECK(map.begin() == map.end());
+    BOOST_CHECK(map.find(vHash[0]) == map.end());
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,202 @@
+// Copyright (c) 2013-2017 The Anoncoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "main.h"
+#include "random.h"
+#include "txdb.h"
+#include "uint256.h"
+
+#include <stdio.h>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+#include <boost/test/unit_test.hpp>
+
+BOOST_AUTO_TEST_SUITE(txdb_tests)
+
+BOOST_AUTO_TEST_CASE(txindex_pending_flush)
+{
+    CBlockTreeDB db(1 << 20, true);
+
+    uint256 txid = GetRandHash();
+    CDiskTxPos pos(CDiskBlockPos(3, 1000), 81);
+    std::vector<std::pair<uint256, CDiskTxPos> > vPos;
+    vPos.push_back(std::make_pair(txid, pos));
+    BOOST_CHECK(db.WriteTxIndex(vPos));
+    BOOST_CHECK_EQUAL(db.GetPendingIndexSize(), 1U);
+
+    //! Readable before it is flushed
+    CDiskTxPos posRead;
+    BOOST_CHECK(db.ReadTxIndex(txid, posRead));
+    BOOST_CHECK_EQUAL(posRead.nFile, 3);
+    BOOST_CHECK_EQUAL(posRead.nTxOffset, 81U);
+
+    BOOST_CHECK(db.FlushPendingIndex());
+    BOOST_CHECK_EQUAL(db.GetPendingIndexSize(), 0U);
+    posRead.SetNull();
+    BOOST_CHECK(db.ReadTxIndex(txid, posRead));
+    BOOST_CHECK_EQUAL(posRead.nPos, 1000U);
+    BOOST_CHECK(!db.ReadTxIndex(GetRandHash(), posRead));
+}
+
+BOOST_AUTO_TEST_CASE(addrindex_write_erase)
+{
+    CBlockTreeDB db(1 << 20, true);
+
+    CScript script;
+    script << OP_DUP << OP_HASH160 << std::vector<unsigned char>(20, 0x42) << OP_EQUALVERIFY << OP_CHECKSIG;
+    CMutableTransaction mtx;
+    mtx.vout.resize(3);
+    mtx.vout[0].scriptPubKey = script;
+    mtx.vout[0].nValue = 5 * COIN;
+    mtx.vout[1].scriptPubKey = CScript() << OP_RETURN;
+    mtx.vout[2].scriptPubKey = script;
+    mtx.vout[2].nValue = 7 * COIN;
+    CTransaction tx(mtx);
+
+    std::vector<std::pair<CAddrIndexKey, CAddrIndexValue> > vEntries;
+    GetAddrIndexEntries(tx, 120, vEntries);
+    //! The provably unspendable output is not indexed
+    BOOST_CHECK_EQUAL(vEntries.size(), 2U);
+    BOOST_CHECK(db.WriteAddrIndex(vEntries));
+    BOOST_CHECK(db.FlushPendingIndex());
+
+    uint160 hashScript = Hash160(script.begin(), script.end());
+    std::vector<std::pair<CAddrIndexKey, CAddrIndexValue> > vRead;
+    BOOST_CHECK(db.ReadAddrIndex(hashScript, vRead));
+    BOOST_CHECK_EQUAL(vRead.size(), 2U);
+    BOOST_CHECK(vRead[0].first.txid == tx.GetHash());
+    BOOST_CHECK_EQUAL(vRead[0].second.nHeight, 120);
+    BOOST_CHECK_EQUAL(vRead[0].second.nValue + vRead[1].second.nValue, 12 * COIN);
+
+    //! A pending erase hides the entry on disk until it is flushed as well
+    std::vector<CAddrIndexKey> vErase;
+    vErase.push_back(vEntries[0].first);
+    BOOST_CHECK(db.EraseAddrIndex(vErase));
+    BOOST_CHECK(db.ReadAddrIndex(hashScript, vRead));
+    BOOST_CHECK_EQUAL(vRead.size(), 1U);
+    BOOST_CHECK(db.FlushPendingIndex());
+    BOOST_CHECK(db.ReadAddrIndex(hashScript, vRead));
+    BOOST_CHECK_EQUAL(vRead.size(), 1U);
+    BOOST_CHECK_EQUAL(vRead[0].first.n, vEntries[1].first.n);
+
+    BOOST_CHECK(db.ReadAddrIndex(uint160(1), vRead));
+    BOOST_CHECK(vRead.empty());
+}
+
+BOOST_AUTO_TEST_CASE(leveldb_stats_counters)
+{
+    CLevelDBWrapper db(GetDataDir() / "statstest", 1 << 20, true, false, "statstest");
+
+    BOOST_CHECK(db.Write('x', uint256(7)));
+    uint256 hash;
+    BOOST_CHECK(db.Read('x', hash));
+    BOOST_CHECK(hash == uint256(7));
+    BOOST_CHECK(!db.Read('y', hash));
+    BOOST_CHECK(db.Exists('x'));
+    db.Compact();
+
+    CLevelDBStats stats = db.GetStats();
+    BOOST_CHECK_EQUAL(stats.nWrites, 1U);
+    BOOST_CHECK(stats.nWriteBytes > 32);
+    BOOST_CHECK_EQUAL(stats.nReads, 3U);
+    BOOST_CHECK_EQUAL(stats.nReadMisses, 1U);
+    BOOST_CHECK_EQUAL(stats.nReadBytes, 64U);
+    BOOST_CHECK_EQUAL(stats.nCompactions, 1U);
+
+    std::string strValue;
+    BOOST_CHECK(db.GetProperty("leveldb.stats", strValue));
+    BOOST_CHECK(db.GetProperty("leveldb.num-files-at-level0", strValue));
+    BOOST_CHECK(!db.GetProperty("leveldb.nosuchproperty", strValue));
+
+    //! Memory databases are never registered for the rpc calls
+    LOCK(cs_mapLevelDB);
+    BOOST_CHECK(!mapLevelDB.count("statstest"));
+}
+
+BOOST_AUTO_TEST_CASE(coins_snapshot_roundtrip)
+{
+    CCoinsViewDB dbFrom(1 << 20, true);
+    CCoinsMap mapCoins;
+    std::vector<std::pair<uint256, CCoins> > vCoins;
+    for (int i = 0; i < 500; i++) {
+        CCoinsCacheEntry& entry = mapCoins[GetRandHash()];
+        entry.coins.nVersion = 1;
+        entry.coins.nHeight = i;
+        entry.coins.fCoinBase = (i % 10 == 0);
+        entry.coins.vout.resize(1 + i % 3);
+        entry.coins.vout.back().nValue = i * CENT;
+        entry.coins.vout.back().scriptPubKey = CScript() << OP_TRUE;
+        entry.flags = CCoinsCacheEntry::DIRTY;
+    }
+    BOOST_FOREACH(const CCoinsMap::value_type& entry, mapCoins)
+        vCoins.push_back(std::make_pair(entry.first, entry.second.coins));
+    uint256 hashBlock = GetRandHash();
+    BOOST_CHECK(dbFrom.BatchWrite(mapCoins, hashBlock));
+
+    boost::filesystem::path path = GetDataDir() / "utxo-test.dat";
+    boost::filesystem::remove(path);
+    CCoinsStats statsDump;
+    {
+        boost::scoped_ptr<CCoinsViewDBCursor> pcursor(dbFrom.Cursor());
+        BOOST_CHECK(pcursor->GetBestBlock() == hashBlock);
+        BOOST_CHECK(DumpCoinsSnapshot(*pcursor, 77, path, statsDump));
+    }
+    BOOST_CHECK_EQUAL(statsDump.nTransactions, 500U);
+
+    CCoinsSnapshotHeader header;
+    CCoinsStats statsVerify;
+    BOOST_CHECK(VerifyCoinsSnapshot(path, header, statsVerify));
+    BOOST_CHECK(header.hashBlock == hashBlock);
+    BOOST_CHECK_EQUAL(header.nHeight, 77);
+    BOOST_CHECK(statsVerify.hashSerialized == statsDump.hashSerialized);
+    BOOST_CHECK_EQUAL(statsVerify.nTotalAmount, statsDump.nTotalAmount);
+
+    //! Loading replaces whatever coins were there before
+    CCoinsViewDB dbTo(1 << 20, true);
+    CCoinsMap mapStale;
+    uint256 txidStale = GetRandHash();
+    mapStale[txidStale].coins.nVersion = 1;
+    mapStale[txidStale].coins.vout.resize(1);
+    mapStale[txidStale].coins.vout[0].nValue = COIN;
+    mapStale[txidStale].coins.vout[0].scriptPubKey = CScript() << OP_TRUE;
+    mapStale[txidStale].flags = CCoinsCacheEntry::DIRTY;
+    BOOST_CHECK(dbTo.BatchWrite(mapStale, GetRandHash()));
+    BOOST_CHECK(dbTo.HaveCoins(txidStale));
+    BOOST_CHECK(dbTo.LoadSnapshot(path, header, 3));
+    BOOST_CHECK(!dbTo.IsLoadingSnapshot());
+    BOOST_CHECK(dbTo.GetBestBlock() == hashBlock);
+    BOOST_CHECK(!dbTo.HaveCoins(txidStale));
+    for (unsigned int i = 0; i < vCoins.size(); i++) {
+        CCoins coins;
+        BOOST_CHECK(dbTo.GetCoins(vCoins[i].first, coins));
+        BOOST_CHECK(coins == vCoins[i].second);
+    }
+
+    //! Flip a byte in the middle of the coins, the chunk checksum catches it
+    FILE* file = fopen(path.string().c_str(), "r+b");
+    BOOST_CHECK(file != NULL);
+    fseek(file, 200, SEEK_SET);
+    int ch = fgetc(file);
+    fseek(file, 200, SEEK_SET);
+    fputc(ch ^ 0x55, file);
+    fclose(file);
+    BOOST_CHECK(!VerifyCoinsSnapshot(path, header, statsVerify));
+
+    //! A load that fails halfway leaves no best block and keeps the in progress marker
+    BOOST_CHECK(!dbTo.LoadSnapshot(path, header, 3));
+    BOOST_CHECK(dbTo.IsLoadingSnapshot());
+    BOOST_CHECK(dbTo.GetBestBlock() == uint256(0));
+    boost::filesystem::remove(path);
+
+    //! The snapshot base is kept in the block tree database, for VerifyDB and DisconnectTip after a restart
+    CBlockTreeDB dbTree(1 << 20, true);
+    uint256 hashBase;
+    BOOST_CHECK(!dbTree.ReadSnapshotBase(hashBase));
+    BOOST_CHECK(dbTree.WriteSnapshotBase(hashBlock));
+    BOOST_CHECK(dbTree.ReadSnapshotBase(hashBase));
+    BOOST_CHECK(hashBase == hashBlock);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -4,6 +4,7 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "wallet.h"
+#include "walletdb.h"
 
 #include <set>
 #include <stdint.h>
@@ -22,6 +23,8 @@
 
 using namespace std;
 
+extern CWallet* pwalletMain;
+
 typedef set<pair<const CWalletTx*,unsigned int> > CoinSet;
 
 BOOST_AUTO_TEST_SUITE(wallet_tests)
@@ -326,4 +329,432 @@ BOOST_AUTO_TEST_CASE(coin_selection_tests)
     empty_wallet();
 }
 
+BOOST_AUTO_TEST_CASE(rescan_filter_tests)
+{
+    CWallet keywallet;
+    LOCK(keywallet.cs_wallet);
+
+    CKey key, keyOther;
+    key.MakeNewKey(true);
+    keyOther.MakeNewKey(true);
+    BOOST_CHECK(keywallet.AddKeyPubKey(key, key.GetPubKey()));
+
+    CBloomFilter filter;
+    BOOST_CHECK(keywallet.GetRescanFilter(filter));
+
+    CMutableTransaction mtx;
+    mtx.vout.resize(1);
+    mtx.vout[0].nValue = 1 * CENT;
+    mtx.vout[0].scriptPubKey = GetScriptForDestination(key.GetPubKey().GetID());
+    BOOST_CHECK(filter.IsRelevantAndUpdate(CTransaction(mtx)));
+    mtx.vout[0].scriptPubKey = CScript() << ToByteVector(key.GetPubKey()) << OP_CHECKSIG;
+    BOOST_CHECK(filter.IsRelevantAndUpdate(CTransaction(mtx)));
+    mtx.vout[0].scriptPubKey = GetScriptForDestination(keyOther.GetPubKey().GetID());
+    BOOST_CHECK(!filter.IsRelevantAndUpdate(CTransaction(mtx)));
+
+    // A spend of a wallet output matches on the outpoint alone
+    mtx.vout[0].scriptPubKey = GetScriptForDestination(key.GetPubKey().GetID());
+    CTransaction txCredit(mtx);
+    BOOST_CHECK(keywallet.AddToWallet(CWalletTx(&keywallet, txCredit), true, NULL));
+    BOOST_CHECK(keywallet.GetRescanFilter(filter));
+    CMutableTransaction mtxSpend;
+    mtxSpend.vin.push_back(CTxIn(COutPoint(txCredit.GetHash(), 0)));
+    mtxSpend.vout.resize(1);
+    mtxSpend.vout[0].scriptPubKey = GetScriptForDestination(keyOther.GetPubKey().GetID());
+    BOOST_CHECK(filter.IsRelevantAndUpdate(CTransaction(mtxSpend)));
+
+    // Nothing to match a script without data pushes on, so the rescan has to check every transaction
+    BOOST_CHECK(keywallet.AddWatchOnly(CScript() << OP_TRUE));
+    BOOST_CHECK(!keywallet.GetRescanFilter(filter));
+}
+
+BOOST_AUTO_TEST_CASE(wallet_filter_tests)
+{
+    CWallet keywallet;
+    // MarkDirty() takes cs_main, so it has to come first
+    LOCK2(cs_main, keywallet.cs_wallet);
+
+    CKey key, keyOther;
+    key.MakeNewKey(true);
+    keyOther.MakeNewKey(true);
+    BOOST_CHECK(keywallet.AddKeyPubKey(key, key.GetPubKey()));
+
+    CMutableTransaction mtx;
+    mtx.vout.resize(1);
+    mtx.vout[0].nValue = 1 * CENT;
+    mtx.vout[0].scriptPubKey = GetScriptForDestination(key.GetPubKey().GetID());
+    BOOST_CHECK(keywallet.IsRelevantToWallet(CTransaction(mtx)));
+    mtx.vout[0].scriptPubKey = CScript() << ToByteVector(key.GetPubKey()) << OP_CHECKSIG;
+    BOOST_CHECK(keywallet.IsRelevantToWallet(CTransaction(mtx)));
+    mtx.vout[0].scriptPubKey = GetScriptForDestination(keyOther.GetPubKey().GetID());
+    BOOST_CHECK(!keywallet.IsRelevantToWallet(CTransaction(mtx)));
+
+    // A 1-of-2 multisig we hold a key of, and a P2SH of a script we know
+    std::vector<CPubKey> vPubKeys;
+    vPubKeys.push_back(keyOther.GetPubKey());
+    vPubKeys.push_back(key.GetPubKey());
+    CScript scriptMulti = GetScriptForMultisig(1, vPubKeys);
+    mtx.vout[0].scriptPubKey = scriptMulti;
+    BOOST_CHECK(keywallet.IsRelevantToWallet(CTransaction(mtx)));
+    mtx.vout[0].scriptPubKey = GetScriptForDestination(CScriptID(scriptMulti));
+    BOOST_CHECK(!keywallet.IsRelevantToWallet(CTransaction(mtx)));
+    BOOST_CHECK(keywallet.AddCScript(scriptMulti));
+    BOOST_CHECK(keywallet.IsRelevantToWallet(CTransaction(mtx)));
+
+    // A spend of a wallet output matches on the outpoint alone
+    mtx.vout[0].scriptPubKey = GetScriptForDestination(key.GetPubKey().GetID());
+    CTransaction txCredit(mtx);
+    BOOST_CHECK(keywallet.AddToWallet(CWalletTx(&keywallet, txCredit), true, NULL));
+    CMutableTransaction mtxSpend;
+    mtxSpend.vin.push_back(CTxIn(COutPoint(txCredit.GetHash(), 0)));
+    mtxSpend.vout.resize(1);
+    mtxSpend.vout[0].scriptPubKey = GetScriptForDestination(keyOther.GetPubKey().GetID());
+    BOOST_CHECK(keywallet.IsRelevantToWallet(CTransaction(mtxSpend)));
+    mtxSpend.vin[0].prevout.n = 1;
+    BOOST_CHECK(!keywallet.IsRelevantToWallet(CTransaction(mtxSpend)));
+
+    // A watch-only script without data pushes still matches exactly
+    mtx.vout[0].scriptPubKey = CScript() << OP_TRUE;
+    BOOST_CHECK(!keywallet.IsRelevantToWallet(CTransaction(mtx)));
+    BOOST_CHECK(keywallet.AddWatchOnly(CScript() << OP_TRUE));
+    BOOST_CHECK(keywallet.IsRelevantToWallet(CTransaction(mtx)));
+
+    // Rebuilding from the key store and wallet gives the same answers
+    keywallet.MarkDirty();
+    BOOST_CHECK(keywallet.IsRelevantToWallet(CTransaction(mtx)));
+    mtxSpend.vin[0].prevout.n = 0;
+    BOOST_CHECK(keywallet.IsRelevantToWallet(CTransaction(mtxSpend)));
+}
+
+BOOST_AUTO_TEST_CASE(coin_index_tests)
+{
+    CWallet keywallet;
+    CKey key, keyOther;
+    key.MakeNewKey(true);
+    keyOther.MakeNewKey(true);
+    {
+        LOCK(keywallet.cs_wallet);
+        BOOST_CHECK(keywallet.AddKeyPubKey(key, key.GetPubKey()));
+    }
+
+    // An unconfirmed credit from someone else, waiting in the mempool
+    CMutableTransaction mtxCredit;
+    mtxCredit.vin.push_back(CTxIn(COutPoint(GetRandHash(), 0)));
+    mtxCredit.vout.resize(1);
+    mtxCredit.vout[0].nValue = 1 * CENT;
+    mtxCredit.vout[0].scriptPubKey = GetScriptForDestination(key.GetPubKey().GetID());
+    CTransaction txCredit(mtxCredit);
+    mempool.addUnchecked(txCredit.GetHash(), CTxMemPoolEntry(txCredit, 0, GetTime(), 0.0, 1));
+    {
+        LOCK(keywallet.cs_wallet);
+        BOOST_CHECK(keywallet.AddToWallet(CWalletTx(&keywallet, txCredit), true, NULL));
+    }
+    keywallet.MarkDirty();
+    BOOST_CHECK_EQUAL(keywallet.GetUnconfirmedBalance(), 1 * CENT);
+    BOOST_CHECK_EQUAL(keywallet.GetBalance(), 0);
+    vector<COutput> vAvailable;
+    keywallet.AvailableCoins(vAvailable, false);
+    BOOST_CHECK_EQUAL(vAvailable.size(), 1U);
+
+    // Once spent, neither the balance nor the available coins count it
+    CMutableTransaction mtxSpend;
+    mtxSpend.vin.push_back(CTxIn(COutPoint(txCredit.GetHash(), 0)));
+    mtxSpend.vout.resize(1);
+    mtxSpend.vout[0].nValue = 1 * CENT;
+    mtxSpend.vout[0].scriptPubKey = GetScriptForDestination(keyOther.GetPubKey().GetID());
+    CTransaction txSpend(mtxSpend);
+    mempool.addUnchecked(txSpend.GetHash(), CTxMemPoolEntry(txSpend, 0, GetTime(), 0.0, 1));
+    {
+        LOCK(keywallet.cs_wallet);
+        BOOST_CHECK(keywallet.AddToWallet(CWalletTx(&keywallet, txSpend), true, NULL));
+    }
+    keywallet.MarkDirty();
+    BOOST_CHECK_EQUAL(keywallet.GetUnconfirmedBalance(), 0);
+    keywallet.AvailableCoins(vAvailable, false);
+    BOOST_CHECK(vAvailable.empty());
+
+    // A spend that drops out of the mempool gives the output back
+    std::list<CTransaction> removed;
+    mempool.remove(txSpend, removed);
+    keywallet.SyncTransaction(txSpend, NULL);
+    BOOST_CHECK_EQUAL(keywallet.GetUnconfirmedBalance(), 1 * CENT);
+    keywallet.AvailableCoins(vAvailable, false);
+    BOOST_CHECK_EQUAL(vAvailable.size(), 1U);
+    mempool.clear();
+}
+
+BOOST_AUTO_TEST_CASE(wallet_snapshot_tests)
+{
+    CWallet keywallet;
+    CKey key;
+    key.MakeNewKey(true);
+    {
+        LOCK(keywallet.cs_wallet);
+        BOOST_CHECK(keywallet.AddKeyPubKey(key, key.GetPubKey()));
+    }
+    boost::shared_ptr<const CWalletSnapshot> pEmpty = keywallet.GetSnapshot();
+    BOOST_CHECK(pEmpty->vCoins.empty());
+    BOOST_CHECK_EQUAL(pEmpty->balances.nUnconfirmed, 0);
+
+    CMutableTransaction mtxCredit;
+    mtxCredit.vin.push_back(CTxIn(COutPoint(GetRandHash(), 0)));
+    mtxCredit.vout.resize(1);
+    mtxCredit.vout[0].nValue = 1 * CENT;
+    mtxCredit.vout[0].scriptPubKey = GetScriptForDestination(key.GetPubKey().GetID());
+    CTransaction txCredit(mtxCredit);
+    mempool.addUnchecked(txCredit.GetHash(), CTxMemPoolEntry(txCredit, 0, GetTime(), 0.0, 1));
+    {
+        LOCK(keywallet.cs_wallet);
+        BOOST_CHECK(keywallet.AddToWallet(CWalletTx(&keywallet, txCredit), true, NULL));
+    }
+
+    // The new transaction makes the old snapshot stale, readers holding it keep their copy
+    boost::shared_ptr<const CWalletSnapshot> pSnapshot = keywallet.GetSnapshot();
+    BOOST_CHECK(pSnapshot != pEmpty);
+    BOOST_CHECK(pEmpty->vCoins.empty());
+    BOOST_CHECK_EQUAL(pSnapshot->balances.nUnconfirmed, keywallet.GetUnconfirmedBalance());
+    BOOST_CHECK_EQUAL(pSnapshot->balances.nUnconfirmed, 1 * CENT);
+    BOOST_REQUIRE_EQUAL(pSnapshot->vCoins.size(), 1U);
+    BOOST_CHECK(pSnapshot->vCoins[0].txid == txCredit.GetHash());
+    BOOST_CHECK_EQUAL(pSnapshot->vCoins[0].i, 0);
+    BOOST_CHECK_EQUAL(pSnapshot->vCoins[0].txout.nValue, 1 * CENT);
+    BOOST_CHECK(pSnapshot->vCoins[0].fSpendable);
+
+    // Without changes the same snapshot is handed out again
+    BOOST_CHECK(keywallet.GetSnapshot() == pSnapshot);
+
+    // Locked coins leave the unspent list
+    COutPoint outpoint(txCredit.GetHash(), 0);
+    {
+        LOCK(keywallet.cs_wallet);
+        keywallet.LockCoin(outpoint);
+    }
+    BOOST_CHECK(keywallet.GetSnapshot()->vCoins.empty());
+    {
+        LOCK(keywallet.cs_wallet);
+        keywallet.UnlockCoin(outpoint);
+    }
+    BOOST_CHECK_EQUAL(keywallet.GetSnapshot()->vCoins.size(), 1U);
+
+    // A block's changes publish at its end, depths moved even if no wallet transaction did
+    pSnapshot = keywallet.GetSnapshot();
+    keywallet.BeginSyncBatch();
+    keywallet.EndSyncBatch();
+    BOOST_CHECK(keywallet.GetSnapshot() != pSnapshot);
+    BOOST_CHECK_EQUAL(keywallet.GetSnapshot()->vCoins.size(), 1U);
+    mempool.clear();
+}
+
+BOOST_AUTO_TEST_CASE(keypool_tests)
+{
+    // Enough keys for the top up to span more than one database transaction
+    const unsigned int nKeys = KEYPOOL_KEYS_PER_TXN + 10;
+    unsigned int nStartSize;
+    {
+        LOCK(pwalletMain->cs_wallet);
+        nStartSize = pwalletMain->GetKeyPoolSize();
+    }
+    BOOST_CHECK(pwalletMain->TopUpKeyPool(nStartSize + nKeys));
+
+    // Every pool entry made it to disk along with its key, including the ones of the last batch
+    CWalletDB walletdb(pwalletMain->strWalletFile);
+    {
+        LOCK(pwalletMain->cs_wallet);
+        BOOST_CHECK(pwalletMain->GetKeyPoolSize() >= nStartSize + nKeys);
+        unsigned int nChecked = 0;
+        BOOST_FOREACH(int64_t nIndex, pwalletMain->setKeyPool) {
+            CKeyPool keypoolDisk;
+            BOOST_CHECK(walletdb.ReadPool(nIndex, keypoolDisk));
+            BOOST_CHECK(pwalletMain->HaveKey(keypoolDisk.vchPubKey.GetID()));
+            nChecked++;
+        }
+        BOOST_CHECK(nChecked > KEYPOOL_KEYS_PER_TXN);
+    }
+
+    // Reserved entries are handed out in order and each one only once
+    std::vector<int64_t> vReserved;
+    std::set<CKeyID> setReserved;
+    for (int i = 0; i < 10; i++) {
+        int64_t nIndex;
+        CKeyPool keypool;
+        pwalletMain->ReserveKeyFromKeyPool(nIndex, keypool);
+        BOOST_CHECK(nIndex > 0);
+        BOOST_CHECK(vReserved.empty() || nIndex > vReserved.back());
+        BOOST_CHECK(setReserved.insert(keypool.vchPubKey.GetID()).second);
+        CKeyPool keypoolDisk;
+        BOOST_CHECK(walletdb.ReadPool(nIndex, keypoolDisk));
+        BOOST_CHECK(keypoolDisk.vchPubKey == keypool.vchPubKey);
+        vReserved.push_back(nIndex);
+    }
+    BOOST_FOREACH(int64_t nIndex, vReserved)
+        pwalletMain->ReturnKey(nIndex);
+    {
+        LOCK(pwalletMain->cs_wallet);
+        BOOST_CHECK(pwalletMain->GetKeyPoolSize() >= nStartSize + nKeys);
+    }
+}
+
+//! Opens up the protected key store calls a wallet makes when it is encrypted and unlocked
+class CCryptBenchKeyStore : public CCryptoKeyStore
+{
+public:
+    bool EncryptKeys(CKeyingMaterial& vMasterKeyIn) { return CCryptoKeyStore::EncryptKeys(vMasterKeyIn); }
+    bool Unlock(const CKeyingMaterial& vMasterKeyIn) { return CCryptoKeyStore::Unlock(vMasterKeyIn); }
+};
+
+BOOST_AUTO_TEST_CASE(wallet_crypt_tests)
+{
+    // Enough keys for several decryption threads
+    const unsigned int nKeys = 3 * CRYPTER_KEYS_PER_THREAD;
+    CCryptBenchKeyStore keystore;
+    vector<CKeyID> vKeyID;
+    map<CKeyID, CKey> mapOriginal;
+    for (unsigned int i = 0; i < nKeys; i++) {
+        CKey key;
+        key.MakeNewKey(true);
+        BOOST_CHECK(keystore.AddKeyPubKey(key, key.GetPubKey()));
+        vKeyID.push_back(key.GetPubKey().GetID());
+        mapOriginal[vKeyID.back()] = key;
+    }
+    CKeyingMaterial vMasterKey(WALLET_CRYPTO_KEY_SIZE);
+    GetRandBytes(&vMasterKey[0], WALLET_CRYPTO_KEY_SIZE);
+    BOOST_REQUIRE(keystore.EncryptKeys(vMasterKey));
+
+    map<CKeyID, CKey> mapKeys;
+    BOOST_CHECK(keystore.GetKeys(vKeyID, mapKeys));
+    BOOST_CHECK(mapKeys == mapOriginal);
+
+    // An empty and a garbled record fail on their own, every other key still comes out
+    CKey keyEmpty, keyGarbled;
+    keyEmpty.MakeNewKey(true);
+    keyGarbled.MakeNewKey(true);
+    BOOST_CHECK(keystore.AddCryptedKey(keyEmpty.GetPubKey(), vector<unsigned char>()));
+    BOOST_CHECK(keystore.AddCryptedKey(keyGarbled.GetPubKey(), vector<unsigned char>(48, 0x5a)));
+    vKeyID.insert(vKeyID.begin() + nKeys / 2, keyEmpty.GetPubKey().GetID());
+    vKeyID.insert(vKeyID.begin() + 1, keyGarbled.GetPubKey().GetID());
+    CKey key;
+    BOOST_CHECK(!keystore.GetKey(keyEmpty.GetPubKey().GetID(), key));
+    mapKeys.clear();
+    BOOST_CHECK(!keystore.GetKeys(vKeyID, mapKeys));
+    BOOST_CHECK(mapKeys == mapOriginal);
+
+    // So does a key the store does not have
+    CKey keyUnknown;
+    keyUnknown.MakeNewKey(true);
+    vector<CKeyID> vUnknown(1, keyUnknown.GetPubKey().GetID());
+    mapKeys.clear();
+    BOOST_CHECK(!keystore.GetKeys(vUnknown, mapKeys));
+    BOOST_CHECK(mapKeys.empty());
+
+    // Encrypting goes on past an empty secret as well
+    vector<CKeyingMaterial> vPlaintext(3, CKeyingMaterial(32, 0x11));
+    vPlaintext[1].clear();
+    vector<uint256> vIV(3);
+    for (unsigned int i = 0; i < vIV.size(); i++)
+        vIV[i] = GetRandHash();
+    vector<vector<unsigned char> > vCiphertext;
+    vector<char> vfOk;
+    BOOST_CHECK(!EncryptSecrets(vMasterKey, vPlaintext, vIV, vCiphertext, vfOk));
+    BOOST_REQUIRE_EQUAL(vfOk.size(), 3U);
+    BOOST_CHECK(vfOk[0] && !vfOk[1] && vfOk[2]);
+    CKeyingMaterial vDecrypted;
+    BOOST_CHECK(DecryptSecret(vMasterKey, vCiphertext[2], vIV[2], vDecrypted));
+    BOOST_CHECK(vDecrypted == vPlaintext[2]);
+}
+
+BOOST_AUTO_TEST_CASE(wallet_load_tests)
+{
+    BOOST_CHECK(pwalletMain->TopUpKeyPool(500));
+
+    // A few transactions paying our keys, straight into the database
+    CPubKey pubkey;
+    {
+        LOCK(pwalletMain->cs_wallet);
+        pubkey = pwalletMain->GenerateNewKey();
+    }
+    CWalletDB walletdb(pwalletMain->strWalletFile);
+    vector<uint256> vHashes;
+    for (int i = 0; i < 10; i++) {
+        CMutableTransaction mtx;
+        mtx.vin.push_back(CTxIn(COutPoint(GetRandHash(), 0)));
+        mtx.vout.resize(1);
+        mtx.vout[0].nValue = (i + 1) * CENT;
+        mtx.vout[0].scriptPubKey = GetScriptForDestination(pubkey.GetID());
+        CWalletTx wtx(pwalletMain, CTransaction(mtx));
+        wtx.nOrderPos = i;
+        BOOST_CHECK(walletdb.WriteTx(wtx.GetHash(), wtx));
+        vHashes.push_back(wtx.GetHash());
+    }
+
+    CWallet walletLoaded(pwalletMain->strWalletFile);
+    bool fFirstRun;
+    BOOST_CHECK_EQUAL(walletLoaded.LoadWallet(fFirstRun), DB_LOAD_OK);
+
+    set<CKeyID> setKeys, setKeysLoaded;
+    pwalletMain->GetKeys(setKeys);
+    walletLoaded.GetKeys(setKeysLoaded);
+    BOOST_CHECK(setKeys == setKeysLoaded);
+    {
+        LOCK2(pwalletMain->cs_wallet, walletLoaded.cs_wallet);
+        BOOST_CHECK_EQUAL(walletLoaded.GetKeyPoolSize(), pwalletMain->GetKeyPoolSize());
+    }
+    BOOST_FOREACH(const uint256& hash, vHashes) {
+        BOOST_CHECK(walletLoaded.mapWallet.count(hash));
+        BOOST_CHECK(walletdb.EraseTx(hash));
+    }
+}
+
+
+BOOST_AUTO_TEST_CASE(wallet_batch_tests)
+{
+    CKey key;
+    key.MakeNewKey(true);
+    CAccount account;
+    account.vchPubKey = key.GetPubKey();
+    CWalletDB walletdb(pwalletMain->strWalletFile);
+    CAccount accountRead;
+    {
+        CDBBatch batch(pwalletMain->strWalletFile);
+        BOOST_CHECK(walletdb.WriteAccount("batch", account));
+        // Queued writes are read back through any handle
+        BOOST_CHECK(CWalletDB(pwalletMain->strWalletFile).ReadAccount("batch", accountRead));
+        BOOST_CHECK(accountRead.vchPubKey == account.vchPubKey);
+        BOOST_CHECK(walletdb.WritePool(1000000, CKeyPool(account.vchPubKey)));
+        BOOST_CHECK(walletdb.ErasePool(1000000));
+        CKeyPool keypool;
+        BOOST_CHECK(!walletdb.ReadPool(1000000, keypool));
+        LOCK(bitdb.cs_writequeue);
+        BOOST_CHECK_EQUAL(bitdb.mapWriteQueue[pwalletMain->strWalletFile].mapWrites.size(), 2U);
+    }
+
+    // Applied once the batch closes
+    {
+        LOCK(bitdb.cs_writequeue);
+        BOOST_CHECK(!bitdb.mapWriteQueue.count(pwalletMain->strWalletFile));
+    }
+    accountRead.SetNull();
+    BOOST_CHECK(walletdb.ReadAccount("batch", accountRead));
+    BOOST_CHECK(accountRead.vchPubKey == account.vchPubKey);
+
+    // Commit() and a write-through scope put the writes on disk while the batch stays open
+    {
+        CDBBatch batch(pwalletMain->strWalletFile);
+        BOOST_CHECK(walletdb.WritePool(1000001, CKeyPool(account.vchPubKey)));
+        BOOST_CHECK(batch.Commit());
+        {
+            LOCK(bitdb.cs_writequeue);
+            BOOST_CHECK(bitdb.mapWriteQueue[pwalletMain->strWalletFile].mapWrites.empty());
+        }
+        BOOST_CHECK(walletdb.WritePool(1000002, CKeyPool(account.vchPubKey)));
+        CDBWriteThrough writeThrough(pwalletMain->strWalletFile);
+        BOOST_CHECK(walletdb.ErasePool(1000001));
+        BOOST_CHECK(walletdb.ErasePool(1000002));
+        LOCK(bitdb.cs_writequeue);
+        BOOST_CHECK(bitdb.mapWriteQueue[pwalletMain->strWalletFile].mapWrites.empty());
+    }
+    CKeyPool keypool;
+    BOOST_CHECK(!walletdb.ReadPool(1000001, keypool));
+    BOOST_CHECK(!walletdb.ReadPool(1000002, keypool));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
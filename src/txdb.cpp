@@ -8,12 +8,16 @@
 
 #include "amount.h"
 #include "checkpoints.h"
+#include "checkqueue.h"
+#include "hash.h"
 #include "pow.h"
 #include "uint256.h"
 
 #include <stdint.h>
 
+#include <boost/bind.hpp>
 #include <boost/scoped_ptr.hpp>
+#include <boost/thread.hpp>
 
 //! Constants found in this source codes header(.h)
 //! -dbcache default (MiB)
@@ -40,7 +44,7 @@ void static BatchWriteHashBestChain(CLevelDBBatch &batch, const uint256 &hash)
     batch.Write('B', hash);
 }
 
-CCoinsViewDB::CCoinsViewDB(size_t nCacheSize, bool fMemory, bool fWipe) : db(GetDataDir() / "chainstate", nCacheSize, fMemory, fWipe) {
+CCoinsViewDB::CCoinsViewDB(size_t nCacheSize, bool fMemory, bool fWipe) : db(GetDataDir() / "chainstate", nCacheSize, fMemory, fWipe, "chainstate") {
 }
 
 bool CCoinsViewDB::GetCoins(const uint256 &txid, CCoins &coins) const {
@@ -87,7 +91,7 @@ bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
     return db.WriteBatch(batch);
 }
 
-CBlockTreeDB::CBlockTreeDB(size_t nCacheSize, bool fMemory, bool fWipe) : CLevelDBWrapper(GetDataDir() / "blocks" / "index", nCacheSize, fMemory, fWipe) {
+CBlockTreeDB::CBlockTreeDB(size_t nCacheSize, bool fMemory, bool fWipe) : CLevelDBWrapper(GetDataDir() / "blocks" / "index", nCacheSize, fMemory, fWipe, "blockindex") {
 }
 
 bool CBlockTreeDB::WriteBlockIndex(const CDiskBlockIndex& blockindex)
@@ -120,72 +124,508 @@ bool CBlockTreeDB::ReadReindexing(bool &fReindexing) {
     return true;
 }
 
+bool CBlockTreeDB::WriteSnapshotBase(const uint256 &hash) {
+    return Write('S', hash, true);
+}
+
+bool CBlockTreeDB::ReadSnapshotBase(uint256 &hash) {
+    return Read('S', hash);
+}
+
 bool CBlockTreeDB::ReadLastBlockFile(int &nFile) {
     return Read('l', nFile);
 }
 
+//! Adds the coins of one transaction to the statistics and serialized hash reported by gettxoutsetinfo
+static void AddCoinsToStats(CCoinsStats &stats, CHashWriter &ss, const uint256 &txhash, const CCoins &coins, unsigned int nValueSize)
+{
+    ss << txhash;
+    ss << VARINT(coins.nVersion);
+    ss << (coins.fCoinBase ? 'c' : 'n');
+    ss << VARINT(coins.nHeight);
+    stats.nTransactions++;
+    for (unsigned int i=0; i<coins.vout.size(); i++) {
+        const CTxOut &out = coins.vout[i];
+        if (!out.IsNull()) {
+            stats.nTransactionOutputs++;
+            ss << VARINT(i+1);
+            ss << out;
+            stats.nTotalAmount += out.nValue;
+        }
+    }
+    stats.nSerializedSize += 32 + nValueSize;
+    ss << VARINT(0);
+}
+
 bool CCoinsViewDB::GetStats(CCoinsStats &stats) const {
+    boost::scoped_ptr<CCoinsViewDBCursor> pcursor(Cursor());
+
+    CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
+    stats.hashBlock = pcursor->GetBestBlock();
+    ss << stats.hashBlock;
+    while (pcursor->Valid()) {
+        boost::this_thread::interruption_point();
+        uint256 txhash;
+        CCoins coins;
+        if (!pcursor->GetKey(txhash) || !pcursor->GetValue(coins))
+            return error("%s : Deserialize or I/O error", __func__);
+        AddCoinsToStats(stats, ss, txhash, coins, pcursor->GetValueSize());
+        pcursor->Next();
+    }
+    stats.nHeight = mapBlockIndex.find(stats.hashBlock)->second->nHeight;
+    stats.hashSerialized = ss.GetHash();
+    return true;
+}
+
+bool CCoinsViewDB::IsLoadingSnapshot() const {
+    return db.Exists('L');
+}
+
+CCoinsViewDBCursor* CCoinsViewDB::Cursor() const {
     /* It seems that there are no "const iterators" for LevelDB.  Since we
        only need read operations on it, use a const-cast to get around
        that restriction.  */
-    boost::scoped_ptr<leveldb::Iterator> pcursor(const_cast<CLevelDBWrapper*>(&db)->NewIterator());
-    pcursor->SeekToFirst();
+    return new CCoinsViewDBCursor(const_cast<CLevelDBWrapper*>(&db)->NewIterator());
+}
+
+CCoinsViewDBCursor::CCoinsViewDBCursor(leveldb::Iterator* pcursorIn) : pcursor(pcursorIn), hashBlock(0)
+{
+    //! Read the best block through the cursor, so it belongs to the same snapshot as the coins
+    CDataStream ssKey(SER_DISK, CLIENT_VERSION);
+    ssKey << 'B';
+    pcursor->Seek(ssKey.str());
+    if (pcursor->Valid() && pcursor->key() == leveldb::Slice(ssKey.str())) {
+        leveldb::Slice slValue = pcursor->value();
+        CDataStream ssValue(slValue.data(), slValue.data()+slValue.size(), SER_DISK, CLIENT_VERSION);
+        try {
+            ssValue >> hashBlock;
+        } catch (std::exception &e) {
+            hashBlock = 0;
+        }
+    }
+
+    ssKey.clear();
+    ssKey << 'c';
+    pcursor->Seek(ssKey.str());
+}
+
+bool CCoinsViewDBCursor::Valid() const
+{
+    return pcursor->Valid() && pcursor->key().size() > 0 && pcursor->key()[0] == 'c';
+}
+
+void CCoinsViewDBCursor::Next()
+{
+    pcursor->Next();
+}
 
+bool CCoinsViewDBCursor::GetKey(uint256 &txid) const
+{
+    leveldb::Slice slKey = pcursor->key();
+    CDataStream ssKey(slKey.data(), slKey.data()+slKey.size(), SER_DISK, CLIENT_VERSION);
+    try {
+        char chType;
+        ssKey >> chType >> txid;
+    } catch (std::exception &e) {
+        return false;
+    }
+    return true;
+}
+
+bool CCoinsViewDBCursor::GetValue(CCoins &coins) const
+{
+    leveldb::Slice slValue = pcursor->value();
+    CDataStream ssValue(slValue.data(), slValue.data()+slValue.size(), SER_DISK, CLIENT_VERSION);
+    try {
+        ssValue >> coins;
+    } catch (std::exception &e) {
+        return false;
+    }
+    return true;
+}
+
+unsigned int CCoinsViewDBCursor::GetValueSize() const
+{
+    return pcursor->value().size();
+}
+
+//! Coins are grouped into chunks of about this many serialized bytes in a snapshot file
+static const unsigned int SNAPSHOT_CHUNK_SIZE = 1 << 20;
+
+//! Writes out one chunk of a snapshot file, a count, the serialized coins and their checksum
+static void WriteSnapshotChunk(CAutoFile &fileout, uint32_t nCount, const CDataStream &ssChunk)
+{
+    std::vector<char> vchData(ssChunk.begin(), ssChunk.end());
+    fileout << nCount;
+    fileout << vchData;
+    fileout << Hash(vchData.begin(), vchData.end());
+}
+
+bool DumpCoinsSnapshot(CCoinsViewDBCursor &cursor, int nHeight, const boost::filesystem::path &path, CCoinsStats &stats)
+{
+    //! Write to a temporary file, so a partial dump never looks like a complete one
+    boost::filesystem::path pathTmp = path;
+    pathTmp += ".incomplete";
+    FILE *file = fopen(pathTmp.string().c_str(), "wb");
+    CAutoFile fileout(file, SER_DISK, CLIENT_VERSION);
+    if (fileout.IsNull())
+        return error("%s : Failed to open file %s", __func__, pathTmp.string());
+
+    CCoinsSnapshotHeader header;
+    header.hashBlock = cursor.GetBestBlock();
+    header.nHeight = nHeight;
+
+    stats = CCoinsStats();
+    stats.hashBlock = header.hashBlock;
+    stats.nHeight = nHeight;
+    CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
+    ss << stats.hashBlock;
+
+    try {
+        fileout << FLATDATA(Params().MessageStart());
+        fileout << header;
+
+        CDataStream ssChunk(SER_DISK, CLIENT_VERSION);
+        uint32_t nCount = 0;
+        while (cursor.Valid()) {
+            boost::this_thread::interruption_point();
+            uint256 txhash;
+            CCoins coins;
+            if (!cursor.GetKey(txhash) || !cursor.GetValue(coins))
+                return error("%s : Deserialize or I/O error", __func__);
+            AddCoinsToStats(stats, ss, txhash, coins, cursor.GetValueSize());
+            ssChunk << txhash << coins;
+            nCount++;
+            if (ssChunk.size() >= SNAPSHOT_CHUNK_SIZE) {
+                WriteSnapshotChunk(fileout, nCount, ssChunk);
+                ssChunk.clear();
+                nCount = 0;
+            }
+            cursor.Next();
+        }
+        if (nCount)
+            WriteSnapshotChunk(fileout, nCount, ssChunk);
+        //! The empty chunk marks the end of the coins
+        ssChunk.clear();
+        WriteSnapshotChunk(fileout, 0, ssChunk);
+
+        stats.hashSerialized = ss.GetHash();
+        fileout << stats.nTransactions << stats.nTransactionOutputs << stats.nTotalAmount << stats.hashSerialized;
+    } catch (std::exception &e) {
+        return error("%s : Serialize or I/O error - %s", __func__, e.what());
+    }
+    FileCommit(fileout.Get());
+    fileout.fclose();
+
+    if (!RenameOver(pathTmp, path))
+        return error("%s : Rename-into-place failed", __func__);
+    return true;
+}
+
+//! Reads the next chunk of a snapshot file and checks it against its checksum
+static bool ReadSnapshotChunk(CAutoFile &filein, uint32_t &nCount, std::vector<char> &vchData)
+{
+    uint256 hashChunk;
+    filein >> nCount;
+    filein >> vchData;
+    filein >> hashChunk;
+    if (hashChunk != Hash(vchData.begin(), vchData.end()))
+        return error("%s : Checksum mismatch, the snapshot file is corrupt", __func__);
+    return true;
+}
+
+//! Opens a snapshot file and reads its header, checking it was made for this network
+static bool OpenCoinsSnapshot(const boost::filesystem::path &path, CAutoFile &filein, CCoinsSnapshotHeader &header)
+{
+    if (filein.IsNull())
+        return error("%s : Failed to open file %s", __func__, path.string());
+    try {
+        unsigned char pchMsgTmp[4];
+        filein >> FLATDATA(pchMsgTmp);
+        if (memcmp(pchMsgTmp, Params().MessageStart(), sizeof(pchMsgTmp)))
+            return error("%s : Invalid network magic number", __func__);
+        filein >> header;
+    } catch (std::exception &e) {
+        return error("%s : Deserialize or I/O error - %s", __func__, e.what());
+    }
+    if (header.nVersion > CCoinsSnapshotHeader::CURRENT_VERSION)
+        return error("%s : Unknown snapshot version %d", __func__, header.nVersion);
+    return true;
+}
+
+bool VerifyCoinsSnapshot(const boost::filesystem::path &path, CCoinsSnapshotHeader &header, CCoinsStats &stats)
+{
+    CAutoFile filein(fopen(path.string().c_str(), "rb"), SER_DISK, CLIENT_VERSION);
+    if (!OpenCoinsSnapshot(path, filein, header))
+        return false;
+
+    stats = CCoinsStats();
+    stats.hashBlock = header.hashBlock;
+    stats.nHeight = header.nHeight;
     CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
-    stats.hashBlock = GetBestBlock();
     ss << stats.hashBlock;
-    int64_t nTotalAmount = 0;
+
+    CCoinsStats statsFile;
+    try {
+        uint32_t nCount;
+        std::vector<char> vchData;
+        do {
+            boost::this_thread::interruption_point();
+            if (!ReadSnapshotChunk(filein, nCount, vchData))
+                return false;
+            CDataStream ssChunk(vchData, SER_DISK, CLIENT_VERSION);
+            for (uint32_t i = 0; i < nCount; i++) {
+                uint256 txhash;
+                CCoins coins;
+                ssChunk >> txhash >> coins;
+                AddCoinsToStats(stats, ss, txhash, coins, ::GetSerializeSize(coins, SER_DISK, CLIENT_VERSION));
+            }
+            if (!ssChunk.empty())
+                return error("%s : Trailing data in a chunk", __func__);
+        } while (nCount);
+        filein >> statsFile.nTransactions >> statsFile.nTransactionOutputs >> statsFile.nTotalAmount >> statsFile.hashSerialized;
+    } catch (std::exception &e) {
+        return error("%s : Deserialize or I/O error - %s", __func__, e.what());
+    }
+    stats.hashSerialized = ss.GetHash();
+
+    if (stats.hashSerialized != statsFile.hashSerialized || stats.nTransactions != statsFile.nTransactions ||
+        stats.nTransactionOutputs != statsFile.nTransactionOutputs || stats.nTotalAmount != statsFile.nTotalAmount)
+        return error("%s : The coins do not match the statistics recorded in the snapshot", __func__);
+    return true;
+}
+
+/** One chunk of snapshot coins, decoded and written to the coin database by a worker thread */
+class CCoinsSnapshotWrite
+{
+private:
+    CLevelDBWrapper *pdb;
+    uint32_t nCount;
+    std::vector<char> vchData;
+
+public:
+    CCoinsSnapshotWrite() : pdb(NULL), nCount(0) {}
+    CCoinsSnapshotWrite(CLevelDBWrapper *pdbIn, uint32_t nCountIn, std::vector<char> &vchDataIn) : pdb(pdbIn), nCount(nCountIn) {
+        vchData.swap(vchDataIn);
+    }
+
+    bool operator()() {
+        CLevelDBBatch batch;
+        try {
+            CDataStream ssChunk(vchData, SER_DISK, CLIENT_VERSION);
+            for (uint32_t i = 0; i < nCount; i++) {
+                uint256 txhash;
+                CCoins coins;
+                ssChunk >> txhash >> coins;
+                BatchWriteCoins(batch, txhash, coins);
+            }
+            return pdb->WriteBatch(batch);
+        } catch (std::exception &e) {
+            return error("CCoinsSnapshotWrite() : %s", e.what());
+        }
+    }
+
+    void swap(CCoinsSnapshotWrite &check) {
+        std::swap(pdb, check.pdb);
+        std::swap(nCount, check.nCount);
+        vchData.swap(check.vchData);
+    }
+};
+
+bool CCoinsViewDB::LoadSnapshot(const boost::filesystem::path &path, CCoinsSnapshotHeader &header, int nThreads)
+{
+    CAutoFile filein(fopen(path.string().c_str(), "rb"), SER_DISK, CLIENT_VERSION);
+    if (!OpenCoinsSnapshot(path, filein, header))
+        return false;
+
+    //! Mark the load as in progress and forget the best block first, so an interrupted load can not be
+    //! mistaken for a valid chainstate, the marker makes the next start refuse it until a -reindex
+    {
+        CLevelDBBatch batch;
+        batch.Write('L', header.hashBlock);
+        batch.Erase('B');
+        if (!db.WriteBatch(batch, true))
+            return error("%s : Failed to reset the best block", __func__);
+    }
+
+    //! Wipe the current coins, in batches of bounded size
+    {
+        boost::scoped_ptr<CCoinsViewDBCursor> pcursor(Cursor());
+        size_t nErased = 0;
+        while (pcursor->Valid()) {
+            CLevelDBBatch batch;
+            for (int i = 0; i < 100000 && pcursor->Valid(); i++, pcursor->Next()) {
+                uint256 txhash;
+                if (!pcursor->GetKey(txhash))
+                    return error("%s : Deserialize or I/O error", __func__);
+                batch.Erase(make_pair('c', txhash));
+                nErased++;
+            }
+            if (!db.WriteBatch(batch))
+                return false;
+        }
+        LogPrint("coindb", "%s : erased %u coins entries\n", __func__, nErased);
+    }
+
+    CCheckQueue<CCoinsSnapshotWrite> queue(1);
+    boost::thread_group threadGroup;
+    for (int i = 1; i < nThreads; i++)
+        threadGroup.create_thread(boost::bind(&CCheckQueue<CCoinsSnapshotWrite>::Thread, &queue));
+
+    bool fOk = true;
+    uint64_t nCoins = 0;
+    try {
+        uint32_t nCount;
+        std::vector<char> vchData;
+        std::vector<CCoinsSnapshotWrite> vWrites;
+        do {
+            //! Keep a bounded number of chunks in flight
+            CCheckQueueControl<CCoinsSnapshotWrite> control(&queue);
+            vWrites.clear();
+            while (vWrites.size() < (size_t)std::max(nThreads, 1) * 4) {
+                if (!ReadSnapshotChunk(filein, nCount, vchData)) {
+                    fOk = false;
+                    break;
+                }
+                if (!nCount)
+                    break;
+                nCoins += nCount;
+                vWrites.push_back(CCoinsSnapshotWrite(&db, nCount, vchData));
+            }
+            control.Add(vWrites);
+            if (!control.Wait())
+                fOk = false;
+        } while (fOk && nCount);
+    } catch (std::exception &e) {
+        fOk = error("%s : Deserialize or I/O error - %s", __func__, e.what());
+    }
+    threadGroup.interrupt_all();
+    threadGroup.join_all();
+    if (!fOk)
+        return error("%s : Failed to load the snapshot, a -reindex is needed", __func__);
+
+    //! Finally sync the new best block together with the removal of the marker, which also commits
+    //! everything written before it
+    CLevelDBBatch batch;
+    BatchWriteHashBestChain(batch, header.hashBlock);
+    batch.Erase('L');
+    if (!db.WriteBatch(batch, true))
+        return false;
+    LogPrint("coindb", "%s : loaded %u transactions with unspent outputs at block %s\n", __func__, nCoins, header.hashBlock.ToString());
+    return true;
+}
+
+bool CBlockTreeDB::ReadTxIndex(const uint256 &txid, CDiskTxPos &pos) {
+    {
+        LOCK(cs_pendingIndex);
+        std::map<uint256, CDiskTxPos>::const_iterator it = mapPendingTxIndex.find(txid);
+        if (it != mapPendingTxIndex.end()) {
+            pos = it->second;
+            return true;
+        }
+    }
+    return Read(make_pair('t', txid), pos);
+}
+
+bool CBlockTreeDB::WriteTxIndex(const std::vector<std::pair<uint256, CDiskTxPos> >&vect) {
+    LOCK(cs_pendingIndex);
+    for (std::vector<std::pair<uint256,CDiskTxPos> >::const_iterator it=vect.begin(); it!=vect.end(); it++)
+        mapPendingTxIndex[it->first] = it->second;
+    return true;
+}
+
+bool CBlockTreeDB::ReadAddrIndex(const uint160 &hashScript, std::vector<std::pair<CAddrIndexKey, CAddrIndexValue> > &vEntries) {
+    //! Entries on disk are merged with those still pending, a pending entry always wins
+    std::map<CAddrIndexKey, CAddrIndexValue> mapEntries;
+
+    boost::scoped_ptr<leveldb::Iterator> pcursor(NewIterator());
+    CDataStream ssKeySet(SER_DISK, CLIENT_VERSION);
+    ssKeySet << make_pair('a', hashScript);
+    pcursor->Seek(ssKeySet.str());
+
     while (pcursor->Valid()) {
         boost::this_thread::interruption_point();
         try {
             leveldb::Slice slKey = pcursor->key();
             CDataStream ssKey(slKey.data(), slKey.data()+slKey.size(), SER_DISK, CLIENT_VERSION);
             char chType;
+            CAddrIndexKey key;
             ssKey >> chType;
-            if (chType == 'c') {
-                leveldb::Slice slValue = pcursor->value();
-                CDataStream ssValue(slValue.data(), slValue.data()+slValue.size(), SER_DISK, CLIENT_VERSION);
-                CCoins coins;
-                ssValue >> coins;
-                uint256 txhash;
-                ssKey >> txhash;
-                ss << txhash;
-                ss << VARINT(coins.nVersion);
-                ss << (coins.fCoinBase ? 'c' : 'n');
-                ss << VARINT(coins.nHeight);
-                stats.nTransactions++;
-                for (unsigned int i=0; i<coins.vout.size(); i++) {
-                    const CTxOut &out = coins.vout[i];
-                    if (!out.IsNull()) {
-                        stats.nTransactionOutputs++;
-                        ss << VARINT(i+1);
-                        ss << out;
-                        nTotalAmount += out.nValue;
-                    }
-                }
-                stats.nSerializedSize += 32 + slValue.size();
-                ss << VARINT(0);
-            }
+            if (chType != 'a')
+                break;
+            ssKey >> key;
+            if (key.hashScript != hashScript)
+                break;
+            leveldb::Slice slValue = pcursor->value();
+            CDataStream ssValue(slValue.data(), slValue.data()+slValue.size(), SER_DISK, CLIENT_VERSION);
+            CAddrIndexValue value;
+            ssValue >> value;
+            mapEntries[key] = value;
             pcursor->Next();
         } catch (std::exception &e) {
             return error("%s : Deserialize or I/O error - %s", __func__, e.what());
         }
     }
-    stats.nHeight = mapBlockIndex.find(GetBestBlock())->second->nHeight;
-    stats.hashSerialized = ss.GetHash();
-    stats.nTotalAmount = nTotalAmount;
+
+    {
+        LOCK(cs_pendingIndex);
+        std::map<CAddrIndexKey, CAddrIndexValue>::const_iterator it = mapPendingAddrIndex.lower_bound(CAddrIndexKey(hashScript, uint256(0), 0));
+        for (; it != mapPendingAddrIndex.end() && it->first.hashScript == hashScript; it++) {
+            if (it->second.IsNull())
+                mapEntries.erase(it->first);
+            else
+                mapEntries[it->first] = it->second;
+        }
+    }
+
+    vEntries.assign(mapEntries.begin(), mapEntries.end());
     return true;
 }
 
-bool CBlockTreeDB::ReadTxIndex(const uint256 &txid, CDiskTxPos &pos) {
-    return Read(make_pair('t', txid), pos);
+bool CBlockTreeDB::WriteAddrIndex(const std::vector<std::pair<CAddrIndexKey, CAddrIndexValue> >&vect) {
+    LOCK(cs_pendingIndex);
+    for (std::vector<std::pair<CAddrIndexKey, CAddrIndexValue> >::const_iterator it=vect.begin(); it!=vect.end(); it++)
+        mapPendingAddrIndex[it->first] = it->second;
+    return true;
 }
 
-bool CBlockTreeDB::WriteTxIndex(const std::vector<std::pair<uint256, CDiskTxPos> >&vect) {
+bool CBlockTreeDB::EraseAddrIndex(const std::vector<CAddrIndexKey>&vect) {
+    LOCK(cs_pendingIndex);
+    for (std::vector<CAddrIndexKey>::const_iterator it=vect.begin(); it!=vect.end(); it++)
+        mapPendingAddrIndex[*it].SetNull();
+    return true;
+}
+
+size_t CBlockTreeDB::GetPendingIndexSize() const {
+    LOCK(cs_pendingIndex);
+    return mapPendingTxIndex.size() + mapPendingAddrIndex.size();
+}
+
+bool CBlockTreeDB::FlushPendingIndex() {
     CLevelDBBatch batch;
-    for (std::vector<std::pair<uint256,CDiskTxPos> >::const_iterator it=vect.begin(); it!=vect.end(); it++)
-        batch.Write(make_pair('t', it->first), it->second);
-    return WriteBatch(batch);
+    size_t nTx, nAddr;
+    {
+        LOCK(cs_pendingIndex);
+        nTx = mapPendingTxIndex.size();
+        nAddr = mapPendingAddrIndex.size();
+        if (!nTx && !nAddr)
+            return true;
+        for (std::map<uint256, CDiskTxPos>::const_iterator it = mapPendingTxIndex.begin(); it != mapPendingTxIndex.end(); it++)
+            batch.Write(make_pair('t', it->first), it->second);
+        for (std::map<CAddrIndexKey, CAddrIndexValue>::const_iterator it = mapPendingAddrIndex.begin(); it != mapPendingAddrIndex.end(); it++) {
+            if (it->second.IsNull())
+                batch.Erase(make_pair('a', it->first));
+            else
+                batch.Write(make_pair('a', it->first), it->second);
+        }
+        //! Entries stay readable from the pending maps until the batch has been committed
+        if (!WriteBatch(batch))
+            return false;
+        mapPendingTxIndex.clear();
+        mapPendingAddrIndex.clear();
+    }
+    LogPrint("coindb", "Committed %u transaction and %u address index entries to block index database\n", (unsigned int)nTx, (unsigned int)nAddr);
+    return true;
 }
 
 bool CBlockTreeDB::WriteFlag(const std::string &name, bool fValue) {
@@ -221,40 +661,18 @@ bool CBlockTreeDB::LoadBlockIndexGuts( vector<BlockTreeEntry>& vSortedByHeight )
                 ssKey >> aBlockDetails.uintRealHash;
                 leveldb::Slice slValue = pcursor->value();
                 CDataStream ssValue(slValue.data(), slValue.data()+slValue.size(), SER_DISK, CLIENT_VERSION);
-                CDiskBlockIndex diskindex;
-                ssValue >> diskindex;
-                aBlockDetails.nHeight = diskindex.nHeight;
+                ssValue >> aBlockDetails.diskindex;
+                aBlockDetails.nHeight = aBlockDetails.diskindex.nHeight;
+                aBlockDetails.pBlockIndex = NULL;
 
                 //! NOTE: On constructing block index objects.  Computing many hash values here can lead to many minutes of waiting for
                 //! the user.  This has been re-written several times in order to be as fast as possible for loading.  We don't
                 //! re-compute hashes here any longer, the fake sha256d ones that are in the mined blocks for the previous block,
-                //! or the real scrypt hashes Anoncoin has used for years as POW.  Just create the CBlockIndex objects and add them to
-                //! a vector of CBlockIndex objects, we will later sort, calculate hashes, organize it and build the mapBlockIndex lookup
-                //! system used by the rest of the software....
-
-                //! Create a new empty CBlockIndex each time we read one
-                CBlockIndex* pindexNew = new CBlockIndex();
-                if (!pindexNew)
-                    throw runtime_error("LoadBlockIndex() : new CBlockIndex failed");
-
-                aBlockDetails.pBlockIndex = pindexNew;
-                //! For speed we'll initially just save the previous block hash (sha256d) in the fakeBIhash field of the new object, this
-                //! is NORMALLY used to hold the sha256d hash of THIS block, but we don't have that value computed yet, and this works fine
-                //! as a temporary holding location, until later when we do the calculations.  See LoadBlockIndexDB() in main.cpp where all
-                //! the time complex work is done.
-                pindexNew->fakeBIhash     = diskindex.hashPrev;
-                //!pindexNew->pprev        We can not set this up yet, without allot of time complexity
-                pindexNew->nHeight        = diskindex.nHeight;
-                pindexNew->nFile          = diskindex.nFile;
-                pindexNew->nDataPos       = diskindex.nDataPos;
-                pindexNew->nUndoPos       = diskindex.nUndoPos;
-                pindexNew->nVersion       = diskindex.nVersion;
-                pindexNew->hashMerkleRoot = diskindex.hashMerkleRoot;
-                pindexNew->nTime          = diskindex.nTime;
-                pindexNew->nBits          = diskindex.nBits;
-                pindexNew->nNonce         = diskindex.nNonce;
-                pindexNew->nStatus        = diskindex.nStatus;
-                pindexNew->nTx            = diskindex.nTx;
+                //! or the real scrypt hashes Anoncoin has used for years as POW.  Just keep the details read from disk in a vector,
+                //! we will later sort, calculate hashes, create the CBlockIndex objects in height order and build the mapBlockIndex
+                //! lookup system used by the rest of the software....  See LoadBlockIndexDB() in main.cpp where all the time
+                //! complex work is done.
+
                 //! Just store it in the vector for later sorting & processing.
                 vSortedByHeight.push_back(aBlockDetails);
                 //! No pow checks here, just go to the next blockindex
@@ -9,12 +9,16 @@
 
 #include "leveldbwrapper.h"
 #include "main.h"
+#include "sync.h"
 
 #include <map>
 #include <string>
 #include <utility>
 #include <vector>
 
+#include <boost/filesystem/path.hpp>
+#include <boost/scoped_ptr.hpp>
+
 class CCoins;
 class uint256;
 
@@ -25,6 +29,58 @@ extern const int64_t nMaxDbCache;
 //! min. -dbcache in (MiB)
 extern const int64_t nMinDbCache;
 
+/**
+ * Cursor over the coins of the coin database, as of the moment it was created.
+ * LevelDB iterators read from an implicit snapshot, so the coins can be streamed
+ * out while blocks keep being connected.
+ */
+class CCoinsViewDBCursor
+{
+private:
+    boost::scoped_ptr<leveldb::Iterator> pcursor;
+    uint256 hashBlock;
+
+public:
+    CCoinsViewDBCursor(leveldb::Iterator* pcursorIn);
+
+    //! The best block the coins in this cursor belong to
+    uint256 GetBestBlock() const { return hashBlock; }
+
+    //! Whether the cursor points at a coins entry
+    bool Valid() const;
+    void Next();
+    bool GetKey(uint256 &txid) const;
+    bool GetValue(CCoins &coins) const;
+    unsigned int GetValueSize() const;
+};
+
+/**
+ * A UTXO snapshot file, as written by dumptxoutset, starts with this header. It
+ * is followed by chunks of coins, each a count, the serialized (txid, CCoins)
+ * pairs and a checksum over them, and ends with an empty chunk and the
+ * gettxoutsetinfo statistics of the set, which the loader verifies.
+ */
+class CCoinsSnapshotHeader
+{
+public:
+    static const int CURRENT_VERSION = 1;
+    int nVersion;
+    //! Real (scrypt) hash and height of the block the coins belong to
+    uint256 hashBlock;
+    int nHeight;
+
+    CCoinsSnapshotHeader() : nVersion(CURRENT_VERSION), hashBlock(0), nHeight(0) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+        READWRITE(this->nVersion);
+        READWRITE(hashBlock);
+        READWRITE(nHeight);
+    }
+};
+
 /** CCoinsView backed by the LevelDB coin database (chainstate/) */
 class CCoinsViewDB : public CCoinsView
 {
@@ -38,18 +94,45 @@ public:
     uint256 GetBestBlock() const;
     bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock);
     bool GetStats(CCoinsStats &stats) const;
+
+    //! True while a LoadSnapshot() has started but not yet written its best block, including after a crash
+    bool IsLoadingSnapshot() const;
+
+    //! Returns a new cursor over the coins as they are on disk now, the caller owns it
+    CCoinsViewDBCursor* Cursor() const;
+
+    /**
+     * Replaces the whole coin database with the coins of a snapshot file, which must
+     * already have been checked with VerifyCoinsSnapshot(). Chunks are decoded and
+     * written as separate LevelDB batches by nThreads threads. The best block is
+     * only set once every coin is on disk, an interrupted load leaves a marker that
+     * IsLoadingSnapshot() reports and needs a -reindex.
+     */
+    bool LoadSnapshot(const boost::filesystem::path &path, CCoinsSnapshotHeader &header, int nThreads);
 };
 
+//! Writes every coin of the cursor into a snapshot file at path, nHeight being the height of its best block
+bool DumpCoinsSnapshot(CCoinsViewDBCursor &cursor, int nHeight, const boost::filesystem::path &path, CCoinsStats &stats);
+
+//! Reads a whole snapshot file, checking the chunk checksums and recomputing the statistics and serialized hash of
+//! the coins, which must match the ones recorded at the end of the file
+bool VerifyCoinsSnapshot(const boost::filesystem::path &path, CCoinsSnapshotHeader &header, CCoinsStats &stats);
+
+extern CCoinsViewDB *pcoinsdbview;
+
 //! We now return and sort the following structure of details during a LoadBlockIndexGuts() call.
 //! This allows us to give a faster load time than could otherwise be done during initialization.
 //! Using this we do not need to calculate every Scrypt hash, for every block in order to build
 //! the cross-reference map, that information is already available as the 'key' field in the LevelDB
 //! database.
+//! The block index entries themselves are only allocated once the details are sorted, so they come out of
+//! the mapBlockIndex slab pool in height order.
 struct BlockTreeEntry
 {
     int nHeight;
     CBlockIndex* pBlockIndex;
     uint256 uintRealHash;
+    CDiskBlockIndex diskindex;
     bool operator <(const BlockTreeEntry& s2) const { return nHeight < s2.nHeight; }
 };
 
@@ -61,6 +144,13 @@ public:
 private:
     CBlockTreeDB(const CBlockTreeDB&);
     void operator=(const CBlockTreeDB&);
+
+    //! Transaction and address index entries are not written when a block is connected, they are held here
+    //! until the next FlushStateToDisk() and then committed in a single batch, ahead of the chainstate.
+    mutable CCriticalSection cs_pendingIndex;
+    std::map<uint256, CDiskTxPos> mapPendingTxIndex;
+    //! A null value marks an address index entry which must be erased from disk at the next flush
+    std::map<CAddrIndexKey, CAddrIndexValue> mapPendingAddrIndex;
 public:
     bool WriteBlockIndex(const CDiskBlockIndex& blockindex);
     bool ReadBlockFileInfo(int nFile, CBlockFileInfo &fileinfo);
@@ -69,8 +159,18 @@ public:
     bool WriteLastBlockFile(int nFile);
     bool WriteReindexing(bool fReindex);
     bool ReadReindexing(bool &fReindex);
+    //! Block the chainstate was loaded from a UTXO snapshot at, see ActivateCoinsSnapshot()
+    bool WriteSnapshotBase(const uint256 &hash);
+    bool ReadSnapshotBase(uint256 &hash);
     bool ReadTxIndex(const uint256 &txid, CDiskTxPos &pos);
     bool WriteTxIndex(const std::vector<std::pair<uint256, CDiskTxPos> > &list);
+    bool ReadAddrIndex(const uint160 &hashScript, std::vector<std::pair<CAddrIndexKey, CAddrIndexValue> > &vEntries);
+    bool WriteAddrIndex(const std::vector<std::pair<CAddrIndexKey, CAddrIndexValue> > &list);
+    bool EraseAddrIndex(const std::vector<CAddrIndexKey> &list);
+    //! Number of index entries waiting for the next flush
+    size_t GetPendingIndexSize() const;
+    //! Commit all pending transaction and address index entries in one LevelDB batch
+    bool FlushPendingIndex();
     bool WriteFlag(const std::string &name, bool fValue);
     bool ReadFlag(const std::string &name, bool &fValue);
     bool LoadBlockIndexGuts( std::vector<BlockTreeEntry>& vSortedByHeight );
@@ -46,6 +46,22 @@ const CAmount nHighTransactionMaxFeeWarning = 100 * nHighTransactionFeeWarning;
 
 //! Largest (in bytes) free transaction we're willing to create
 const uint32_t MAX_FREE_TRANSACTION_CREATE_SIZE = 1000;
+//! Most threads reading and prefiltering blocks during a wallet rescan
+const int MAX_RESCAN_THREADS = 8;
+//! Blocks each rescan thread reads before the matches are applied and the locks taken again
+const unsigned int RESCAN_BLOCKS_PER_THREAD = 16;
+//! Nodes the branch and bound coin selection visits before settling for the best subset found so far
+const int MAX_COINSELECTION_TRIES = 100000;
+//! Most threads deriving keys for a keypool top up
+const int MAX_KEYPOOL_THREADS = 8;
+//! Fewest new keypool keys worth handing to another derivation thread
+const unsigned int KEYPOOL_KEYS_PER_THREAD = 32;
+//! New keypool keys written to the wallet database in each transaction
+const unsigned int KEYPOOL_KEYS_PER_TXN = 1000;
+//! Most threads decoding key and transaction records while the wallet loads
+const int MAX_WALLETLOAD_THREADS = 8;
+//! Fewest key and transaction records worth handing to another decoding thread
+const unsigned int WALLETLOAD_RECORDS_PER_THREAD = 64;
 
 //!
 //! Variables declared for global visibility in the header file, defined in this source code file.
@@ -69,12 +85,11 @@ bool fSendFreeTransactions = false;
 bool fPayAtLeastCustomFee = true;
 
 
-struct CompareValueOnly
+struct CompareOutputValueDescending
 {
-    bool operator()(const pair<CAmount, pair<const CWalletTx*, unsigned int> >& t1,
-                    const pair<CAmount, pair<const CWalletTx*, unsigned int> >& t2) const
+    bool operator()(const COutput& t1, const COutput& t2) const
     {
-        return t1.first < t2.first;
+        return t1.tx->vout[t1.i].nValue > t2.tx->vout[t2.i].nValue;
     }
 };
 
@@ -107,11 +122,38 @@ void WriteOrderPos(const int64_t& nOrderPos, mapValue_t& mapValue)
 //! of node event signals through them, initialization registers the interface once after the
 //! main wallet pointer has been setup...GR
 //!
+void CWallet::BeginSyncBatch()
+{
+    LOCK(cs_wallet);
+    fInSyncBatch = true;
+    if (fFileBacked && !pdbSyncBatch)
+        pdbSyncBatch = new CDBBatch(strWalletFile);
+}
+
+void CWallet::EndSyncBatch()
+{
+    LOCK(cs_wallet);
+    delete pdbSyncBatch;
+    pdbSyncBatch = NULL;
+    fInSyncBatch = false;
+
+    // Every depth moved with the tip, so the snapshot goes stale even when no wallet transaction changed.
+    // It is only marked so, rebuilding walks every wallet output and is left to the next GetSnapshot(),
+    // blocks that nobody reads a snapshot in between (the initial download) don't pay for it.
+    {
+        LOCK(cs_snapshot);
+        nSnapshotVersion++;
+    }
+}
+
 void CWallet::SyncTransaction(const CTransaction& tx, const CBlock* pblock)
 {
     LOCK2(cs_main, cs_wallet);
-    if (!AddToWalletIfInvolvingMe(tx, pblock, true))
-        return; // Not one of ours
+    if (!AddToWalletIfInvolvingMe(tx, pblock, true)) {
+        // Not one of ours, but it may conflict with one of ours
+        UpdateCoinTxs(tx);
+        return;
+    }
 
     // If a transaction changes 'conflicted' state, that changes the balance
     // available of the outputs it spends. So force those to be
@@ -250,10 +292,43 @@ CPubKey CWallet::GenerateNewKey()
 }
 
 bool CWallet::AddKeyPubKey(const CKey& secret, const CPubKey &pubkey)
+{
+    CWalletDB walletdb(strWalletFile);
+    return AddKeyPubKeyWithDB(walletdb, secret, pubkey);
+}
+
+//! Points a wallet's pwalletdbEncryption at a database handle while in scope, unless it already points at one
+class CWalletDBTunnel
+{
+private:
+    CWalletDB*& pwalletdb;
+    bool fSet;
+
+public:
+    CWalletDBTunnel(CWalletDB*& pwalletdbIn, CWalletDB& walletdb) : pwalletdb(pwalletdbIn), fSet(pwalletdbIn == NULL)
+    {
+        if (fSet)
+            pwalletdb = &walletdb;
+    }
+    ~CWalletDBTunnel()
+    {
+        if (fSet)
+            pwalletdb = NULL;
+    }
+};
+
+bool CWallet::AddKeyPubKeyWithDB(CWalletDB &walletdb, const CKey& secret, const CPubKey &pubkey)
 {
     AssertLockHeld(cs_wallet); // mapKeyMetadata
-    if (!CCryptoKeyStore::AddKeyPubKey(secret, pubkey))
+    // CCryptoKeyStore writes an encrypted key back through AddCryptedKey, hand it our database handle
+    bool fAdded;
+    {
+        CWalletDBTunnel tunnel(pwalletdbEncryption, walletdb);
+        fAdded = CCryptoKeyStore::AddKeyPubKey(secret, pubkey);
+    }
+    if (!fAdded)
         return false;
+    setFilterIds.insert(pubkey.GetID());
 
     // check if we need to remove from watch-only
     CScript script;
@@ -264,9 +339,9 @@ bool CWallet::AddKeyPubKey(const CKey& secret, const CPubKey &pubkey)
     if (!fFileBacked)
         return true;
     if (!IsCrypted()) {
-        return CWalletDB(strWalletFile).WriteKey(pubkey,
-                                                 secret.GetPrivKey(),
-                                                 mapKeyMetadata[pubkey.GetID()]);
+        return walletdb.WriteKey(pubkey,
+                                 secret.GetPrivKey(),
+                                 mapKeyMetadata[pubkey.GetID()]);
     }
     return true;
 }
@@ -276,6 +351,10 @@ bool CWallet::AddCryptedKey(const CPubKey &vchPubKey,
 {
     if (!CCryptoKeyStore::AddCryptedKey(vchPubKey, vchCryptedSecret))
         return false;
+    {
+        LOCK(cs_wallet);
+        setFilterIds.insert(vchPubKey.GetID());
+    }
     if (!fFileBacked)
         return true;
     {
@@ -311,6 +390,10 @@ bool CWallet::AddCScript(const CScript& redeemScript)
 {
     if (!CCryptoKeyStore::AddCScript(redeemScript))
         return false;
+    {
+        LOCK(cs_wallet);
+        setFilterIds.insert(Hash160(redeemScript));
+    }
     if (!fFileBacked)
         return true;
     return CWalletDB(strWalletFile).WriteCScript(Hash160(redeemScript), redeemScript);
@@ -336,6 +419,11 @@ bool CWallet::AddWatchOnly(const CScript &dest)
 {
     if (!CCryptoKeyStore::AddWatchOnly(dest))
         return false;
+    {
+        LOCK(cs_wallet);
+        setFilterIds.insert(Hash160(dest));
+        fFilterWatchOnly = true;
+    }
     nTimeFirstKey = 1; // No birthday information for watch-only keys.
     NotifyWatchonlyChanged(true);
     if (!fFileBacked)
@@ -564,6 +652,80 @@ void CWallet::AddToSpends(const uint256& wtxid)
         AddToSpends(txin.prevout, wtxid);
 }
 
+void CWallet::UpdateCoinTxs(const uint256& hash)
+{
+    map<uint256, CWalletTx>::const_iterator it = mapWallet.find(hash);
+    if (it == mapWallet.end()) {
+        setCoinTxs.erase(hash);
+        return;
+    }
+    const CWalletTx& wtx = it->second;
+    bool fCoins = wtx.IsCoinBase() && wtx.GetBlocksToMaturity() > 0;
+    for (unsigned int i = 0; !fCoins && i < wtx.vout.size(); i++)
+        fCoins = IsMine(wtx.vout[i]) != ISMINE_NO && !IsSpent(hash, i);
+    if (fCoins)
+        setCoinTxs.insert(hash);
+    else
+        setCoinTxs.erase(hash);
+}
+
+// Called for every transaction the wallet hears about, as it can change what is left to spend of the
+// transactions it spends from, and a conflicting one can give back the outputs a wallet transaction spent.
+void CWallet::UpdateCoinTxs(const CTransaction& tx)
+{
+    AssertLockHeld(cs_main);
+    AssertLockHeld(cs_wallet);
+    const uint256& hash = tx.GetHash();
+    bool fChanged = mapWallet.count(hash) != 0;
+    if (fChanged)
+        UpdateCoinTxs(hash);
+    if (tx.IsCoinBase())
+        return;
+
+    BOOST_FOREACH(const CTxIn& txin, tx.vin)
+    {
+        if (mapWallet.count(txin.prevout.hash)) {
+            UpdateCoinTxs(txin.prevout.hash);
+            fChanged = true;
+        }
+        pair<TxSpends::const_iterator, TxSpends::const_iterator> range = mapTxSpends.equal_range(txin.prevout);
+        for (TxSpends::const_iterator it = range.first; it != range.second; ++it)
+        {
+            if (it->second == hash)
+                continue;
+            const CWalletTx* pspender = GetWalletTx(it->second);
+            if (pspender == NULL)
+                continue;
+            BOOST_FOREACH(const CTxIn& txinSpender, pspender->vin)
+                if (mapWallet.count(txinSpender.prevout.hash))
+                    UpdateCoinTxs(txinSpender.prevout.hash);
+            fChanged = true;
+        }
+    }
+    if (fChanged)
+        MarkBalancesChanged();
+}
+
+void CWallet::RebuildCoinTxs()
+{
+    AssertLockHeld(cs_main);
+    AssertLockHeld(cs_wallet);
+    setCoinTxs.clear();
+    for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+        UpdateCoinTxs(it->first);
+    MarkBalancesChanged();
+}
+
+void CWallet::MarkBalancesChanged()
+{
+    AssertLockHeld(cs_wallet);
+    fBalancesCached = false;
+    if (fInSyncBatch)
+        return;
+    LOCK(cs_snapshot);
+    nSnapshotVersion++;
+}
+
 bool CWallet::EncryptWallet(const SecureString& strWalletPassphrase)
 {
     if (IsCrypted())
@@ -656,37 +818,80 @@ int64_t CWallet::IncOrderPosNext(CWalletDB *pwalletdb)
     return nRet;
 }
 
-CWallet::TxItems CWallet::OrderedTxItems(list<CAccountingEntry>& acentries, string strAccount)
+bool CWallet::AddAccountingEntry(const CAccountingEntry& acentry, CWalletDB& walletdb)
 {
-    AssertLockHeld(cs_wallet); // mapWallet
-    CWalletDB walletdb(strWalletFile);
+    AssertLockHeld(cs_wallet); // laccentries
+    if (!walletdb.WriteAccountingEntry(acentry))
+        return false;
+
+    laccentries.push_back(acentry);
+    CAccountingEntry& entry = laccentries.back();
+    wtxOrdered.insert(make_pair(entry.nOrderPos, TxPair((CWalletTx*)0, &entry)));
+    return true;
+}
 
-    // First: get all CWalletTx and CAccountingEntry into a sorted-by-order multimap.
-    TxItems txOrdered;
+//! Height of the active chain block holding wtx, or -1 when it is unconfirmed or its block left the active chain
+static int GetTxIndexHeight(const CWalletTx& wtx)
+{
+    if (wtx.GetTxBlockHash() == 0)
+        return -1;
+    uint256 aRealHash = wtx.GetTxBlockHash().GetRealHash();
+    BlockMap::iterator mi = (aRealHash != 0) ? mapBlockIndex.find(aRealHash) : mapBlockIndex.end();
+    if (mi == mapBlockIndex.end() || !mi->second || !chainActive.Contains(mi->second))
+        return -1;
+    return mi->second->nHeight;
+}
+
+void CWallet::UpdateTxHeightIndex(CWalletTx& wtx)
+{
+    AssertLockHeld(cs_main);
+    AssertLockHeld(cs_wallet);
+    int nHeight = GetTxIndexHeight(wtx);
+    if (nHeight == wtx.nIndexHeight)
+        return;
+    if (wtx.nIndexHeight != -2) {
+        pair<multimap<int, CWalletTx*>::iterator, multimap<int, CWalletTx*>::iterator> range = mapTxByHeight.equal_range(wtx.nIndexHeight);
+        for (multimap<int, CWalletTx*>::iterator it = range.first; it != range.second; ++it)
+            if (it->second == &wtx) {
+                mapTxByHeight.erase(it);
+                break;
+            }
+    }
+    mapTxByHeight.insert(make_pair(nHeight, &wtx));
+    wtx.nIndexHeight = nHeight;
+}
 
-    // Note: maintaining indices in the database of (account,time) --> txid and (account, time) --> acentry
-    // would make this much faster for applications that do this a lot.
+void CWallet::RebuildTxIndex()
+{
+    AssertLockHeld(cs_main);
+    AssertLockHeld(cs_wallet);
+    wtxOrdered.clear();
+    mapTxByHeight.clear();
     for (map<uint256, CWalletTx>::iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
     {
         CWalletTx* wtx = &((*it).second);
-        txOrdered.insert(make_pair(wtx->nOrderPos, TxPair(wtx, (CAccountingEntry*)0)));
+        wtxOrdered.insert(make_pair(wtx->nOrderPos, TxPair(wtx, (CAccountingEntry*)0)));
+        wtx->nIndexHeight = -2;
+        UpdateTxHeightIndex(*wtx);
     }
-    acentries.clear();
-    walletdb.ListAccountCreditDebit(strAccount, acentries);
-    BOOST_FOREACH(CAccountingEntry& entry, acentries)
+    laccentries.clear();
+    if (fFileBacked)
+        CWalletDB(strWalletFile).ListAccountCreditDebit("*", laccentries);
+    BOOST_FOREACH(CAccountingEntry& entry, laccentries)
     {
-        txOrdered.insert(make_pair(entry.nOrderPos, TxPair((CWalletTx*)0, &entry)));
+        wtxOrdered.insert(make_pair(entry.nOrderPos, TxPair((CWalletTx*)0, &entry)));
     }
-
-    return txOrdered;
 }
 
 void CWallet::MarkDirty()
 {
     {
-        LOCK(cs_wallet);
+        LOCK2(cs_main, cs_wallet);
         BOOST_FOREACH(PAIRTYPE(const uint256, CWalletTx)& item, mapWallet)
             item.second.MarkDirty();
+        // What is ours may have changed too, after a key or script import
+        RebuildCoinTxs();
+        RebuildFilter();
     }
 }
 
@@ -699,6 +904,7 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet, CWalletD
         mapWallet[hash] = wtxIn;
         mapWallet[hash].BindWallet(this);
         AddToSpends(hash);
+        AddFilterOutpoints(mapWallet[hash]);
     }
     else
     {
@@ -712,6 +918,7 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet, CWalletD
         {
             wtx.nTimeReceived = GetAdjustedTime();
             wtx.nOrderPos = IncOrderPosNext();
+            wtxOrdered.insert(make_pair(wtx.nOrderPos, TxPair(&wtx, (CAccountingEntry*)0)));
 
             wtx.nTimeSmart = wtx.nTimeReceived;
             uintFakeHash wtxHashBlock( wtxIn.GetTxBlockHash() );
@@ -723,9 +930,7 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet, CWalletD
                     {
                         // Tolerate times up to the last timestamp in the wallet not more than 5 minutes into the future
                         int64_t latestTolerated = latestNow + 300;
-                        list<CAccountingEntry> acentries;
-                        TxItems txOrdered = OrderedTxItems(acentries);
-                        for (TxItems::reverse_iterator it = txOrdered.rbegin(); it != txOrdered.rend(); ++it)
+                        for (TxItems::const_reverse_iterator it = wtxOrdered.rbegin(); it != wtxOrdered.rend(); ++it)
                         {
                             CWalletTx *const pwtx = (*it).second.first;
                             if (pwtx == &wtx)
@@ -784,6 +989,11 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet, CWalletD
         //// debug print
         LogPrintf( "%s : %s  %s%s\n", __func__, wtxIn.GetHash().ToString(), (fInsertedNew ? "new" : ""), (fUpdated ? "update" : "") );
 
+        // Keep setCoinTxs current for this transaction and the ones it spends from
+        UpdateCoinTxs(wtx);
+        UpdateTxHeightIndex(wtx);
+        AddFilterOutpoints(wtx);
+
         // Write to disk
         if (fInsertedNew || fUpdated)
             if (!wtx.WriteToDisk(pwalletdb))
@@ -820,7 +1030,7 @@ bool CWallet::AddToWalletIfInvolvingMe(const CTransaction& tx, const CBlock* pbl
         AssertLockHeld(cs_wallet);
         bool fExisted = mapWallet.count(tx.GetHash()) != 0;
         if (fExisted && !fUpdate) return false;
-        if (fExisted || IsMine(tx) || IsFromMe(tx))
+        if (fExisted || (IsRelevantToWallet(tx) && (IsMine(tx) || IsFromMe(tx))))
         {
             CWalletTx wtx(this,tx);
             // Get merkle branch if transaction was found in a block
@@ -948,15 +1158,176 @@ int64_t CWallet::GetChange(const CTransaction& tx) const
     return nChange;
 }
 
+//! Adds the data pushes of a script to vElements, false if it has none a bloom filter could match on
+static bool GetScriptPushes(const CScript& script, std::vector<std::vector<unsigned char> >& vElements)
+{
+    bool fFound = false;
+    CScript::const_iterator pc = script.begin();
+    std::vector<unsigned char> data;
+    while (pc < script.end()) {
+        opcodetype opcode;
+        if (!script.GetOp(pc, opcode, data))
+            break;
+        if (data.size() != 0) {
+            vElements.push_back(data);
+            fFound = true;
+        }
+    }
+    return fFound;
+}
+
+bool CWallet::GetRescanFilter(CBloomFilter& filter) const
+{
+    AssertLockHeld(cs_wallet);
+    std::vector<std::vector<unsigned char> > vElements;
+
+    // Pay to pubkey, pubkeyhash and bare multisig outputs push one of our keys or key ids
+    std::set<CKeyID> setKeyIds;
+    GetKeys(setKeyIds);
+    BOOST_FOREACH(const CKeyID& keyid, setKeyIds) {
+        vElements.push_back(std::vector<unsigned char>(keyid.begin(), keyid.end()));
+        CPubKey pubkey;
+        if (GetPubKey(keyid, pubkey))
+            vElements.push_back(std::vector<unsigned char>(pubkey.begin(), pubkey.end()));
+    }
+    {
+        LOCK(cs_KeyStore);
+        BOOST_FOREACH(const PAIRTYPE(CScriptID, CScript)& item, mapScripts)
+            vElements.push_back(std::vector<unsigned char>(item.first.begin(), item.first.end()));
+        BOOST_FOREACH(const CScript& script, setWatchOnly) {
+            if (!GetScriptPushes(script, vElements))
+                return false;
+        }
+    }
+
+    // Transactions already in the wallet, and spends of our outputs for IsFromMe()
+    std::vector<COutPoint> vOutpoints;
+    for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it) {
+        const CWalletTx& wtx = it->second;
+        for (unsigned int i = 0; i < wtx.vout.size(); i++)
+            if (IsMine(wtx.vout[i]) != ISMINE_NO)
+                vOutpoints.push_back(COutPoint(it->first, i));
+    }
+
+    // The filter stays local, so it is sized for the wallet rather than held to the protocol limits
+    unsigned int nElements = std::max((unsigned int)(vElements.size() + mapWallet.size() + vOutpoints.size()), 1U);
+    filter = CBloomFilter(nElements, 0.0001, GetRand(std::numeric_limits<unsigned int>::max()));
+    BOOST_FOREACH(const std::vector<unsigned char>& vch, vElements)
+        filter.insert(vch);
+    for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+        filter.insert(it->first);
+    BOOST_FOREACH(const COutPoint& outpoint, vOutpoints)
+        filter.insert(outpoint);
+    return true;
+}
+
+void CWallet::AddFilterOutpoints(const CWalletTx& wtx)
+{
+    AssertLockHeld(cs_wallet);
+    for (unsigned int i = 0; i < wtx.vout.size(); i++)
+        if (IsMine(wtx.vout[i]) != ISMINE_NO)
+            setFilterOutpoints.insert(COutPoint(wtx.GetHash(), i));
+}
+
+void CWallet::RebuildFilter()
+{
+    AssertLockHeld(cs_wallet);
+    setFilterIds.clear();
+    setFilterOutpoints.clear();
+
+    std::set<CKeyID> setKeyIds;
+    GetKeys(setKeyIds);
+    BOOST_FOREACH(const CKeyID& keyid, setKeyIds)
+        setFilterIds.insert(keyid);
+    {
+        LOCK(cs_KeyStore);
+        BOOST_FOREACH(const PAIRTYPE(CScriptID, CScript)& item, mapScripts)
+            setFilterIds.insert(item.first);
+        BOOST_FOREACH(const CScript& script, setWatchOnly)
+            setFilterIds.insert(Hash160(script));
+        fFilterWatchOnly = !setWatchOnly.empty();
+    }
+
+    for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+        AddFilterOutpoints(it->second);
+}
+
+// Every output IsMine() accepts pushes one of our key ids or script ids, or a public key hashing to one of
+// our key ids, or is a watch-only script. So an output that misses all of those can't be ours, and an input
+// that spends none of our outputs can't make the transaction IsFromMe().
+bool CWallet::IsRelevantToWallet(const CTransaction& tx) const
+{
+    AssertLockHeld(cs_wallet);
+    if (mapWallet.count(tx.GetHash()))
+        return true;
+    BOOST_FOREACH(const CTxIn& txin, tx.vin)
+        if (setFilterOutpoints.count(txin.prevout))
+            return true;
+
+    std::vector<unsigned char> vch;
+    opcodetype opcode;
+    BOOST_FOREACH(const CTxOut& txout, tx.vout)
+    {
+        const CScript& script = txout.scriptPubKey;
+        if (fFilterWatchOnly && setFilterIds.count(Hash160(script)))
+            return true;
+        CScript::const_iterator pc = script.begin();
+        while (pc < script.end() && script.GetOp(pc, opcode, vch))
+        {
+            if (vch.size() == 20 && setFilterIds.count(uint160(vch)))
+                return true;
+            if ((vch.size() == 33 || vch.size() == 65) && setFilterIds.count(Hash160(vch)))
+                return true;
+        }
+    }
+    return false;
+}
+
+//! A block of a rescan batch, as read and prefiltered by one of the worker threads
+struct CRescanBlock
+{
+    CBlockIndex* pindex;
+    CDiskBlockPos pos;
+    CBlock block;
+    //! Transactions the prefilter matched, all of them when there is no filter
+    std::vector<bool> vMatch;
+    bool fRead;
+
+    CRescanBlock() : pindex(NULL), fRead(false) {}
+};
+
+//! Reads every nThreads-th block of the batch. A BLOOM_UPDATE_NONE filter is only read, so the workers share it.
+static void ReadRescanBlocks(std::vector<CRescanBlock>* pvBlocks, CBloomFilter* pfilter, unsigned int nThread, unsigned int nThreads)
+{
+    for (unsigned int i = nThread; i < pvBlocks->size(); i += nThreads) {
+        CRescanBlock& rescan = (*pvBlocks)[i];
+        rescan.fRead = ReadBlockFromDisk(rescan.block, rescan.pos) && rescan.block.GetHash() == rescan.pindex->GetBlockHash();
+        if (!rescan.fRead)
+            continue;
+        rescan.vMatch.assign(rescan.block.vtx.size(), pfilter == NULL);
+        if (pfilter)
+            for (unsigned int j = 0; j < rescan.block.vtx.size(); j++)
+                rescan.vMatch[j] = pfilter->IsRelevantAndUpdate(rescan.block.vtx[j]);
+    }
+}
+
 // Scan the block chain (starting in pindexStart) for transactions
 // from or to us. If fUpdate is true, found transactions that already
 // exist in the wallet will be updated.
+// Blocks are read and prefiltered in batches on several threads with no locks held,
+// cs_main and cs_wallet are only taken to collect a batch and to apply its matches in order.
 int CWallet::ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate)
 {
     int ret = 0;
     int64_t nNow = GetTime();
+    unsigned int nThreads = std::max(1, std::min((int)boost::thread::hardware_concurrency(), MAX_RESCAN_THREADS));
+    // A rescan can take hours, what it finds must not wait in a batch opened by the caller
+    CDBWriteThrough writeThrough(strWalletFile);
 
+    CBloomFilter filter;
+    bool fFilter;
     CBlockIndex* pindex = pindexStart;
+    double dProgressStart, dProgressTip;
     {
         LOCK2(cs_main, cs_wallet);
 
@@ -965,29 +1336,90 @@ int CWallet::ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate)
         while (pindex && nTimeFirstKey && (pindex->nTime < (nTimeFirstKey - 7200)))
             pindex = chainActive.Next(pindex);
 
+        fFilter = GetRescanFilter(filter);
+        if (!fFilter)
+            LogPrintf("%s : A watch-only script has no data to match on, checking every transaction\n", __func__);
+
         ShowProgress(_("Rescanning..."), 0); // show rescan progress in GUI as dialog or on splashscreen, if -rescan on startup
-        double dProgressStart = Checkpoints::GuessVerificationProgress(pindex, false);
-        double dProgressTip = Checkpoints::GuessVerificationProgress(chainActive.Tip(), false);
-        while (pindex)
+        dProgressStart = Checkpoints::GuessVerificationProgress(pindex, false);
+        dProgressTip = Checkpoints::GuessVerificationProgress(chainActive.Tip(), false);
+    }
+
+    std::vector<CRescanBlock> vBlocks;
+    //! Outputs found in the current batch, the workers' filter did not know about them yet
+    std::set<COutPoint> setFound;
+    while (pindex)
+    {
+        vBlocks.clear();
         {
-            if (pindex->nHeight % 100 == 0 && dProgressTip - dProgressStart > 0.0)
+            LOCK(cs_main);
+            // A reorganization while the locks were released may have taken pindex off the active chain
+            if (!chainActive.Contains(pindex))
+                pindex = chainActive[chainActive.FindFork(pindex)->nHeight];
+            if (dProgressTip - dProgressStart > 0.0)
                 ShowProgress(_("Rescanning..."), max(1, min(99, (int)((Checkpoints::GuessVerificationProgress(pindex, false) - dProgressStart) / (dProgressTip - dProgressStart) * 100))));
-
-            CBlock block;
-            ReadBlockFromDisk(block, pindex);
-            BOOST_FOREACH(CTransaction& tx, block.vtx)
-            {
-                if (AddToWalletIfInvolvingMe(tx, &block, fUpdate))
-                    ret++;
+            vBlocks.resize(nThreads * RESCAN_BLOCKS_PER_THREAD);
+            unsigned int nBlocks = 0;
+            for (; pindex && nBlocks < vBlocks.size(); nBlocks++) {
+                vBlocks[nBlocks].pindex = pindex;
+                vBlocks[nBlocks].pos = pindex->GetBlockPos();
+                pindex = chainActive.Next(pindex);
             }
-            pindex = chainActive.Next(pindex);
-            if (GetTime() >= nNow + 60) {
-                nNow = GetTime();
-                LogPrintf( "%s : Still rescanning. At block %d. Progress=%f\n", __func__, pindex->nHeight, Checkpoints::GuessVerificationProgress(pindex) );
+            vBlocks.resize(nBlocks);
+        }
+
+        CBloomFilter* pfilter = fFilter ? &filter : NULL;
+        if (nThreads == 1 || vBlocks.size() == 1)
+            ReadRescanBlocks(&vBlocks, pfilter, 0, 1);
+        else {
+            boost::thread_group threadGroup;
+            for (unsigned int i = 0; i < nThreads; i++)
+                threadGroup.create_thread(boost::bind(&ReadRescanBlocks, &vBlocks, pfilter, i, nThreads));
+            threadGroup.join_all();
+        }
+
+        bool fMatched = false;
+        BOOST_FOREACH(const CRescanBlock& rescan, vBlocks) {
+            if (!rescan.fRead)
+                LogPrintf("%s : Could not read block %s at height %d, skipping it\n", __func__, rescan.pindex->GetBlockHash().ToString(), rescan.pindex->nHeight);
+            else if (std::find(rescan.vMatch.begin(), rescan.vMatch.end(), true) != rescan.vMatch.end())
+                fMatched = true;
+        }
+        if (fMatched) {
+            LOCK2(cs_main, cs_wallet);
+            BOOST_FOREACH(CRescanBlock& rescan, vBlocks) {
+                if (!rescan.fRead)
+                    continue;
+                for (unsigned int j = 0; j < rescan.block.vtx.size(); j++) {
+                    const CTransaction& tx = rescan.block.vtx[j];
+                    if (!rescan.vMatch[j]) {
+                        bool fSpendsFound = false;
+                        for (unsigned int k = 0; !fSpendsFound && !setFound.empty() && k < tx.vin.size(); k++)
+                            fSpendsFound = setFound.count(tx.vin[k].prevout) != 0;
+                        if (!fSpendsFound)
+                            continue;
+                    }
+                    if (AddToWalletIfInvolvingMe(tx, &rescan.block, fUpdate)) {
+                        ret++;
+                        const uint256& hash = tx.GetHash();
+                        for (unsigned int k = 0; k < tx.vout.size(); k++) {
+                            setFound.insert(COutPoint(hash, k));
+                            if (fFilter)
+                                filter.insert(COutPoint(hash, k));
+                        }
+                    }
+                }
             }
+            setFound.clear();
+        }
+
+        if (GetTime() >= nNow + 60 && !vBlocks.empty()) {
+            nNow = GetTime();
+            LOCK(cs_main);
+            LogPrintf( "%s : Still rescanning. At block %d. Progress=%f\n", __func__, vBlocks.back().pindex->nHeight, Checkpoints::GuessVerificationProgress(vBlocks.back().pindex) );
         }
-        ShowProgress(_("Rescanning..."), 100); // hide progress dialog in GUI
     }
+    ShowProgress(_("Rescanning..."), 100); // hide progress dialog in GUI
     return ret;
 }
 
@@ -1009,6 +1441,8 @@ void CWallet::ReacceptWalletTransactions()
             wtx.AcceptToMemoryPool(false);
         }
     }
+    // Transactions back in the mempool are no longer at depth -1
+    MarkBalancesChanged();
 }
 
 vector<uint256> CWallet::ResendWalletTransactionsBefore(int64_t nTime)
@@ -1035,94 +1469,102 @@ vector<uint256> CWallet::ResendWalletTransactionsBefore(int64_t nTime)
     return result;
 }
 
-CAmount CWallet::GetBalance() const
+CWalletBalances CWallet::GetBalances() const
 {
-    CAmount nTotal = 0;
+    LOCK2(cs_main, cs_wallet);
+    if (fBalancesCached && pindexBalances == chainActive.Tip())
+        return balancesCached;
+
+    CWalletBalances balances;
+    BOOST_FOREACH(const uint256& hash, setCoinTxs)
     {
-        LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
-        {
-            const CWalletTx* pcoin = &(*it).second;
-            if (pcoin->IsTrusted())
-                nTotal += pcoin->GetAvailableCredit();
+        const CWalletTx* pcoin = &mapWallet.find(hash)->second;
+        bool fTrusted = pcoin->IsTrusted();
+        if (fTrusted) {
+            balances.nTrusted += pcoin->GetAvailableCredit();
+            balances.nWatchOnlyTrusted += pcoin->GetAvailableWatchOnlyCredit();
         }
+        if (!IsFinalTx(*pcoin) || (!fTrusted && pcoin->GetDepthInMainChain() == 0)) {
+            balances.nUnconfirmed += pcoin->GetAvailableCredit();
+            balances.nWatchOnlyUnconfirmed += pcoin->GetAvailableWatchOnlyCredit();
+        }
+        balances.nImmature += pcoin->GetImmatureCredit();
+        balances.nWatchOnlyImmature += pcoin->GetImmatureWatchOnlyCredit();
     }
-
-    return nTotal;
+    balancesCached = balances;
+    pindexBalances = chainActive.Tip();
+    fBalancesCached = true;
+    return balances;
 }
 
-CAmount CWallet::GetUnconfirmedBalance() const
+boost::shared_ptr<const CWalletSnapshot> CWallet::GetSnapshot() const
 {
-    CAmount nTotal = 0;
     {
-        LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
-        {
-            const CWalletTx* pcoin = &(*it).second;
-            if (!IsFinalTx(*pcoin) || (!pcoin->IsTrusted() && pcoin->GetDepthInMainChain() == 0))
-                nTotal += pcoin->GetAvailableCredit();
-        }
+        LOCK(cs_snapshot);
+        if (pSnapshot && pSnapshot->nVersion == nSnapshotVersion)
+            return pSnapshot;
     }
-    return nTotal;
+    LOCK2(cs_main, cs_wallet);
+    return UpdateSnapshot();
 }
 
-CAmount CWallet::GetImmatureBalance() const
+boost::shared_ptr<const CWalletSnapshot> CWallet::UpdateSnapshot() const
 {
-    CAmount nTotal = 0;
+    AssertLockHeld(cs_main);
+    AssertLockHeld(cs_wallet);
+    uint64_t nVersion;
     {
-        LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
-        {
-            const CWalletTx* pcoin = &(*it).second;
-            nTotal += pcoin->GetImmatureCredit();
-        }
+        LOCK(cs_snapshot);
+        // Another caller may have rebuilt it while we waited for the locks
+        if (pSnapshot && pSnapshot->nVersion == nSnapshotVersion)
+            return pSnapshot;
+        nVersion = nSnapshotVersion;
     }
-    return nTotal;
+
+    // The version cannot move while we hold cs_wallet, every change to it does so too
+    boost::shared_ptr<CWalletSnapshot> pNew(new CWalletSnapshot());
+    pNew->nVersion = nVersion;
+    pNew->nHeight = chainActive.Height();
+    pNew->balances = GetBalances();
+    vector<COutput> vCoins;
+    AvailableCoins(vCoins, false);
+    pNew->vCoins.reserve(vCoins.size());
+    BOOST_FOREACH(const COutput& out, vCoins)
+        pNew->vCoins.push_back(CSnapshotOutput(out));
+
+    LOCK(cs_snapshot);
+    pSnapshot = pNew;
+    return pSnapshot;
 }
 
-CAmount CWallet::GetWatchOnlyBalance() const
+CAmount CWallet::GetBalance() const
 {
-    CAmount nTotal = 0;
-    {
-        LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
-        {
-            const CWalletTx* pcoin = &(*it).second;
-            if (pcoin->IsTrusted())
-                nTotal += pcoin->GetAvailableWatchOnlyCredit();
-        }
-    }
+    return GetBalances().nTrusted;
+}
 
-    return nTotal;
+CAmount CWallet::GetUnconfirmedBalance() const
+{
+    return GetBalances().nUnconfirmed;
+}
+
+CAmount CWallet::GetImmatureBalance() const
+{
+    return GetBalances().nImmature;
+}
+
+CAmount CWallet::GetWatchOnlyBalance() const
+{
+    return GetBalances().nWatchOnlyTrusted;
 }
 
 CAmount CWallet::GetUnconfirmedWatchOnlyBalance() const
 {
-    CAmount nTotal = 0;
-    {
-        LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
-        {
-            const CWalletTx* pcoin = &(*it).second;
-            if (!IsFinalTx(*pcoin) || (!pcoin->IsTrusted() && pcoin->GetDepthInMainChain() == 0))
-                nTotal += pcoin->GetAvailableWatchOnlyCredit();
-        }
-    }
-    return nTotal;
+    return GetBalances().nWatchOnlyUnconfirmed;
 }
 
 CAmount CWallet::GetImmatureWatchOnlyBalance() const
 {
-    CAmount nTotal = 0;
-    {
-        LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
-        {
-            const CWalletTx* pcoin = &(*it).second;
-            nTotal += pcoin->GetImmatureWatchOnlyCredit();
-        }
-    }
-    return nTotal;
+    return GetBalances().nWatchOnlyImmature;
 }
 
 //! populate vCoins with vector of available COutputs.
@@ -1132,10 +1574,9 @@ void CWallet::AvailableCoins(vector<COutput>& vCoins, bool fOnlyConfirmed, const
 
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+        BOOST_FOREACH(const uint256& wtxid, setCoinTxs)
         {
-            const uint256& wtxid = it->first;
-            const CWalletTx* pcoin = &(*it).second;
+            const CWalletTx* pcoin = &mapWallet.find(wtxid)->second;
 
             if (!IsFinalTx(*pcoin))
                 continue;
@@ -1153,8 +1594,8 @@ void CWallet::AvailableCoins(vector<COutput>& vCoins, bool fOnlyConfirmed, const
             for (unsigned int i = 0; i < pcoin->vout.size(); i++) {
                 isminetype mine = IsMine(pcoin->vout[i]);
                 if (!(IsSpent(wtxid, i)) && mine != ISMINE_NO &&
-                    !IsLockedCoin((*it).first, i) && pcoin->vout[i].nValue > 0 &&
-                    (!coinControl || !coinControl->HasSelected() || coinControl->IsSelected((*it).first, i)))
+                    !IsLockedCoin(wtxid, i) && pcoin->vout[i].nValue > 0 &&
+                    (!coinControl || !coinControl->HasSelected() || coinControl->IsSelected(wtxid, i)))
                         vCoins.push_back(COutput(pcoin, i, nDepth, (mine & ISMINE_SPENDABLE) != ISMINE_NO));
             }
         }
@@ -1162,48 +1603,79 @@ void CWallet::AvailableCoins(vector<COutput>& vCoins, bool fOnlyConfirmed, const
 }
 
 
-static void ApproximateBestSubset(vector<pair<CAmount, pair<const CWalletTx*,unsigned int> > >vValue, const CAmount& nTotalLower, const CAmount& nTargetValue,
-                                  vector<char>& vfBest, CAmount& nBest, int iterations = 1000)
+//! Orders coins by descending value, equal values keep a random order so selections among them stay random
+static void SortCoinsByValue(vector<COutput>& vCoins)
 {
-    vector<char> vfIncluded;
+    random_shuffle(vCoins.begin(), vCoins.end(), GetRandInt);
+    stable_sort(vCoins.begin(), vCoins.end(), CompareOutputValueDescending());
+}
 
-    vfBest.assign(vValue.size(), true);
+//! Depth first branch and bound search over vValue (sorted by descending value) for the smallest
+//! subset reaching nTargetValue. Gives up after nMaxTries nodes and keeps the best subset seen.
+static void SelectCoinsBnB(const vector<pair<CAmount, pair<const CWalletTx*,unsigned int> > >& vValue, const CAmount& nTotalLower, const CAmount& nTargetValue,
+                           vector<char>& vfBest, CAmount& nBest, int nMaxTries)
+{
+    const size_t nCount = vValue.size();
+    // vRemaining[i] is what the coins from i onwards add up to
+    vector<CAmount> vRemaining(nCount + 1, 0);
+    for (size_t i = nCount; i-- > 0; )
+        vRemaining[i] = vRemaining[i + 1] + vValue[i].first;
+
+    vfBest.assign(nCount, true);
     nBest = nTotalLower;
 
-    seed_insecure_rand();
-
-    for (int nRep = 0; nRep < iterations && nBest != nTargetValue; nRep++) {
-        vfIncluded.assign(vValue.size(), false);
-        CAmount nTotal = 0;
-        bool fReachedTarget = false;
-        for (int nPass = 0; nPass < 2 && !fReachedTarget; nPass++) {
-            for (unsigned int i = 0; i < vValue.size(); i++) {
-                //The solver here uses a randomized algorithm,
-                //the randomness serves no real security purpose but is just
-                //needed to prevent degenerate behavior and it is important
-                //that the rng fast. We do not use a constant random sequence,
-                //because there may be some privacy improvement by making
-                //the selection random.
-                if (nPass == 0 ? insecure_rand() & 1 : !vfIncluded[i]) {
-                    nTotal += vValue[i].first;
-                    vfIncluded[i] = true;
-                    if (nTotal >= nTargetValue) {
-                        fReachedTarget = true;
-                        if (nTotal < nBest) {
-                            nBest = nTotal;
-                            vfBest = vfIncluded;
-                        }
-                        nTotal -= vValue[i].first;
-                        vfIncluded[i] = false;
-                    }
-                }
+    vector<size_t> vIncluded;
+    vector<size_t> vBestIncluded;
+    bool fBestFound = false;
+    CAmount nTotal = 0;
+    size_t i = 0;
+    for (int nTries = 0; nTries < nMaxTries; nTries++) {
+        bool fBacktrack = false;
+        if (nTotal >= nTargetValue) {
+            if (nTotal < nBest) {
+                nBest = nTotal;
+                vBestIncluded = vIncluded;
+                fBestFound = true;
             }
+            if (nBest == nTargetValue)
+                break;
+            fBacktrack = true;
+        } else if (nTotal + vRemaining[i] < nTargetValue) {
+            // Also covers running out of coins, vRemaining[nCount] is 0
+            fBacktrack = true;
+        }
+
+        if (!fBacktrack) {
+            nTotal += vValue[i].first;
+            vIncluded.push_back(i++);
+            continue;
         }
+        if (vIncluded.empty())
+            break;
+        // Exclude the last coin taken. Coins of the same value right after it would only
+        // repeat the totals already tried with it, so move past them as well.
+        size_t j = vIncluded.back();
+        vIncluded.pop_back();
+        nTotal -= vValue[j].first;
+        for (i = j + 1; i < nCount && vValue[i].first == vValue[j].first; i++) {}
+    }
+
+    if (fBestFound) {
+        vfBest.assign(nCount, false);
+        BOOST_FOREACH(size_t n, vBestIncluded)
+            vfBest[n] = true;
     }
 }
 
 bool CWallet::SelectCoinsMinConf(const CAmount& nTargetValue, int nConfMine, int nConfTheirs, vector<COutput> vCoins,
                                  set<pair<const CWalletTx*,unsigned int> >& setCoinsRet, CAmount& nValueRet) const
+{
+    SortCoinsByValue(vCoins);
+    return SelectCoinsSorted(nTargetValue, nConfMine, nConfTheirs, vCoins, setCoinsRet, nValueRet);
+}
+
+bool CWallet::SelectCoinsSorted(const CAmount& nTargetValue, int nConfMine, int nConfTheirs, const vector<COutput>& vCoins,
+                                set<pair<const CWalletTx*,unsigned int> >& setCoinsRet, CAmount& nValueRet) const
 {
     bool fResult = false;
     bool fSolutionFound = false;
@@ -1217,8 +1689,8 @@ bool CWallet::SelectCoinsMinConf(const CAmount& nTargetValue, int nConfMine, int
     vector<pair<CAmount, pair<const CWalletTx*,unsigned int> > > vValue;
     CAmount nTotalLower = 0;
 
-    random_shuffle(vCoins.begin(), vCoins.end(), GetRandInt);
-
+    // vCoins is sorted by descending value, so vValue comes out sorted too and the
+    // last larger coin met is the lowest one
     BOOST_FOREACH(const COutput &output, vCoins) {
         if (!output.fSpendable)
             continue;
@@ -1268,16 +1740,15 @@ bool CWallet::SelectCoinsMinConf(const CAmount& nTargetValue, int nConfMine, int
     }
 
     if( !fSolutionFound ) {
-        // Solve subset sum by stochastic approximation
-        sort(vValue.rbegin(), vValue.rend(), CompareValueOnly());
+        // Solve subset sum by branch and bound
         vector<char> vfBest;
         CAmount nBest;
 
-        ApproximateBestSubset(vValue, nTotalLower, nTargetValue, vfBest, nBest, 1000);
+        SelectCoinsBnB(vValue, nTotalLower, nTargetValue, vfBest, nBest, MAX_COINSELECTION_TRIES);
         if (nBest != nTargetValue && nTotalLower >= nTargetValue + CENT)
-            ApproximateBestSubset(vValue, nTotalLower, nTargetValue + CENT, vfBest, nBest, 1000);
+            SelectCoinsBnB(vValue, nTotalLower, nTargetValue + CENT, vfBest, nBest, MAX_COINSELECTION_TRIES);
 
-        // If we have a bigger coin and (either the stochastic approximation didn't find a good solution,
+        // If we have a bigger coin and (either the search didn't find a good solution,
         //                                   or the next bigger coin is closer), return the bigger coin
         if (coinLowestLarger.second.first &&
             ((nBest != nTargetValue && nBest < nTargetValue + CENT) || coinLowestLarger.first <= nBest))
@@ -1319,9 +1790,11 @@ bool CWallet::SelectCoins(const CAmount& nTargetValue, set<pair<const CWalletTx*
         return (nValueRet >= nTargetValue);
     }
 
-    return (SelectCoinsMinConf(nTargetValue, 1, 6, vCoins, setCoinsRet, nValueRet) ||
-            SelectCoinsMinConf(nTargetValue, 1, 1, vCoins, setCoinsRet, nValueRet) ||
-            (bSpendZeroConfChange && SelectCoinsMinConf(nTargetValue, 0, 1, vCoins, setCoinsRet, nValueRet)));
+    // Sort once, every pass below works on the same value index
+    SortCoinsByValue(vCoins);
+    return (SelectCoinsSorted(nTargetValue, 1, 6, vCoins, setCoinsRet, nValueRet) ||
+            SelectCoinsSorted(nTargetValue, 1, 1, vCoins, setCoinsRet, nValueRet) ||
+            (bSpendZeroConfChange && SelectCoinsSorted(nTargetValue, 0, 1, vCoins, setCoinsRet, nValueRet)));
 }
 
 
@@ -1521,6 +1994,13 @@ bool CWallet::CommitTransaction(CWalletTx& wtxNew, CReserveKey& reservekey)
             // otherwise just for transaction history.
             AddToWallet(wtxNew, false, pwalletdb);
 
+            // The record has to be on disk before the transaction goes out, even with a batch open
+            if (pwalletdb && !pwalletdb->CommitWriteQueue())
+            {
+                delete pwalletdb;
+                return error("%s : writing the transaction to the wallet failed, not relaying it", __func__);
+            }
+
             // Notify that old coins are spent
             set<CWalletTx*> setCoins;
             BOOST_FOREACH(const CTxIn& txin, wtxNew.vin)
@@ -1584,6 +2064,12 @@ DBErrors CWallet::LoadWallet(bool fFirstRunRet)
         return DB_LOAD_OK;
     fFirstRunRet = false;
     DBErrors nLoadWalletRet = CWalletDB(strWalletFile,"cr+").LoadWallet(this);
+    {
+        LOCK2(cs_main, cs_wallet);
+        RebuildCoinTxs();
+        RebuildTxIndex();
+        RebuildFilter();
+    }
     if (nLoadWalletRet == DB_NEED_REWRITE)
     {
         if (CDB::Rewrite(strWalletFile, "\x04pool"))
@@ -1702,44 +2188,123 @@ bool CWallet::NewKeyPool()
             return false;
 
         int64_t nKeys = max(GetArg("-keypool", 100), (int64_t)0);
-        for (int i = 0; i < nKeys; i++)
-        {
-            int64_t nIndex = i+1;
-            walletdb.WritePool(nIndex, CKeyPool(GenerateNewKey()));
-            setKeyPool.insert(nIndex);
-        }
-        LogPrintf( "%s : wrote %d new keys\n", __func__, nKeys );
+        if (!FillKeyPool(nKeys))
+            return false;
+        LogPrintf( "%s : wrote %d new keys\n", __func__, setKeyPool.size() );
     }
     return true;
 }
 
+//! Derives the keys in every nThreads-th slot of vKeys
+static void DeriveKeyPoolKeys(std::vector<std::pair<CKey, CPubKey> >* pvKeys, bool fCompressed, unsigned int nThread, unsigned int nThreads)
+{
+    for (unsigned int i = nThread; i < pvKeys->size(); i += nThreads) {
+        CKey& secret = (*pvKeys)[i].first;
+        secret.MakeNewKey(fCompressed);
+        (*pvKeys)[i].second = secret.GetPubKey();
+    }
+}
+
 bool CWallet::TopUpKeyPool(unsigned int kpSize)
 {
+    unsigned int nTargetSize;
+    if (kpSize > 0)
+        nTargetSize = kpSize;
+    else
+        nTargetSize = max(GetArg("-keypool", 100), (int64_t) 0);
+
+    return FillKeyPool(nTargetSize + 1);
+}
+
+bool CWallet::FillKeyPool(unsigned int nPoolSize)
+{
+    unsigned int nMissing;
+    bool fCompressed;
     {
         LOCK(cs_wallet);
 
         if (IsLocked())
             return false;
+        if (setKeyPool.size() >= nPoolSize)
+            return true;
+        nMissing = nPoolSize - setKeyPool.size();
+        fCompressed = CanSupportFeature(FEATURE_COMPRPUBKEY); // default to compressed public keys if we want 0.6.0 wallets
+    }
 
-        CWalletDB walletdb(strWalletFile);
+    // Key derivation is the expensive part, it needs no wallet state and is spread over several threads
+    RandAddSeedPerfmon();
+    std::vector<std::pair<CKey, CPubKey> > vKeys(nMissing);
+    unsigned int nThreads = std::max(1, std::min((int)boost::thread::hardware_concurrency(), MAX_KEYPOOL_THREADS));
+    nThreads = std::max(1U, std::min(nThreads, nMissing / KEYPOOL_KEYS_PER_THREAD));
+    if (nThreads == 1)
+        DeriveKeyPoolKeys(&vKeys, fCompressed, 0, 1);
+    else {
+        boost::thread_group threadGroup;
+        for (unsigned int i = 0; i < nThreads; i++)
+            threadGroup.create_thread(boost::bind(&DeriveKeyPoolKeys, &vKeys, fCompressed, i, nThreads));
+        threadGroup.join_all();
+    }
 
-        // Top up key pool
-        unsigned int nTargetSize;
-        if (kpSize > 0)
-            nTargetSize = kpSize;
-        else
-            nTargetSize = max(GetArg("-keypool", 100), (int64_t) 0);
+    {
+        LOCK(cs_wallet);
 
-        uint16_t nCountAdded = 0;
-        while (setKeyPool.size() < (nTargetSize + 1))
+        // The wallet may have been locked, or topped up by someone else, while we were busy
+        if (IsLocked())
+            return false;
+
+        CWalletDB walletdb(strWalletFile);
+        if (fCompressed)
+            SetMinVersion(FEATURE_COMPRPUBKEY, &walletdb);
+
+        int64_t nCreationTime = GetTime();
+        uint32_t nCountAdded = 0;
+        std::vector<std::pair<CKey, CPubKey> >::const_iterator it = vKeys.begin();
+        while (it != vKeys.end() && setKeyPool.size() < nPoolSize)
         {
+            // Each batch of keys and their pool entries goes to disk in a single transaction
+            if (!walletdb.TxnBegin())
+                throw runtime_error("TopUpKeyPool() : could not begin the database transaction");
             int64_t nEnd = 1;
             if (!setKeyPool.empty())
                 nEnd = *(--setKeyPool.end()) + 1;
-            if (!walletdb.WritePool(nEnd, CKeyPool(GenerateNewKey())))
-                throw runtime_error("TopUpKeyPool() : writing generated key failed");
-            setKeyPool.insert(nEnd);
-            nCountAdded++;
+            std::vector<int64_t> vIndexes;
+            std::vector<CKeyID> vKeyIDs;
+            std::string strError;
+            try {
+                while (it != vKeys.end() && setKeyPool.size() + vIndexes.size() < nPoolSize && vIndexes.size() < KEYPOOL_KEYS_PER_TXN)
+                {
+                    const CPubKey& pubkey = it->second;
+                    vKeyIDs.push_back(pubkey.GetID());
+                    mapKeyMetadata[pubkey.GetID()] = CKeyMetadata(nCreationTime);
+                    if (!AddKeyPubKeyWithDB(walletdb, it->first, pubkey)) {
+                        strError = "TopUpKeyPool() : AddKey failed";
+                        break;
+                    }
+                    if (!walletdb.WritePool(nEnd, CKeyPool(pubkey))) {
+                        strError = "TopUpKeyPool() : writing generated key failed";
+                        break;
+                    }
+                    vIndexes.push_back(nEnd++);
+                    ++it;
+                }
+                if (strError.empty() && !walletdb.TxnCommit())
+                    strError = "TopUpKeyPool() : committing generated keys failed";
+            } catch (const std::exception& e) {
+                strError = strprintf("TopUpKeyPool() : %s", e.what());
+            }
+            if (!strError.empty()) {
+                // Nothing of this batch made it to disk, so the wallet must not know these keys either
+                walletdb.TxnAbort();
+                BOOST_FOREACH(const CKeyID& keyid, vKeyIDs) {
+                    EraseKey(keyid);
+                    mapKeyMetadata.erase(keyid);
+                }
+                throw runtime_error(strError);
+            }
+            if (!nTimeFirstKey || nCreationTime < nTimeFirstKey)
+                nTimeFirstKey = nCreationTime;
+            setKeyPool.insert(vIndexes.begin(), vIndexes.end());
+            nCountAdded += vIndexes.size();
         }
         if( nCountAdded ) LogPrintf( "%s : added %d keys to your wallet, now have %u available.\n", __func__, nCountAdded, setKeyPool.size() );
     }
@@ -2010,18 +2575,21 @@ void CWallet::LockCoin(COutPoint& output)
 {
     AssertLockHeld(cs_wallet); // setLockedCoins
     setLockedCoins.insert(output);
+    MarkBalancesChanged();
 }
 
 void CWallet::UnlockCoin(COutPoint& output)
 {
     AssertLockHeld(cs_wallet); // setLockedCoins
     setLockedCoins.erase(output);
+    MarkBalancesChanged();
 }
 
 void CWallet::UnlockAllCoins()
 {
     AssertLockHeld(cs_wallet); // setLockedCoins
     setLockedCoins.clear();
+    MarkBalancesChanged();
 }
 
 bool CWallet::IsLockedCoin(uint256 hash, unsigned int n) const
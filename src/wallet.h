@@ -8,6 +8,7 @@
 
 #include "amount.h"
 #include "block.h"
+#include "bloom.h"
 #include "crypter.h"
 #include "key.h"
 #include "keystore.h"
@@ -18,6 +19,7 @@
 #include "walletdb.h"
 
 #include <algorithm>
+#include <list>
 #include <map>
 #include <set>
 #include <stdexcept>
@@ -27,6 +29,7 @@
 #include <vector>
 
 #include <boost/shared_ptr.hpp>
+#include <boost/unordered_set.hpp>
 
 //! Constant definitions found in the wallet source code file.
 
@@ -42,6 +45,22 @@ extern const unsigned int DEFAULT_TX_CONFIRM_TARGET;
 extern const CAmount nHighTransactionMaxFeeWarning;
 //! Largest (in bytes) free transaction we're willing to create
 extern const uint32_t MAX_FREE_TRANSACTION_CREATE_SIZE;
+//! Most threads reading and prefiltering blocks during a wallet rescan
+extern const int MAX_RESCAN_THREADS;
+//! Blocks each rescan thread reads before the matches are applied and the locks taken again
+extern const unsigned int RESCAN_BLOCKS_PER_THREAD;
+//! Nodes the branch and bound coin selection visits before settling for the best subset found so far
+extern const int MAX_COINSELECTION_TRIES;
+//! Most threads deriving keys for a keypool top up
+extern const int MAX_KEYPOOL_THREADS;
+//! Fewest new keypool keys worth handing to another derivation thread
+extern const unsigned int KEYPOOL_KEYS_PER_THREAD;
+//! New keypool keys written to the wallet database in each transaction
+extern const unsigned int KEYPOOL_KEYS_PER_TXN;
+//! Most threads decoding key and transaction records while the wallet loads
+extern const int MAX_WALLETLOAD_THREADS;
+//! Fewest key and transaction records worth handing to another decoding thread
+extern const unsigned int WALLETLOAD_RECORDS_PER_THREAD;
 
 //! Variable definitions found in the wallet source code file.
 
@@ -403,6 +422,7 @@ public:
     mutable CAmount nImmatureWatchCreditCached;
     mutable CAmount nAvailableWatchCreditCached;
     mutable CAmount nChangeCached;
+    int nIndexHeight; //! key of this transaction in CWallet::mapTxByHeight, -2 while not indexed
 
     CWalletTx()
     {
@@ -452,6 +472,7 @@ public:
         nAvailableWatchCreditCached = 0;
         nImmatureWatchCreditCached = 0;
         nChangeCached = 0;
+        nIndexHeight = -2;
         nOrderPos = -1;
     }
 
@@ -570,6 +591,53 @@ public:
     }
 };
 
+/** Hasher for the wallet relevance filter, its keys are hashes already so some of their bits will do */
+struct CWalletFilterHasher
+{
+    size_t operator()(const uint160& id) const { return id.GetLow64(); }
+    size_t operator()(const COutPoint& outpoint) const { return outpoint.hash.GetLow64() ^ outpoint.n; }
+};
+
+/** Balances of a wallet per confirmation class, for its spendable and its watch-only outputs */
+struct CWalletBalances
+{
+    CAmount nTrusted;
+    CAmount nUnconfirmed;
+    CAmount nImmature;
+    CAmount nWatchOnlyTrusted;
+    CAmount nWatchOnlyUnconfirmed;
+    CAmount nWatchOnlyImmature;
+
+    CWalletBalances() : nTrusted(0), nUnconfirmed(0), nImmature(0), nWatchOnlyTrusted(0), nWatchOnlyUnconfirmed(0), nWatchOnlyImmature(0) {}
+};
+
+/** An unspent output of a CWalletSnapshot, holding a copy of the output instead of a pointer into mapWallet */
+struct CSnapshotOutput
+{
+    uint256 txid;
+    int i;
+    CTxOut txout;
+    int nDepth;
+    bool fSpendable;
+
+    CSnapshotOutput(const COutput& out) : txid(out.tx->GetHash()), i(out.i), txout(out.tx->vout[out.i]), nDepth(out.nDepth), fSpendable(out.fSpendable) {}
+};
+
+/**
+ * Read-only copy of the wallet balances and unspent outputs at one chain height.
+ * Published by CWallet::GetSnapshot() and never changed afterwards, so RPC calls
+ * can answer from it without cs_main or cs_wallet.
+ */
+struct CWalletSnapshot
+{
+    uint64_t nVersion;
+    int nHeight;
+    CWalletBalances balances;
+    std::vector<CSnapshotOutput> vCoins;
+
+    CWalletSnapshot() : nVersion(0), nHeight(-1) {}
+};
+
 /**
  * A CWallet is an extension of a keystore, which also maintains a set of transactions and balances,
  * and provides the ability to create new transactions.
@@ -581,8 +649,17 @@ private:
     typedef std::multimap<COutPoint, uint256> TxSpends;
 
     bool SelectCoins(const CAmount& nTargetValue, std::set<std::pair<const CWalletTx*,unsigned int> >& setCoinsRet, CAmount& nValueRet, const CCoinControl *coinControl = NULL) const;
+    //! SelectCoinsMinConf over coins already sorted by descending value
+    bool SelectCoinsSorted(const CAmount& nTargetValue, int nConfMine, int nConfTheirs, const std::vector<COutput>& vCoins, std::set<std::pair<const CWalletTx*,unsigned int> >& setCoinsRet, CAmount& nValueRet) const;
 
     CWalletDB *pwalletdbEncryption;
+    //! Groups the wallet writes made for one block, between BeginSyncBatch() and EndSyncBatch()
+    CDBBatch *pdbSyncBatch;
+
+    //! AddKeyPubKey writing through walletdb, so the key can join an open database transaction
+    bool AddKeyPubKeyWithDB(CWalletDB &walletdb, const CKey& key, const CPubKey &pubkey);
+    //! Adds new keys to the pool until it holds nPoolSize of them, see TopUpKeyPool()
+    bool FillKeyPool(unsigned int nPoolSize);
 
     //! the current wallet version: clients below this version are not able to load the wallet
     int nWalletVersion;
@@ -602,6 +679,42 @@ private:
 
     void SyncMetaData(std::pair<TxSpends::iterator, TxSpends::iterator>);
 
+    //! Wallet transactions with an output of ours that nothing in the wallet spends, or an immature coinbase.
+    //! Only these can add to a balance or to AvailableCoins, so those walk this set instead of all of mapWallet.
+    std::set<uint256> setCoinTxs;
+    //! The balances summed over setCoinTxs, valid for pindexBalances until a wallet transaction changes
+    mutable CWalletBalances balancesCached;
+    mutable bool fBalancesCached;
+    mutable const CBlockIndex* pindexBalances;
+
+    void UpdateCoinTxs(const uint256& hash);
+    void UpdateCoinTxs(const CTransaction& tx);
+    void RebuildCoinTxs();
+    //! Moves wtx to the mapTxByHeight key of its block, after it was added or its block left or joined the active chain
+    void UpdateTxHeightIndex(CWalletTx& wtx);
+
+    //! Relevance filter: the key ids, script ids and watch-only script hashes an output has to push, and
+    //! our outputs an input has to spend, for a transaction to have any chance of involving the wallet
+    boost::unordered_set<uint160, CWalletFilterHasher> setFilterIds;
+    boost::unordered_set<COutPoint, CWalletFilterHasher> setFilterOutpoints;
+    //! Whether setFilterIds holds watch-only script hashes, only then is every output script hashed whole
+    bool fFilterWatchOnly;
+
+    void AddFilterOutpoints(const CWalletTx& wtx);
+    void RebuildFilter();
+
+    //! Guards pSnapshot and nSnapshotVersion only, held for a pointer copy and never while taking cs_main or cs_wallet
+    mutable CCriticalSection cs_snapshot;
+    mutable boost::shared_ptr<const CWalletSnapshot> pSnapshot;
+    //! Bumped for every change a snapshot would show, a snapshot older than this is rebuilt on its next use
+    uint64_t nSnapshotVersion;
+    //! Set between BeginSyncBatch() and EndSyncBatch(), so the changes of one block publish together
+    bool fInSyncBatch;
+
+    //! Drops the cached balances and marks the snapshot stale
+    void MarkBalancesChanged();
+    boost::shared_ptr<const CWalletSnapshot> UpdateSnapshot() const;
+
     //! check whether we are allowed to upgrade (or already support) to the named feature
     bool CanSupportFeature(enum WalletFeature wf) { AssertLockHeld(cs_wallet); return nWalletMaxVersion >= wf; }
     //! Look up a destination data tuple in the store, return true if found false otherwise
@@ -632,6 +745,12 @@ public:
     //! ToDo: These maps and set should all be made private, and references made to them be done as calls to new public methods...
     std::map<CKeyID, CKeyMetadata> mapKeyMetadata;
     std::map<uint256, CWalletTx> mapWallet;
+    //! The wallet's activity log: every wallet transaction and accounting entry by nOrderPos, newest last
+    TxItems wtxOrdered;
+    //! All accounting entries of the wallet, wtxOrdered points into this list
+    std::list<CAccountingEntry> laccentries;
+    //! Wallet transactions by the height of their block in the active chain, -1 for those in no active block
+    std::multimap<int, CWalletTx*> mapTxByHeight;
     std::map<uintFakeHash, int> mapRequestCount;            //! This is used to track the block & transaction hashes from our wallet, and is stored as sha256d hashes for both.
     std::map<CTxDestination, CAddressBookData> mapAddressBook;
     MasterKeyMap mapMasterKeys;
@@ -669,6 +788,8 @@ public:
     {
         delete pwalletdbEncryption;
         pwalletdbEncryption = NULL;
+        delete pdbSyncBatch;
+        pdbSyncBatch = NULL;
     }
 
     void SetNull()
@@ -678,10 +799,16 @@ public:
         fFileBacked = false;
         nMasterKeyMaxID = 0;
         pwalletdbEncryption = NULL;
+        pdbSyncBatch = NULL;
         nOrderPosNext = 0;
         nNextResend = 0;
         nLastResend = 0;
         nTimeFirstKey = 0;
+        fBalancesCached = false;
+        pindexBalances = NULL;
+        nSnapshotVersion = 0;
+        fInSyncBatch = false;
+        fFilterWatchOnly = false;
     }
 
     //!
@@ -742,24 +869,31 @@ public:
     void GetKeyBirthTimes(std::map<CKeyID, int64_t> &mapKeyBirth) const;
     //! Increment the next transaction order id, return next transaction order id
     int64_t IncOrderPosNext(CWalletDB *pwalletdb = NULL);
-    /**
-     * Get the wallet's activity log
-     * @return multimap of ordered transactions and accounting entries
-     * @warning Returned pointers are *only* valid within the scope of passed acentries
-     */
-    TxItems OrderedTxItems(std::list<CAccountingEntry>& acentries, std::string strAccount = "");
+    //! Write an accounting entry and add it to the activity log
+    bool AddAccountingEntry(const CAccountingEntry& acentry, CWalletDB& walletdb);
+    //! Build wtxOrdered, laccentries and mapTxByHeight again from mapWallet and the database
+    void RebuildTxIndex();
     //!
     void MarkDirty();
     //!
     bool AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet, CWalletDB* pwalletdb);
     //!
     bool AddToWalletIfInvolvingMe(const CTransaction& tx, const CBlock* pblock, bool fUpdate);
-    //!
+    //! Fills a bloom filter with what our outputs and spends push in scripts, false if some watch-only script can't be matched that way
+    bool GetRescanFilter(CBloomFilter& filter) const;
+    //! False when tx can neither pay to nor spend from the wallet, decided with hash lookups and without solving a script
+    bool IsRelevantToWallet(const CTransaction& tx) const;
+    //! Takes cs_main and cs_wallet itself, releasing them between batches of blocks unless the caller holds them
     int ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate = false);
     //!
     void ReacceptWalletTransactions();
     //!
     std::vector<uint256> ResendWalletTransactionsBefore(int64_t nTime);
+    //! All balances at once, recomputed from setCoinTxs only when the chain tip or the wallet changed
+    CWalletBalances GetBalances() const;
+    //! The balances and unspent outputs as of the last wallet change or block, for readers that do not need cs_main or
+    //! cs_wallet.  A stale snapshot is rebuilt by the first caller after the change, which takes both for it
+    boost::shared_ptr<const CWalletSnapshot> GetSnapshot() const;
     //!
     CAmount GetBalance() const;
     //!
@@ -780,7 +914,7 @@ public:
                            CWalletTx& wtxNew, CReserveKey& reservekey, CAmount& nFeeRet, std::string& strFailReason, const CCoinControl *coinControl = NULL);
     //!
     bool CommitTransaction(CWalletTx& wtxNew, CReserveKey& reservekey);
-    //!
+    //! Derives the missing keys on several threads without holding cs_wallet, then writes them in batches of database transactions
     bool TopUpKeyPool(unsigned int kpSize = 0);
     //!
     int64_t AddReserveKey(const CKeyPool& keypool);
@@ -853,6 +987,10 @@ public:
     //!
     void SyncTransaction( const CTransaction& tx, const CBlock* pblock );
     //!
+    void BeginSyncBatch();
+    //!
+    void EndSyncBatch();
+    //!
     void SetBestChain( const CBlockLocator& loc );
     //!
     void UpdatedTransaction( const uint256& uintTxHash );
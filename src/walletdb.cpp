@@ -340,6 +340,129 @@ public:
     }
 };
 
+//! Reads a "tx" record and checks it, touching no wallet state so it can run on a worker thread
+static bool DecodeWalletTx(CDataStream& ssKey, CDataStream& ssValue, CWalletTx& wtx, bool& fUpgraded, string& strErr)
+{
+    uint256 hash;
+    ssKey >> hash;
+    ssValue >> wtx;
+    CValidationState state;
+    if (!(CheckTransaction(wtx, state) && (wtx.GetHash() == hash) && state.IsValid()))
+        return false;
+
+    // Undo serialize changes in 31600
+    fUpgraded = false;
+    if (31404 <= wtx.fTimeReceivedIsTxTime && wtx.fTimeReceivedIsTxTime <= 31703)
+    {
+        if (!ssValue.empty())
+        {
+            char fTmp;
+            char fUnused;
+            ssValue >> fTmp >> fUnused >> wtx.strFromAccount;
+            strErr = strprintf("LoadWallet() upgrading tx ver=%d %d '%s' %s",
+                               wtx.fTimeReceivedIsTxTime, fTmp, wtx.strFromAccount, hash.ToString());
+            wtx.fTimeReceivedIsTxTime = fTmp;
+        }
+        else
+        {
+            strErr = strprintf("LoadWallet() repairing tx ver=%d %s", wtx.fTimeReceivedIsTxTime, hash.ToString());
+            wtx.fTimeReceivedIsTxTime = 0;
+        }
+        fUpgraded = true;
+    }
+    return true;
+}
+
+static void LoadDecodedWalletTx(CWallet* pwallet, CWalletScanState &wss, const CWalletTx& wtx, bool fUpgraded)
+{
+    if (fUpgraded)
+        wss.vWalletUpgrade.push_back(wtx.GetHash());
+
+    if (wtx.nOrderPos == -1)
+        wss.fAnyUnordered = true;
+
+    pwallet->AddToWallet(wtx, true, NULL);
+    //// debug print
+    //LogPrintf("LoadWallet  %s\n", wtx.GetHash().ToString());
+    //LogPrintf(" %12d  %s  %s  %s\n",
+    //    wtx.vout[0].nValue,
+    //    DateTimeStrFormat("%Y-%m-%d %H:%M:%S", wtx.GetBlockTime()),
+    //    wtx.hashBlock.ToString(),
+    //    wtx.mapValue["message"]);
+}
+
+//! Reads a "key" or "wkey" record and verifies the private key against its public key.
+//! Touches no wallet state, so it can run on a worker thread.
+static bool DecodeWalletKey(const string& strType, CDataStream& ssKey, CDataStream& ssValue, CPubKey& vchPubKey, CKey& key, string& strErr)
+{
+    ssKey >> vchPubKey;
+    if (!vchPubKey.IsValid())
+    {
+        strErr = "Error reading wallet database: CPubKey corrupt";
+        return false;
+    }
+    CPrivKey pkey;
+    uint256 hash;
+
+    if (strType == "key")
+    {
+        ssValue >> pkey;
+    } else {
+        CWalletKey wkey;
+        ssValue >> wkey;
+        pkey = wkey.vchPrivKey;
+    }
+
+    // Old wallets store keys as "key" [pubkey] => [privkey]
+    // ... which was slow for wallets with lots of keys, because the public key is re-derived from the private key
+    // using EC operations as a checksum.
+    // Newer wallets store keys as "key"[pubkey] => [privkey][hash(pubkey,privkey)], which is much faster while
+    // remaining backwards-compatible.
+    try
+    {
+        ssValue >> hash;
+    }
+    catch(...){}
+
+    bool fSkipCheck = false;
+
+    if (!hash.IsNull())
+    {
+        // hash pubkey/privkey to accelerate wallet load
+        vector<unsigned char> vchKey;
+        vchKey.reserve(vchPubKey.size() + pkey.size());
+        vchKey.insert(vchKey.end(), vchPubKey.begin(), vchPubKey.end());
+        vchKey.insert(vchKey.end(), pkey.begin(), pkey.end());
+
+        if (Hash(vchKey.begin(), vchKey.end()) != hash)
+        {
+            strErr = "Error reading wallet database: CPubKey/CPrivKey corrupt";
+            return false;
+        }
+
+        fSkipCheck = true;
+    }
+
+    if (!key.Load(pkey, vchPubKey, fSkipCheck))
+    {
+        strErr = "Error reading wallet database: CPrivKey corrupt";
+        return false;
+    }
+    return true;
+}
+
+static bool LoadDecodedWalletKey(CWallet* pwallet, CWalletScanState &wss, const string& strType, const CPubKey& vchPubKey, const CKey& key, string& strErr)
+{
+    if (strType == "key")
+        wss.nKeys++;
+    if (!pwallet->LoadKey(key, vchPubKey))
+    {
+        strErr = "Error reading wallet database: LoadKey failed";
+        return false;
+    }
+    return true;
+}
+
 bool
 ReadKeyValue(CWallet* pwallet, CDataStream& ssKey, CDataStream& ssValue,
              CWalletScanState &wss, string& strType, string& strErr)
@@ -363,45 +486,11 @@ ReadKeyValue(CWallet* pwallet, CDataStream& ssKey, CDataStream& ssValue,
         }
         else if (strType == "tx")
         {
-            uint256 hash;
-            ssKey >> hash;
             CWalletTx wtx;
-            ssValue >> wtx;
-            CValidationState state;
-            if (!(CheckTransaction(wtx, state) && (wtx.GetHash() == hash) && state.IsValid()))
+            bool fUpgraded;
+            if (!DecodeWalletTx(ssKey, ssValue, wtx, fUpgraded, strErr))
                 return false;
-
-            // Undo serialize changes in 31600
-            if (31404 <= wtx.fTimeReceivedIsTxTime && wtx.fTimeReceivedIsTxTime <= 31703)
-            {
-                if (!ssValue.empty())
-                {
-                    char fTmp;
-                    char fUnused;
-                    ssValue >> fTmp >> fUnused >> wtx.strFromAccount;
-                    strErr = strprintf("LoadWallet() upgrading tx ver=%d %d '%s' %s",
-                                       wtx.fTimeReceivedIsTxTime, fTmp, wtx.strFromAccount, hash.ToString());
-                    wtx.fTimeReceivedIsTxTime = fTmp;
-                }
-                else
-                {
-                    strErr = strprintf("LoadWallet() repairing tx ver=%d %s", wtx.fTimeReceivedIsTxTime, hash.ToString());
-                    wtx.fTimeReceivedIsTxTime = 0;
-                }
-                wss.vWalletUpgrade.push_back(hash);
-            }
-
-            if (wtx.nOrderPos == -1)
-                wss.fAnyUnordered = true;
-
-            pwallet->AddToWallet(wtx, true, NULL);
-            //// debug print
-            //LogPrintf("LoadWallet  %s\n", wtx.GetHash().ToString());
-            //LogPrintf(" %12d  %s  %s  %s\n",
-            //    wtx.vout[0].nValue,
-            //    DateTimeStrFormat("%Y-%m-%d %H:%M:%S", wtx.GetBlockTime()),
-            //    wtx.hashBlock.ToString(),
-            //    wtx.mapValue["message"]);
+            LoadDecodedWalletTx(pwallet, wss, wtx, fUpgraded);
         }
         else if (strType == "acentry")
         {
@@ -436,66 +525,11 @@ ReadKeyValue(CWallet* pwallet, CDataStream& ssKey, CDataStream& ssValue,
         else if (strType == "key" || strType == "wkey")
         {
             CPubKey vchPubKey;
-            ssKey >> vchPubKey;
-            if (!vchPubKey.IsValid())
-            {
-                strErr = "Error reading wallet database: CPubKey corrupt";
-                return false;
-            }
             CKey key;
-            CPrivKey pkey;
-            uint256 hash;
-
-            if (strType == "key")
-            {
-                wss.nKeys++;
-                ssValue >> pkey;
-            } else {
-                CWalletKey wkey;
-                ssValue >> wkey;
-                pkey = wkey.vchPrivKey;
-            }
-
-            // Old wallets store keys as "key" [pubkey] => [privkey]
-            // ... which was slow for wallets with lots of keys, because the public key is re-derived from the private key
-            // using EC operations as a checksum.
-            // Newer wallets store keys as "key"[pubkey] => [privkey][hash(pubkey,privkey)], which is much faster while
-            // remaining backwards-compatible.
-            try
-            {
-                ssValue >> hash;
-            }
-            catch(...){}
-
-            bool fSkipCheck = false;
-
-            if (!hash.IsNull())
-            {
-                // hash pubkey/privkey to accelerate wallet load
-                vector<unsigned char> vchKey;
-                vchKey.reserve(vchPubKey.size() + pkey.size());
-                vchKey.insert(vchKey.end(), vchPubKey.begin(), vchPubKey.end());
-                vchKey.insert(vchKey.end(), pkey.begin(), pkey.end());
-
-                if (Hash(vchKey.begin(), vchKey.end()) != hash)
-                {
-                    strErr = "Error reading wallet database: CPubKey/CPrivKey corrupt";
-                    return false;
-                }
-
-                fSkipCheck = true;
-            }
-
-            if (!key.Load(pkey, vchPubKey, fSkipCheck))
-            {
-                strErr = "Error reading wallet database: CPrivKey corrupt";
+            if (!DecodeWalletKey(strType, ssKey, ssValue, vchPubKey, key, strErr))
                 return false;
-            }
-            if (!pwallet->LoadKey(key, vchPubKey))
-            {
-                strErr = "Error reading wallet database: LoadKey failed";
+            if (!LoadDecodedWalletKey(pwallet, wss, strType, vchPubKey, key, strErr))
                 return false;
-            }
         }
         else if (strType == "mkey")
         {
@@ -608,12 +642,54 @@ static bool IsKeyType(string strType)
             strType == "mkey" || strType == "ckey");
 }
 
+//! A record read off the wallet database cursor. Key and transaction records, where the load
+//! spends its time, are decoded on worker threads before every record is merged in database order.
+class CWalletRecord
+{
+public:
+    CDataStream ssKey;
+    CDataStream ssValue;
+    string strType;
+    bool fDecoded;
+    bool fDecodeOK;
+    string strErr;
+    CPubKey vchPubKey;
+    CKey key;
+    //! Index of the decoded transaction, -1 unless this is a "tx" record
+    int nTx;
+    bool fUpgraded;
+
+    CWalletRecord() : ssKey(SER_DISK, CLIENT_VERSION), ssValue(SER_DISK, CLIENT_VERSION),
+                      fDecoded(false), fDecodeOK(false), nTx(-1), fUpgraded(false) {}
+};
+
+//! Decodes every nThreads-th record listed in vDecode
+static void DecodeWalletRecords(vector<CWalletRecord>* pvRecords, const vector<size_t>* pvDecode, vector<CWalletTx>* pvWtx,
+                                unsigned int nThread, unsigned int nThreads)
+{
+    for (size_t i = nThread; i < pvDecode->size(); i += nThreads) {
+        CWalletRecord& record = (*pvRecords)[(*pvDecode)[i]];
+        try {
+            string strType;
+            record.ssKey >> strType;
+            if (record.nTx >= 0)
+                record.fDecodeOK = DecodeWalletTx(record.ssKey, record.ssValue, (*pvWtx)[record.nTx], record.fUpgraded, record.strErr);
+            else
+                record.fDecodeOK = DecodeWalletKey(record.strType, record.ssKey, record.ssValue, record.vchPubKey, record.key, record.strErr);
+        } catch (...) {
+            record.fDecodeOK = false;
+        }
+        record.fDecoded = true;
+    }
+}
+
 DBErrors CWalletDB::LoadWallet(CWallet* pwallet)
 {
     pwallet->vchDefaultKey = CPubKey();
     CWalletScanState wss;
     bool fNoncriticalErrors = false;
     DBErrors result = DB_LOAD_OK;
+    int64_t nStart = GetTimeMillis();
 
     try {
         LOCK(pwallet->cs_wallet);
@@ -633,23 +709,77 @@ DBErrors CWalletDB::LoadWallet(CWallet* pwallet)
             return DB_CORRUPT;
         }
 
+        // Read all the raw records first, noting those worth decoding ahead
+        vector<CWalletRecord> vRecords;
+        vector<size_t> vDecode;
+        int nTxRecords = 0;
         while (true)
         {
             // Read next record
-            CDataStream ssKey(SER_DISK, CLIENT_VERSION);
-            CDataStream ssValue(SER_DISK, CLIENT_VERSION);
-            int ret = ReadAtCursor(pcursor, ssKey, ssValue);
+            vRecords.push_back(CWalletRecord());
+            CWalletRecord& record = vRecords.back();
+            int ret = ReadAtCursor(pcursor, record.ssKey, record.ssValue);
             if (ret == DB_NOTFOUND)
+            {
+                vRecords.pop_back();
                 break;
+            }
             else if (ret != 0)
             {
                 LogPrintf("Error reading next record from wallet database\n");
                 return DB_CORRUPT;
             }
 
+            try {
+                CDataStream ssType(record.ssKey);
+                ssType >> record.strType;
+            } catch (...) {
+                // Left for ReadKeyValue() to fail on
+                continue;
+            }
+            if (record.strType == "tx")
+                record.nTx = nTxRecords++;
+            if (record.strType == "tx" || record.strType == "key" || record.strType == "wkey")
+                vDecode.push_back(vRecords.size() - 1);
+        }
+        pcursor->close();
+        int64_t nRead = GetTimeMillis();
+
+        vector<CWalletTx> vWtx(nTxRecords);
+        unsigned int nThreads = std::max(1, std::min((int)boost::thread::hardware_concurrency(), MAX_WALLETLOAD_THREADS));
+        nThreads = std::max(1U, std::min(nThreads, (unsigned int)(vDecode.size() / WALLETLOAD_RECORDS_PER_THREAD)));
+        if (nThreads == 1)
+            DecodeWalletRecords(&vRecords, &vDecode, &vWtx, 0, 1);
+        else {
+            boost::thread_group threadGroup;
+            for (unsigned int i = 0; i < nThreads; i++)
+                threadGroup.create_thread(boost::bind(&DecodeWalletRecords, &vRecords, &vDecode, &vWtx, i, nThreads));
+            threadGroup.join_all();
+        }
+        int64_t nDecoded = GetTimeMillis();
+
+        BOOST_FOREACH(CWalletRecord& record, vRecords)
+        {
             // Try to be tolerant of single corrupt records:
             string strType, strErr;
-            if (!ReadKeyValue(pwallet, ssKey, ssValue, wss, strType, strErr))
+            bool fReadOK;
+            if (record.fDecoded)
+            {
+                strType = record.strType;
+                strErr = record.strErr;
+                fReadOK = record.fDecodeOK;
+                try {
+                    if (fReadOK && record.nTx >= 0)
+                        LoadDecodedWalletTx(pwallet, wss, vWtx[record.nTx], record.fUpgraded);
+                    else if (fReadOK)
+                        fReadOK = LoadDecodedWalletKey(pwallet, wss, strType, record.vchPubKey, record.key, strErr);
+                } catch (...) {
+                    fReadOK = false;
+                }
+            }
+            else
+                fReadOK = ReadKeyValue(pwallet, record.ssKey, record.ssValue, wss, strType, strErr);
+            if (!fReadOK)
             {
                 // losing keys is considered a catastrophic error, anything else
                 // we assume the user can live with:
@@ -667,7 +797,8 @@ DBErrors CWalletDB::LoadWallet(CWallet* pwallet)
             if (!strErr.empty())
                 LogPrintf("%s\n", strErr);
         }
-        pcursor->close();
+        LogPrintf("%s : %u records read in %dms, %u keys and transactions decoded on %u threads in %dms, merged in %dms\n", __func__,
+                  vRecords.size(), nRead - nStart, vDecode.size(), nThreads, nDecoded - nRead, GetTimeMillis() - nDecoded);
     }
     catch (const boost::thread_interrupted&) {
         throw;
@@ -704,7 +835,11 @@ DBErrors CWalletDB::LoadWallet(CWallet* pwallet)
         WriteVersion(CLIENT_VERSION);
 
     if (wss.fAnyUnordered)
+    {
+        int64_t nReorderStart = GetTimeMillis();
         result = ReorderTransactions(pwallet);
+        LogPrintf("%s : transactions reordered in %dms\n", __func__, GetTimeMillis() - nReorderStart);
+    }
 
     return result;
 }
@@ -858,6 +993,9 @@ bool BackupWallet(const CWallet& wallet, const string& strDest)
 {
     if (!wallet.fFileBacked)
         return false;
+    // Writes held back by a batch would be missing from the copy
+    if (!bitdb.CommitWriteQueue(wallet.strWalletFile))
+        return false;
     while (true)
     {
         {